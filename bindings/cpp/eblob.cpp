@@ -18,6 +18,8 @@
 #include <unistd.h>
 #include <string.h>
 
+#include <algorithm>
+
 #include <eblob/eblob.hpp>
 
 using namespace ioremap::eblob;
@@ -86,6 +88,75 @@ void eblob::write(const struct eblob_key &key, const std::string &data, const ui
 	write(key, data.data(), offset, data.size(), flags);
 }
 
+std::vector<int> eblob::write_batch(const std::vector<struct eblob_key> &keys,
+		const std::vector<std::string> &data, uint64_t flags)
+{
+	if (keys.size() != data.size()) {
+		std::ostringstream str;
+		str << "EBLOB: eblob batch write failed: keys: " << keys.size()
+			<< ", data: " << data.size() << ": sizes mismatch";
+		throw std::runtime_error(str.str());
+	}
+
+	std::vector<struct eblob_iovec> iov(data.size());
+	for (size_t i = 0; i < data.size(); ++i) {
+		iov[i].base = (void *)data[i].data();
+		iov[i].size = data[i].size();
+		iov[i].offset = 0;
+	}
+
+	std::vector<int> errors(keys.size(), 0);
+	int err = eblob_write_batch(eblob_, (struct eblob_key *)keys.data(), iov.data(), keys.size(),
+			flags, errors.data());
+	/*
+	 * Nothing was written if every key failed or if the call failed before
+	 * writing any key, in which case per-key results are left untouched.
+	 */
+	const ssize_t written = std::count(errors.begin(), errors.end(), 0);
+	if (err && (written == 0 || written == (ssize_t)errors.size())) {
+		std::ostringstream str;
+		str << "EBLOB: eblob batch write failed: keys: " << keys.size()
+			<< ", flags: " << flags << ": " << strerror(-err);
+		throw std::runtime_error(str.str());
+	}
+
+	return errors;
+}
+
+std::vector<int> eblob::read_multi(const std::vector<struct eblob_key> &keys, std::vector<std::string> &data,
+		enum eblob_read_flavour csum)
+{
+	std::vector<char *> buffers(keys.size(), NULL);
+	std::vector<uint64_t> sizes(keys.size(), 0);
+	std::vector<int> errors(keys.size(), 0);
+
+	int err = eblob_read_multi(eblob_, (struct eblob_key *)keys.data(), keys.size(), csum,
+			buffers.data(), sizes.data(), errors.data());
+	if (err && std::count(errors.begin(), errors.end(), 0) == 0) {
+		std::ostringstream str;
+		str << "EBLOB: eblob multi read failed: keys: " << keys.size() << ": " << strerror(-err);
+		throw std::runtime_error(str.str());
+	}
+
+	try {
+		data.resize(keys.size());
+		for (size_t i = 0; i < keys.size(); ++i) {
+			if (errors[i] == 0)
+				data[i].assign(buffers[i], sizes[i]);
+			else
+				data[i].clear();
+		}
+	} catch (...) {
+		for (size_t i = 0; i < keys.size(); ++i)
+			free(buffers[i]);
+		throw;
+	}
+	for (size_t i = 0; i < keys.size(); ++i)
+		free(buffers[i]);
+
+	return errors;
+}
+
 void eblob::read(const struct eblob_key &key, int *fd, uint64_t *offset, uint64_t *size)
 {
 	read(key, fd, offset, size, EBLOB_READ_CSUM);
@@ -143,6 +214,26 @@ std::string eblob::read(const struct eblob_key &key, const uint64_t req_offset,
 	return ret;
 }
 
+uint64_t eblob::read(const struct eblob_key &key, const uint64_t req_offset, void *buf, const uint64_t req_size,
+		enum eblob_read_flavour csum)
+{
+	uint64_t dsize = 0;
+	int err;
+
+	if (csum)
+		err = eblob_read_into(eblob_, (struct eblob_key *)&key, req_offset, buf, req_size, &dsize);
+	else
+		err = eblob_read_into_nocsum(eblob_, (struct eblob_key *)&key, req_offset, buf, req_size, &dsize);
+	if (err < 0) {
+		std::ostringstream str;
+		str << "EBLOB: " << eblob_dump_id(key.id) << ": eblob read failed: offset: "
+			<< req_offset << ", size: " << req_size << ": " << strerror(-err);
+		throw std::runtime_error(str.str());
+	}
+
+	return dsize;
+}
+
 void eblob::write_hashed(const std::string &key, const std::string &data, const uint64_t offset, uint64_t flags)
 {
 	struct eblob_key ekey;
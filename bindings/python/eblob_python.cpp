@@ -105,6 +105,42 @@ public:
 		eblob::write(key, data, offset, flags);
 	}
 
+	bp::list write_batch_by_id(const bp::list &ids, const bp::list &data, const uint64_t flags) {
+		std::vector<struct eblob_key> keys(len(ids));
+		std::vector<std::string> d;
+
+		for (size_t i = 0; i < keys.size(); ++i)
+			eblob_extract_id(bp::extract<eblob_id>(ids[i]), keys[i]);
+		for (int i = 0; i < len(data); ++i)
+			d.push_back(bp::extract<std::string>(data[i]));
+
+		std::vector<int> errors = eblob::write_batch(keys, d, flags);
+
+		bp::list ret;
+		for (size_t i = 0; i < errors.size(); ++i)
+			ret.append(errors[i]);
+		return ret;
+	}
+
+	bp::list read_multi_by_id(const bp::list &ids) {
+		std::vector<struct eblob_key> keys(len(ids));
+		std::vector<std::string> data;
+
+		for (size_t i = 0; i < keys.size(); ++i)
+			eblob_extract_id(bp::extract<eblob_id>(ids[i]), keys[i]);
+
+		std::vector<int> errors = eblob::read_multi(keys, data);
+
+		bp::list ret;
+		for (size_t i = 0; i < errors.size(); ++i) {
+			if (errors[i])
+				ret.append(bp::object());
+			else
+				ret.append(data[i]);
+		}
+		return ret;
+	}
+
 	std::string read_by_id(const struct eblob_id &id, const uint64_t req_offset, const uint64_t req_size) {
 		struct eblob_key key;
 		eblob_extract_id(id, key);
@@ -158,8 +194,10 @@ BOOST_PYTHON_MODULE(libeblob_python) {
 		.def(bp::init<const char *, const uint32_t, struct eblob_config>())
 		.def("write", &eblob_python::write_by_id)
 		.def("write_hashed", &eblob_python::write_hashed)
+		.def("write_batch", &eblob_python::write_batch_by_id)
 		.def("read", &eblob_python::read_by_id)
 		.def("read_hashed", &eblob_python::read_by_name)
+		.def("read_multi", &eblob_python::read_multi_by_id)
 		.def("remove", &eblob_python::remove_by_id)
 		.def("remove_hashed", &eblob_python::remove_hashed)
 		.def("elements", &eblob_python::elements)
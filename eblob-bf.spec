@@ -22,6 +22,7 @@ BuildRequires:	gcc44 gcc44-c++
 BuildRequires:	boost%{boost_ver}-devel, boost%{boost_ver}-filesystem, boost%{boost_ver}-iostreams, boost%{boost_ver}-python, boost%{boost_ver}-regex, boost%{boost_ver}-system, boost%{boost_ver}-thread
 BuildRequires:	cmake >= 2.6
 BuildRequires:	python-devel
+BuildRequires:	lz4-devel, libzstd-devel
 BuildRequires:	handystats >= 1.10.2
 
 %description
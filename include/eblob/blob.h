@@ -226,6 +226,49 @@ enum eblob_read_flavour {
  */
 #define BLOB_DISK_CTL_CORRUPTED         (1<<9)
 
+/*
+ * Write returns without waiting for sync even if eblob is configured to sync
+ * every operation (sync == 0). Record is synced by the next group commit.
+ * This flag is not stored on disk.
+ */
+#define BLOB_DISK_CTL_NOSYNC		(1<<10)
+
+/*
+ * This flag is set for records that are appended to with
+ * BLOB_DISK_CTL_APPEND | BLOB_DISK_CTL_CHAINED. Payload of such record starts
+ * with struct eblob_chain_header listing extents that hold its data, so append
+ * costs only the size of appended data instead of the copy of whole record.
+ * Extents are records of the same base marked BLOB_DISK_CTL_REMOVE, they are
+ * skipped by everything but the chain. Reads follow the chain, data-sort
+ * coalesces it into one contiguous record without this flag. Instead of
+ * footers each extent has its checksum in the chain header.
+ *
+ * NB! Iterators get the chain header as record payload.
+ */
+#define BLOB_DISK_CTL_CHAINED		(1<<11)
+
+/*
+ * This flag is set for records written by backend configured with
+ * EBLOB_COMPRESS_LZ4 or EBLOB_COMPRESS_ZSTD. Payload of such record starts
+ * with struct eblob_compress_header followed by compressed data. Reads into
+ * buffer return uncompressed data, fd-based reads fail with -ENOTSUP. data_size
+ * of disk control is the size of stored payload.
+ * It has nothing to do with deprecated BLOB_DISK_CTL_COMPRESS.
+ *
+ * NB! Iterators get compressed payload.
+ */
+#define BLOB_DISK_CTL_COMPRESSED	(1<<12)
+
+/*
+ * This flag is set for records written by backend configured with
+ * direct_io_threshold whose data is at least that big. Such record starts at
+ * offset aligned to 4 KiB and is followed by zero padding up to the next
+ * aligned offset, so it's written and read with O_DIRECT. Padding is not part
+ * of the record: disk_size stays exact and position + disk_size rounded up to
+ * 4 KiB is the end of the padding. Data-sort drops padding and this flag.
+ */
+#define BLOB_DISK_CTL_DIRECT		(1<<13)
+
 struct eblob_disk_control {
 	/* key data */
 	struct eblob_key	key;
@@ -257,6 +300,77 @@ static inline void eblob_convert_disk_control(struct eblob_disk_control *ctl)
 	ctl->position = eblob_bswap64(ctl->position);
 }
 
+/* Maximum number of extents of BLOB_DISK_CTL_CHAINED record */
+#define EBLOB_CHAIN_EXTENTS_MAX		(64)
+
+struct eblob_chain_extent {
+	/* Position of extent data in the blob file */
+	uint64_t		position;
+	/* Number of bytes of data in extent */
+	uint64_t		size;
+	/* Number of bytes reserved for extent data */
+	uint64_t		capacity;
+	/*
+	 * MurmurHash64A of extent data chained over EBLOB_CSUM_BLOCK_SIZE
+	 * blocks the way chunks of footer are hashed, and the same of its
+	 * whole blocks only, which appended data is hashed from
+	 */
+	uint64_t		csum;
+	uint64_t		blocks_csum;
+} __attribute__ ((packed));
+
+/*
+ * Payload of BLOB_DISK_CTL_CHAINED record. Extent 0 follows the header inside
+ * the record itself, others are separate records in the same blob file.
+ */
+struct eblob_chain_header {
+	/* Total size of data in all extents */
+	uint64_t			size;
+	/* Number of used extents */
+	uint64_t			num;
+	struct eblob_chain_extent	ext[EBLOB_CHAIN_EXTENTS_MAX];
+} __attribute__ ((packed));
+
+static inline void eblob_convert_chain_header(struct eblob_chain_header *chain)
+{
+	uint64_t i;
+
+	chain->size = eblob_bswap64(chain->size);
+	chain->num = eblob_bswap64(chain->num);
+	for (i = 0; i < EBLOB_CHAIN_EXTENTS_MAX; ++i) {
+		chain->ext[i].position = eblob_bswap64(chain->ext[i].position);
+		chain->ext[i].size = eblob_bswap64(chain->ext[i].size);
+		chain->ext[i].capacity = eblob_bswap64(chain->ext[i].capacity);
+		chain->ext[i].csum = eblob_bswap64(chain->ext[i].csum);
+		chain->ext[i].blocks_csum = eblob_bswap64(chain->ext[i].blocks_csum);
+	}
+}
+
+/* Compression algorithms of BLOB_DISK_CTL_COMPRESSED records */
+enum eblob_compress_algorithm {
+	EBLOB_COMPRESS_ALGORITHM_LZ4 = 1,
+	EBLOB_COMPRESS_ALGORITHM_ZSTD,
+};
+
+/*
+ * Head of payload of BLOB_DISK_CTL_COMPRESSED record.
+ */
+struct eblob_compress_header {
+	/* One of EBLOB_COMPRESS_ALGORITHM_* */
+	uint8_t			algorithm;
+	uint8_t			__pad[3];
+	/* Id of zstd dictionary of the base data was compressed with, 0 if none */
+	uint32_t		dict_id;
+	/* Size of uncompressed data */
+	uint64_t		size;
+} __attribute__ ((packed));
+
+static inline void eblob_convert_compress_header(struct eblob_compress_header *hdr)
+{
+	hdr->dict_id = eblob_bswap32(hdr->dict_id);
+	hdr->size = eblob_bswap64(hdr->size);
+}
+
 /* when set, reserve 10% of free space and return -ENOSPC when there is not enough free space to reserve */
 #define EBLOB_RESERVE_10_PERCENTS	(1<<0)
 /*
@@ -309,6 +423,62 @@ static inline void eblob_convert_disk_control(struct eblob_disk_control *ctl)
  */
 #define EBLOB_AUTO_INDEXSORT			(1<<11)
 
+/*
+ * Use open-addressing hash table instead of rb-tree for in-memory index.
+ * Lookups touch one or two cache lines instead of walking the tree, but
+ * range requests are not supported. Ignored if EBLOB_L2HASH is set.
+ */
+#define EBLOB_OHASH				(1<<12)
+
+/*
+ * Store in-memory index entries in packed form: 16-bit base slot instead of
+ * bctl pointer, 40-bit offsets and size. Bases are limited to 1 TiB and 2^32
+ * records, blob_size and records_in_blob are clamped to half of that to
+ * leave room for the last record of the base.
+ * Ignored if EBLOB_L2HASH is set.
+ */
+#define EBLOB_PACKED_CACHE			(1<<13)
+
+/*
+ * Keep record flags and disk size in in-memory index, so reads and
+ * eblob_exists() do not read index and data headers from disk. Consistency of
+ * index and data headers is checked by inspect thread instead of read path.
+ * Ignored if EBLOB_L2HASH is set.
+ */
+#define EBLOB_CACHE_META			(1<<14)
+
+/*
+ * Execute data I/O of asynchronous requests with io_uring instead of thread
+ * pool, if it's supported by the kernel and eblob was built with it.
+ */
+#define EBLOB_IO_URING				(1<<15)
+
+/*
+ * Compress data of records that are at least cfg.compress_threshold bytes
+ * long with LZ4 or zstd. Data that does not shrink is stored as is. Does
+ * nothing if eblob was built without the library. Records are marked with
+ * BLOB_DISK_CTL_COMPRESSED and are transparently uncompressed by reads into
+ * buffer: eblob_read_data(), eblob_read_into() and eblob_read_async().
+ * If both flags are set zstd is used.
+ */
+#define EBLOB_COMPRESS_LZ4			(1<<16)
+#define EBLOB_COMPRESS_ZSTD			(1<<17)
+
+/*
+ * Data-sort trains zstd dictionary on records of sorted base and
+ * recompresses them with it. Dictionary is stored next to the base with
+ * .dict suffix. Requires EBLOB_COMPRESS_ZSTD.
+ */
+#define EBLOB_COMPRESS_DICT			(1<<18)
+
+/*
+ * Record removes as sequential appends to tombstone journal of backend
+ * instead of marking index and data headers of removed records in place.
+ * Tombstones are folded into bases by index sort, data-sort and by periodic
+ * thread when journal grows too big.
+ */
+#define EBLOB_TOMBSTONE_JOURNAL			(1<<19)
+
 struct eblob_config {
 	/* blob flags above */
 	unsigned int		blob_flags;
@@ -426,10 +596,82 @@ struct eblob_config {
 	int			bg_ioprio_class;  // one of IOPRIO_CLASS_*
 	int			bg_ioprio_data; // priority level within @bg_ioprio_class
 
+	/*
+	 * Records with at least this many bytes of data are written and read
+	 * with O_DIRECT, bypassing page cache. Headers and index stay buffered.
+	 * Only such records are aligned and padded to 4 KiB, see BLOB_DISK_CTL_DIRECT.
+	 * Default: 0 (disabled)
+	 */
+	uint64_t		direct_io_threshold;
+
+	/*
+	 * Active base data file is preallocated with FALLOC_FL_KEEP_SIZE this
+	 * many bytes ahead of its end by background thread, index file gets
+	 * 1/64 of it. Records that fit into preallocated extent skip
+	 * per-record preallocation.
+	 * Default: 0 (disabled)
+	 */
+	uint64_t		prealloc_size;
+
+	/*
+	 * With EBLOB_COMPRESS_LZ4 or EBLOB_COMPRESS_ZSTD only records with at
+	 * least this many bytes of data are compressed.
+	 * Default: 512
+	 */
+	uint64_t		compress_threshold;
+
+	/*
+	 * Size of in-memory buffer of each active base, small records written
+	 * without waiting for sync are collected in it and written by batch
+	 * once it's full, see @wbuf_timeout. Reads of buffered records are
+	 * served from memory.
+	 * Default: 0 (disabled)
+	 */
+	uint64_t		wbuf_size;
+
+	/* for future use */
+	uint64_t		__pad_64[4];
+
+	/*
+	 * Number of shards in-memory index is split into, each shard has its
+	 * own lock. Shards are selected by key prefix.
+	 * Default: 32, maximum: 65536
+	 */
+	unsigned int		cache_shards;
+
+	/*
+	 * Number of bases new records are written to simultaneously.
+	 * Each key always goes to the same one of them, selected by key hash,
+	 * so appends are spread across several data and index files.
+	 * Default: 1, maximum: 64
+	 */
+	unsigned int		active_bases;
+
+	/*
+	 * Number of threads executing asynchronous requests: eblob_read_async(),
+	 * eblob_writev_async() and eblob_remove_async(). Writes and removes are
+	 * executed by their own threads of the same number.
+	 * Threads are started by the first asynchronous request.
+	 * Default: 4
+	 */
+	unsigned int		aio_threads;
+
+	/*
+	 * Once active base is filled above this percent of blob_size or
+	 * records_in_blob, the next base is created and preallocated in
+	 * background, so rollover to it does not stall writers.
+	 * Default: 0 (disabled)
+	 */
+	unsigned int		spare_base_threshold;
+
+	/*
+	 * Records stay in buffer enabled by @wbuf_size for at most this many
+	 * milliseconds. Ignored with EBLOB_DISABLE_THREADS.
+	 * Default: 100
+	 */
+	unsigned int		wbuf_timeout;
+
 	/* for future use */
-	uint64_t		__pad_64[8];
-	int			__pad_int[3];
-	char			__pad_char[8];
 	void			*__pad_voidp[7];
 };
 
@@ -530,6 +772,14 @@ struct eblob_iterate_control {
 	void				*data;
 };
 
+/*
+ * eblob_iterate() - iterates over bases existing at the moment of the call.
+ * Defrag neither sorts nor removes them until they are iterated.
+ *
+ * NB! Callbacks get raw stored payload: compressed records are not inflated
+ * and chained ones are not coalesced, see BLOB_DISK_CTL_COMPRESSED and
+ * BLOB_DISK_CTL_CHAINED. Use eblob_read_data() to get the payload.
+ */
 int eblob_iterate(struct eblob_backend *b, struct eblob_iterate_control *ctl);
 
 struct eblob_backend;
@@ -545,7 +795,8 @@ int eblob_remove_hashed(struct eblob_backend *b, const void *key, const uint64_t
  * @offset and @size will be filled with written metadata: offset of the entry
  * and its data size.
  *
- * Returns negative error value or zero on success.
+ * Returns negative error value or zero on success, -ENOTSUP for
+ * BLOB_DISK_CTL_COMPRESSED record which data can't be read from @fd as is.
  */
 struct eblob_write_control;
 int eblob_read(struct eblob_backend *b, struct eblob_key *key,
@@ -555,6 +806,14 @@ int eblob_read_nocsum(struct eblob_backend *b, struct eblob_key *key,
 int eblob_read_return(struct eblob_backend *b, struct eblob_key *key,
 		enum eblob_read_flavour csum, struct eblob_write_control *wc);
 
+/*
+ * Checks that committed record with given key exists.
+ * @size, if not NULL, will be filled with its data size.
+ *
+ * Returns zero if record exists, -ENOENT if it does not or negative error.
+ */
+int eblob_exists(struct eblob_backend *b, struct eblob_key *key, uint64_t *size);
+
 /*
  * Allocates buffer and reads data there.
  * @size will contain number of bytes read
@@ -564,6 +823,32 @@ int eblob_read_data(struct eblob_backend *b, struct eblob_key *key,
 int eblob_read_data_nocsum(struct eblob_backend *b, struct eblob_key *key,
 		uint64_t offset, char **dst, uint64_t *size);
 
+/*
+ * Reads up to @len bytes of data at @offset straight into caller's buffer
+ * @buf instead of allocating one.
+ * @out_len will contain number of bytes read.
+ * Checksum is verified on data in @buf, so it is not read from disk twice.
+ */
+int eblob_read_into(struct eblob_backend *b, struct eblob_key *key, uint64_t offset,
+		void *buf, uint64_t len, uint64_t *out_len);
+int eblob_read_into_nocsum(struct eblob_backend *b, struct eblob_key *key, uint64_t offset,
+		void *buf, uint64_t len, uint64_t *out_len);
+
+/*
+ * Reads data of @num records at once: @data[i] gets allocated buffer with data
+ * of @keys[i], @sizes[i] is constraint to read size like @size of
+ * eblob_read_data() (zero means whole record) and receives number of bytes read.
+ * Keys are looked up first, then records are read grouped by base in order of
+ * their offsets, records close to each other are read by single preadv(2).
+ * Buffered, compressed, chained and O_DIRECT records are read one by one.
+ * @errors, if not NULL, receives result of read of each key, @data[i] is
+ * NULL if it failed.
+ *
+ * Returns zero if all keys were read or error of the first failed one.
+ */
+int eblob_read_multi(struct eblob_backend *b, struct eblob_key *keys, uint32_t num,
+		enum eblob_read_flavour csum, char **data, uint64_t *sizes, int *errors);
+
 
 /*
  * eblob_verify_checksum() - verifies checksum of entry pointed by @wc.
@@ -589,6 +874,47 @@ int eblob_writev_return(struct eblob_backend *b, struct eblob_key *key,
 		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags,
 		struct eblob_write_control *wc);
 
+/*
+ * Writes @num records at once: @keys[i] gets data of @iov[i] written at
+ * @iov[i].offset, all with the same @flags.
+ * Space for new keys is reserved at once and their data and index entries are
+ * written by few large writes. Existing keys, appends and writes with offset
+ * are done one by one.
+ * @errors, if not NULL, receives result of write of each key.
+ * If buffered record of any key can't be written, nothing is written and its
+ * error is returned for all keys.
+ *
+ * Returns zero if all keys were written or error of the first failed one.
+ */
+int eblob_write_batch(struct eblob_backend *b, struct eblob_key *keys,
+		const struct eblob_iovec *iov, uint32_t num, uint64_t flags, int *errors);
+
+/*
+ * Asynchronous requests.
+ *
+ * Functions return as soon as request is submitted, @complete is called later
+ * from eblob's thread with result of the operation and number of bytes read
+ * or written. If request could not be submitted, error is returned and
+ * @complete is never called. eblob_cleanup() waits for all submitted requests.
+ */
+typedef void (*eblob_async_complete_t)(struct eblob_key *key, int err, uint64_t size, void *priv);
+
+/*
+ * Reads up to @size bytes of data starting at @offset into @buf, which must
+ * stay valid until @complete.
+ */
+int eblob_read_async(struct eblob_backend *b, struct eblob_key *key, uint64_t offset, uint64_t size,
+		void *buf, enum eblob_read_flavour csum, eblob_async_complete_t complete, void *priv);
+/*
+ * Same as eblob_writev(). @iov array is copied, but data it points to must
+ * stay valid until @complete.
+ */
+int eblob_writev_async(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags,
+		eblob_async_complete_t complete, void *priv);
+int eblob_remove_async(struct eblob_backend *b, struct eblob_key *key,
+		eblob_async_complete_t complete, void *priv);
+
 int eblob_plain_write(struct eblob_backend *b, struct eblob_key *key,
 		void *data, uint64_t offset, uint64_t size, uint64_t flags);
 int eblob_plain_writev(struct eblob_backend *b, struct eblob_key *key,
@@ -650,6 +976,32 @@ int eblob_write_prepare(struct eblob_backend *b, struct eblob_key *key,
 int eblob_write_commit(struct eblob_backend *b, struct eblob_key *key,
 		uint64_t size, uint64_t flags);
 
+/*
+ * Streaming write.
+ *
+ * eblob_stream_open() prepares record for @size bytes of data like
+ * eblob_write_prepare(), eblob_stream_append() writes data right after
+ * previously appended one like eblob_plain_write() and eblob_stream_close()
+ * commits record with all appended data like eblob_write_commit().
+ * Checksums are computed from appended buffers, so commit does not read
+ * data back from disk.
+ *
+ * eblob_stream_close() frees the stream even on error.
+ */
+struct eblob_stream;
+int eblob_stream_open(struct eblob_backend *b, struct eblob_key *key,
+		uint64_t size, uint64_t flags, struct eblob_stream **stream);
+int eblob_stream_append(struct eblob_stream *stream, const void *data, uint64_t size);
+int eblob_stream_close(struct eblob_stream *stream);
+
+/*
+ * Writes @size bytes of file or pipe @src_fd as record of @key without copying
+ * them through userspace buffers. File is read at @src_off, pipe is read from
+ * its current position. APPEND and CHAINED flags are not supported.
+ */
+int eblob_write_from_fd(struct eblob_backend *b, struct eblob_key *key,
+		int src_fd, uint64_t src_off, uint64_t size, uint64_t flags);
+
 struct eblob_range_request {
 	unsigned char			start[EBLOB_ID_SIZE];
 	unsigned char			end[EBLOB_ID_SIZE];
@@ -721,6 +1073,30 @@ enum eblob_stat_global_flavour {
 	EBLOB_GST_INDEX_READS,
 	EBLOB_GST_DATASORT_COMPLETION_TIME,
 	EBLOB_GST_DATASORT_COMPLETION_STATUS,
+	EBLOB_GST_CACHED_RSS,
+	EBLOB_GST_CACHED_META_READS,
+	EBLOB_GST_READ_COPY_UPDATE_TIME,	/* usecs spent copying old records outside of b->lock */
+	EBLOB_GST_GROUP_COMMITS,
+	EBLOB_GST_GROUP_COMMIT_WAITERS,
+	EBLOB_GST_WRITE_SYSCALLS,
+	EBLOB_GST_DIRECT_WRITES,
+	EBLOB_GST_DIRECT_READS,
+	EBLOB_GST_PREALLOC_EXTENTS,
+	EBLOB_GST_PREALLOC_FALLBACKS,
+	EBLOB_GST_ROLLOVERS,
+	EBLOB_GST_ROLLOVERS_SPARE,
+	EBLOB_GST_ROLLOVERS_TIME,
+	EBLOB_GST_ROLLOVER_TIME_MAX,
+	EBLOB_GST_CHAIN_APPENDS,
+	EBLOB_GST_CHAIN_EXTENTS,
+	EBLOB_GST_CHAIN_COALESCES,
+	EBLOB_GST_TOMBSTONES,
+	EBLOB_GST_TOMBSTONES_FOLDED,
+	EBLOB_GST_WBUF_RECORDS,
+	EBLOB_GST_WBUF_FLUSHES,
+	EBLOB_GST_WBUF_READS,
+	EBLOB_GST_MULTI_READ_KEYS,
+	EBLOB_GST_MULTI_READ_SYSCALLS,
 	EBLOB_GST_MAX,
 };
 
@@ -744,6 +1120,11 @@ enum eblob_stat_local_flavour {
 					 */
 	EBLOB_LST_RECORDS_CORRUPTED,
 	EBLOB_LST_CORRUPTED_SIZE,
+	EBLOB_LST_RECORDS_COMPRESSED,	/* records compressed by writes and data-sort */
+	EBLOB_LST_COMPRESS_RAW_SIZE,	/* their size before compression */
+	EBLOB_LST_COMPRESS_SIZE,	/* and after it */
+	EBLOB_LST_COMPRESS_TIME,	/* usecs of CPU time spent compressing */
+	EBLOB_LST_DECOMPRESS_TIME,	/* usecs of CPU time spent uncompressing */
 	EBLOB_LST_MAX,
 };
 
@@ -826,7 +1207,11 @@ static inline const char *eblob_dump_dctl_flags(uint64_t flags) {
 		{ BLOB_DISK_CTL_EXTHDR,		"exthdr"},
 		{ BLOB_DISK_CTL_UNCOMMITTED,	"uncommitted"},
 		{ BLOB_DISK_CTL_CHUNKED_CSUM,	"chunked_csum"},
-		{ BLOB_DISK_CTL_CORRUPTED,      "corrupted"}
+		{ BLOB_DISK_CTL_CORRUPTED,      "corrupted"},
+		{ BLOB_DISK_CTL_NOSYNC,		"nosync"},
+		{ BLOB_DISK_CTL_CHAINED,	"chained"},
+		{ BLOB_DISK_CTL_COMPRESSED,	"compressed"},
+		{ BLOB_DISK_CTL_DIRECT,		"direct"}
 	};
 
 	eblob_dump_flags_raw(buffer, sizeof(buffer), flags, infos, sizeof(infos) / sizeof(infos[0]));
@@ -847,6 +1232,14 @@ static inline const char *eblob_dump_blob_flags(unsigned int flags) {
 		{ EBLOB_SCHEDULED_DATASORT,		"scheduled_datasort"},
 		{ EBLOB_DISABLE_THREADS,		"disabled_threads"},
 		{ EBLOB_AUTO_INDEXSORT,			"auto_indexsort"},
+		{ EBLOB_OHASH,				"ohash"},
+		{ EBLOB_PACKED_CACHE,			"packed_cache"},
+		{ EBLOB_CACHE_META,			"cache_meta"},
+		{ EBLOB_IO_URING,			"io_uring"},
+		{ EBLOB_COMPRESS_LZ4,			"compress_lz4"},
+		{ EBLOB_COMPRESS_ZSTD,			"compress_zstd"},
+		{ EBLOB_COMPRESS_DICT,			"compress_dict"},
+		{ EBLOB_TOMBSTONE_JOURNAL,		"tombstone_journal"},
 	};
 
 	eblob_dump_flags_raw(buffer, sizeof(buffer), flags, infos, sizeof(infos) / sizeof(infos[0]));
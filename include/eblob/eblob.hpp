@@ -86,10 +86,25 @@ class eblob {
 		void write_hashed(const std::string &key, const std::string &data, const uint64_t offset,
 				uint64_t flags = 0);
 
+		/*
+		 * write_batch() returns result of write of each key, throws exception only if nothing was written:
+		 * every key failed or the call failed before writing any of them
+		 */
+		std::vector<int> write_batch(const std::vector<struct eblob_key> &keys,
+				const std::vector<std::string> &data, uint64_t flags = 0);
+
+		/* read_multi() returns result of read of each key, throws exception only if nothing was read */
+		std::vector<int> read_multi(const std::vector<struct eblob_key> &keys, std::vector<std::string> &data,
+				enum eblob_read_flavour csum = EBLOB_READ_CSUM);
+
 		std::string read(const struct eblob_key &key, const uint64_t offset, const uint64_t size);
 		std::string read(const struct eblob_key &key, const uint64_t offset, const uint64_t size,
 				enum eblob_read_flavour csum);
 
+		/* read() into preallocated @buf of @size bytes returns number of bytes read */
+		uint64_t read(const struct eblob_key &key, const uint64_t offset, void *buf, const uint64_t size,
+				enum eblob_read_flavour csum = EBLOB_READ_CSUM);
+
 		/* read() returns exception on error, zero on success, positive return value if data is compressed */
 		void read(const struct eblob_key &key, int *fd, uint64_t *offset, uint64_t *size);
 		void read(const struct eblob_key &key, int *fd, uint64_t *offset, uint64_t *size,
@@ -0,0 +1,649 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Asynchronous I/O engine.
+ *
+ * Thread pool executes reads with blocking preadv(2), so it works everywhere.
+ * With EBLOB_IO_URING on Linux EBLOB_AIO_READV requests go to io_uring
+ * instead: submitter only fills submission queue entry and returns, reaper
+ * thread waits for completions and calls request callbacks. Ring is set up
+ * with raw syscalls, so liburing is not needed.
+ *
+ * Only data reads of eblob_read_async() are submitted as I/O requests.
+ * Asynchronous writes and removes update index under locks, so they are
+ * EBLOB_AIO_CALL_BLOCKING requests executed by separate pool threads and never
+ * go to the ring.
+ */
+
+#include "features.h"
+
+#include "blob.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+ * eblob_aio_advance() - skips @bytes already transferred by @req.
+ * Fully transferred iovecs are dropped, so @req is done when @iovcnt is zero.
+ */
+static void eblob_aio_advance(struct eblob_aio_req *req, size_t bytes)
+{
+	req->offset += bytes;
+	while (req->iovcnt > 0 && bytes >= req->iov->iov_len) {
+		bytes -= req->iov->iov_len;
+		req->iov++;
+		req->iovcnt--;
+	}
+	if (req->iovcnt > 0) {
+		req->iov->iov_base = (char *)req->iov->iov_base + bytes;
+		req->iov->iov_len -= bytes;
+	}
+}
+
+/*
+ * eblob_aio_execute() - synchronously executes @req in pool thread.
+ */
+static int eblob_aio_execute(struct eblob_aio_req *req)
+{
+	ssize_t bytes;
+
+	switch (req->op) {
+	case EBLOB_AIO_READV:
+		eblob_aio_advance(req, 0);
+		while (req->iovcnt > 0) {
+			bytes = preadv(req->fd, req->iov, req->iovcnt < IOV_MAX ? req->iovcnt : IOV_MAX,
+					req->offset);
+			if (bytes == -1) {
+				if (errno == EINTR)
+					continue;
+				return -errno;
+			}
+			/* Read beyond the end of file */
+			if (bytes == 0)
+				return -ESPIPE;
+			eblob_aio_advance(req, bytes);
+		}
+		return 0;
+	case EBLOB_AIO_CALL:
+	case EBLOB_AIO_CALL_BLOCKING:
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * eblob_aio_complete() - calls completion of @req and accounts it.
+ * @req may be already freed or resubmitted when @complete returns.
+ */
+static void eblob_aio_complete(struct eblob_backend *b, struct eblob_aio_req *req, int err)
+{
+	struct eblob_aio *aio = &b->aio;
+
+	req->complete(req, err);
+
+	pthread_mutex_lock(&aio->lock);
+	if (--aio->pending == 0)
+		pthread_cond_broadcast(&aio->idle);
+	pthread_mutex_unlock(&aio->lock);
+}
+
+/*
+ * eblob_aio_queue() - passes @req to the pool.
+ * NB! Called with @aio->lock held.
+ */
+static void eblob_aio_queue(struct eblob_aio *aio, struct eblob_aio_req *req)
+{
+	if (req->op == EBLOB_AIO_CALL_BLOCKING) {
+		list_add_tail(&req->entry, &aio->blocking_queue);
+		pthread_cond_signal(&aio->blocking_cond);
+	} else {
+		list_add_tail(&req->entry, &aio->queue);
+		pthread_cond_signal(&aio->cond);
+	}
+}
+
+/*
+ * eblob_aio_worker() - executes requests from @queue until engine is stopped.
+ */
+static void eblob_aio_worker(struct eblob_backend *b, struct list_head *queue, pthread_cond_t *cond)
+{
+	struct eblob_aio *aio = &b->aio;
+	struct eblob_aio_req *req;
+
+	pthread_mutex_lock(&aio->lock);
+	for (;;) {
+		while (list_empty(queue) && !aio->need_exit)
+			pthread_cond_wait(cond, &aio->lock);
+		if (list_empty(queue))
+			break;
+
+		req = list_first_entry(queue, struct eblob_aio_req, entry);
+		list_del(&req->entry);
+		pthread_mutex_unlock(&aio->lock);
+
+		eblob_aio_complete(b, req, eblob_aio_execute(req));
+
+		pthread_mutex_lock(&aio->lock);
+	}
+	pthread_mutex_unlock(&aio->lock);
+}
+
+static void *eblob_aio_thread(void *data)
+{
+	struct eblob_backend *b = data;
+
+	eblob_set_name("aio_%u", b->cfg.stat_id);
+	eblob_aio_worker(b, &b->aio.queue, &b->aio.cond);
+	return NULL;
+}
+
+static void *eblob_aio_blocking_thread(void *data)
+{
+	struct eblob_backend *b = data;
+
+	eblob_set_name("aio_blk_%u", b->cfg.stat_id);
+	eblob_aio_worker(b, &b->aio.blocking_queue, &b->aio.blocking_cond);
+	return NULL;
+}
+
+#ifdef HAVE_IO_URING
+#define EBLOB_AIO_URING_ENTRIES		256
+
+struct eblob_uring {
+	int			fd;
+	unsigned int		entries;
+
+	unsigned int		*sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe	*sqes;
+	unsigned int		*cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	void			*sq_ptr, *cq_ptr;
+	size_t			sq_size, cq_size, sqes_size;
+
+	/* Requests whose completions were not reaped yet */
+	unsigned int		inflight;
+	/* Entries in submission queue not consumed by kernel yet */
+	unsigned int		unsubmitted;
+	pthread_t		reaper;
+};
+
+static int eblob_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static void eblob_uring_free(struct eblob_uring *r)
+{
+	if (r->sqes != NULL && r->sqes != MAP_FAILED)
+		munmap(r->sqes, r->sqes_size);
+	if (r->cq_ptr != NULL && r->cq_ptr != MAP_FAILED)
+		munmap(r->cq_ptr, r->cq_size);
+	if (r->sq_ptr != NULL && r->sq_ptr != MAP_FAILED)
+		munmap(r->sq_ptr, r->sq_size);
+	if (r->fd >= 0)
+		close(r->fd);
+	free(r);
+}
+
+static struct eblob_uring *eblob_uring_setup(int *errp)
+{
+	struct io_uring_params p;
+	struct eblob_uring *r;
+	int err;
+
+	r = calloc(1, sizeof(struct eblob_uring));
+	if (r == NULL) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	memset(&p, 0, sizeof(p));
+	r->fd = syscall(__NR_io_uring_setup, EBLOB_AIO_URING_ENTRIES, &p);
+	if (r->fd < 0) {
+		err = -errno;
+		goto err_out_free;
+	}
+
+	r->entries = p.sq_entries;
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED) {
+		err = -errno;
+		goto err_out_free;
+	}
+
+	r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			r->fd, IORING_OFF_CQ_RING);
+	if (r->cq_ptr == MAP_FAILED) {
+		err = -errno;
+		goto err_out_free;
+	}
+
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		err = -errno;
+		goto err_out_free;
+	}
+
+	r->sq_tail = (unsigned int *)((char *)r->sq_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)((char *)r->sq_ptr + p.sq_off.array);
+	r->cq_head = (unsigned int *)((char *)r->cq_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned int *)((char *)r->cq_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+
+	return r;
+
+err_out_free:
+	eblob_uring_free(r);
+err_out_exit:
+	*errp = err;
+	return NULL;
+}
+
+/*
+ * eblob_uring_push() - puts @req to submission queue and submits it.
+ * NULL @req is a no-op which tells reaper to exit.
+ * Returns -EBUSY if the ring is full or can't execute @req.
+ * NB! Called with @aio->lock held.
+ */
+static int eblob_uring_push(struct eblob_uring *r, struct eblob_aio_req *req)
+{
+	const unsigned int tail = *r->sq_tail;
+	const unsigned int idx = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+	int ret;
+
+	if (r->inflight >= r->entries)
+		return -EBUSY;
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	if (req == NULL) {
+		sqe->opcode = IORING_OP_NOP;
+	} else {
+		if (req->op != EBLOB_AIO_READV)
+			return -EBUSY;
+
+		sqe->opcode = IORING_OP_READV;
+		sqe->fd = req->fd;
+		sqe->off = req->offset;
+		sqe->addr = (uintptr_t)req->iov;
+		sqe->len = req->iovcnt < IOV_MAX ? req->iovcnt : IOV_MAX;
+	}
+	sqe->user_data = (uintptr_t)req;
+	r->sq_array[idx] = idx;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	r->inflight++;
+	r->unsubmitted++;
+
+	/*
+	 * If kernel can't take entries now they stay in the queue and are
+	 * submitted by the next push or by reaper.
+	 */
+	do {
+		ret = eblob_uring_enter(r->fd, r->unsubmitted, 0, 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret > 0)
+		r->unsubmitted -= ret;
+
+	return 0;
+}
+
+/*
+ * eblob_uring_complete() - handles completion of read @req with @res.
+ * Interrupted and short reads are resubmitted, to the pool if the ring is
+ * full.
+ */
+static void eblob_uring_complete(struct eblob_backend *b, struct eblob_aio_req *req, int res)
+{
+	struct eblob_aio *aio = &b->aio;
+
+	if (res == -EINTR || res == -EAGAIN)
+		goto err_out_resubmit;
+	if (res < 0)
+		goto err_out_complete;
+
+	/* Read beyond the end of file */
+	if (res == 0) {
+		res = -ESPIPE;
+		goto err_out_complete;
+	}
+	eblob_aio_advance(req, res);
+	if (req->iovcnt > 0)
+		goto err_out_resubmit;
+	res = 0;
+
+err_out_complete:
+	eblob_aio_complete(b, req, res);
+	return;
+
+err_out_resubmit:
+	pthread_mutex_lock(&aio->lock);
+	if (eblob_uring_push(aio->ring, req))
+		eblob_aio_queue(aio, req);
+	pthread_mutex_unlock(&aio->lock);
+}
+
+static void *eblob_uring_reaper(void *data)
+{
+	struct eblob_backend *b = data;
+	struct eblob_aio *aio = &b->aio;
+	struct eblob_uring *r = aio->ring;
+	struct eblob_aio_req *req;
+	unsigned int head, tail, to_submit;
+	int ret, res, need_exit = 0;
+
+	eblob_set_name("aio_reaper_%u", b->cfg.stat_id);
+
+	while (!need_exit) {
+		pthread_mutex_lock(&aio->lock);
+		to_submit = r->unsubmitted;
+		pthread_mutex_unlock(&aio->lock);
+
+		ret = eblob_uring_enter(r->fd, to_submit, 1, IORING_ENTER_GETEVENTS);
+		if (ret < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "%s: io_uring_enter: %s[%d]",
+					__func__, strerror(errno), errno);
+			usleep(1000);
+		}
+		if (ret > 0) {
+			pthread_mutex_lock(&aio->lock);
+			r->unsubmitted -= ret;
+			pthread_mutex_unlock(&aio->lock);
+		}
+
+		head = *r->cq_head;
+		tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+
+			req = (struct eblob_aio_req *)(uintptr_t)cqe->user_data;
+			res = cqe->res;
+			__atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+
+			pthread_mutex_lock(&aio->lock);
+			r->inflight--;
+			pthread_mutex_unlock(&aio->lock);
+
+			if (req == NULL)
+				need_exit = 1;
+			else
+				eblob_uring_complete(b, req, res);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * eblob_uring_start() - sets up the ring and starts reaper.
+ * NB! Called with @aio->lock held.
+ */
+static int eblob_uring_start(struct eblob_backend *b)
+{
+	struct eblob_aio *aio = &b->aio;
+	int err = 0;
+
+	aio->ring = eblob_uring_setup(&err);
+	if (aio->ring == NULL)
+		return err;
+
+	err = pthread_create(&aio->ring->reaper, NULL, eblob_uring_reaper, b);
+	if (err) {
+		eblob_uring_free(aio->ring);
+		aio->ring = NULL;
+		return -err;
+	}
+
+	return 0;
+}
+
+/*
+ * eblob_uring_stop() - stops reaper and frees the ring.
+ * NB! All requests must be completed.
+ */
+static void eblob_uring_stop(struct eblob_backend *b)
+{
+	struct eblob_aio *aio = &b->aio;
+
+	pthread_mutex_lock(&aio->lock);
+	eblob_uring_push(aio->ring, NULL);
+	pthread_mutex_unlock(&aio->lock);
+
+	pthread_join(aio->ring->reaper, NULL);
+	eblob_uring_free(aio->ring);
+	aio->ring = NULL;
+}
+#else
+static int eblob_uring_start(struct eblob_backend *b __attribute_unused__)
+{
+	return -ENOTSUP;
+}
+
+static int eblob_uring_push(struct eblob_uring *r __attribute_unused__,
+		struct eblob_aio_req *req __attribute_unused__)
+{
+	return -EBUSY;
+}
+
+static void eblob_uring_stop(struct eblob_backend *b __attribute_unused__)
+{
+}
+#endif /* HAVE_IO_URING */
+
+/*
+ * eblob_aio_start_threads() - starts up to @b->cfg.aio_threads threads
+ * running @func. Fails only if none was started.
+ */
+static int eblob_aio_start_threads(struct eblob_backend *b, void *(*func)(void *),
+		pthread_t **threadsp, unsigned int *nump)
+{
+	pthread_t *threads;
+	unsigned int i;
+	int err = 0;
+
+	threads = calloc(b->cfg.aio_threads, sizeof(pthread_t));
+	if (threads == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < b->cfg.aio_threads; ++i) {
+		err = pthread_create(&threads[i], NULL, func, b);
+		if (err) {
+			eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "%s: failed to start aio thread: %s[%d]",
+					__func__, strerror(err), err);
+			break;
+		}
+	}
+	if (i == 0) {
+		free(threads);
+		return -err;
+	}
+
+	*threadsp = threads;
+	*nump = i;
+	return 0;
+}
+
+/*
+ * eblob_aio_stop_threads() - joins threads started by eblob_aio_start_threads().
+ * NB! @aio->need_exit must be set.
+ */
+static void eblob_aio_stop_threads(pthread_t **threadsp, unsigned int *nump)
+{
+	unsigned int i;
+
+	for (i = 0; i < *nump; ++i)
+		pthread_join((*threadsp)[i], NULL);
+	free(*threadsp);
+	*threadsp = NULL;
+	*nump = 0;
+}
+
+/*
+ * eblob_aio_start() - starts both pools and the ring if it's enabled.
+ * NB! Called with @aio->lock held.
+ */
+static int eblob_aio_start(struct eblob_backend *b)
+{
+	struct eblob_aio *aio = &b->aio;
+	int err;
+
+	err = eblob_aio_start_threads(b, eblob_aio_thread, &aio->threads, &aio->threads_num);
+	if (err)
+		return err;
+
+	err = eblob_aio_start_threads(b, eblob_aio_blocking_thread,
+			&aio->blocking_threads, &aio->blocking_threads_num);
+	if (err) {
+		/* Nothing is queued yet, so threads exit right away */
+		aio->need_exit = 1;
+		pthread_cond_broadcast(&aio->cond);
+		pthread_mutex_unlock(&aio->lock);
+		eblob_aio_stop_threads(&aio->threads, &aio->threads_num);
+		pthread_mutex_lock(&aio->lock);
+		aio->need_exit = 0;
+		return err;
+	}
+
+	if (b->cfg.blob_flags & EBLOB_IO_URING) {
+		err = eblob_uring_start(b);
+		if (err)
+			eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "%s: io_uring is not available, "
+					"falling back to thread pool: %s[%d]", __func__, strerror(-err), err);
+	}
+
+	aio->started = 1;
+	return 0;
+}
+
+int eblob_aio_init(struct eblob_aio *aio)
+{
+	int err;
+
+	memset(aio, 0, sizeof(struct eblob_aio));
+	INIT_LIST_HEAD(&aio->queue);
+	INIT_LIST_HEAD(&aio->blocking_queue);
+
+	err = eblob_mutex_init(&aio->lock);
+	if (err)
+		goto err_out_exit;
+
+	err = eblob_cond_init(&aio->cond);
+	if (err)
+		goto err_out_mutex_destroy;
+
+	err = eblob_cond_init(&aio->blocking_cond);
+	if (err)
+		goto err_out_cond_destroy;
+
+	err = eblob_cond_init(&aio->idle);
+	if (err)
+		goto err_out_blocking_cond_destroy;
+
+	return 0;
+
+err_out_blocking_cond_destroy:
+	pthread_cond_destroy(&aio->blocking_cond);
+err_out_cond_destroy:
+	pthread_cond_destroy(&aio->cond);
+err_out_mutex_destroy:
+	pthread_mutex_destroy(&aio->lock);
+err_out_exit:
+	return err;
+}
+
+/**
+ * eblob_aio_destroy() - waits for all submitted requests and stops threads.
+ */
+void eblob_aio_destroy(struct eblob_backend *b)
+{
+	struct eblob_aio *aio = &b->aio;
+
+	pthread_mutex_lock(&aio->lock);
+	while (aio->pending)
+		pthread_cond_wait(&aio->idle, &aio->lock);
+	aio->need_exit = 1;
+	pthread_cond_broadcast(&aio->cond);
+	pthread_cond_broadcast(&aio->blocking_cond);
+	pthread_mutex_unlock(&aio->lock);
+
+	if (aio->ring != NULL)
+		eblob_uring_stop(b);
+
+	eblob_aio_stop_threads(&aio->threads, &aio->threads_num);
+	eblob_aio_stop_threads(&aio->blocking_threads, &aio->blocking_threads_num);
+
+	pthread_cond_destroy(&aio->idle);
+	pthread_cond_destroy(&aio->blocking_cond);
+	pthread_cond_destroy(&aio->cond);
+	pthread_mutex_destroy(&aio->lock);
+}
+
+/**
+ * eblob_aio_submit() - schedules @req, @req->complete will be called from
+ * engine's thread.
+ * Returns error only if @req was not submitted.
+ */
+int eblob_aio_submit(struct eblob_backend *b, struct eblob_aio_req *req)
+{
+	struct eblob_aio *aio = &b->aio;
+	int err;
+
+	pthread_mutex_lock(&aio->lock);
+	if (aio->need_exit) {
+		err = -ESHUTDOWN;
+		goto err_out_unlock;
+	}
+
+	if (!aio->started) {
+		err = eblob_aio_start(b);
+		if (err)
+			goto err_out_unlock;
+	}
+
+	aio->pending++;
+	if (aio->ring == NULL || eblob_uring_push(aio->ring, req))
+		eblob_aio_queue(aio, req);
+	pthread_mutex_unlock(&aio->lock);
+
+	return 0;
+
+err_out_unlock:
+	pthread_mutex_unlock(&aio->lock);
+	return err;
+}
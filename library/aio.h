@@ -0,0 +1,97 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __EBLOB_AIO_H
+#define __EBLOB_AIO_H
+
+#include "list.h"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <pthread.h>
+
+struct eblob_backend;
+struct eblob_uring;
+
+enum eblob_aio_op {
+	EBLOB_AIO_READV,
+	/* No I/O, @complete is just called from engine's thread */
+	EBLOB_AIO_CALL,
+	/*
+	 * Same as EBLOB_AIO_CALL, but @complete may wait for data-sort, so it
+	 * is called from separate threads: data-sort waits for bases held by
+	 * in-flight reads, which are completed by the others.
+	 */
+	EBLOB_AIO_CALL_BLOCKING,
+};
+
+/*
+ * Request to I/O engine.
+ *
+ * Reads are completed only when all @iov are transferred, short reads are
+ * resubmitted. @iov is modified meanwhile.
+ */
+struct eblob_aio_req {
+	struct list_head	entry;
+	enum eblob_aio_op	op;
+	int			fd;
+	struct iovec		*iov;
+	int			iovcnt;
+	off_t			offset;
+	/* Called from engine's thread with zero or negative error */
+	void			(*complete)(struct eblob_aio_req *req, int err);
+};
+
+/*
+ * I/O engine for asynchronous requests.
+ *
+ * Requests are executed by thread pool. If backend is configured with
+ * EBLOB_IO_URING and io_uring is available, EBLOB_AIO_READV requests are
+ * submitted to the ring instead and completed by reaper thread; pool then
+ * executes only EBLOB_AIO_CALL requests and reads that do not fit the ring.
+ * EBLOB_AIO_CALL_BLOCKING requests are always executed by their own pool.
+ *
+ * Threads are started by the first request.
+ */
+struct eblob_aio {
+	pthread_mutex_t		lock;
+	/* Signalled when @queue gets new request */
+	pthread_cond_t		cond;
+	/* Broadcasted when @pending drops to zero */
+	pthread_cond_t		idle;
+	/* Requests waiting for pool thread */
+	struct list_head	queue;
+	pthread_t		*threads;
+	unsigned int		threads_num;
+	/* The same for EBLOB_AIO_CALL_BLOCKING requests */
+	pthread_cond_t		blocking_cond;
+	struct list_head	blocking_queue;
+	pthread_t		*blocking_threads;
+	unsigned int		blocking_threads_num;
+	/* Submitted requests which @complete has not returned yet */
+	unsigned long		pending;
+	int			started;
+	int			need_exit;
+	struct eblob_uring	*ring;
+};
+
+int eblob_aio_init(struct eblob_aio *aio);
+void eblob_aio_destroy(struct eblob_backend *b);
+int eblob_aio_submit(struct eblob_backend *b, struct eblob_aio_req *req);
+
+#endif /* __EBLOB_AIO_H */
@@ -28,6 +28,7 @@
 #include "blob.h"
 #include "crypto/sha512.h"
 #include "footer.h"
+#include "murmurhash.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -36,6 +37,7 @@
 #include <sys/mman.h>
 #include <sys/wait.h>
 #include <sys/time.h>
+#include <sys/uio.h>
 
 #include <assert.h>
 #include <errno.h>
@@ -323,26 +325,39 @@ inline static uint64_t eblob_validate_ctl_flags(struct eblob_backend *b, uint64_
 	 */
 	flags |= BLOB_DISK_CTL_CHUNKED_CSUM;
 
+	/* Chained records are written only by eblob_chain_writev() */
+	flags &= ~BLOB_DISK_CTL_CHAINED;
+
+	/* Compressed records are written only by eblob_writev_return() */
+	flags &= ~BLOB_DISK_CTL_COMPRESSED;
+
+	/*
+	 * Direct records are marked when space for them is reserved, writes in
+	 * place keep the mark of the record
+	 */
+	flags &= ~BLOB_DISK_CTL_DIRECT;
+
 	return flags;
 }
 
 /*!
- * Writes all \a iov wrt record position in base
+ * Fills \a seg with data file offsets of all \a iov wrt record position in base
  */
-static int eblob_writev_raw(struct eblob_key *key, struct eblob_write_control *wc,
-		const struct eblob_iovec *iov, uint16_t iovcnt)
+static int eblob_writev_segments(struct eblob_key *key, struct eblob_write_control *wc,
+		const struct eblob_iovec *iov, uint16_t iovcnt, struct eblob_iovec *seg)
 {
-	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.write.raw", wc->bctl->back->cfg.stat_id));
 	const uint64_t offset_min = wc->ctl_data_offset + sizeof(struct eblob_disk_control);
 	const uint64_t offset_max = wc->ctl_data_offset + wc->total_size;
 	const struct eblob_iovec *tmp;
-	int err = -EFAULT;
 
 	assert(wc != NULL);
 	assert(wc->bctl != NULL);
 	assert(key != NULL);
 	assert(iov != NULL);
 
+	if (iovcnt < EBLOB_IOVCNT_MIN || iovcnt > EBLOB_IOVCNT_MAX)
+		return -E2BIG;
+
 	/*
 	 * Hack: decrease size and offset of EXTHDR & APPEND record by the size
 	 * of 0th iov.
@@ -356,12 +371,8 @@ static int eblob_writev_raw(struct eblob_key *key, struct eblob_write_control *w
 		wc->total_data_size -= iov->size;
 	}
 
-	for (tmp = iov; tmp < iov + iovcnt; ++tmp) {
-		uint64_t offset = wc->data_offset + tmp->offset;
-
-		/* Hack: for extended records we should override offset of iov[0] */
-		if ((tmp == iov) && (wc->flags & BLOB_DISK_CTL_EXTHDR))
-			offset = offset_min;
+	for (tmp = iov; tmp < iov + iovcnt; ++tmp, ++seg) {
+		const uint64_t offset = offset_min + eblob_iovec_data_offset(wc, tmp, tmp == iov);
 
 		EBLOB_WARNX(wc->bctl->back->cfg.log, EBLOB_LOG_DEBUG, "%s: writev: fd: %d"
 				", iov_size: %" PRIu64 ", iov_offset: %" PRIu64
@@ -369,17 +380,34 @@ static int eblob_writev_raw(struct eblob_key *key, struct eblob_write_control *w
 				wc->bctl->data_ctl.fd, tmp->size, tmp->offset, offset);
 
 		/* Sanity - do not write outside of the record */
-		if (offset + tmp->size > offset_max || offset < offset_min) {
-			err = -ERANGE;
-			goto err_exit;
-		}
+		if (offset + tmp->size > offset_max || offset < offset_min)
+			return -ERANGE;
 
-		err = __eblob_write_ll(wc->bctl->data_ctl.fd, tmp->base, tmp->size, offset);
-		if (err != 0)
-			goto err_exit;
+		seg->base = tmp->base;
+		seg->size = tmp->size;
+		seg->offset = offset;
 	}
 
-err_exit:
+	return 0;
+}
+
+/*!
+ * Writes all \a iov wrt record position in base
+ */
+static int eblob_writev_raw(struct eblob_key *key, struct eblob_write_control *wc,
+		const struct eblob_iovec *iov, uint16_t iovcnt)
+{
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.write.raw", wc->bctl->back->cfg.stat_id));
+	struct eblob_iovec seg[EBLOB_IOVCNT_MAX];
+	unsigned int syscalls = 0;
+	int err;
+
+	err = eblob_writev_segments(key, wc, iov, iovcnt, seg);
+	if (err)
+		return err;
+
+	err = __eblob_writev_ll(wc->bctl->data_ctl.fd, seg, iovcnt, &syscalls);
+	eblob_stat_add(wc->bctl->back->stat, EBLOB_GST_WRITE_SYSCALLS, syscalls);
 	return err;
 }
 
@@ -498,6 +526,21 @@ int eblob_check_record(const struct eblob_base_ctl *bctl,
 	const uint64_t bctl_size = bctl->data_ctl.size > bctl->data_ctl.offset ?
 		bctl->data_ctl.size : bctl->data_ctl.offset;
 
+	/*
+	 * Zero-filled header is a hole: index entry reserved by a writer that
+	 * has not written it (yet), e.g. because of a crash.
+	 */
+	if (dc->disk_size == 0) {
+		static const struct eblob_key zero_key;
+
+		if (memcmp(&dc->key, &zero_key, sizeof(zero_key)) == 0) {
+			eblob_log(bctl->back->cfg.log, EBLOB_LOG_ERROR,
+					"blob i%d: malformed entry: zero-filled header (hole in index): pos: %" PRIu64 "\n",
+					bctl->index, dc->position);
+			return -ESPIPE;
+		}
+	}
+
 	/*
 	 * Check record itself
 	 */
@@ -532,8 +575,9 @@ int eblob_check_record(const struct eblob_base_ctl *bctl,
 
 	/*
 	 * If there is no no-checksum bit, there must be enough space in the footer for checksum.
+	 * Checksums of chained record are kept in its chain header.
 	 */
-	if (!(dc->flags & BLOB_DISK_CTL_NOCSUM)) {
+	if (!(dc->flags & (BLOB_DISK_CTL_NOCSUM | BLOB_DISK_CTL_CHAINED))) {
 		long footer_min_size = sizeof(struct eblob_disk_footer);
 		if (dc->flags & BLOB_DISK_CTL_CHUNKED_CSUM) {
 			footer_min_size = 0;
@@ -587,6 +631,10 @@ static int eblob_check_disk_one(struct eblob_iterate_local *loc)
 		goto err_out_exit;
 	}
 
+	/* Record removed by tombstone that is not folded into the base yet */
+	if (!(dc->flags & BLOB_DISK_CTL_REMOVE) && eblob_tombstone_exists(bc->back, bc, &dc->key, dc->position))
+		dc->flags |= BLOB_DISK_CTL_REMOVE;
+
 	/* Save last non-corrupted dc position */
 	loc->last_valid_offset = loc->index_offset;
 	loc->last_valid_dc = dc;
@@ -1128,17 +1176,36 @@ int eblob_mark_index_removed(int fd, uint64_t offset)
 	return __eblob_write_ll(fd, &flags, sizeof(flags), offset + offsetof(struct eblob_disk_control, flags));
 }
 
+/**
+ * eblob_sync_record() - makes writes to @data_fd and @index_fd durable if
+ * every operation should be synced (cfg.sync == 0).
+ *
+ * Syncs are shared by concurrent operations via group commit. Unless @flags
+ * has BLOB_DISK_CTL_NOSYNC caller waits until its group is synced.
+ */
+static int eblob_sync_record(struct eblob_backend *b, int data_fd, int index_fd, uint64_t flags)
+{
+	const int fds[] = { data_fd, index_fd };
+
+	if (b->cfg.sync)
+		return 0;
+
+	return eblob_gcommit_sync(b, fds, 2, !(flags & BLOB_DISK_CTL_NOSYNC));
+}
+
 /**
  * eblob_mark_entry_removed() - Mark entry as removed in both index and data file.
  *
- * Also updates stats and syncs data.
+ * Also updates stats. Flags and size of the record are taken from @meta if it's
+ * known, index header is read otherwise.
  *
  * TODO: We can add task to periodic thread to punch holes (do fadvise
  * FALLOC_FL_PUNCH_HOLE) in data files. This will free space utilized by
  * removed entries.
  */
 static int eblob_mark_entry_removed(struct eblob_backend *b,
-		struct eblob_key *key, struct eblob_ram_control *old)
+		struct eblob_key *key, struct eblob_ram_control *old,
+		const struct eblob_ram_meta *meta)
 {
 	int err;
 	struct eblob_disk_control old_dc;
@@ -1171,40 +1238,57 @@ static int eblob_mark_entry_removed(struct eblob_backend *b,
 			eblob_dump_id(key->id), old->index_offset, old->bctl->index_ctl.fd,
 			old->data_offset, old->bctl->data_ctl.fd);
 
-	err = __eblob_read_ll(old->bctl->index_ctl.fd, &old_dc, sizeof(old_dc), old->index_offset);
-	if (err) {
-		EBLOB_WARNX(b->cfg.log, EBLOB_LOG_ERROR, "%s: __eblob_read_ll: FAILED: index, fd: %d, err: %d",
-				eblob_dump_id(key->id), old->bctl->index_ctl.fd, err);
-		goto err;
-	}
+	if (meta != NULL && meta->disk_size != 0) {
+		/* Headers are cross-checked by inspect thread */
+		memset(&old_dc, 0, sizeof(old_dc));
+		old_dc.flags = meta->flags;
+		old_dc.disk_size = meta->disk_size;
+	} else {
+		err = __eblob_read_ll(old->bctl->index_ctl.fd, &old_dc, sizeof(old_dc), old->index_offset);
+		if (err) {
+			EBLOB_WARNX(b->cfg.log, EBLOB_LOG_ERROR, "%s: __eblob_read_ll: FAILED: index, fd: %d, err: %d",
+					eblob_dump_id(key->id), old->bctl->index_ctl.fd, err);
+			goto err;
+		}
 
-	/* Sanity: Check that on-disk and in-memory keys are the same */
-	if (memcmp(&old_dc.key, key, sizeof(struct eblob_key)) != 0) {
-		EBLOB_WARNX(b->cfg.log, EBLOB_LOG_ERROR, "keys mismatch: in-memory: %s, on-disk: %s",
-				eblob_dump_id_len(key->id, EBLOB_ID_SIZE),
-				eblob_dump_id_len(old_dc.key.id, EBLOB_ID_SIZE));
-		err = -EINVAL;
-		goto err;
-	}
+		/* Sanity: Check that on-disk and in-memory keys are the same */
+		if (memcmp(&old_dc.key, key, sizeof(struct eblob_key)) != 0) {
+			EBLOB_WARNX(b->cfg.log, EBLOB_LOG_ERROR, "keys mismatch: in-memory: %s, on-disk: %s",
+					eblob_dump_id_len(key->id, EBLOB_ID_SIZE),
+					eblob_dump_id_len(old_dc.key.id, EBLOB_ID_SIZE));
+			err = -EINVAL;
+			goto err;
+		}
 
-	eblob_convert_disk_control(&old_dc);
+		eblob_convert_disk_control(&old_dc);
+	}
 	/* size of the place occupied by the record in the index and the blob */
 	record_size = old_dc.disk_size + sizeof(struct eblob_disk_control);
 
-	err = eblob_mark_index_removed(old->bctl->index_ctl.fd, old->index_offset);
-	if (err != 0) {
-		EBLOB_WARNX(b->cfg.log, EBLOB_LOG_ERROR,
-				"%s: eblob_mark_index_removed: FAILED: index, fd: %d, err: %d",
-				eblob_dump_id(key->id), old->bctl->index_ctl.fd, err);
-		goto err;
-	}
+	if (b->cfg.blob_flags & EBLOB_TOMBSTONE_JOURNAL) {
+		/* Headers are marked later, when tombstone is folded into the base */
+		err = eblob_tombstone_add(b, key, old);
+		if (err != 0) {
+			EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err,
+					"%s: eblob_tombstone_add: FAILED", eblob_dump_id(key->id));
+			goto err;
+		}
+	} else {
+		err = eblob_mark_index_removed(old->bctl->index_ctl.fd, old->index_offset);
+		if (err != 0) {
+			EBLOB_WARNX(b->cfg.log, EBLOB_LOG_ERROR,
+					"%s: eblob_mark_index_removed: FAILED: index, fd: %d, err: %d",
+					eblob_dump_id(key->id), old->bctl->index_ctl.fd, err);
+			goto err;
+		}
 
-	err = eblob_mark_index_removed(old->bctl->data_ctl.fd, old->data_offset);
-	if (err != 0) {
-		EBLOB_WARNX(b->cfg.log, EBLOB_LOG_ERROR,
-				"%s: eblob_mark_index_removed: FAILED: data, fd: %d, err: %d",
-				eblob_dump_id(key->id), old->bctl->data_ctl.fd, err);
-		goto err;
+		err = eblob_mark_index_removed(old->bctl->data_ctl.fd, old->data_offset);
+		if (err != 0) {
+			EBLOB_WARNX(b->cfg.log, EBLOB_LOG_ERROR,
+					"%s: eblob_mark_index_removed: FAILED: data, fd: %d, err: %d",
+					eblob_dump_id(key->id), old->bctl->data_ctl.fd, err);
+			goto err;
+		}
 	}
 
 	if (old_dc.flags & BLOB_DISK_CTL_UNCOMMITTED) {
@@ -1226,11 +1310,6 @@ static int eblob_mark_entry_removed(struct eblob_backend *b,
 	eblob_stat_inc(b->stat_summary, EBLOB_LST_RECORDS_REMOVED);
 	eblob_stat_add(b->stat_summary, EBLOB_LST_REMOVED_SIZE, record_size);
 
-	if (!b->cfg.sync) {
-		eblob_fdatasync(old->bctl->data_ctl.fd);
-		eblob_fdatasync(old->bctl->index_ctl.fd);
-	}
-
 err:
 	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_NOTICE, "%s: finished: %d",
 			eblob_dump_id(key->id), err);
@@ -1239,10 +1318,13 @@ err:
 
 /**
  * eblob_mark_entry_removed_purge() - remove entry from disk and memory.
+ * Removal is synced according to @flags, see eblob_sync_record().
+ * @meta is metadata of @old if caller knows it, may be NULL.
  * FIXME: Rename!
  */
 static int eblob_mark_entry_removed_purge(struct eblob_backend *b,
-		struct eblob_key *key, struct eblob_ram_control *old)
+		struct eblob_key *key, struct eblob_ram_control *old,
+		const struct eblob_ram_meta *meta, uint64_t flags)
 {
 	int err;
 
@@ -1255,7 +1337,7 @@ static int eblob_mark_entry_removed_purge(struct eblob_backend *b,
 	pthread_mutex_lock(&old->bctl->lock);
 
 	/* Remove from disk blob and index */
-	err = eblob_mark_entry_removed(b, key, old);
+	err = eblob_mark_entry_removed(b, key, old, meta);
 	if (err)
 		goto err;
 
@@ -1270,6 +1352,18 @@ static int eblob_mark_entry_removed_purge(struct eblob_backend *b,
 		err = 0;
 	}
 
+	pthread_mutex_unlock(&old->bctl->lock);
+
+	/* Caller holds @old->bctl, so its fds stay open until they are synced */
+	if (b->cfg.blob_flags & EBLOB_TOMBSTONE_JOURNAL)
+		err = eblob_tombstones_sync(b, flags);
+	else
+		err = eblob_sync_record(b, old->bctl->data_ctl.fd, old->bctl->index_ctl.fd, flags);
+	if (err)
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err,
+				"%s: eblob_sync_record: FAILED", eblob_dump_id(key->id));
+	return err;
+
 err:
 	pthread_mutex_unlock(&old->bctl->lock);
 	return err;
@@ -1286,7 +1380,7 @@ static void eblob_wc_to_dc(const struct eblob_key *key, const struct eblob_write
 	assert(dc != NULL);
 
 	memcpy(&dc->key, key, sizeof(struct eblob_key));
-	dc->flags = wc->flags;
+	dc->flags = wc->flags & ~BLOB_DISK_CTL_NOSYNC;
 	dc->data_size = wc->total_data_size;
 	dc->disk_size = wc->total_size;
 	dc->position = wc->ctl_data_offset;
@@ -1315,20 +1409,19 @@ static int eblob_commit_disk(struct eblob_backend *b, struct eblob_key *key,
 	eblob_wc_to_dc(key, wc, &dc);
 
 	err = __eblob_write_ll(wc->index_fd, &dc, sizeof(dc), wc->ctl_index_offset);
+	eblob_stat_inc(b->stat, EBLOB_GST_WRITE_SYSCALLS);
 	if (err) {
 		eblob_dump_wc(b, key, wc, "eblob_commit_disk: ERROR-write-index", err);
 		goto err_out_exit;
 	}
 
 	err = __eblob_write_ll(wc->data_fd, &dc, sizeof(dc), wc->ctl_data_offset);
+	eblob_stat_inc(b->stat, EBLOB_GST_WRITE_SYSCALLS);
 	if (err) {
 		eblob_dump_wc(b, key, wc, "eblob_commit_disk: ERROR-write-data", err);
 		goto err_out_exit;
 	}
 
-	if (!b->cfg.sync)
-		fsync(wc->index_fd);
-
 	eblob_dump_wc(b, key, wc, "eblob_commit_disk", err);
 
 err_out_exit:
@@ -1360,6 +1453,57 @@ err_out_exit:
 	return err;
 }
 
+/**
+ * __eblob_writev_ll() - interruption-safe wrapper for pwritev(2)
+ * @seg:	buffers with their offsets in @fd, written in given order
+ * @syscalls:	incremented by number of issued syscalls
+ *
+ * Runs of adjacent segments are written by single pwritev(2).
+ */
+int __eblob_writev_ll(int fd, const struct eblob_iovec *seg, unsigned int num, unsigned int *syscalls)
+{
+	struct iovec vec[IOV_MAX], *tmp;
+	unsigned int i = 0, cnt;
+	off_t offset;
+	ssize_t bytes;
+	int err = 0;
+
+	while (i < num) {
+		offset = seg[i].offset;
+		for (cnt = 0; i < num && cnt < IOV_MAX; ++i, ++cnt) {
+			if (cnt && seg[i].offset != seg[i - 1].offset + seg[i - 1].size)
+				break;
+			vec[cnt].iov_base = seg[i].base;
+			vec[cnt].iov_len = seg[i].size;
+		}
+
+		for (tmp = vec; cnt; ) {
+			bytes = pwritev(fd, tmp, cnt, offset);
+			++*syscalls;
+			if (bytes == -1) {
+				if (errno == EINTR)
+					continue;
+				err = -errno;
+				goto err_out_exit;
+			} else if (bytes == 0) {
+				err = -EIO;
+				goto err_out_exit;
+			}
+			offset += bytes;
+
+			/* skip written buffers and adjust partially written one */
+			for (; cnt && (size_t)bytes >= tmp->iov_len; ++tmp, --cnt)
+				bytes -= tmp->iov_len;
+			if (cnt) {
+				tmp->iov_base = (char *)tmp->iov_base + bytes;
+				tmp->iov_len -= bytes;
+			}
+		}
+	}
+err_out_exit:
+	return err;
+}
+
 /**
  * __eblob_read_ll() - interruption-safe wrapper for pread(2)
  */
@@ -1383,6 +1527,57 @@ again:
 	return 0;
 }
 
+/**
+ * __eblob_readv_ll() - interruption-safe wrapper for preadv(2)
+ * @seg:	buffers with their offsets in @fd, read in given order
+ * @syscalls:	incremented by number of issued syscalls
+ *
+ * Runs of adjacent segments are read by single preadv(2).
+ */
+int __eblob_readv_ll(int fd, const struct eblob_iovec *seg, unsigned int num, unsigned int *syscalls)
+{
+	struct iovec vec[IOV_MAX], *tmp;
+	unsigned int i = 0, cnt;
+	off_t offset;
+	ssize_t bytes;
+	int err = 0;
+
+	while (i < num) {
+		offset = seg[i].offset;
+		for (cnt = 0; i < num && cnt < IOV_MAX; ++i, ++cnt) {
+			if (cnt && seg[i].offset != seg[i - 1].offset + seg[i - 1].size)
+				break;
+			vec[cnt].iov_base = seg[i].base;
+			vec[cnt].iov_len = seg[i].size;
+		}
+
+		for (tmp = vec; cnt; ) {
+			bytes = preadv(fd, tmp, cnt, offset);
+			++*syscalls;
+			if (bytes == -1) {
+				if (errno == EINTR)
+					continue;
+				err = -errno;
+				goto err_out_exit;
+			} else if (bytes == 0) {
+				err = -ESPIPE;
+				goto err_out_exit;
+			}
+			offset += bytes;
+
+			/* skip filled buffers and adjust partially filled one */
+			for (; cnt && (size_t)bytes >= tmp->iov_len; ++tmp, --cnt)
+				bytes -= tmp->iov_len;
+			if (cnt) {
+				tmp->iov_base += bytes;
+				tmp->iov_len -= bytes;
+			}
+		}
+	}
+err_out_exit:
+	return err;
+}
+
 /**
  * eblob_calculate_size() - calculate size of data with respect to
  * header/footer and alignment
@@ -1401,6 +1596,107 @@ static inline uint64_t eblob_calculate_size(struct eblob_backend *b, struct eblo
 	return total_size;
 }
 
+/**
+ * eblob_direct_record() - checks if record with @data_size bytes of data
+ * should be reserved as BLOB_DISK_CTL_DIRECT one.
+ */
+static int eblob_direct_record(struct eblob_backend *b, uint64_t data_size)
+{
+	return b->cfg.direct_io_threshold && data_size >= b->cfg.direct_io_threshold;
+}
+
+/**
+ * eblob_reserved_size() - size of space reserved for record pointed by @wc:
+ * BLOB_DISK_CTL_DIRECT record is followed by padding up to aligned offset.
+ */
+static uint64_t eblob_reserved_size(const struct eblob_write_control *wc)
+{
+	if (wc->flags & BLOB_DISK_CTL_DIRECT)
+		return ALIGN(wc->total_size, (uint64_t)EBLOB_DIRECT_IO_ALIGN);
+	return wc->total_size;
+}
+
+/**
+ * eblob_direct_io() - checks if data of record pointed by @wc is transferred
+ * with O_DIRECT: record is BLOB_DISK_CTL_DIRECT one.
+ * Records written before direct I/O was enabled or moved by data-sort are
+ * not aligned, these are always read through page cache.
+ */
+static int eblob_direct_io(struct eblob_backend *b, const struct eblob_write_control *wc)
+{
+	return b->cfg.direct_io_threshold &&
+		(wc->flags & BLOB_DISK_CTL_DIRECT) &&
+		wc->bctl != NULL && wc->bctl->direct_fd >= 0 &&
+		wc->ctl_data_offset % EBLOB_DIRECT_IO_ALIGN == 0;
+}
+
+/**
+ * eblob_read_direct() - reads @size bytes at @offset of data file of @bctl
+ * into @data with O_DIRECT through aligned bounce buffer.
+ * NB! Range rounded to EBLOB_DIRECT_IO_ALIGN must be within the file.
+ */
+static int eblob_read_direct(struct eblob_base_ctl *bctl, void *data, uint64_t size, uint64_t offset)
+{
+	const uint64_t start = offset & ~((uint64_t)EBLOB_DIRECT_IO_ALIGN - 1);
+	const uint64_t end = ALIGN(offset + size, (uint64_t)EBLOB_DIRECT_IO_ALIGN);
+	void *buf;
+	int err;
+
+	err = posix_memalign(&buf, EBLOB_DIRECT_IO_ALIGN, end - start);
+	if (err)
+		return -err;
+
+	err = __eblob_read_ll(bctl->direct_fd, buf, end - start, start);
+	if (err == 0)
+		memcpy(data, (char *)buf + (offset - start), size);
+
+	free(buf);
+	return err;
+}
+
+/**
+ * eblob_writev_direct() - writes whole record: header, data and footer from
+ * @seg and padding with single O_DIRECT write through aligned bounce buffer.
+ * @seg[0] is the header, followed by @iovcnt data segments and footer.
+ *
+ * Returns -EAGAIN if data segments do not cover all data of the record
+ * contiguously, so the rest of data is already on disk.
+ */
+static int eblob_writev_direct(struct eblob_write_control *wc,
+		const struct eblob_iovec *seg, unsigned int num, uint16_t iovcnt)
+{
+	const uint64_t data_start = wc->ctl_data_offset + sizeof(struct eblob_disk_control);
+	const uint64_t size = eblob_reserved_size(wc);
+	uint64_t data_end = data_start;
+	unsigned int i;
+	void *mem;
+	char *buf;
+	int err;
+
+	for (i = 1; i <= iovcnt; ++i) {
+		if (seg[i].offset != data_end)
+			return -EAGAIN;
+		data_end += seg[i].size;
+	}
+	if (data_end != data_start + wc->total_data_size)
+		return -EAGAIN;
+
+	err = posix_memalign(&mem, EBLOB_DIRECT_IO_ALIGN, size);
+	if (err)
+		return -err;
+	buf = mem;
+
+	/* Padding and unused checksums are zeroed */
+	memset(buf + (data_end - wc->ctl_data_offset), 0, size - (data_end - wc->ctl_data_offset));
+	for (i = 0; i < num; ++i)
+		memcpy(buf + (seg[i].offset - wc->ctl_data_offset), seg[i].base, seg[i].size);
+
+	err = __eblob_write_ll(wc->bctl->direct_fd, buf, size, wc->ctl_data_offset);
+
+	free(buf);
+	return err;
+}
+
 /*! Fills \a rctl fields from given \a wc */
 static void eblob_wc_to_rctl(const struct eblob_write_control *wc,
 		struct eblob_ram_control *rctl)
@@ -1422,6 +1718,7 @@ static void eblob_wc_to_rctl(const struct eblob_write_control *wc,
 static int eblob_commit_ram(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc)
 {
 	struct eblob_ram_control ctl;
+	struct eblob_ram_meta meta;
 	int err;
 
 	/* Do not cache keys that are on disk */
@@ -1429,7 +1726,10 @@ static int eblob_commit_ram(struct eblob_backend *b, struct eblob_key *key, stru
 		return 0;
 
 	eblob_wc_to_rctl(wc, &ctl);
-	err = eblob_cache_insert(b, key, &ctl);
+	meta.flags = wc->flags & ~BLOB_DISK_CTL_NOSYNC;
+	meta.disk_size = wc->total_size;
+
+	err = eblob_cache_insert(b, key, &ctl, &meta);
 	if (err) {
 		eblob_log(b->cfg.log, EBLOB_LOG_ERROR,
 				"blob: %s: %s: eblob_cache_insert: fd: %d: FAILED: %d.\n",
@@ -1597,6 +1897,63 @@ int eblob_splice_data(int fd_in, uint64_t off_in, int fd_out, uint64_t off_out,
 }
 #endif
 
+/**
+ * eblob_copy_from_fd() - moves @len bytes from @fd_in to @fd_out at @off_out
+ * without passing them through userspace.
+ * @fd_in is either a pipe, which is read from its current position, or
+ * a file, which is read at *@off_in. *@off_in is advanced past copied data.
+ */
+static int eblob_copy_from_fd(int fd_in, int pipe_in, uint64_t *off_in,
+		int fd_out, uint64_t off_out, uint64_t len)
+{
+	ssize_t bytes;
+	int err;
+
+#ifdef __linux__
+	if (pipe_in) {
+		while (len > 0) {
+			bytes = splice(fd_in, NULL, fd_out, (loff_t *)&off_out, len, SPLICE_F_MOVE);
+			if (bytes == -1) {
+				if (errno == EINTR)
+					continue;
+				return -errno;
+			}
+			/* Writer closed pipe before all data was sent */
+			if (bytes == 0)
+				return -ESPIPE;
+			len -= bytes;
+		}
+		return 0;
+	}
+#else
+	(void)pipe_in;
+#endif
+
+#ifdef HAVE_COPY_FILE_RANGE
+	while (len > 0) {
+		bytes = copy_file_range(fd_in, (loff_t *)off_in, fd_out, (loff_t *)&off_out, len, 0);
+		if (bytes == -1) {
+			if (errno == EINTR)
+				continue;
+			/* Cross-device copy or file system without copy_file_range() */
+			if (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL)
+				break;
+			return -errno;
+		}
+		if (bytes == 0)
+			return -ESPIPE;
+		len -= bytes;
+	}
+	if (len == 0)
+		return 0;
+#endif
+
+	err = eblob_splice_data(fd_in, *off_in, fd_out, off_out, len);
+	if (err == 0)
+		*off_in += len;
+	return err;
+}
+
 /**
  * eblob_write_control_cleanup() - cleanups @wc that is returned by
  *  eblob_fill_write_control_from_ram() on success.
@@ -1615,9 +1972,14 @@ static void eblob_write_control_cleanup(struct eblob_write_control *wc) {
  * in cache and fills write control with them.
  * @for_write:		specifies if this request is intended for future write
  *
+ * Returns -EAGAIN if base was invalidated by data-sort between lookup and
+ * hold, so caller should relookup the key.
+ *
  * NB! If this function succeeded, then @wc must be released using
  *  eblob_write_control_cleanup().
- *  This function should only be called when @b->lock is locked by caller thread.
+ *  Writers should call this function with @b->lock locked, readers may call
+ *  it without it, but then they must recheck @b->defrag_generation after it
+ *  (see _eblob_read_ll()).
  */
 static int eblob_fill_write_control_from_ram(struct eblob_backend *b, struct eblob_key *key,
 		struct eblob_write_control *wc, int for_write, struct eblob_ram_control *old)
@@ -1625,12 +1987,13 @@ static int eblob_fill_write_control_from_ram(struct eblob_backend *b, struct ebl
 	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.lookup", b->cfg.stat_id));
 
 	struct eblob_ram_control ctl;
+	struct eblob_ram_meta meta;
 	struct eblob_disk_control dc, data_dc;
 	uint64_t orig_offset = wc->offset;
 	uint64_t calculated_size;
 	int err;
 
-	err = eblob_cache_lookup(b, key, &ctl, &wc->on_disk);
+	err = eblob_cache_lookup(b, key, &ctl, &meta, &wc->on_disk);
 	if (err) {
 		int level = EBLOB_LOG_DEBUG;
 		if (err != -ENOENT)
@@ -1648,9 +2011,35 @@ static int eblob_fill_write_control_from_ram(struct eblob_backend *b, struct ebl
 		wc->offset = orig_offset + ctl.size;
 	}
 
+	/*
+	 * Hold bctl before taking its fds - otherwise data-sort can close them
+	 * right under our feet.
+	 */
+	eblob_bctl_hold(ctl.bctl);
+	if (ctl.bctl->index_ctl.fd < 0 || ctl.bctl->data_ctl.fd < 0) {
+		eblob_bctl_release(ctl.bctl);
+		err = -EAGAIN;
+		goto err_out_exit;
+	}
+
 	eblob_rctl_to_wc(&ctl, wc);
 
-	eblob_bctl_hold(wc->bctl);
+	/*
+	 * Readers trust metadata from cache if there is one, index and data
+	 * headers are cross-checked by inspect thread. Writers always read
+	 * headers since they are going to modify the record.
+	 */
+	if (!for_write && meta.disk_size != 0) {
+		memset(&dc, 0, sizeof(dc));
+		dc.flags = meta.flags;
+		dc.data_size = ctl.size;
+		dc.disk_size = meta.disk_size;
+		eblob_dc_to_wc(&dc, wc);
+
+		eblob_stat_inc(b->stat, EBLOB_GST_CACHED_META_READS);
+		eblob_dump_wc(b, key, wc, "eblob_fill_write_control_from_ram: meta", 0);
+		return 0;
+	}
 
 	err = __eblob_read_ll(wc->index_fd, &dc, sizeof(dc), ctl.index_offset);
 	if (err) {
@@ -1741,46 +2130,201 @@ static int eblob_check_free_space(struct eblob_backend *b, uint64_t size)
 	return 0;
 }
 
-/*!
- * Low-level counterpart for \fn eblob_write_prepare_disk()
+/*
+ * eblob_base_full() - checks whether new records should go to the next base.
+ */
+static int eblob_base_full(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	const uint64_t data_offset = __atomic_load_n(&bctl->data_ctl.offset, __ATOMIC_RELAXED);
+	const uint64_t index_size = __atomic_load_n(&bctl->index_ctl.size, __ATOMIC_RELAXED);
+
+	return (data_offset >= b->cfg.blob_size) || bctl->index_ctl.sorted ||
+		(index_size / sizeof(struct eblob_disk_control) >= b->cfg.records_in_blob);
+}
+
+/*
+ * eblob_base_rollover() - adds new base to @slot if @bctl is still active there.
+ * Time since @start, including wait for the lock, is accounted as rollover
+ * latency.
  * NB! Caller should hold "backend" lock.
  */
-static int eblob_write_prepare_disk_ll(struct eblob_backend *b, struct eblob_key *key,
-		struct eblob_write_control *wc, uint64_t prepare_disk_size,
-		enum eblob_copy_flavour copy, uint64_t copy_offset,
-		struct eblob_ram_control *old)
+static int eblob_base_rollover(struct eblob_backend *b, unsigned int slot,
+		struct eblob_base_ctl *bctl, const struct timeval *start)
 {
-	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.write.prepare.disk.ll", b->cfg.stat_id));
+	struct timeval end;
+	int64_t usec;
+	int err;
 
-	struct eblob_base_ctl *ctl = NULL;
-	ssize_t err = 0;
+	/* Someone has already switched to the new base */
+	if (eblob_active_base(b, slot) != bctl)
+		return 0;
 
-	if (list_empty(&b->bases)) {
-		err = eblob_add_new_base(b);
-		if (err)
-			goto err_out_exit;
-	}
+	err = eblob_add_new_base(b, slot);
+	if (err)
+		return err;
 
-	ctl = list_last_entry(&b->bases, struct eblob_base_ctl, base_entry);
-	if ((ctl->data_ctl.offset >= b->cfg.blob_size) || ctl->index_ctl.sorted ||
-			(ctl->index_ctl.size / sizeof(struct eblob_disk_control) >= b->cfg.records_in_blob)) {
-		err = eblob_add_new_base(b);
-		if (err)
-			goto err_out_exit;
+	gettimeofday(&end, NULL);
+	usec = DIFF(*start, end);
+	eblob_stat_inc(b->stat, EBLOB_GST_ROLLOVERS);
+	eblob_stat_add(b->stat, EBLOB_GST_ROLLOVERS_TIME, usec);
+	if (usec > eblob_stat_get(b->stat, EBLOB_GST_ROLLOVER_TIME_MAX))
+		eblob_stat_set(b->stat, EBLOB_GST_ROLLOVER_TIME_MAX, usec);
+	FORMATTED(HANDY_GAUGE_SET, ("eblob.%u.disk.write.rollover.time", b->cfg.stat_id), usec);
 
-		if (!ctl->index_ctl.sorted)
-			datasort_force_sort(b);
+	if (bctl != NULL && !bctl->index_ctl.sorted)
+		datasort_force_sort(b);
 
-		ctl = list_last_entry(&b->bases, struct eblob_base_ctl, base_entry);
-	}
+	return 0;
+}
 
-	if (old != NULL) {
-		/* Check that bctl is still valid */
-		if (old->bctl->index_ctl.fd == -1) {
-			err = -EAGAIN;
-			goto err_out_exit;
-		}
-		if (wc->flags & BLOB_DISK_CTL_APPEND)
+/**
+ * eblob_base_reserve_ll() - reserves @data_size bytes of data and @index_size
+ * bytes of index in the active base @slot and returns held base and offsets
+ * of reserved space.
+ * @aligned:	reserved data starts at offset aligned to EBLOB_DIRECT_IO_ALIGN
+ * @locked:	caller holds @b->lock
+ *
+ * Both cursors are moved under the base lock in the same critical section
+ * that holds the base, so writers do not serialize on @b->lock - it's taken
+ * only to roll over to the new base - and index entries follow their data in
+ * the same order. As before, base may overflow blob_size by one record.
+ *
+ * Active base is held on success: data-sort and iterators wait for holders,
+ * and since the base is re-checked to be active under its lock, they can't
+ * start on it while reservation is in flight.
+ */
+static int eblob_base_reserve_ll(struct eblob_backend *b, unsigned int slot,
+		uint64_t data_size, uint64_t index_size, int aligned, int locked,
+		struct eblob_base_ctl **bctl, uint64_t *data_offset, uint64_t *index_offset)
+{
+	struct eblob_base_ctl *ctl;
+	struct timeval start;
+	int err;
+
+again:
+	ctl = eblob_active_base(b, slot);
+	if (ctl != NULL) {
+		pthread_mutex_lock(&ctl->lock);
+		if (ctl != eblob_active_base(b, slot)) {
+			pthread_mutex_unlock(&ctl->lock);
+			goto again;
+		}
+
+		if (!eblob_base_full(b, ctl)) {
+			ctl->critness++;
+			*data_offset = ctl->data_ctl.offset;
+			if (aligned)
+				*data_offset = ALIGN(*data_offset, (uint64_t)EBLOB_DIRECT_IO_ALIGN);
+			*index_offset = ctl->index_ctl.size;
+			/* Cursors are read without the lock by eblob_base_full() and prealloc */
+			__atomic_store_n(&ctl->data_ctl.offset, *data_offset + data_size, __ATOMIC_RELAXED);
+			__atomic_store_n(&ctl->index_ctl.size, *index_offset + index_size, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&ctl->lock);
+
+			eblob_prealloc_kick(b, ctl, *data_offset + data_size);
+			*bctl = ctl;
+			return 0;
+		}
+		pthread_mutex_unlock(&ctl->lock);
+	}
+
+	gettimeofday(&start, NULL);
+	if (!locked)
+		pthread_mutex_lock(&b->lock);
+	err = eblob_base_rollover(b, slot, ctl, &start);
+	if (!locked)
+		pthread_mutex_unlock(&b->lock);
+	if (err)
+		return err;
+
+	goto again;
+}
+
+/**
+ * eblob_base_reserve() - reserves space for record of @wc->total_size bytes
+ * and one index entry in the active base @key belongs to and fills @wc with them.
+ * @locked:	caller holds @b->lock
+ */
+static int eblob_base_reserve(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_write_control *wc, int locked)
+{
+	struct eblob_base_ctl *ctl;
+	int err;
+
+	/* Holders must not wait for @b->lock - data-sort waits for them under it */
+	if (!locked)
+		eblob_write_control_cleanup(wc);
+
+	err = eblob_base_reserve_ll(b, eblob_active_base_slot(b, key),
+			eblob_reserved_size(wc), sizeof(struct eblob_disk_control),
+			!!(wc->flags & BLOB_DISK_CTL_DIRECT), locked,
+			&ctl, &wc->ctl_data_offset, &wc->ctl_index_offset);
+	if (err)
+		return err;
+
+	wc->data_fd = ctl->data_ctl.fd;
+	wc->index_fd = ctl->index_ctl.fd;
+	wc->index = ctl->index;
+	wc->on_disk = 0;
+
+	eblob_write_control_cleanup(wc);
+	wc->bctl = ctl;
+	return 0;
+}
+
+/*
+ * eblob_base_unreserve() - rolls back reservation made by eblob_base_reserve().
+ *
+ * Cursors are moved back only if nobody has reserved space after us.
+ * Otherwise index entry stays in the middle of the index, so it's marked
+ * removed and keeps its data space.
+ */
+static void eblob_base_unreserve(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_write_control *wc)
+{
+	struct eblob_base_ctl *ctl = wc->bctl;
+	const uint64_t index_end = wc->ctl_index_offset + sizeof(struct eblob_disk_control);
+	const uint64_t data_end = wc->ctl_data_offset + eblob_reserved_size(wc);
+	int err;
+
+	pthread_mutex_lock(&ctl->lock);
+	if (ctl->index_ctl.size == index_end && ctl->data_ctl.offset == data_end) {
+		__atomic_store_n(&ctl->index_ctl.size, wc->ctl_index_offset, __ATOMIC_RELAXED);
+		__atomic_store_n(&ctl->data_ctl.offset, wc->ctl_data_offset, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&ctl->lock);
+		return;
+	}
+	pthread_mutex_unlock(&ctl->lock);
+
+	err = eblob_commit_disk(b, key, wc, 1);
+	if (err)
+		eblob_dump_wc(b, key, wc, "eblob_base_unreserve: ERROR-hole-in-index", err);
+}
+
+/*!
+ * Low-level counterpart for \fn eblob_write_prepare_disk() that reserves
+ * space for the record, the rest is done by eblob_write_prepare_disk_finish().
+ * @prepare_disk_size may be increased for append to non-existent key.
+ *
+ * NB! Caller should hold "backend" lock if @old is set, @old->bctl is held
+ * then so data-sort can't swap it until the old record is copied and removed.
+ * Otherwise caller must not hold the lock.
+ */
+static int eblob_write_prepare_disk_ll(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_write_control *wc, uint64_t *prepare_disk_size,
+		struct eblob_ram_control *old)
+{
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.write.prepare.disk.ll", b->cfg.stat_id));
+
+	ssize_t err = 0;
+
+	if (old != NULL) {
+		/* Check that bctl is still valid */
+		if (old->bctl->index_ctl.fd == -1) {
+			err = -EAGAIN;
+			goto err_out_exit;
+		}
+		if (wc->flags & BLOB_DISK_CTL_APPEND)
 			wc->offset += old->size;
 	} else {
 		if (wc->flags & BLOB_DISK_CTL_APPEND) {
@@ -1794,31 +2338,14 @@ static int eblob_write_prepare_disk_ll(struct eblob_backend *b, struct eblob_key
 			 * strong indication that we need to preallocate more
 			 * space.
 			 */
-			prepare_disk_size += wc->size * 4;
+			*prepare_disk_size += wc->size * 4;
 		}
 	}
 
-	assert(datasort_base_is_sorted(ctl) != 1);
-
-	wc->data_fd = ctl->data_ctl.fd;
-	wc->index_fd = ctl->index_ctl.fd;
-
-	wc->index = ctl->index;
-	wc->on_disk = 0;
-
-	wc->ctl_index_offset = ctl->index_ctl.size;
-	wc->ctl_data_offset = ctl->data_ctl.offset;
-
-	wc->data_offset = wc->ctl_data_offset + sizeof(struct eblob_disk_control) + wc->offset;
 	wc->total_data_size = wc->offset + wc->size;
 
-	if (wc->bctl)
-		eblob_bctl_release(wc->bctl);
-	eblob_bctl_hold(ctl);
-	wc->bctl = ctl;
-
-	if (wc->total_data_size < prepare_disk_size)
-		wc->total_size = eblob_calculate_size(b, key, 0, prepare_disk_size);
+	if (wc->total_data_size < *prepare_disk_size)
+		wc->total_size = eblob_calculate_size(b, key, 0, *prepare_disk_size);
 	else
 		wc->total_size = eblob_calculate_size(b, key, 0, wc->total_data_size);
 
@@ -1830,8 +2357,72 @@ static int eblob_write_prepare_disk_ll(struct eblob_backend *b, struct eblob_key
 	if (wc->flags & BLOB_DISK_CTL_APPEND)
 		wc->total_size *= 2;
 
-	ctl->data_ctl.offset += wc->total_size;
-	ctl->index_ctl.size += sizeof(struct eblob_disk_control);
+	if (eblob_direct_record(b, EBLOB_MAX(wc->total_data_size, *prepare_disk_size)))
+		wc->flags |= BLOB_DISK_CTL_DIRECT;
+	else
+		wc->flags &= ~BLOB_DISK_CTL_DIRECT;
+
+	err = eblob_base_reserve(b, key, wc, old != NULL);
+	if (err)
+		goto err_out_exit;
+
+	assert(datasort_base_is_sorted(wc->bctl) != 1);
+
+	wc->data_offset = wc->ctl_data_offset + sizeof(struct eblob_disk_control) + wc->offset;
+
+	if (old != NULL)
+		eblob_bctl_hold(old->bctl);
+
+	eblob_dump_wc(b, key, wc, "eblob_write_prepare_disk_ll: complete", 0);
+
+	return 0;
+
+err_out_exit:
+	eblob_dump_wc(b, key, wc, "eblob_write_prepare_disk_ll: error", err);
+	return err;
+}
+
+/**
+ * eblob_extend_record() - allocates space of record reserved at @offset of
+ * data file @fd of @ctl, so that it's not outside of the file.
+ *
+ * If the record is inside of extent preallocated in background only file size
+ * has to be extended, writing last byte of the record does it and never
+ * shrinks the file.
+ */
+static int eblob_extend_record(struct eblob_backend *b, struct eblob_base_ctl *ctl,
+		int fd, uint64_t offset, uint64_t size)
+{
+	static const char zero = 0;
+	int err;
+
+	if (eblob_prealloc_covered(ctl, offset + size))
+		return __eblob_write_ll(fd, &zero, 1, offset + size - 1);
+
+	err = eblob_preallocate(fd, offset, size);
+	if (b->cfg.prealloc_size)
+		eblob_stat_inc(b->stat, EBLOB_GST_PREALLOC_FALLBACKS);
+	return err;
+}
+
+/**
+ * eblob_write_prepare_disk_finish() - commits reserved record and moves @old
+ * record to it.
+ *
+ * Runs without "backend" lock, so that copy of big record, its removal and
+ * syncs do not stall other writers. Releases @old->bctl held by
+ * eblob_write_prepare_disk_ll().
+ */
+static int eblob_write_prepare_disk_finish(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_write_control *wc, uint64_t prepare_disk_size,
+		enum eblob_copy_flavour copy, uint64_t copy_offset,
+		struct eblob_ram_control *old)
+{
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.write.prepare.disk.finish", b->cfg.stat_id));
+
+	struct eblob_base_ctl *ctl = wc->bctl;
+	struct eblob_ram_meta old_meta = { 0 };
+	ssize_t err = 0;
 
 	/*
 	 * We are doing early index update to prevent situations when system
@@ -1859,10 +2450,10 @@ static int eblob_write_prepare_disk_ll(struct eblob_backend *b, struct eblob_key
 		 * or delayed eblob can be restarted and startup iterator will consider the entry broken
 		 * because offset + size may be outside of blob. So extend blob manually.
 		 */
-		err = eblob_preallocate(wc->data_fd, wc->ctl_data_offset, wc->total_size);
+		err = eblob_extend_record(b, ctl, wc->data_fd, wc->ctl_data_offset, eblob_reserved_size(wc));
 		eblob_log(b->cfg.log, err == 0 ? EBLOB_LOG_DEBUG : EBLOB_LOG_ERROR,
 		          "blob i%d: %s: eblob_preallocate: fd: %d, size: %" PRIu64 ", err: %zu\n",
-		          wc->index, eblob_dump_id(key->id), wc->data_fd, wc->ctl_data_offset + wc->total_size, err);
+		          wc->index, eblob_dump_id(key->id), wc->data_fd, wc->ctl_data_offset + eblob_reserved_size(wc), err);
 		if (err != 0)
 			goto err_out_rollback;
 	}
@@ -1876,7 +2467,9 @@ static int eblob_write_prepare_disk_ll(struct eblob_backend *b, struct eblob_key
 	 */
 	if (old != NULL && copy == EBLOB_COPY_RECORD) {
 		struct eblob_disk_control old_dc;
+		struct timeval start, end;
 		uint64_t off_in = old->data_offset + sizeof(struct eblob_disk_control);
+		const uint64_t off_out_end = wc->ctl_data_offset + wc->total_size;
 		uint64_t off_out = wc->ctl_data_offset + sizeof(struct eblob_disk_control);
 		uint64_t size;
 
@@ -1917,10 +2510,31 @@ static int eblob_write_prepare_disk_ll(struct eblob_backend *b, struct eblob_key
 		eblob_convert_disk_control(&old_dc);
 		size = old_dc.disk_size - sizeof(struct eblob_disk_control);
 
+		/* Data header is the same as index one, removal does not need to read it again */
+		old_meta.flags = old_dc.flags;
+		old_meta.disk_size = old_dc.disk_size;
+
+		/*
+		 * New record may be smaller than the old one. Since copy runs
+		 * without b->lock, next record can already be written right
+		 * after ours, so never copy past reserved space.
+		 */
+		if (off_out >= off_out_end)
+			size = 0;
+		else if (size > off_out_end - off_out)
+			size = off_out_end - off_out;
+
+		/*
+		 * Copy is done without b->lock, but old base is held while we
+		 * copy, so data-sort of it waits for us - account for that time.
+		 */
+		gettimeofday(&start, NULL);
 		if (wc->data_fd != old->bctl->data_ctl.fd)
 			err = eblob_splice_data(old->bctl->data_ctl.fd, off_in, wc->data_fd, off_out, size);
 		else
 			err = eblob_copy_data(old->bctl->data_ctl.fd, off_in, wc->data_fd, off_out, size);
+		gettimeofday(&end, NULL);
+		eblob_stat_add(b->stat, EBLOB_GST_READ_COPY_UPDATE_TIME, DIFF(start, end));
 
 		FORMATTED(HANDY_GAUGE_SET, ("eblob.%u.disk.write.move.size", b->cfg.stat_id), size);
 
@@ -1937,7 +2551,7 @@ static int eblob_write_prepare_disk_ll(struct eblob_backend *b, struct eblob_key
 	}
 
 	if (old != NULL) {
-		err = eblob_mark_entry_removed_purge(b, key, old);
+		err = eblob_mark_entry_removed_purge(b, key, old, &old_meta, wc->flags);
 		if (err != 0) {
 			eblob_log(b->cfg.log, EBLOB_LOG_ERROR,
 					"%s: %s: eblob_mark_entry_removed_purge: %zd\n",
@@ -1969,15 +2583,18 @@ static int eblob_write_prepare_disk_ll(struct eblob_backend *b, struct eblob_key
 		               wc->total_size + sizeof(struct eblob_disk_control));
 	}
 
-	eblob_dump_wc(b, key, wc, "eblob_write_prepare_disk_ll: complete", 0);
+	if (old != NULL)
+		eblob_bctl_release(old->bctl);
+	eblob_dump_wc(b, key, wc, "eblob_write_prepare_disk_finish: complete", 0);
 
 	return 0;
 
 err_out_rollback:
-	ctl->data_ctl.offset -= wc->total_size;
-	ctl->index_ctl.size -= sizeof(struct eblob_disk_control);
+	eblob_base_unreserve(b, key, wc);
 err_out_exit:
-	eblob_dump_wc(b, key, wc, "eblob_write_prepare_disk_ll: error", err);
+	if (old != NULL)
+		eblob_bctl_release(old->bctl);
+	eblob_dump_wc(b, key, wc, "eblob_write_prepare_disk_finish: error", err);
 	return err;
 }
 
@@ -1996,26 +2613,36 @@ static int eblob_write_prepare_disk(struct eblob_backend *b, struct eblob_key *k
 	ssize_t err = 0;
 	uint64_t size;
 	struct eblob_ram_control upd_old;
+	int locked = 0;
 
 	eblob_log(b->cfg.log, EBLOB_LOG_NOTICE,
 			"blob: %s: eblob_write_prepare_disk: start: "
 			"size: %" PRIu64 ", offset: %" PRIu64 ", prepare: %" PRIu64 "\n",
 			eblob_dump_id(key->id), wc->size, wc->offset, prepare_disk_size);
 
-	pthread_mutex_lock(&b->lock);
-
-	if (defrag_generation != b->defrag_generation) {
-		int disk;
-		err = eblob_cache_lookup(b, key, &upd_old, &disk);
-		switch (err) {
-		case -ENOENT:
-			old = NULL;
-			break;
-		case 0:
-			old = &upd_old;
-			break;
-		default:
-			goto err_out_exit;
+	/*
+	 * New keys are written without "backend" lock, overwrites need it only
+	 * to pin the old record against data-sort.
+	 */
+	if (old != NULL) {
+		pthread_mutex_lock(&b->lock);
+		locked = 1;
+
+		if (defrag_generation != eblob_defrag_generation(b)) {
+			int disk;
+			err = eblob_cache_lookup(b, key, &upd_old, NULL, &disk);
+			switch (err) {
+			case -ENOENT:
+				old = NULL;
+				locked = 0;
+				pthread_mutex_unlock(&b->lock);
+				break;
+			case 0:
+				old = &upd_old;
+				break;
+			default:
+				goto err_out_exit;
+			}
 		}
 	}
 
@@ -2024,11 +2651,19 @@ static int eblob_write_prepare_disk(struct eblob_backend *b, struct eblob_key *k
 	if (err)
 		goto err_out_exit;
 
-	err = eblob_write_prepare_disk_ll(b, key, wc, prepare_disk_size,
+	err = eblob_write_prepare_disk_ll(b, key, wc, &prepare_disk_size, old);
+	if (locked)
+		pthread_mutex_unlock(&b->lock);
+	locked = 0;
+	if (err)
+		goto err_out_exit;
+
+	err = eblob_write_prepare_disk_finish(b, key, wc, prepare_disk_size,
 			copy, copy_offset, old);
 
 err_out_exit:
-	pthread_mutex_unlock(&b->lock);
+	if (locked)
+		pthread_mutex_unlock(&b->lock);
 	eblob_dump_wc(b, key, wc, "eblob_write_prepare_disk", err);
 	return err;
 }
@@ -2055,12 +2690,17 @@ int eblob_write_prepare(struct eblob_backend *b, struct eblob_key *key,
 		goto err_out_exit;
 	}
 
+	/* Buffered record has to be on disk to be overwritten or reused */
+	err = eblob_wbuf_flush_key(b, key);
+	if (err)
+		goto err_out_exit;
+
 	/*
 	 * For eblob_write_prepare() this can fail with -E2BIG if we try to overwrite
 	 * record without footer by record with footer.
 	 */
 	pthread_mutex_lock(&b->lock);
-	defrag_generation = b->defrag_generation;
+	defrag_generation = eblob_defrag_generation(b);
 
 	err = eblob_fill_write_control_from_ram(b, key, &wc, 1, &old);
 	pthread_mutex_unlock(&b->lock);
@@ -2083,7 +2723,7 @@ int eblob_write_prepare(struct eblob_backend *b, struct eblob_key *key,
 		 * but it also allocates new space.
 		 */
 		new_flags = eblob_validate_ctl_flags(b, flags);
-		new_flags |= BLOB_DISK_CTL_UNCOMMITTED;
+		new_flags |= BLOB_DISK_CTL_UNCOMMITTED | (wc.flags & BLOB_DISK_CTL_DIRECT);
 
 		if (wc.flags != new_flags) {
 			if (!(wc.flags & BLOB_DISK_CTL_UNCOMMITTED)) {
@@ -2103,6 +2743,10 @@ int eblob_write_prepare(struct eblob_backend *b, struct eblob_key *key,
 			if (err)
 				goto err_out_cleanup_wc;
 
+			err = eblob_sync_record(b, wc.data_fd, wc.index_fd, wc.flags);
+			if (err)
+				goto err_out_cleanup_wc;
+
 			err = eblob_commit_ram(b, key, &wc);
 			if (err)
 				goto err_out_cleanup_wc;
@@ -2118,6 +2762,10 @@ int eblob_write_prepare(struct eblob_backend *b, struct eblob_key *key,
 		if (err)
 			goto err_out_cleanup_wc;
 
+		err = eblob_sync_record(b, wc.data_fd, wc.index_fd, wc.flags);
+		if (err)
+			goto err_out_cleanup_wc;
+
 		err = eblob_commit_ram(b, key, &wc);
 		if (err)
 			goto err_out_cleanup_wc;
@@ -2141,26 +2789,134 @@ int eblob_hash(struct eblob_backend *b, void *dst,
 	return 0;
 }
 
+/**
+ * eblob_writev_commit_disk() - writes @iov together with header and footer of
+ * the record and updates on-disk index.
+ *
+ * Header, data and footer are written by single pwritev(2) where they are
+ * adjacent in data file. If some chunk of data is not entirely covered by
+ * @iov, its checksum can only be computed after data is on disk, so footer is
+ * written separately.
+ */
+static int eblob_writev_commit_disk(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_write_control *wc, const struct eblob_iovec *iov, uint16_t iovcnt)
+{
+	struct eblob_iovec seg[EBLOB_WRITEV_SEGS_MAX];
+	struct eblob_iovec footer;
+	struct eblob_disk_control dc;
+	unsigned int num = iovcnt + 1, syscalls = 0;
+	int err, footer_ready;
+
+	err = eblob_writev_segments(key, wc, iov, iovcnt, seg + 1);
+	if (err) {
+		eblob_dump_wc(b, key, wc, "eblob_writev_segments: ERROR", err);
+		goto err_out_exit;
+	}
+
+	err = eblob_fill_footer(b, key, wc, iov, iovcnt, &footer);
+	if (err && err != -EAGAIN) {
+		eblob_dump_wc(b, key, wc, "eblob_fill_footer: ERROR", err);
+		goto err_out_exit;
+	}
+	footer_ready = (err == 0);
+	if (footer_ready && footer.size)
+		seg[num++] = footer;
+
+	wc->flags &= ~BLOB_DISK_CTL_REMOVE;
+	eblob_wc_to_dc(key, wc, &dc);
+
+	seg[0].base = &dc;
+	seg[0].size = sizeof(dc);
+	seg[0].offset = wc->ctl_data_offset;
+
+	err = -EAGAIN;
+	if (footer_ready && eblob_direct_io(b, wc)) {
+		err = eblob_writev_direct(wc, seg, num, iovcnt);
+		if (err == 0) {
+			eblob_stat_inc(b->stat, EBLOB_GST_DIRECT_WRITES);
+			syscalls = 1;
+		}
+	}
+	if (err == -EAGAIN) {
+		err = __eblob_writev_ll(wc->data_fd, seg, num, &syscalls);
+		/*
+		 * O_DIRECT reads of a record cover its padding, so the file must
+		 * reach the padding's end even if nothing is written there.
+		 */
+		if (!err && (wc->flags & BLOB_DISK_CTL_DIRECT) &&
+				seg[num - 1].offset + seg[num - 1].size < wc->ctl_data_offset + eblob_reserved_size(wc))
+			err = eblob_extend_record(b, wc->bctl, wc->data_fd, wc->ctl_data_offset,
+					eblob_reserved_size(wc));
+	}
+	eblob_stat_add(b->stat, EBLOB_GST_WRITE_SYSCALLS, syscalls);
+	if (err) {
+		eblob_dump_wc(b, key, wc, "eblob_writev_commit_disk: ERROR-write-data", err);
+		goto err_out_free;
+	}
+
+	if (!footer_ready) {
+		err = eblob_commit_footer(b, key, wc, iov, iovcnt);
+		if (err) {
+			eblob_dump_wc(b, key, wc, "eblob_commit_footer: ERROR", err);
+			goto err_out_free;
+		}
+	}
+
+	err = __eblob_write_ll(wc->index_fd, &dc, sizeof(dc), wc->ctl_index_offset);
+	eblob_stat_inc(b->stat, EBLOB_GST_WRITE_SYSCALLS);
+	if (err) {
+		eblob_dump_wc(b, key, wc, "eblob_writev_commit_disk: ERROR-write-index", err);
+		goto err_out_free;
+	}
+
+	eblob_dump_wc(b, key, wc, "eblob_writev_commit_disk", err);
+
+err_out_free:
+	free(footer.base);
+err_out_exit:
+	return err;
+}
+
 /**
  * eblob_write_commit_ll() - commit phase - writes to disk, updates on-disk2
  * index and puts entry to hash.
+ * @iov:	data to be written to the record together with its header and
+ *		footer or NULL if data is already on disk
+ * @fs:		checksums of data already on disk or NULL if they should be
+ *		computed from disk
  */
 static int eblob_write_commit_ll(struct eblob_backend *b, struct eblob_key *key,
-		struct eblob_write_control *wc)
+		struct eblob_write_control *wc, const struct eblob_iovec *iov, uint16_t iovcnt,
+		struct eblob_footer_stream *fs)
 {
 	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.write.commit", b->cfg.stat_id));
 
 	int err;
 
-	err = eblob_commit_footer(b, key, wc);
-	if (err) {
-		eblob_dump_wc(b, key, wc, "eblob_commit_footer: ERROR", err);
-		goto err_out_exit;
+	if (iov != NULL) {
+		err = eblob_writev_commit_disk(b, key, wc, iov, iovcnt);
+		if (err)
+			goto err_out_exit;
+	} else {
+		if (fs != NULL)
+			err = eblob_commit_footer_stream(b, key, wc, fs);
+		else
+			err = eblob_commit_footer(b, key, wc, NULL, 0);
+		if (err) {
+			eblob_dump_wc(b, key, wc, "eblob_commit_footer: ERROR", err);
+			goto err_out_exit;
+		}
+
+		err = eblob_commit_disk(b, key, wc, 0);
+		if (err)
+			goto err_out_exit;
 	}
 
-	err = eblob_commit_disk(b, key, wc, 0);
-	if (err)
+	err = eblob_sync_record(b, wc->data_fd, wc->index_fd, wc->flags);
+	if (err) {
+		eblob_dump_wc(b, key, wc, "eblob_sync_record: ERROR", err);
 		goto err_out_exit;
+	}
 
 	err = eblob_commit_ram(b, key, wc);
 	if (err < 0)
@@ -2174,7 +2930,9 @@ err_out_exit:
 static int eblob_write_commit_prepare(struct eblob_backend *b, struct eblob_key *key, uint64_t size,
 				      uint64_t flags, struct eblob_write_control *wc)
 {
-	int err;
+	struct eblob_ram_control rctl;
+	uint64_t direct;
+	int err, copy = 0;
 
 	pthread_mutex_lock(&b->lock);
 	err = eblob_fill_write_control_from_ram(b, key, wc, 1, NULL);
@@ -2195,37 +2953,45 @@ static int eblob_write_commit_prepare(struct eblob_backend *b, struct eblob_key
 		goto err_out_cleanup_wc;
 	}
 
+	direct = wc->flags & BLOB_DISK_CTL_DIRECT;
 	if (size != ~0ULL)
 		wc->size = wc->total_data_size = size;
 	if (flags != ~0ULL)
 		wc->flags = flags;
 
-	wc->flags = eblob_validate_ctl_flags(b, wc->flags) | BLOB_DISK_CTL_UNCOMMITTED;
+	wc->flags = eblob_validate_ctl_flags(b, wc->flags) | BLOB_DISK_CTL_UNCOMMITTED | direct;
 
 	/*
 	 * We can only overwrite keys inplace if data-sort is not processing
 	 * this base (so binlog for it is not enabled)
 	 */
 	if (eblob_binlog_enabled(&wc->bctl->binlog)) {
-		struct eblob_ram_control rctl;
-
-		err = eblob_cache_lookup(b, key, &rctl, NULL);
+		err = eblob_cache_lookup(b, key, &rctl, NULL, NULL);
 		if (err != 0)
 			goto err_out_cleanup_wc;
 
-		err = eblob_write_prepare_disk_ll(b, key, wc, size,
-				EBLOB_COPY_RECORD, 0, &rctl);
+		err = eblob_write_prepare_disk_ll(b, key, wc, &size, &rctl);
 		if (err != 0)
 			goto err_out_cleanup_wc;
+		copy = 1;
 	}
 
 	pthread_mutex_unlock(&b->lock);
 
+	if (copy) {
+		err = eblob_write_prepare_disk_finish(b, key, wc, size,
+				EBLOB_COPY_RECORD, 0, &rctl);
+		if (err != 0) {
+			eblob_write_control_cleanup(wc);
+			return err;
+		}
+	}
+
 	/*
 	 * We are committing the record,
 	 * so `BLOB_DISK_CTL_UNCOMMITTED` should be removed from record's flags.
-	 * This flag is removed after a possible call of `eblob_write_prepare_disk_ll`
-	 * because `eblob_write_prepare_disk_ll` copies data from locked blob to open one
+	 * This flag is removed after a possible call of `eblob_write_prepare_disk_finish`
+	 * because `eblob_write_prepare_disk_finish` copies data from locked blob to open one
 	 * and it should be copied with original flags.
 	 */
 	wc->flags &= ~BLOB_DISK_CTL_UNCOMMITTED;
@@ -2239,12 +3005,12 @@ err_out_unlock:
 	return err;
 }
 
-/*!
- * Commits record:
- *	Writes footer, index and data file indexes and updates data in ram.
+/*
+ * eblob_write_commit_footer() - commits record with footer computed from @fs
+ * or read from disk if @fs is NULL.
  */
-int eblob_write_commit(struct eblob_backend *b, struct eblob_key *key,
-		uint64_t size, uint64_t flags)
+static int eblob_write_commit_footer(struct eblob_backend *b, struct eblob_key *key,
+		uint64_t size, uint64_t flags, struct eblob_footer_stream *fs)
 {
 	struct eblob_write_control wc = { .offset = 0, };
 	int err;
@@ -2263,7 +3029,7 @@ int eblob_write_commit(struct eblob_backend *b, struct eblob_key *key,
 	if (err != 0)
 		goto err_out_exit;
 
-	err = eblob_write_commit_ll(b, key, &wc);
+	err = eblob_write_commit_ll(b, key, &wc, NULL, 0, fs);
 	if (err != 0)
 		goto err_out_cleanup_wc;
 
@@ -2282,596 +3048,2959 @@ err_out_exit:
 	return err;
 }
 
-static int eblob_try_overwritev(struct eblob_backend *b, struct eblob_key *key,
-		const struct eblob_iovec *iov, uint16_t iovcnt, struct eblob_write_control *wc, struct eblob_ram_control *old, size_t *defrag_generation)
+/*!
+ * Commits record:
+ *	Writes footer, index and data file indexes and updates data in ram.
+ */
+int eblob_write_commit(struct eblob_backend *b, struct eblob_key *key,
+		uint64_t size, uint64_t flags)
 {
-	ssize_t err;
-	uint64_t flags = wc->flags;
-	const size_t size = wc->size;
+	return eblob_write_commit_footer(b, key, size, flags, NULL);
+}
 
-	pthread_mutex_lock(&b->lock);
-	*defrag_generation = b->defrag_generation;
+/*
+ * Streaming writer: record is prepared for the whole size, data is written
+ * with plain writes one after another and hashed on the way, so commit only
+ * writes footer.
+ */
+struct eblob_stream {
+	struct eblob_backend		*b;
+	struct eblob_key		key;
+	uint64_t			flags;
+	/* Size the record is prepared for */
+	uint64_t			size;
+	/* Size of data appended so far */
+	uint64_t			offset;
+	struct eblob_footer_stream	fs;
+};
 
-	err = eblob_fill_write_control_from_ram(b, key, wc, 1, old);
-	if (err) {
-		pthread_mutex_unlock(&b->lock);
-		goto err_out_exit;
-	}
+/**
+ * eblob_stream_open() - prepares record of @key for @size bytes of data to be
+ * appended by eblob_stream_append().
+ */
+int eblob_stream_open(struct eblob_backend *b, struct eblob_key *key,
+		uint64_t size, uint64_t flags, struct eblob_stream **stream)
+{
+	struct eblob_stream *s;
+	int err;
 
-	/*
+	if (b == NULL || key == NULL || stream == NULL)
+		return -EINVAL;
+
+	s = malloc(sizeof(struct eblob_stream));
+	if (s == NULL) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+
+	s->b = b;
+	s->key = *key;
+	s->flags = flags;
+	s->size = size;
+	s->offset = 0;
+
+	err = eblob_footer_stream_init(&s->fs, size);
+	if (err)
+		goto err_out_free;
+
+	err = eblob_write_prepare(b, key, size, flags);
+	if (err)
+		goto err_out_destroy;
+
+	*stream = s;
+	return 0;
+
+err_out_destroy:
+	eblob_footer_stream_destroy(&s->fs);
+err_out_free:
+	free(s);
+err_out_exit:
+	return err;
+}
+
+/**
+ * eblob_stream_append() - writes @size bytes of @data after previously
+ * appended ones and adds them to checksums.
+ */
+int eblob_stream_append(struct eblob_stream *s, const void *data, uint64_t size)
+{
+	int err;
+
+	if (s == NULL || (data == NULL && size != 0))
+		return -EINVAL;
+	if (size > s->size - s->offset)
+		return -E2BIG;
+	if (size == 0)
+		return 0;
+
+	err = eblob_plain_write(s->b, &s->key, (void *)data, s->offset, size, s->flags);
+	if (err)
+		return err;
+
+	eblob_footer_stream_update(&s->fs, data, size);
+	s->offset += size;
+	return 0;
+}
+
+/**
+ * eblob_stream_close() - commits record with all appended data and frees
+ * @s. Record is left uncommitted on error.
+ */
+int eblob_stream_close(struct eblob_stream *s)
+{
+	int err;
+
+	if (s == NULL)
+		return -EINVAL;
+
+	err = eblob_write_commit_footer(s->b, &s->key, s->offset, s->flags, &s->fs);
+
+	eblob_footer_stream_destroy(&s->fs);
+	free(s);
+	return err;
+}
+
+/**
+ * eblob_compress_account() - accounts compression of record @zs written to
+ * base @bctl.
+ */
+static void eblob_compress_account(struct eblob_backend *b, struct eblob_base_ctl *bctl,
+		const struct eblob_compress_stat *zs)
+{
+	eblob_stat_inc(bctl->stat, EBLOB_LST_RECORDS_COMPRESSED);
+	eblob_stat_add(bctl->stat, EBLOB_LST_COMPRESS_RAW_SIZE, zs->raw_size);
+	eblob_stat_add(bctl->stat, EBLOB_LST_COMPRESS_SIZE, zs->size);
+	eblob_stat_add(bctl->stat, EBLOB_LST_COMPRESS_TIME, zs->usecs);
+
+	eblob_stat_inc(b->stat_summary, EBLOB_LST_RECORDS_COMPRESSED);
+	eblob_stat_add(b->stat_summary, EBLOB_LST_COMPRESS_RAW_SIZE, zs->raw_size);
+	eblob_stat_add(b->stat_summary, EBLOB_LST_COMPRESS_SIZE, zs->size);
+	eblob_stat_add(b->stat_summary, EBLOB_LST_COMPRESS_TIME, zs->usecs);
+}
+
+/**
+ * eblob_read_uncompressed() - reads and uncompresses data of
+ * BLOB_DISK_CTL_COMPRESSED record pointed by @wc, base of the record must be
+ * held. Returned @data should be freed by caller.
+ */
+static int eblob_read_uncompressed(struct eblob_backend *b, struct eblob_write_control *wc,
+		void **data, uint64_t *size)
+{
+	uint64_t usecs = 0;
+	void *packed;
+	int err;
+
+	packed = malloc(wc->total_data_size ? wc->total_data_size : 1);
+	if (packed == NULL)
+		return -ENOMEM;
+
+	if (eblob_direct_io(b, wc))
+		err = eblob_read_direct(wc->bctl, packed, wc->total_data_size, wc->data_offset);
+	else
+		err = __eblob_read_ll(wc->data_fd, packed, wc->total_data_size, wc->data_offset);
+	if (err)
+		goto err_out_free;
+
+	err = eblob_decompress(wc->bctl->dict, packed, wc->total_data_size, data, size, &usecs);
+	if (err) {
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob i%d: %s: eblob_decompress: size: %" PRIu64
+				", offset: %" PRIu64 ": %d\n",
+				wc->index, __func__, wc->total_data_size, wc->data_offset, err);
+		goto err_out_free;
+	}
+
+	eblob_stat_add(wc->bctl->stat, EBLOB_LST_DECOMPRESS_TIME, usecs);
+	eblob_stat_add(b->stat_summary, EBLOB_LST_DECOMPRESS_TIME, usecs);
+
+err_out_free:
+	free(packed);
+	return err;
+}
+
+/**
+ * eblob_compress_merge_writev() - writes @iov over data of compressed record
+ * of @key, that can't be modified in place. Old data is uncompressed, @iov is
+ * applied to it and the result is written as new record, compressed again if
+ * compression is enabled. With BLOB_DISK_CTL_APPEND @iov is appended to
+ * uncompressed data.
+ */
+static int eblob_compress_merge_writev(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags,
+		struct eblob_write_control *wc)
+{
+	struct eblob_iovec_bounds bounds;
+	struct eblob_write_control owc;
+	struct eblob_iovec merged;
+	uint64_t old_size, start = 0, size;
+	void *old;
+	char *data;
+	uint16_t i;
+	int err;
+
+	if (flags & BLOB_DISK_CTL_EXTHDR)
+		return -ENOTSUP;
+
+	memset(&owc, 0, sizeof(struct eblob_write_control));
+	err = eblob_fill_write_control_from_ram(b, key, &owc, 0, NULL);
+	if (err == -ENOENT)
+		return eblob_writev_return(b, key, iov, iovcnt, flags, wc);
+	if (err)
+		return err;
+
+	/* Record has been replaced meanwhile */
+	if (!(owc.flags & BLOB_DISK_CTL_COMPRESSED)) {
+		eblob_write_control_cleanup(&owc);
+		return eblob_writev_return(b, key, iov, iovcnt, flags, wc);
+	}
+
+	err = eblob_verify_checksum(b, key, &owc);
+	if (err == 0)
+		err = eblob_read_uncompressed(b, &owc, &old, &old_size);
+	eblob_write_control_cleanup(&owc);
+	if (err)
+		return err;
+
+	eblob_iovec_get_bounds(&bounds, iov, iovcnt);
+	if (flags & BLOB_DISK_CTL_APPEND)
+		start = old_size;
+	size = start + bounds.max;
+
+	data = realloc(old, size ? size : 1);
+	if (data == NULL) {
+		free(old);
+		return -ENOMEM;
+	}
+
+	if (size > old_size)
+		memset(data + old_size, 0, size - old_size);
+	for (i = 0; i < iovcnt; ++i)
+		memcpy(data + start + iov[i].offset, iov[i].base, iov[i].size);
+
+	merged.base = data;
+	merged.size = size;
+	merged.offset = 0;
+
+	err = eblob_writev_return(b, key, &merged, 1, flags & ~BLOB_DISK_CTL_APPEND, wc);
+	free(data);
+	return err;
+}
+
+/**
+ * eblob_compress_read_record() - reads data of record @dc of base @bctl
+ * located at @data_offset of @fd, uncompressing it if needed. Record is
+ * verified against its checksum first. Returned @data should be freed by
+ * caller.
+ */
+int eblob_compress_read_record(struct eblob_backend *b, struct eblob_base_ctl *bctl,
+		const struct eblob_disk_control *dc, int fd, uint64_t data_offset,
+		void **data, uint64_t *size)
+{
+	struct eblob_write_control wc;
+	int err;
+
+	memset(&wc, 0, sizeof(struct eblob_write_control));
+	wc.bctl = bctl;
+	wc.index = bctl->index;
+	wc.data_fd = fd;
+	wc.ctl_data_offset = data_offset - sizeof(struct eblob_disk_control);
+	wc.data_offset = data_offset;
+	eblob_dc_to_wc(dc, &wc);
+
+	err = eblob_verify_checksum(b, (struct eblob_key *)&dc->key, &wc);
+	if (err)
+		return err;
+
+	if (wc.flags & BLOB_DISK_CTL_COMPRESSED)
+		return eblob_read_uncompressed(b, &wc, data, size);
+
+	*data = malloc(wc.size ? wc.size : 1);
+	if (*data == NULL)
+		return -ENOMEM;
+
+	err = __eblob_read_ll(fd, *data, wc.size, data_offset);
+	if (err) {
+		free(*data);
+		return err;
+	}
+	*size = wc.size;
+	return 0;
+}
+
+/**
+ * eblob_compress_reencode() - compresses record @dc of base @bctl located at
+ * @data_offset of @fd again for data-sort: with @dict if it is not NULL,
+ * otherwise the way new records are. On success @dc is updated to describe
+ * new record placed at @dc->position, its data that follows the header and
+ * footer are returned in @data and @footer, which bases should be freed by
+ * caller, and compression
+ * is described by @zs if record stays compressed.
+ *
+ * Returns -EAGAIN if record should be copied as is.
+ */
+int eblob_compress_reencode(struct eblob_backend *b, struct eblob_base_ctl *bctl,
+		const struct eblob_compress_dict *dict, struct eblob_disk_control *dc,
+		int fd, uint64_t data_offset, struct eblob_iovec *data, struct eblob_iovec *footer,
+		struct eblob_compress_stat *zs)
+{
+	const int algorithm = dict ? EBLOB_COMPRESS_ALGORITHM_ZSTD : eblob_compress_algorithm(b);
+	struct eblob_write_control wc;
+	void *raw, *packed;
+	uint64_t raw_size, packed_size;
+	int err;
+
+	if ((dc->flags & (BLOB_DISK_CTL_REMOVE | BLOB_DISK_CTL_UNCOMMITTED | BLOB_DISK_CTL_EXTHDR |
+			BLOB_DISK_CTL_CHAINED | BLOB_DISK_CTL_CORRUPTED | BLOB_DISK_CTL_NOCSUM)) ||
+			!(dc->flags & BLOB_DISK_CTL_CHUNKED_CSUM))
+		return -EAGAIN;
+
+	/* Only records compressed with dictionary of old base have to be changed without new one */
+	if (dc->flags & BLOB_DISK_CTL_COMPRESSED) {
+		struct eblob_compress_header hdr;
+
+		if (dict == NULL) {
+			if (dc->data_size < sizeof(struct eblob_compress_header))
+				return -EAGAIN;
+			err = __eblob_read_ll(fd, &hdr, sizeof(struct eblob_compress_header), data_offset);
+			if (err)
+				return err;
+			eblob_convert_compress_header(&hdr);
+			if (hdr.dict_id == 0)
+				return -EAGAIN;
+		}
+	} else if (dict == NULL || dc->data_size < b->cfg.compress_threshold) {
+		return -EAGAIN;
+	}
+
+	err = eblob_compress_read_record(b, bctl, dc, fd, data_offset, &raw, &raw_size);
+	if (err)
+		return err == -EILSEQ ? -EAGAIN : err;
+
+	memset(zs, 0, sizeof(struct eblob_compress_stat));
+	memset(&wc, 0, sizeof(struct eblob_write_control));
+	wc.flags = dc->flags & ~BLOB_DISK_CTL_COMPRESSED;
+
+	err = -E2BIG;
+	if (algorithm && raw_size >= b->cfg.compress_threshold)
+		err = eblob_compress(algorithm, dict, raw, raw_size, &packed, &packed_size, &zs->usecs);
+	if (err == 0) {
+		free(raw);
+		data->base = packed;
+		data->size = packed_size;
+		wc.flags |= BLOB_DISK_CTL_COMPRESSED;
+		zs->raw_size = raw_size;
+		zs->size = packed_size;
+	} else if (err == -E2BIG) {
+		data->base = raw;
+		data->size = raw_size;
+	} else {
+		free(raw);
+		return err;
+	}
+	data->offset = 0;
+
+	wc.index = bctl->index;
+	wc.size = wc.total_data_size = data->size;
+	wc.total_size = eblob_calculate_size(b, &dc->key, 0, data->size);
+	wc.ctl_data_offset = dc->position;
+	wc.data_offset = dc->position + sizeof(struct eblob_disk_control);
+
+	err = eblob_fill_footer(b, &dc->key, &wc, data, 1, footer);
+	if (err) {
+		free(data->base);
+		return err;
+	}
+
+	dc->flags = wc.flags;
+	dc->data_size = wc.total_data_size;
+	dc->disk_size = wc.total_size;
+	return 0;
+}
+
+/**
+ * eblob_chain_read_header() - reads chain header of BLOB_DISK_CTL_CHAINED
+ * record pointed by @wc.
+ */
+static int eblob_chain_read_header(const struct eblob_write_control *wc,
+		struct eblob_chain_header *chain)
+{
+	int err;
+
+	if (wc->total_data_size < sizeof(struct eblob_chain_header))
+		return -EINVAL;
+
+	err = __eblob_read_ll(wc->data_fd, chain, sizeof(struct eblob_chain_header),
+			wc->ctl_data_offset + sizeof(struct eblob_disk_control));
+	if (err)
+		return err;
+
+	eblob_convert_chain_header(chain);
+	if (chain->num == 0 || chain->num > EBLOB_CHAIN_EXTENTS_MAX)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int eblob_chain_write_header(int fd, uint64_t offset, const struct eblob_chain_header *chain)
+{
+	struct eblob_chain_header tmp = *chain;
+
+	eblob_convert_chain_header(&tmp);
+	return __eblob_write_ll(fd, &tmp, sizeof(struct eblob_chain_header), offset);
+}
+
+/**
+ * eblob_chain_read() - reads @size bytes at @offset of data of chained record
+ * @wc to @data following extents of @chain.
+ */
+static int eblob_chain_read(const struct eblob_write_control *wc,
+		const struct eblob_chain_header *chain, char *data, uint64_t size, uint64_t offset)
+{
+	const struct eblob_chain_extent *ext;
+	uint64_t len;
+	int err;
+
+	for (ext = chain->ext; ext < chain->ext + chain->num && size != 0; ++ext) {
+		if (offset >= ext->size) {
+			offset -= ext->size;
+			continue;
+		}
+
+		len = ext->size - offset;
+		if (len > size)
+			len = size;
+
+		err = __eblob_read_ll(wc->data_fd, data, len, ext->position + offset);
+		if (err)
+			return err;
+
+		data += len;
+		size -= len;
+		offset = 0;
+	}
+
+	return size != 0 ? -EINVAL : 0;
+}
+
+/**
+ * eblob_chain_copy() - copies data of all extents of @chain from @fd_in to
+ * @off_out of @fd_out.
+ */
+int eblob_chain_copy(int fd_in, const struct eblob_chain_header *chain,
+		int fd_out, uint64_t off_out)
+{
+	const struct eblob_chain_extent *ext;
+	int err;
+
+	for (ext = chain->ext; ext < chain->ext + chain->num; ++ext) {
+		if (ext->size == 0)
+			continue;
+
+		if (fd_in != fd_out)
+			err = eblob_splice_data(fd_in, ext->position, fd_out, off_out, ext->size);
+		else
+			err = eblob_copy_data(fd_in, ext->position, fd_out, off_out, ext->size);
+		if (err)
+			return err;
+
+		off_out += ext->size;
+	}
+
+	return 0;
+}
+
+static int eblob_chain_write_data(int fd, uint64_t offset,
+		const struct eblob_iovec *iov, uint16_t iovcnt)
+{
+	const struct eblob_iovec *tmp;
+	int err;
+
+	for (tmp = iov; tmp < iov + iovcnt; ++tmp) {
+		err = __eblob_write_ll(fd, tmp->base, tmp->size, offset + tmp->offset);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/**
+ * eblob_chain_hash() - adds @size bytes appended to extent @ext, which are
+ * already written to @fd, to its checksums and size. Checksum is chained over
+ * whole blocks, so only the partial last block of old data is hashed again.
+ * Extents of record with BLOB_DISK_CTL_NOCSUM in @flags are not hashed.
+ */
+static int eblob_chain_hash(int fd, struct eblob_chain_extent *ext, uint64_t size, uint64_t flags)
+{
+	char buffer[EBLOB_CSUM_BLOCK_SIZE];
+	const uint64_t tail = ext->size % EBLOB_CSUM_BLOCK_SIZE;
+	uint64_t offset = ext->position + ext->size - tail;
+	uint64_t count = tail + size, len, hash = ext->blocks_csum;
+	int err;
+
+	if (flags & BLOB_DISK_CTL_NOCSUM) {
+		ext->size += size;
+		return 0;
+	}
+
+	ext->csum = hash;
+	while (count != 0) {
+		len = count < EBLOB_CSUM_BLOCK_SIZE ? count : EBLOB_CSUM_BLOCK_SIZE;
+
+		err = __eblob_read_ll(fd, buffer, len, offset);
+		if (err)
+			return err;
+
+		ext->csum = MurmurHash64A(buffer, len, hash);
+		if (len == EBLOB_CSUM_BLOCK_SIZE)
+			hash = ext->csum;
+
+		offset += len;
+		count -= len;
+	}
+
+	ext->blocks_csum = hash;
+	ext->size += size;
+	return 0;
+}
+
+/**
+ * eblob_chain_verify() - checks data of all extents of @chain located in @fd
+ * against their checksums.
+ *
+ * Returns -EILSEQ on mismatch.
+ */
+int eblob_chain_verify(int fd, const struct eblob_chain_header *chain)
+{
+	const struct eblob_chain_extent *ext;
+	struct eblob_chain_extent tmp;
+	int err;
+
+	for (ext = chain->ext; ext < chain->ext + chain->num; ++ext) {
+		memset(&tmp, 0, sizeof(struct eblob_chain_extent));
+		tmp.position = ext->position;
+
+		err = eblob_chain_hash(fd, &tmp, ext->size, 0);
+		if (err)
+			return err;
+
+		if (tmp.csum != ext->csum)
+			return -EILSEQ;
+	}
+
+	return 0;
+}
+
+/**
+ * eblob_chain_verify_checksum() - verifies extents of chained record pointed
+ * by @wc. Concurrent append may update chain header while extents are hashed,
+ * so mismatch is reported only if the header stays the same.
+ */
+static int eblob_chain_verify_checksum(const struct eblob_write_control *wc)
+{
+	static const int max_tries = 3;
+	const uint64_t offset = wc->ctl_data_offset + sizeof(struct eblob_disk_control);
+	struct eblob_chain_header chain, prev;
+	int err, tries = 0;
+
+	for (;;) {
+		err = __eblob_read_ll(wc->data_fd, &chain, sizeof(struct eblob_chain_header), offset);
+		if (err)
+			return err;
+
+		eblob_convert_chain_header(&chain);
+		if (tries != 0 && memcmp(&chain, &prev, sizeof(struct eblob_chain_header)) == 0)
+			return -EILSEQ;
+		if (chain.num == 0 || chain.num > EBLOB_CHAIN_EXTENTS_MAX)
+			return -EINVAL;
+
+		err = eblob_chain_verify(wc->data_fd, &chain);
+		if (err != -EILSEQ || ++tries == max_tries)
+			return err;
+		prev = chain;
+	}
+}
+
+/*
+ * eblob_chain_capacity() - returns space reserved for @size bytes appended to
+ * chained record of @total bytes. Record is doubled, so number of extents
+ * grows logarithmically until reservation is limited by EBLOB_CHAIN_EXTENT_MAX.
+ */
+static uint64_t eblob_chain_capacity(uint64_t total, uint64_t size)
+{
+	const uint64_t capacity = total < EBLOB_CHAIN_EXTENT_MAX ? total : EBLOB_CHAIN_EXTENT_MAX;
+
+	return capacity > size ? capacity : size;
+}
+
+/**
+ * eblob_chain_coalesce() - moves data of @key to the new chained record with
+ * single extent in the active base and appends @size bytes of @iov to it.
+ * @replace:	old data is dropped instead of being moved
+ *
+ * Used when chain can't be extended in place: for append to non-chained
+ * record, when base of the record is not active anymore or its extent list
+ * is full, and by readers that need data to be contiguous. Old record is
+ * removed as on overwrite.
+ */
+static int eblob_chain_coalesce(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t size,
+		uint64_t flags, int replace, struct eblob_write_control *wc)
+{
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.write.chain.coalesce", b->cfg.stat_id));
+
+	struct eblob_chain_header chain, old_chain;
+	struct eblob_disk_control old_dc;
+	struct eblob_ram_control old;
+	struct eblob_ram_meta old_meta;
+	uint64_t old_size = 0, data_offset, need, capacity;
+	int err, disk, have_old = 0;
+
+	memset(wc, 0, sizeof(struct eblob_write_control));
+	memset(&old_chain, 0, sizeof(struct eblob_chain_header));
+	wc->index = -1;
+
+	/* As in eblob_write_prepare_disk() lock pins old record against data-sort */
+	pthread_mutex_lock(&b->lock);
+	err = eblob_cache_lookup(b, key, &old, &old_meta, &disk);
+	if (err == 0) {
+		if (old.bctl->index_ctl.fd < 0 || old.bctl->data_ctl.fd < 0) {
+			err = -EAGAIN;
+			goto err_out_unlock;
+		}
+		eblob_bctl_hold(old.bctl);
+		have_old = 1;
+	} else if (err != -ENOENT) {
+		goto err_out_unlock;
+	}
+
+	if (have_old && !replace) {
+		err = __eblob_read_ll(old.bctl->data_ctl.fd, &old_dc, sizeof(struct eblob_disk_control),
+				old.data_offset);
+		if (err)
+			goto err_out_release;
+		eblob_convert_disk_control(&old_dc);
+
+		if (old_dc.flags & (BLOB_DISK_CTL_EXTHDR | BLOB_DISK_CTL_COMPRESSED)) {
+			err = -ENOTSUP;
+			goto err_out_release;
+		}
+
+		if (old_dc.flags & BLOB_DISK_CTL_CHAINED) {
+			struct eblob_write_control owc = {
+				.data_fd = old.bctl->data_ctl.fd,
+				.ctl_data_offset = old.data_offset,
+				.total_data_size = old_dc.data_size,
+			};
+
+			err = eblob_chain_read_header(&owc, &old_chain);
+			if (err)
+				goto err_out_release;
+			old_size = old_chain.size;
+		} else {
+			old_size = old_dc.data_size;
+		}
+	}
+
+	need = old_size + size;
+	capacity = need + eblob_chain_capacity(need, 0);
+
+	wc->flags = flags | BLOB_DISK_CTL_CHAINED;
+	wc->total_data_size = sizeof(struct eblob_chain_header) + capacity;
+	wc->total_size = sizeof(struct eblob_disk_control) + wc->total_data_size;
+
+	err = eblob_base_reserve(b, key, wc, 1);
+	if (err)
+		goto err_out_release;
+	pthread_mutex_unlock(&b->lock);
+
+	data_offset = wc->ctl_data_offset + sizeof(struct eblob_disk_control)
+		+ sizeof(struct eblob_chain_header);
+
+	err = eblob_extend_record(b, wc->bctl, wc->data_fd, wc->ctl_data_offset, wc->total_size);
+	if (err)
+		goto err_out_rollback;
+
+	if (old_size != 0) {
+		if (old_dc.flags & BLOB_DISK_CTL_CHAINED)
+			err = eblob_chain_copy(old.bctl->data_ctl.fd, &old_chain, wc->data_fd, data_offset);
+		else if (old.bctl->data_ctl.fd != wc->data_fd)
+			err = eblob_splice_data(old.bctl->data_ctl.fd,
+					old.data_offset + sizeof(struct eblob_disk_control),
+					wc->data_fd, data_offset, old_size);
+		else
+			err = eblob_copy_data(old.bctl->data_ctl.fd,
+					old.data_offset + sizeof(struct eblob_disk_control),
+					wc->data_fd, data_offset, old_size);
+		if (err)
+			goto err_out_rollback;
+	}
+
+	err = eblob_chain_write_data(wc->data_fd, data_offset + old_size, iov, iovcnt);
+	if (err)
+		goto err_out_rollback;
+
+	memset(&chain, 0, sizeof(struct eblob_chain_header));
+	chain.size = need;
+	chain.num = 1;
+	chain.ext[0].position = data_offset;
+	chain.ext[0].capacity = capacity;
+
+	err = eblob_chain_hash(wc->data_fd, &chain.ext[0], need, wc->flags);
+	if (err)
+		goto err_out_rollback;
+
+	err = eblob_chain_write_header(wc->data_fd,
+			wc->ctl_data_offset + sizeof(struct eblob_disk_control), &chain);
+	if (err)
+		goto err_out_rollback;
+
+	/* Headers are written after data, so crash never leaves broken chain */
+	err = eblob_commit_disk(b, key, wc, 0);
+	if (err)
+		goto err_out_rollback;
+
+	eblob_stat_inc(wc->bctl->stat, EBLOB_LST_RECORDS_TOTAL);
+	eblob_stat_add(wc->bctl->stat, EBLOB_LST_BASE_SIZE,
+	               wc->total_size + sizeof(struct eblob_disk_control));
+	eblob_stat_inc(b->stat_summary, EBLOB_LST_RECORDS_TOTAL);
+	eblob_stat_add(b->stat_summary, EBLOB_LST_BASE_SIZE,
+	               wc->total_size + sizeof(struct eblob_disk_control));
+
+	if (have_old) {
+		err = eblob_mark_entry_removed_purge(b, key, &old, &old_meta, flags);
+		eblob_bctl_release(old.bctl);
+		have_old = 0;
+		if (err)
+			goto err_out_exit;
+		eblob_stat_inc(b->stat, EBLOB_GST_CHAIN_COALESCES);
+	}
+
+	err = eblob_sync_record(b, wc->data_fd, wc->index_fd, wc->flags);
+	if (err)
+		goto err_out_exit;
+
+	err = eblob_commit_ram(b, key, wc);
+	if (err)
+		goto err_out_exit;
+
+	eblob_dump_wc(b, key, wc, "eblob_chain_coalesce: complete", 0);
+	return 0;
+
+err_out_rollback:
+	eblob_base_unreserve(b, key, wc);
+	if (have_old)
+		eblob_bctl_release(old.bctl);
+	goto err_out_exit;
+
+err_out_release:
+	if (have_old)
+		eblob_bctl_release(old.bctl);
+err_out_unlock:
+	pthread_mutex_unlock(&b->lock);
+err_out_exit:
+	eblob_write_control_cleanup(wc);
+	eblob_dump_wc(b, key, wc, "eblob_chain_coalesce: error", err);
+	return err;
+}
+
+/**
+ * eblob_chain_writev() - writes @iov to BLOB_DISK_CTL_CHAINED record of @key.
+ *
+ * With BLOB_DISK_CTL_APPEND data is written to the free space of the last
+ * extent or to the new extent reserved in the same base, so that only the
+ * appended data is written. Record is coalesced into new one if it was not
+ * chained, its base is not active anymore or its extent list is full.
+ * Without BLOB_DISK_CTL_APPEND record is replaced by the new chain.
+ *
+ * NB! As with other writes concurrent appends to the same key should be
+ * serialized by caller.
+ */
+static int eblob_chain_writev(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags,
+		struct eblob_write_control *wc)
+{
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.write.chain", b->cfg.stat_id));
+
+	struct eblob_iovec_bounds bounds;
+	struct eblob_chain_header chain;
+	struct eblob_chain_extent *ext;
+	struct eblob_write_control ewc;
+	struct eblob_ram_control rctl;
+	struct eblob_base_ctl *bctl;
+	const uint64_t orig_flags = flags;
+	uint64_t size, head_offset, head_flags, record_size;
+	int err, disk;
+
+	/* Data is appended as is, so it must not have holes */
+	eblob_iovec_get_bounds(&bounds, iov, iovcnt);
+	if (bounds.min != 0 || !bounds.contiguous)
+		return -EINVAL;
+	size = bounds.max;
+
+	if (flags & (BLOB_DISK_CTL_EXTHDR | BLOB_DISK_CTL_UNCOMMITTED))
+		return -ENOTSUP;
+
+	/* Extents have no footers, their checksums are kept in chain header */
+	flags = eblob_validate_ctl_flags(b, flags);
+
+	eblob_stat_inc(b->stat, EBLOB_GST_WRITES_NUMBER);
+	eblob_stat_add(b->stat, EBLOB_GST_WRITES_SIZE, size);
+
+	if (!(flags & BLOB_DISK_CTL_APPEND))
+		return eblob_chain_coalesce(b, key, iov, iovcnt, size, flags, 1, wc);
+	flags &= ~BLOB_DISK_CTL_APPEND;
+
+	eblob_stat_inc(b->stat, EBLOB_GST_CHAIN_APPENDS);
+
+	memset(wc, 0, sizeof(struct eblob_write_control));
+	err = eblob_fill_write_control_from_ram(b, key, wc, 0, NULL);
+	if (err == -ENOENT)
+		goto err_out_coalesce;
+	if (err)
+		return err;
+
+	/* Data of compressed record can't be chained, it's rewritten as a whole */
+	if (wc->flags & BLOB_DISK_CTL_COMPRESSED) {
+		eblob_write_control_cleanup(wc);
+		return eblob_compress_merge_writev(b, key, iov, iovcnt,
+				orig_flags & ~BLOB_DISK_CTL_CHAINED, wc);
+	}
+
+	if (!(wc->flags & BLOB_DISK_CTL_CHAINED) || (wc->flags & BLOB_DISK_CTL_UNCOMMITTED)) {
+		eblob_write_control_cleanup(wc);
+		goto err_out_coalesce;
+	}
+
+	err = eblob_chain_read_header(wc, &chain);
+	if (err)
+		goto err_out_cleanup_wc;
+
+	bctl = wc->bctl;
+	head_offset = wc->ctl_data_offset;
+	head_flags = wc->flags;
+	ext = &chain.ext[chain.num - 1];
+
+	/*
+	 * Data-sort copies base before applying binlog, so records can be
+	 * modified in place only if base is not being sorted.
+	 */
+	if (ext->capacity - ext->size >= size && !eblob_binlog_enabled(&bctl->binlog)) {
+		err = eblob_chain_write_data(wc->data_fd, ext->position + ext->size, iov, iovcnt);
+		if (err)
+			goto err_out_cleanup_wc;
+
+		err = eblob_chain_hash(wc->data_fd, ext, size, wc->flags);
+		if (err)
+			goto err_out_cleanup_wc;
+		chain.size += size;
+		err = eblob_chain_write_header(wc->data_fd, head_offset + sizeof(struct eblob_disk_control), &chain);
+		if (err)
+			goto err_out_cleanup_wc;
+
+		err = eblob_sync_record(b, wc->data_fd, wc->index_fd, flags);
+		goto err_out_cleanup_wc;
+	}
+
+	/* Holders must not wait for "backend" lock taken by reservation */
+	eblob_write_control_cleanup(wc);
+
+	/* Extents can only be reserved in the base of the record */
+	if (chain.num == EBLOB_CHAIN_EXTENTS_MAX || !eblob_base_is_active(b, bctl))
+		goto err_out_coalesce;
+
+	memset(&ewc, 0, sizeof(struct eblob_write_control));
+	ewc.index = -1;
+	ewc.flags = flags | BLOB_DISK_CTL_CHAINED;
+	ewc.total_data_size = eblob_chain_capacity(chain.size, size);
+	ewc.total_size = sizeof(struct eblob_disk_control) + ewc.total_data_size;
+
+	err = eblob_base_reserve(b, key, &ewc, 0);
+	if (err)
+		return err;
+
+	/*
+	 * Base is held by reservation now, check that it's still the base of
+	 * the record and the record is still there.
+	 */
+	if (ewc.bctl != bctl
+			|| eblob_cache_lookup(b, key, &rctl, NULL, &disk) != 0
+			|| rctl.bctl != bctl || rctl.data_offset != head_offset) {
+		eblob_base_unreserve(b, key, &ewc);
+		eblob_write_control_cleanup(&ewc);
+		goto err_out_coalesce;
+	}
+
+	err = eblob_extend_record(b, bctl, ewc.data_fd, ewc.ctl_data_offset, ewc.total_size);
+	if (err)
+		goto err_out_rollback;
+
+	ext = &chain.ext[chain.num];
+	memset(ext, 0, sizeof(struct eblob_chain_extent));
+	ext->position = ewc.ctl_data_offset + sizeof(struct eblob_disk_control);
+	ext->capacity = ewc.total_data_size;
+
+	err = eblob_chain_write_data(ewc.data_fd, ext->position, iov, iovcnt);
+	if (err)
+		goto err_out_rollback;
+
+	err = eblob_chain_hash(ewc.data_fd, ext, size, head_flags);
+	if (err)
+		goto err_out_rollback;
+
+	/* Extent is invisible for everything but the chain */
+	err = eblob_commit_disk(b, key, &ewc, 1);
+	if (err)
+		goto err_out_rollback;
+
+	record_size = ewc.total_size + sizeof(struct eblob_disk_control);
+	eblob_stat_inc(bctl->stat, EBLOB_LST_RECORDS_TOTAL);
+	eblob_stat_add(bctl->stat, EBLOB_LST_BASE_SIZE, record_size);
+	eblob_stat_inc(bctl->stat, EBLOB_LST_RECORDS_REMOVED);
+	eblob_stat_add(bctl->stat, EBLOB_LST_REMOVED_SIZE, record_size);
+	eblob_stat_inc(b->stat_summary, EBLOB_LST_RECORDS_TOTAL);
+	eblob_stat_add(b->stat_summary, EBLOB_LST_BASE_SIZE, record_size);
+	eblob_stat_inc(b->stat_summary, EBLOB_LST_RECORDS_REMOVED);
+	eblob_stat_add(b->stat_summary, EBLOB_LST_REMOVED_SIZE, record_size);
+
+	chain.num++;
+	chain.size += size;
+	err = eblob_chain_write_header(ewc.data_fd, head_offset + sizeof(struct eblob_disk_control), &chain);
+	if (err) {
+		eblob_write_control_cleanup(&ewc);
+		goto err_out_exit;
+	}
+
+	eblob_stat_inc(b->stat, EBLOB_GST_CHAIN_EXTENTS);
+
+	err = eblob_sync_record(b, ewc.data_fd, ewc.index_fd, flags);
+	eblob_write_control_cleanup(&ewc);
+	goto err_out_exit;
+
+err_out_rollback:
+	eblob_base_unreserve(b, key, &ewc);
+	eblob_write_control_cleanup(&ewc);
+	goto err_out_exit;
+
+err_out_coalesce:
+	return eblob_chain_coalesce(b, key, iov, iovcnt, size, flags, 0, wc);
+
+err_out_cleanup_wc:
+	eblob_write_control_cleanup(wc);
+err_out_exit:
+	eblob_dump_wc(b, key, wc, "eblob_chain_writev: finished", err);
+	return err;
+}
+
+static int eblob_try_overwritev(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_iovec *iov, uint16_t iovcnt, struct eblob_write_control *wc, struct eblob_ram_control *old, size_t *defrag_generation,
+		const struct eblob_compress_stat *zs)
+{
+	ssize_t err;
+	uint64_t flags = wc->flags;
+	const size_t size = wc->size;
+
+	pthread_mutex_lock(&b->lock);
+	*defrag_generation = eblob_defrag_generation(b);
+
+	err = eblob_fill_write_control_from_ram(b, key, wc, 1, old);
+	if (err) {
+		pthread_mutex_unlock(&b->lock);
+		goto err_out_exit;
+	}
+
+	/*
+	 * We can only overwrite keys inplace if data-sort is not processing
+	 * this base (so binlog for it is not enabled)
+	 */
+	if (eblob_binlog_enabled(&wc->bctl->binlog)) {
+		err = -EROFS;
+	}
+	pthread_mutex_unlock(&b->lock);
+	if (err)
+		goto err_out_cleanup_wc;
+
+	/* Chained record is never overwritten in place, see eblob_chain_writev() */
+	if (wc->flags & BLOB_DISK_CTL_CHAINED) {
+		err = -E2BIG;
+		goto err_out_cleanup_wc;
+	}
+
+	/* Neither is compressed one, see eblob_compress_merge_writev() */
+	if (wc->flags & BLOB_DISK_CTL_COMPRESSED) {
+		err = -E2BIG;
+		goto err_out_cleanup_wc;
+	}
+
+	/*
+	 * We can't overwrite old record with new one if they have different
+	 * format.
+	 */
+	if ((flags & BLOB_DISK_CTL_EXTHDR) != (wc->flags & BLOB_DISK_CTL_EXTHDR)) {
+		err = -E2BIG;
+		goto err_out_cleanup_wc;
+	}
+
+	/*
+	 * Append of empty record is same as write of new one
+	 */
+	if ((flags & BLOB_DISK_CTL_EXTHDR) && (flags & BLOB_DISK_CTL_APPEND))
+		if (wc->offset == 0)
+			flags &= ~BLOB_DISK_CTL_APPEND;
+
+	wc->flags = flags | (wc->flags & BLOB_DISK_CTL_DIRECT);
+	wc->size = size;
+	wc->total_data_size = wc->offset + wc->size;
+
+	eblob_stat_inc(b->stat, EBLOB_GST_WRITES_NUMBER);
+	eblob_stat_add(b->stat, EBLOB_GST_WRITES_SIZE, wc->size);
+
+	err = eblob_write_commit_ll(b, key, wc, iov, iovcnt, NULL);
+	if (err) {
+		eblob_dump_wc(b, key, wc, "eblob_try_overwrite: ERROR-eblob_write_commit_ll", err);
+		goto err_out_cleanup_wc;
+	}
+
+	if (zs != NULL)
+		eblob_compress_account(b, wc->bctl, zs);
+
+	eblob_dump_wc(b, key, wc, "eblob_try_overwrite", err);
+
+err_out_cleanup_wc:
+	eblob_write_control_cleanup(wc);
+err_out_exit:
+	return err;
+}
+
+int eblob_plain_write(struct eblob_backend *b, struct eblob_key *key,
+		void *data, uint64_t offset, uint64_t size, uint64_t flags)
+{
+	const struct eblob_iovec iov = {
+		.base = data,
+		.size = size,
+		.offset = offset,
+	};
+
+	return eblob_plain_writev(b, key, &iov, 1, flags);
+}
+
+static int eblob_plain_writev_prepare(struct eblob_backend *b, struct eblob_key *key,
+				      const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags,
+				      struct eblob_write_control *wc, int *prepared)
+{
+	struct eblob_iovec_bounds bounds;
+	struct eblob_ram_control rctl;
+	uint64_t prepare_disk_size = 0;
+	ssize_t err;
+
+	eblob_iovec_get_bounds(&bounds, iov, iovcnt);
+	wc->size = bounds.max;
+
+	pthread_mutex_lock(&b->lock);
+	err = eblob_fill_write_control_from_ram(b, key, wc, 1, NULL);
+	if (err)
+		goto err_out_unlock;
+
+	/*
+	 * plain write is allowed only for uncommitted records
+	 */
+	if (!(wc->flags & BLOB_DISK_CTL_UNCOMMITTED)) {
+		err = -EPERM;
+		goto err_out_cleanup_wc;
+	}
+
+	/*
+	 * We can't use plain write if EXTHDR flag is differ on old and new record.
+	 * TODO: We can preform read-modify-write cycle here but it's too hacky.
+	 */
+	if ((flags & BLOB_DISK_CTL_EXTHDR)
+			&& !(wc->flags & BLOB_DISK_CTL_EXTHDR)) {
+		err = -ENOTSUP;
+		goto err_out_cleanup_wc;
+	}
+
+	wc->flags = eblob_validate_ctl_flags(b, flags) | BLOB_DISK_CTL_UNCOMMITTED |
+		(wc->flags & BLOB_DISK_CTL_DIRECT);
+
+	/*
 	 * We can only overwrite keys inplace if data-sort is not processing
 	 * this base (so binlog for it is not enabled)
 	 */
-	if (eblob_binlog_enabled(&wc->bctl->binlog)) {
-		err = -EROFS;
+	if (eblob_binlog_enabled(&wc->bctl->binlog)) {
+		err = eblob_cache_lookup(b, key, &rctl, NULL, NULL);
+		if (err != 0)
+			goto err_out_cleanup_wc;
+
+		/*
+		 * Copy prepare_disk_size bytes of an existing key from old closed blob to a new one.
+		 * prepare_disk_size is calculated as follows: wc->total_size decreased by the size of the header and footer -
+		 * that's because eblob_write_prepare_disk_ll() accepts size of the space allocated for data,
+		 * and it will add header and footer sizes internally.
+		 */
+		const uint64_t hdr_footer_size = sizeof(struct eblob_disk_control) + eblob_get_footer_size(b, wc);
+		if (wc->total_size < hdr_footer_size) {
+			err = -EINVAL;
+			eblob_log(b->cfg.log, EBLOB_LOG_NOTICE,
+				  "blob i%d: %s: %s: size check failed: total-size: %" PRIu64 ", header-footer-size: %" PRIu64 "\n",
+				  wc->index, eblob_dump_id(key->id), __func__, wc->total_size, hdr_footer_size);
+			eblob_dump_wc(b, key, wc, "eblob_plain_writev_prepare: ERROR-size-check", err);
+			goto err_out_cleanup_wc;
+		}
+		prepare_disk_size = wc->total_size - hdr_footer_size;
+		err = eblob_write_prepare_disk_ll(b, key, wc, &prepare_disk_size, &rctl);
+		if (err != 0)
+			goto err_out_cleanup_wc;
+		*prepared = 1;
+	}
+
+	pthread_mutex_unlock(&b->lock);
+
+	if (*prepared) {
+		err = eblob_write_prepare_disk_finish(b, key, wc, prepare_disk_size,
+				EBLOB_COPY_RECORD, 0, &rctl);
+		if (err != 0)
+			eblob_write_control_cleanup(wc);
+	}
+
+	return err;
+
+err_out_cleanup_wc:
+	eblob_write_control_cleanup(wc);
+err_out_unlock:
+	pthread_mutex_unlock(&b->lock);
+	return err;
+}
+
+int eblob_plain_writev(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags)
+{
+	struct eblob_write_control wc = { .offset = 0 };
+	ssize_t err;
+	int prepared = 0;
+
+	/* Sanity */
+	if (b == NULL || key == NULL || iov == NULL)
+		return -EINVAL;
+	if (iovcnt < EBLOB_IOVCNT_MIN || iovcnt > EBLOB_IOVCNT_MAX)
+		return -E2BIG;
+
+	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_DEBUG,
+			"key: %s, iovcnt: %" PRIu16 ", flags: %s",
+			eblob_dump_id(key->id), iovcnt, eblob_dump_dctl_flags(flags));
+
+	err = eblob_wbuf_flush_key(b, key);
+	if (err)
+		goto err_out_exit;
+
+	err = eblob_plain_writev_prepare(b, key, iov, iovcnt, flags, &wc, &prepared);
+	if (err)
+		goto err_out_exit;
+
+	err = eblob_writev_raw(key, &wc, iov, iovcnt);
+	if (err)
+		goto err_out_cleanup_wc;
+
+	/* Re-commit record to ram if it was copied */
+	if (prepared) {
+		err = eblob_commit_ram(b, key, &wc);
+		if (err != 0)
+			goto err_out_cleanup_wc;
+	}
+
+err_out_cleanup_wc:
+	eblob_write_control_cleanup(&wc);
+err_out_exit:
+	eblob_log(b->cfg.log, err ? EBLOB_LOG_ERROR : EBLOB_LOG_NOTICE,
+			"blob: %s: %s: eblob_writev_raw: fd: %d: "
+			"size: %" PRIu64 ", offset: %" PRIu64 ": %zd.\n",
+			eblob_dump_id(key->id), __func__, wc.data_fd, wc.size,
+			wc.data_offset + wc.offset, err);
+	if (err) {
+		FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.disk.write.plain.errors.%zd", b->cfg.stat_id, -err), 1);
+	}
+	return err;
+}
+
+/**
+ * eblob_footer_stream_fd() - hashes @size bytes at @offset of @fd into @fs
+ * right from page cache.
+ */
+static int eblob_footer_stream_fd(struct eblob_footer_stream *fs, int fd,
+		uint64_t offset, uint64_t size)
+{
+	const uint64_t start = offset & ~((uint64_t)sysconf(_SC_PAGESIZE) - 1);
+	const uint64_t map_size = size + offset - start;
+	void *map;
+
+	map = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, start);
+	if (map == MAP_FAILED)
+		return -errno;
+
+	eblob_footer_stream_update(fs, (char *)map + (offset - start), size);
+
+	munmap(map, map_size);
+	return 0;
+}
+
+/**
+ * eblob_write_from_fd() - writes @size bytes of @src_fd as record of @key.
+ *
+ * Record is prepared like eblob_write_prepare() and data is moved from @src_fd
+ * by splice(2) or copy_file_range(2). Each chunk is hashed from page cache
+ * right after it is copied, so commit does not read the record back.
+ * Record is left uncommitted on error.
+ */
+int eblob_write_from_fd(struct eblob_backend *b, struct eblob_key *key,
+		int src_fd, uint64_t src_off, uint64_t size, uint64_t flags)
+{
+	struct eblob_write_control wc = { .offset = 0 };
+	struct eblob_footer_stream fs, *fsp = NULL;
+	/* Only bounds of the record are used by eblob_plain_writev_prepare() */
+	const struct eblob_iovec iov = {
+		.base = NULL,
+		.size = size,
+		.offset = 0,
+	};
+	uint64_t done, chunk;
+	struct stat st;
+	int err, prepared = 0;
+
+	if (b == NULL || key == NULL || src_fd < 0)
+		return -EINVAL;
+	if (flags & (BLOB_DISK_CTL_APPEND | BLOB_DISK_CTL_CHAINED))
+		return -ENOTSUP;
+
+	if (fstat(src_fd, &st) == -1)
+		return -errno;
+
+	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_DEBUG,
+			"key: %s, src_fd: %d, src_off: %" PRIu64 ", size: %" PRIu64 ", flags: %s",
+			eblob_dump_id(key->id), src_fd, src_off, size, eblob_dump_dctl_flags(flags));
+
+	/* Footer of record without checksums does not depend on its data */
+	if (!(flags & BLOB_DISK_CTL_NOCSUM) && !(b->cfg.blob_flags & EBLOB_NO_FOOTER)) {
+		err = eblob_footer_stream_init(&fs, size);
+		if (err)
+			goto err_out_exit;
+		fsp = &fs;
+	}
+
+	err = eblob_write_prepare(b, key, size, flags);
+	if (err)
+		goto err_out_destroy;
+
+	err = eblob_plain_writev_prepare(b, key, &iov, 1, flags, &wc, &prepared);
+	if (err)
+		goto err_out_destroy;
+
+	for (done = 0; done < size; done += chunk) {
+		chunk = EBLOB_MIN(size - done, EBLOB_CSUM_CHUNK_SIZE);
+
+		err = eblob_copy_from_fd(src_fd, S_ISFIFO(st.st_mode), &src_off,
+				wc.data_fd, wc.data_offset + done, chunk);
+		if (err)
+			goto err_out_cleanup_wc;
+
+		if (fsp != NULL) {
+			err = eblob_footer_stream_fd(fsp, wc.data_fd, wc.data_offset + done, chunk);
+			if (err)
+				goto err_out_cleanup_wc;
+		}
+	}
+
+	/* Re-commit record to ram if it was copied */
+	if (prepared) {
+		err = eblob_commit_ram(b, key, &wc);
+		if (err)
+			goto err_out_cleanup_wc;
+	}
+	eblob_write_control_cleanup(&wc);
+
+	err = eblob_write_commit_footer(b, key, size, flags, fsp);
+	goto err_out_destroy;
+
+err_out_cleanup_wc:
+	eblob_write_control_cleanup(&wc);
+err_out_destroy:
+	if (fsp != NULL)
+		eblob_footer_stream_destroy(fsp);
+err_out_exit:
+	eblob_log(b->cfg.log, err ? EBLOB_LOG_ERROR : EBLOB_LOG_NOTICE,
+			"blob: %s: %s: src_fd: %d, size: %" PRIu64 ": %d\n",
+			eblob_dump_id(key->id), __func__, src_fd, size, err);
+	return err;
+}
+
+/*!
+ * Write data to eblob
+ */
+int eblob_write(struct eblob_backend *b, struct eblob_key *key,
+		void *data, uint64_t offset, uint64_t size,
+		uint64_t flags)
+{
+	const struct eblob_iovec iov = {
+		.base = data,
+		.size = size,
+		.offset = offset,
+	};
+
+	return eblob_writev(b, key, &iov, 1, flags);
+}
+
+/*!
+ * Write and return wc.
+ *
+ * This API added mostly for purpose of BLOB_DISK_CTL_WRITE_RETURN removal - it
+ * removes overhead of reading data back after writing it to determinate it's
+ * location on disk.
+ */
+int eblob_write_return(struct eblob_backend *b, struct eblob_key *key,
+		void *data, uint64_t offset, uint64_t size, uint64_t flags,
+		struct eblob_write_control *wc)
+{
+	const struct eblob_iovec iov = {
+		.base = data,
+		.size = size,
+		.offset = offset,
+	};
+
+	return eblob_writev_return(b, key, &iov, 1, flags, wc);
+}
+
+/*!
+ * Checks correctness of writev's flags and returns corresponding error code if anything is wrong
+ */
+static int check_writev_return_flags(uint64_t flags, uint16_t iovcnt) {
+	if (flags & BLOB_DISK_CTL_COMPRESS)
+		return -ENOTSUP;
+	if (flags & BLOB_DISK_CTL_WRITE_RETURN)
+		return -ENOTSUP;
+	/* write()-functions must not be used as a replacement for remove */
+	if (flags & BLOB_DISK_CTL_REMOVE)
+		return -ENOTSUP;
+	if (iovcnt < EBLOB_IOVCNT_MIN || iovcnt > EBLOB_IOVCNT_MAX)
+		return -E2BIG;
+	return 0;
+}
+
+/*!
+ * Writes \a iovcnt number of iovecs to the key and returns information in \a wc.
+ * BLOB_DISK_CTL_COMPRESSED in \a flags means that \a iov is compressed
+ * payload, then \a zs is accounted to the base it's written to.
+ */
+static int eblob_writev_return_ll(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags,
+		struct eblob_write_control *wc, const struct eblob_compress_stat *zs)
+{
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.write", b->cfg.stat_id));
+
+	struct eblob_iovec_bounds bounds;
+	struct eblob_ram_control old;
+	enum eblob_copy_flavour copy = EBLOB_DONT_COPY_RECORD;
+	const uint64_t compressed = flags & BLOB_DISK_CTL_COMPRESSED;
+	uint64_t copy_offset = 0;
+	int err;
+	size_t defrag_generation = 0;
+
+	memset(wc, 0, sizeof(struct eblob_write_control));
+	eblob_iovec_get_bounds(&bounds, iov, iovcnt);
+	wc->size = bounds.max;
+	wc->flags = eblob_validate_ctl_flags(b, flags) | compressed;
+	wc->index = -1;
+
+	if (flags & BLOB_DISK_CTL_CHAINED) {
+		err = eblob_chain_writev(b, key, iov, iovcnt, flags, wc);
+		goto err_out_cleanup_wc;
+	}
+
+	err = eblob_try_overwritev(b, key, iov, iovcnt, wc, &old, &defrag_generation, zs);
+	if (err == 0) {
+		/* We have overwritten old data - bail out */
+		FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.disk.write.rewrites", b->cfg.stat_id), 1);
+		goto err_out_exit;
+	} else if (!(err == -E2BIG || err == -ENOENT || err == -EROFS)) {
+		/* Unknown error occurred during rewrite */
+		goto err_out_exit;
+	} else if (err == -E2BIG || err == -EROFS) {
+		/* If record exists and too small */
+
+		/*
+		 * Data of chained record is not contiguous, so it can only be
+		 * appended to or overwritten entirely.
+		 */
+		if (wc->flags & BLOB_DISK_CTL_CHAINED) {
+			if (flags & BLOB_DISK_CTL_APPEND) {
+				err = eblob_chain_writev(b, key, iov, iovcnt,
+						flags | BLOB_DISK_CTL_CHAINED, wc);
+				goto err_out_cleanup_wc;
+			}
+			if ((flags & BLOB_DISK_CTL_EXTHDR) || bounds.min != 0 || bounds.contiguous == 0) {
+				err = -ENOTSUP;
+				goto err_out_exit;
+			}
+			/* Nothing to copy */
+			wc->total_data_size = 0;
+		}
+
+		/* Compressed data can't be partially reused, it's merged */
+		if (wc->flags & BLOB_DISK_CTL_COMPRESSED) {
+			if (flags & BLOB_DISK_CTL_EXTHDR) {
+				err = -ENOTSUP;
+				goto err_out_exit;
+			}
+			if ((flags & BLOB_DISK_CTL_APPEND) || bounds.min != 0 || bounds.contiguous == 0) {
+				err = eblob_compress_merge_writev(b, key, iov, iovcnt, flags, wc);
+				goto err_out_exit;
+			}
+			/* Nothing to copy */
+			wc->total_data_size = 0;
+		}
+
+		/* If new record uses any part of old one - we should copy it */
+		if ((flags & BLOB_DISK_CTL_APPEND)
+				|| bounds.min != 0
+				|| bounds.max < wc->total_data_size
+				|| bounds.contiguous == 0)
+			copy = EBLOB_COPY_RECORD;
+
+		/*
+		 * If now it's extended record and previous was not, then we need to
+		 * copy record with offset of extended record length.
+		 */
+		if ((flags & BLOB_DISK_CTL_EXTHDR)
+				&& !(wc->flags & BLOB_DISK_CTL_EXTHDR)) {
+			copy = EBLOB_COPY_RECORD;
+			copy_offset = iov[0].size;
+		}
+
+		/* We can't overwrite extended record with non-extended one */
+		if (!(flags & BLOB_DISK_CTL_EXTHDR)
+				&& (wc->flags & BLOB_DISK_CTL_EXTHDR)) {
+			err = -EINVAL;
+			goto err_out_exit;
+		}
+
+		/* overwrite can modify offset and flags */
+		wc->offset = 0;
+		wc->flags = eblob_validate_ctl_flags(b, flags) | compressed;
+	}
+
+	err = eblob_write_prepare_disk(b, key, wc, 0, copy, copy_offset, err == -ENOENT ? NULL : &old, defrag_generation);
+	if (err)
+		goto err_out_cleanup_wc;
+
+	err = eblob_write_commit_ll(b, key, wc, iov, iovcnt, NULL);
+	if (err) {
+		eblob_dump_wc(b, key, wc, "eblob_writev: eblob_write_commit_ll: FAILED", err);
+		goto err_out_cleanup_wc;
+	}
+
+	if (zs != NULL)
+		eblob_compress_account(b, wc->bctl, zs);
+
+err_out_cleanup_wc:
+	eblob_write_control_cleanup(wc);
+err_out_exit:
+	eblob_dump_wc(b, key, wc, "eblob_writev: finished", err);
+	if (err) {
+		FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.disk.write.errors.%d", b->cfg.stat_id, -err), 1);
+	}
+	return err;
+}
+
+/**
+ * eblob_compress_iov() - compresses data of record written by @iov if
+ * compression is enabled, the record is replaced as a whole and compression
+ * pays off. Returned @packed should be freed by caller.
+ *
+ * Returns -EAGAIN if record should be written as is.
+ */
+static int eblob_compress_iov(struct eblob_backend *b, const struct eblob_iovec *iov,
+		uint16_t iovcnt, uint64_t flags, void **packed, uint64_t *packed_size,
+		struct eblob_compress_stat *zs)
+{
+	const int algorithm = eblob_compress_algorithm(b);
+	struct eblob_iovec_bounds bounds;
+	const void *src = iov[0].base;
+	char *data = NULL;
+	uint16_t i;
+	int err;
+
+	if (algorithm == 0 || (flags & (BLOB_DISK_CTL_APPEND | BLOB_DISK_CTL_EXTHDR |
+			BLOB_DISK_CTL_UNCOMMITTED | BLOB_DISK_CTL_CHAINED)))
+		return -EAGAIN;
+
+	eblob_iovec_get_bounds(&bounds, iov, iovcnt);
+	if (bounds.min != 0 || bounds.contiguous == 0 || bounds.max < b->cfg.compress_threshold)
+		return -EAGAIN;
+
+	if (iovcnt > 1) {
+		data = malloc(bounds.max);
+		if (data == NULL)
+			return -ENOMEM;
+		for (i = 0; i < iovcnt; ++i)
+			memcpy(data + iov[i].offset, iov[i].base, iov[i].size);
+		src = data;
+	}
+
+	memset(zs, 0, sizeof(struct eblob_compress_stat));
+	err = eblob_compress(algorithm, NULL, src, bounds.max, packed, packed_size, &zs->usecs);
+	free(data);
+	if (err) {
+		/* Time is wasted anyway */
+		eblob_stat_add(b->stat_summary, EBLOB_LST_COMPRESS_TIME, zs->usecs);
+		return err == -E2BIG ? -EAGAIN : err;
+	}
+
+	zs->raw_size = bounds.max;
+	zs->size = *packed_size;
+	return 0;
+}
+
+/*!
+ * Writes \a iovcnt number of iovecs to the key bypassing write buffer and
+ * returns information in \a wc
+ */
+static int _eblob_writev_return(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags,
+		struct eblob_write_control *wc)
+{
+	struct eblob_compress_stat zs;
+	struct eblob_iovec packed_iov;
+	uint64_t packed_size;
+	void *packed;
+	int err;
+
+	err = eblob_compress_iov(b, iov, iovcnt, flags, &packed, &packed_size, &zs);
+	if (err == -EAGAIN)
+		return eblob_writev_return_ll(b, key, iov, iovcnt, flags & ~BLOB_DISK_CTL_COMPRESSED, wc, NULL);
+	if (err)
+		return err;
+
+	packed_iov.base = packed;
+	packed_iov.size = packed_size;
+	packed_iov.offset = 0;
+
+	err = eblob_writev_return_ll(b, key, &packed_iov, 1, flags | BLOB_DISK_CTL_COMPRESSED, wc, &zs);
+	free(packed);
+	return err;
+}
+
+/*!
+ * Writes \a iovcnt number of iovecs to the key and returns information in \a wc
+ */
+int eblob_writev_return(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags,
+		struct eblob_write_control *wc)
+{
+	int err;
+
+	if (b == NULL || key == NULL || iov == NULL || wc == NULL)
+		return -EINVAL;
+
+	err = check_writev_return_flags(flags, iovcnt);
+	if (err) {
+		return err;
+	}
+
+	/* Location of the record is returned, so it has to be on disk */
+	err = eblob_wbuf_flush_key(b, key);
+	if (err)
+		return err;
+
+	return _eblob_writev_return(b, key, iov, iovcnt, flags, wc);
+}
+
+/*!
+ * Writes \a iovcnt number of iovecs to the key, small records may be
+ * buffered if write buffer is enabled
+ */
+int eblob_writev(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags)
+{
+	struct eblob_write_control wc;
+	int err;
+
+	if (b == NULL || key == NULL || iov == NULL)
+		return -EINVAL;
+
+	err = check_writev_return_flags(flags, iovcnt);
+	if (err) {
+		return err;
+	}
+
+	err = eblob_wbuf_write(b, key, iov, iovcnt, flags);
+	if (err != -EAGAIN)
+		return err;
+
+	return _eblob_writev_return(b, key, iov, iovcnt, flags, &wc);
+}
+
+/**
+ * eblob_write_batch_group() - writes new records @group of eblob_write_batch()
+ * that belong to the same active base @slot.
+ *
+ * Space for all of them is reserved at once, so records lie back to back in
+ * the data file, except for padding of direct ones, and their headers, data
+ * and footers are written by few pwritev(2), while index entries are written
+ * by single pwrite(2). Keys are put to RAM index taking lock of each shard
+ * once. Records are compressed one by one before that, as
+ * eblob_writev_return() does.
+ */
+static void eblob_write_batch_group(struct eblob_backend *b, unsigned int slot,
+		struct eblob_key *keys, const struct eblob_iovec *iov,
+		const uint32_t *group, uint32_t count, uint64_t flags, int *errors)
+{
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.write.batch.group", b->cfg.stat_id));
+
+	struct eblob_write_control *wc;
+	struct eblob_disk_control *dc;
+	struct eblob_iovec *seg, *footer, *rec;
+	struct eblob_compress_stat *zs;
+	struct eblob_ram_control *rctl;
+	struct eblob_ram_meta *meta;
+	struct eblob_base_ctl *bctl;
+	uint64_t data_size = 0, data_offset, index_offset;
+	unsigned int syscalls = 0;
+	uint32_t i, nseg = 0;
+	int *res, err, aligned = 0;
+
+	wc = calloc(count, sizeof(struct eblob_write_control));
+	dc = calloc(count, sizeof(struct eblob_disk_control));
+	seg = calloc(count * 3, sizeof(struct eblob_iovec));
+	footer = calloc(count, sizeof(struct eblob_iovec));
+	rctl = calloc(count, sizeof(struct eblob_ram_control));
+	meta = calloc(count, sizeof(struct eblob_ram_meta));
+	res = calloc(count, sizeof(int));
+	rec = calloc(count, sizeof(struct eblob_iovec));
+	zs = calloc(count, sizeof(struct eblob_compress_stat));
+	if (wc == NULL || dc == NULL || seg == NULL || footer == NULL
+			|| rctl == NULL || meta == NULL || res == NULL || rec == NULL || zs == NULL) {
+		err = -ENOMEM;
+		goto err_out_free;
+	}
+
+	for (i = 0; i < count; ++i) {
+		void *packed;
+		uint64_t packed_size;
+
+		rec[i] = iov[group[i]];
+		wc[i].index = -1;
+		wc[i].flags = eblob_validate_ctl_flags(b, flags);
+
+		/* Record that can't be compressed is written as is */
+		if (eblob_compress_iov(b, &rec[i], 1, flags, &packed, &packed_size, &zs[i]) == 0) {
+			rec[i].base = packed;
+			rec[i].size = packed_size;
+			wc[i].flags |= BLOB_DISK_CTL_COMPRESSED;
+		}
+
+		wc[i].size = rec[i].size;
+		wc[i].total_data_size = wc[i].size;
+		wc[i].total_size = eblob_calculate_size(b, &keys[group[i]], 0, wc[i].size);
+
+		/* Direct records are aligned within reserved space, which starts aligned then */
+		if (eblob_direct_record(b, wc[i].total_data_size)) {
+			wc[i].flags |= BLOB_DISK_CTL_DIRECT;
+			data_size = ALIGN(data_size, (uint64_t)EBLOB_DIRECT_IO_ALIGN);
+			aligned = 1;
+		}
+		data_size += eblob_reserved_size(&wc[i]);
+	}
+
+	err = eblob_check_free_space(b, data_size);
+	if (err)
+		goto err_out_free;
+
+	err = eblob_base_reserve_ll(b, slot, data_size, count * sizeof(struct eblob_disk_control), aligned, 0,
+			&bctl, &data_offset, &index_offset);
+	if (err)
+		goto err_out_free;
+
+	for (i = 0; i < count; ++i) {
+		struct eblob_key *key = &keys[group[i]];
+
+		wc[i].bctl = bctl;
+		wc[i].data_fd = bctl->data_ctl.fd;
+		wc[i].index_fd = bctl->index_ctl.fd;
+		wc[i].index = bctl->index;
+		if (wc[i].flags & BLOB_DISK_CTL_DIRECT)
+			data_offset = ALIGN(data_offset, (uint64_t)EBLOB_DIRECT_IO_ALIGN);
+		wc[i].ctl_data_offset = data_offset;
+		wc[i].ctl_index_offset = index_offset + i * sizeof(struct eblob_disk_control);
+		wc[i].data_offset = wc[i].ctl_data_offset + sizeof(struct eblob_disk_control);
+		data_offset += eblob_reserved_size(&wc[i]);
+
+		res[i] = eblob_writev_segments(key, &wc[i], &rec[i], 1, &seg[nseg + 1]);
+		if (res[i] == 0)
+			res[i] = eblob_fill_footer(b, key, &wc[i], &rec[i], 1, &footer[i]);
+
+		/* Reserved space of failed record stays in base as removed record */
+		if (res[i])
+			wc[i].flags |= BLOB_DISK_CTL_REMOVE;
+		eblob_wc_to_dc(key, &wc[i], &dc[i]);
+
+		seg[nseg].base = &dc[i];
+		seg[nseg].size = sizeof(struct eblob_disk_control);
+		seg[nseg].offset = wc[i].ctl_data_offset;
+		nseg += res[i] ? 1 : 2;
+		if (res[i] == 0 && footer[i].size)
+			seg[nseg++] = footer[i];
+	}
+
+	err = __eblob_writev_ll(bctl->data_ctl.fd, seg, nseg, &syscalls);
+	/* Same as in eblob_writev_commit_disk(): cover padding of the last record */
+	if (!err && aligned && seg[nseg - 1].offset + seg[nseg - 1].size < data_offset)
+		err = eblob_extend_record(b, bctl, bctl->data_ctl.fd, data_offset - data_size, data_size);
+	if (err) {
+		/* Index entries can't be left unwritten, so they are written removed */
+		for (i = 0; i < count; ++i) {
+			if (res[i] == 0)
+				res[i] = err;
+			wc[i].flags |= BLOB_DISK_CTL_REMOVE;
+			eblob_wc_to_dc(&keys[group[i]], &wc[i], &dc[i]);
+		}
+	}
+
+	err = __eblob_write_ll(bctl->index_ctl.fd, dc, count * sizeof(struct eblob_disk_control), index_offset);
+	eblob_stat_add(b->stat, EBLOB_GST_WRITE_SYSCALLS, syscalls + 1);
+	if (err) {
+		for (i = 0; i < count; ++i)
+			if (res[i] == 0)
+				res[i] = err;
+		goto err_out_release;
+	}
+
+	err = eblob_sync_record(b, bctl->data_ctl.fd, bctl->index_ctl.fd, flags);
+	if (err) {
+		for (i = 0; i < count; ++i)
+			if (res[i] == 0)
+				res[i] = err;
+		goto err_out_release;
+	}
+
+	for (i = 0; i < count; ++i) {
+		if (res[i])
+			continue;
+
+		eblob_wc_to_rctl(&wc[i], &rctl[i]);
+		meta[i].flags = wc[i].flags & ~BLOB_DISK_CTL_NOSYNC;
+		meta[i].disk_size = wc[i].total_size;
+
+		eblob_stat_inc(bctl->stat, EBLOB_LST_RECORDS_TOTAL);
+		eblob_stat_add(bctl->stat, EBLOB_LST_BASE_SIZE,
+		               wc[i].total_size + sizeof(struct eblob_disk_control));
+
+		eblob_stat_inc(b->stat_summary, EBLOB_LST_RECORDS_TOTAL);
+		eblob_stat_add(b->stat_summary, EBLOB_LST_BASE_SIZE,
+		               wc[i].total_size + sizeof(struct eblob_disk_control));
+
+		if (wc[i].flags & BLOB_DISK_CTL_COMPRESSED)
+			eblob_compress_account(b, bctl, &zs[i]);
+	}
+
+	/* Failed entries are written removed, so they are skipped */
+	err = eblob_cache_insert_batch(b, dc, rctl, meta, count, res);
+	if (err) {
+		for (i = 0; i < count; ++i)
+			if (res[i] == 0)
+				res[i] = err;
+	}
+
+err_out_release:
+	eblob_bctl_release(bctl);
+err_out_free:
+	eblob_log(b->cfg.log, err ? EBLOB_LOG_ERROR : EBLOB_LOG_NOTICE,
+			"blob: %s: slot: %u, records: %" PRIu32 ", size: %" PRIu64 ", syscalls: %u: %d\n",
+			__func__, slot, count, data_size, syscalls, err);
+	for (i = 0; i < count; ++i) {
+		errors[group[i]] = (res != NULL && res[i]) ? res[i] : err;
+		if (footer != NULL)
+			free(footer[i].base);
+		if (rec != NULL && wc != NULL && (wc[i].flags & BLOB_DISK_CTL_COMPRESSED))
+			free(rec[i].base);
+	}
+	free(zs);
+	free(rec);
+	free(res);
+	free(meta);
+	free(rctl);
+	free(footer);
+	free(seg);
+	free(dc);
+	free(wc);
+}
+
+struct eblob_write_batch_key {
+	const struct eblob_key	*key;
+	uint32_t		idx;
+};
+
+static int eblob_write_batch_key_cmp(const void *l, const void *r)
+{
+	const struct eblob_write_batch_key *lk = l, *rk = r;
+	int cmp;
+
+	cmp = eblob_id_cmp(lk->key->id, rk->key->id);
+	if (cmp)
+		return cmp;
+	return (lk->idx > rk->idx) - (lk->idx < rk->idx);
+}
+
+/*!
+ * Writes \a num records at once: \a keys[i] gets data of \a iov[i] written at
+ * \a iov[i].offset. New keys are written by batch, keys that already exist,
+ * are written with an offset or appended are written one by one afterwards.
+ */
+int eblob_write_batch_ll(struct eblob_backend *b, struct eblob_key *keys,
+		const struct eblob_iovec *iov, uint32_t num, uint64_t flags, int *errors)
+{
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.write.batch", b->cfg.stat_id));
+
+	struct eblob_write_batch_key *sorted = NULL;
+	struct eblob_ram_control rctl;
+	unsigned char *batch = NULL;
+	uint32_t *group = NULL, i, count;
+	unsigned int slot;
+	int *res, err, disk;
+
+	if (b == NULL || keys == NULL || iov == NULL)
+		return -EINVAL;
+
+	err = check_writev_return_flags(flags, 1);
+	if (err || num == 0)
+		return err;
+
+	res = errors != NULL ? errors : calloc(num, sizeof(int));
+	batch = calloc(num, sizeof(unsigned char));
+	group = calloc(num, sizeof(uint32_t));
+	sorted = calloc(num, sizeof(struct eblob_write_batch_key));
+	if (res == NULL || batch == NULL || group == NULL || sorted == NULL) {
+		err = -ENOMEM;
+		goto err_out_free;
+	}
+
+	/* Only writes of new records can be batched */
+	for (count = 0, i = 0; i < num; ++i) {
+		res[i] = 0;
+		if ((flags & (BLOB_DISK_CTL_APPEND | BLOB_DISK_CTL_UNCOMMITTED | BLOB_DISK_CTL_CHAINED))
+				|| iov[i].offset != 0)
+			continue;
+		if (eblob_cache_lookup(b, &keys[i], &rctl, NULL, &disk) != -ENOENT)
+			continue;
+
+		batch[i] = 1;
+		sorted[count].key = &keys[i];
+		sorted[count].idx = i;
+		++count;
+	}
+
+	/* Repeated keys overwrite their first write */
+	qsort(sorted, count, sizeof(struct eblob_write_batch_key), eblob_write_batch_key_cmp);
+	for (i = 1; i < count; ++i)
+		if (eblob_id_cmp(sorted[i].key->id, sorted[i - 1].key->id) == 0)
+			batch[sorted[i].idx] = 0;
+
+	for (slot = 0; slot < b->cfg.active_bases; ++slot) {
+		for (count = 0, i = 0; i < num; ++i)
+			if (batch[i] && eblob_active_base_slot(b, &keys[i]) == slot)
+				group[count++] = i;
+
+		if (count)
+			eblob_write_batch_group(b, slot, keys, iov, group, count, flags, res);
+	}
+
+	for (i = 0; i < num; ++i)
+		if (!batch[i]) {
+			struct eblob_write_control wc;
+
+			res[i] = _eblob_writev_return(b, &keys[i], &iov[i], 1, flags, &wc);
+		}
+
+	for (i = 0; i < num; ++i) {
+		if (res[i]) {
+			err = res[i];
+			break;
+		}
+	}
+
+err_out_free:
+	if (res != errors)
+		free(res);
+	free(sorted);
+	free(group);
+	free(batch);
+	return err;
+}
+
+int eblob_write_batch(struct eblob_backend *b, struct eblob_key *keys,
+		const struct eblob_iovec *iov, uint32_t num, uint64_t flags, int *errors)
+{
+	uint32_t i;
+	int err;
+
+	if (b == NULL || keys == NULL || iov == NULL)
+		return -EINVAL;
+
+	/* Buffered records would overwrite these ones once flushed */
+	for (i = 0; i < num; ++i) {
+		err = eblob_wbuf_flush_key(b, &keys[i]);
+		if (err) {
+			for (i = 0; errors != NULL && i < num; ++i)
+				errors[i] = err;
+			return err;
+		}
+	}
+
+	return eblob_write_batch_ll(b, keys, iov, num, flags, errors);
+}
+
+/**
+ * eblob_remove() - remove entry from backend
+ */
+int eblob_remove(struct eblob_backend *b, struct eblob_key *key)
+{
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.remove", b->cfg.stat_id));
+	struct eblob_ram_control ctl;
+	struct eblob_ram_meta meta;
+	int err, disk, buffered;
+
+	/* Buffered record is only dropped, but older one may be on disk */
+	buffered = eblob_wbuf_remove(b, key) == 0;
+
+	pthread_mutex_lock(&b->lock);
+	err = eblob_cache_lookup(b, key, &ctl, &meta, &disk);
+	if (err == -ENOENT && buffered) {
+		pthread_mutex_unlock(&b->lock);
+		err = 0;
+		goto err_out_exit;
+	}
+	if (err) {
+		pthread_mutex_unlock(&b->lock);
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: %s: %s: eblob_cache_lookup: %d.\n",
+				eblob_dump_id(key->id), __func__, err);
+		goto err_out_exit;
+	}
+
+	eblob_bctl_hold(ctl.bctl);
+	pthread_mutex_unlock(&b->lock);
+
+	if ((err = eblob_mark_entry_removed_purge(b, key, &ctl, &meta, 0)) != 0) {
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR,
+				"%s: %s: eblob_mark_entry_removed_purge: %d\n",
+				__func__, eblob_dump_id(key->id), -err);
+		goto err_out_bctl_release;
+	}
+
+	eblob_log(b->cfg.log, EBLOB_LOG_NOTICE,
+		"blob: %s: eblob_remove: removed block at: %" PRIu64
+		", size: %" PRIu64 ".\n",
+		eblob_dump_id(key->id), ctl.data_offset, ctl.size);
+
+	FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.remove.size", b->cfg.stat_id), ctl.size);
+
+err_out_bctl_release:
+	eblob_bctl_release(ctl.bctl);
+err_out_exit:
+	if (err && err != -ENOENT) {
+		FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.disk.remove.errors.%d", b->cfg.stat_id, -err), 1);
+	}
+	return err;
+}
+
+/**
+ * eblob_read_lookup_ll() - fills @wc for reading @key.
+ * On success @wc->bctl is held and must be released by
+ * eblob_write_control_cleanup().
+ * @chain:	if not NULL, gets chain header of BLOB_DISK_CTL_CHAINED record,
+ *		otherwise such record is coalesced if its data is not contiguous
+ *		and -ENOTSUP is returned for BLOB_DISK_CTL_COMPRESSED record,
+ *		since its data can't be read from fd as is
+ *
+ * @wc of chained record points to data of its first extent, @wc of
+ * compressed one points to compressed payload.
+ */
+static int eblob_read_lookup_ll(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_write_control *wc, struct eblob_chain_header *chain)
+{
+	static const int max_tries = 10;
+	int err, tries = 0;
+	size_t defrag_generation;
+
+	eblob_stat_inc(b->stat, EBLOB_GST_LOOKUP_READS_NUMBER);
+
+	/* Buffered record is located only once it's written */
+	eblob_wbuf_flush_key(b, key);
+
+	/*
+	 * Read path does not take @b->lock: bctl hold protects us from
+	 * data-sort/index-sort while we are reading headers, and change of
+	 * defrag generation means that lookup could have been made against
+	 * already swapped base or stale offsets, so just lookup key once again.
+	 */
+again:
+	memset(wc, 0, sizeof(struct eblob_write_control));
+
+	defrag_generation = eblob_defrag_generation(b);
+	err = eblob_fill_write_control_from_ram(b, key, wc, 0, NULL);
+	if (err == -EAGAIN || defrag_generation != eblob_defrag_generation(b)) {
+		if (err == 0)
+			eblob_write_control_cleanup(wc);
+		if (tries++ < max_tries)
+			goto again;
+		if (err == 0)
+			err = -EAGAIN;
+	}
+	if (err < 0) {
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR,
+				"blob: %s: %s: eblob_fill_write_control_from_ram: %d.\n",
+				eblob_dump_id(key->id), __func__, err);
+		return err;
 	}
-	pthread_mutex_unlock(&b->lock);
-	if (err)
-		goto err_out_cleanup_wc;
 
-	/*
-	 * We can't overwrite old record with new one if they have different
-	 * format.
-	 */
-	if ((flags & BLOB_DISK_CTL_EXTHDR) != (wc->flags & BLOB_DISK_CTL_EXTHDR)) {
-		err = -E2BIG;
-		goto err_out_cleanup_wc;
+	if (wc->flags & BLOB_DISK_CTL_COMPRESS) {
+		eblob_write_control_cleanup(wc);
+		return -ENOTSUP;
 	}
 
-	/*
-	 * Append of empty record is same as write of new one
-	 */
-	if ((flags & BLOB_DISK_CTL_EXTHDR) && (flags & BLOB_DISK_CTL_APPEND))
-		if (wc->offset == 0)
-			flags &= ~BLOB_DISK_CTL_APPEND;
+	if ((wc->flags & BLOB_DISK_CTL_COMPRESSED) && chain == NULL) {
+		eblob_write_control_cleanup(wc);
+		return -ENOTSUP;
+	}
 
-	wc->flags = flags;
-	wc->size = size;
-	wc->total_data_size = wc->offset + wc->size;
+	if (wc->flags & BLOB_DISK_CTL_CHAINED) {
+		struct eblob_chain_header tmp;
+		struct eblob_write_control cwc;
 
-	err = eblob_writev_raw(key, wc, iov, iovcnt);
-	if (err) {
-		eblob_dump_wc(b, key, wc, "eblob_try_overwrite: ERROR-eblob_writev_raw", err);
-		goto err_out_cleanup_wc;
+		err = eblob_chain_read_header(wc, &tmp);
+		if (err) {
+			eblob_write_control_cleanup(wc);
+			return err;
+		}
+
+		if (tmp.num > 1 && chain == NULL) {
+			const uint64_t flags = wc->flags & ~(BLOB_DISK_CTL_REMOVE | BLOB_DISK_CTL_CHAINED);
+
+			eblob_write_control_cleanup(wc);
+			err = eblob_chain_coalesce(b, key, NULL, 0, 0, flags, 0, &cwc);
+			eblob_write_control_cleanup(&cwc);
+			if (err && err != -EAGAIN)
+				return err;
+			if (tries++ < max_tries)
+				goto again;
+			return -EAGAIN;
+		}
+
+		wc->data_offset = tmp.ext[0].position;
+		wc->size = wc->total_data_size = tmp.size;
+		if (chain != NULL)
+			*chain = tmp;
 	}
 
-	eblob_stat_inc(b->stat, EBLOB_GST_WRITES_NUMBER);
-	eblob_stat_add(b->stat, EBLOB_GST_WRITES_SIZE, wc->size);
+	return 0;
+}
 
-	err = eblob_write_commit_ll(b, key, wc);
-	if (err) {
-		eblob_dump_wc(b, key, wc, "eblob_try_overwrite: ERROR-eblob_write_commit_ll", err);
-		goto err_out_cleanup_wc;
+/**
+ * eblob_read_hold_ll() - looks up and verifies record of given key.
+ * On success base of the record is held, so its fds can't be closed until
+ * caller releases it by eblob_write_control_cleanup().
+ * @chain:	see eblob_read_lookup_ll()
+ */
+static int eblob_read_hold_ll(struct eblob_backend *b, struct eblob_key *key,
+		enum eblob_read_flavour csum, struct eblob_write_control *wc,
+		struct eblob_chain_header *chain)
+{
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.read", b->cfg.stat_id));
+	struct timeval start, end;
+	long csum_time;
+	int err;
+
+	assert(b != NULL);
+	assert(key != NULL);
+	assert(wc != NULL);
+
+	err = eblob_read_lookup_ll(b, key, wc, chain);
+	if (err)
+		goto err_out_exit;
+
+	gettimeofday(&start, NULL);
+
+	if (csum != EBLOB_READ_NOCSUM) {
+		err = eblob_verify_checksum(b, key, wc);
+		if (err) {
+			eblob_dump_wc(b, key, wc, "_eblob_read_ll: checksum verification failed", err);
+			goto err_out_cleanup_wc;
+		}
 	}
 
-	eblob_dump_wc(b, key, wc, "eblob_try_overwrite", err);
+	gettimeofday(&end, NULL);
+	csum_time = DIFF(start, end);
+
+	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob i%d: %s: eblob_read: Ok: data_fd: %d"
+			", ctl_data_offset: %" PRIu64 ", data_offset: %" PRIu64
+			", index_fd: %d, index_offset: %" PRIu64 ", size: %" PRIu64
+			", total(disk)_size: %" PRIu64 ", on_disk: %d, want-csum: %d, csum-time: %ld usecs, err: %d\n",
+			wc->index, eblob_dump_id(key->id), wc->data_fd, wc->ctl_data_offset, wc->data_offset,
+			wc->index_fd, wc->ctl_index_offset, wc->size, wc->total_size, wc->on_disk,
+			csum, csum_time, err);
+	return 0;
 
 err_out_cleanup_wc:
 	eblob_write_control_cleanup(wc);
 err_out_exit:
+	if (err && err != -ENOENT) {
+		FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.disk.read.errors.%d", b->cfg.stat_id, -err), 1);
+	}
 	return err;
 }
 
-int eblob_plain_write(struct eblob_backend *b, struct eblob_key *key,
-		void *data, uint64_t offset, uint64_t size, uint64_t flags)
+/**
+ * _eblob_read_ll() - returns @fd, @offset and @size of data for given key.
+ * Caller should the read data manually.
+ */
+static int _eblob_read_ll(struct eblob_backend *b, struct eblob_key *key,
+		enum eblob_read_flavour csum, struct eblob_write_control *wc)
 {
-	const struct eblob_iovec iov = {
-		.base = data,
-		.size = size,
-		.offset = offset,
-	};
+	int err;
 
-	return eblob_plain_writev(b, key, &iov, 1, flags);
+	err = eblob_read_hold_ll(b, key, csum, wc, NULL);
+	if (err == 0)
+		eblob_write_control_cleanup(wc);
+	return err;
 }
 
-static int eblob_plain_writev_prepare(struct eblob_backend *b, struct eblob_key *key,
-				      const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags,
-				      struct eblob_write_control *wc, int *prepared)
+/*!
+ * Wrapper that reads via _eblob_read_ll expands wc into fd, offset, size
+ */
+static int eblob_read_ll(struct eblob_backend *b, struct eblob_key *key, int *fd,
+		uint64_t *offset, uint64_t *size, enum eblob_read_flavour csum)
 {
-	struct eblob_iovec_bounds bounds;
-	ssize_t err;
+	struct eblob_write_control wc = { .size = 0 };
+	int err;
 
-	eblob_iovec_get_bounds(&bounds, iov, iovcnt);
-	wc->size = bounds.max;
+	if (b == NULL || key == NULL || fd == NULL || offset == NULL || size == NULL)
+		return -EINVAL;
 
-	pthread_mutex_lock(&b->lock);
-	err = eblob_fill_write_control_from_ram(b, key, wc, 1, NULL);
-	if (err)
-		goto err_out_unlock;
+	err = _eblob_read_ll(b, key, csum, &wc);
+	if (err < 0)
+		goto err;
 
-	/*
-	 * plain write is allowed only for uncommitted records
-	 */
-	if (!(wc->flags & BLOB_DISK_CTL_UNCOMMITTED)) {
-		err = -EPERM;
-		goto err_out_cleanup_wc;
+	if (wc.flags & BLOB_DISK_CTL_UNCOMMITTED) {
+		err = -ENOENT;
+		goto err;
 	}
 
-	/*
-	 * We can't use plain write if EXTHDR flag is differ on old and new record.
-	 * TODO: We can preform read-modify-write cycle here but it's too hacky.
-	 */
-	if ((flags & BLOB_DISK_CTL_EXTHDR)
-			&& !(wc->flags & BLOB_DISK_CTL_EXTHDR)) {
-		err = -ENOTSUP;
-		goto err_out_cleanup_wc;
+	*fd = wc.data_fd;
+	*size = wc.size;
+	*offset = wc.data_offset;
+err:
+	return err;
+}
+
+int eblob_read(struct eblob_backend *b, struct eblob_key *key, int *fd,
+		uint64_t *offset, uint64_t *size)
+{
+	return eblob_read_ll(b, key, fd, offset, size, EBLOB_READ_CSUM);
+}
+
+int eblob_read_nocsum(struct eblob_backend *b, struct eblob_key *key,
+		int *fd, uint64_t *offset, uint64_t *size)
+{
+	return eblob_read_ll(b, key, fd, offset, size, EBLOB_READ_NOCSUM);
+}
+
+int eblob_read_return(struct eblob_backend *b, struct eblob_key *key,
+		enum eblob_read_flavour csum, struct eblob_write_control *wc)
+{
+	if (b == NULL || key == NULL || wc == NULL)
+		return -EINVAL;
+
+	return _eblob_read_ll(b, key, csum, wc);
+}
+
+int eblob_exists(struct eblob_backend *b, struct eblob_key *key, uint64_t *size)
+{
+	struct eblob_chain_header chain;
+	struct eblob_write_control wc;
+	int err;
+
+	if (b == NULL || key == NULL)
+		return -EINVAL;
+
+	if (eblob_wbuf_read(b, key, 0, NULL, NULL, &wc.size) == 0) {
+		if (size != NULL)
+			*size = wc.size;
+		return 0;
 	}
 
-	wc->flags = eblob_validate_ctl_flags(b, flags) | BLOB_DISK_CTL_UNCOMMITTED;
+	/* Size is known without coalescing chained record or uncompressing compressed one */
+	err = eblob_read_hold_ll(b, key, EBLOB_READ_NOCSUM, &wc, &chain);
+	if (err < 0)
+		return err;
 
-	/*
-	 * We can only overwrite keys inplace if data-sort is not processing
-	 * this base (so binlog for it is not enabled)
-	 */
-	if (eblob_binlog_enabled(&wc->bctl->binlog)) {
-		struct eblob_ram_control rctl;
+	if (wc.flags & BLOB_DISK_CTL_COMPRESSED) {
+		struct eblob_compress_header hdr;
+		int64_t raw_size = -EILSEQ;
 
-		err = eblob_cache_lookup(b, key, &rctl, NULL);
-		if (err != 0)
-			goto err_out_cleanup_wc;
+		if (wc.size >= sizeof(struct eblob_compress_header)) {
+			err = __eblob_read_ll(wc.data_fd, &hdr, sizeof(struct eblob_compress_header), wc.data_offset);
+			raw_size = err ? err : eblob_decompressed_size(&hdr, sizeof(struct eblob_compress_header));
+		}
+		if (raw_size < 0) {
+			eblob_write_control_cleanup(&wc);
+			return raw_size;
+		}
+		wc.size = raw_size;
+	}
+	eblob_write_control_cleanup(&wc);
 
-		/*
-		 * Copy prepare_disk_size bytes of an existing key from old closed blob to a new one.
-		 * prepare_disk_size is calculated as follows: wc->total_size decreased by the size of the header and footer -
-		 * that's because eblob_write_prepare_disk_ll() accepts size of the space allocated for data,
-		 * and it will add header and footer sizes internally.
-		 */
-		const uint64_t hdr_footer_size = sizeof(struct eblob_disk_control) + eblob_get_footer_size(b, wc);
-		if (wc->total_size < hdr_footer_size) {
-			err = -EINVAL;
-			eblob_log(b->cfg.log, EBLOB_LOG_NOTICE,
-				  "blob i%d: %s: %s: size check failed: total-size: %" PRIu64 ", header-footer-size: %" PRIu64 "\n",
-				  wc->index, eblob_dump_id(key->id), __func__, wc->total_size, hdr_footer_size);
-			eblob_dump_wc(b, key, wc, "eblob_plain_writev_prepare: ERROR-size-check", err);
-			goto err_out_cleanup_wc;
+	if (wc.flags & BLOB_DISK_CTL_UNCOMMITTED)
+		return -ENOENT;
+
+	if (size != NULL)
+		*size = wc.size;
+	return 0;
+}
+
+/**
+ * eblob_read_held_ll() - reads data of record looked up into @wc, which base
+ * is held by caller.
+ * @chain:	chain header of BLOB_DISK_CTL_CHAINED record
+ * @verify:	whether data read into @buf should be checksummed there
+ * Other arguments are the same as of eblob_read_data_ll().
+ */
+static int eblob_read_held_ll(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_write_control *wc, const struct eblob_chain_header *chain,
+		uint64_t offset, char **dst, void *buf, uint64_t *size, int verify)
+{
+	void *data;
+	uint64_t record_offset, record_size;
+	int err;
+
+	/* Checksum of compressed or chained record does not cover data as it is read */
+	if (verify && (wc->flags & (BLOB_DISK_CTL_COMPRESSED | BLOB_DISK_CTL_CHAINED))) {
+		verify = 0;
+		err = eblob_verify_checksum(b, key, wc);
+		if (err) {
+			eblob_dump_wc(b, key, wc, "eblob_read_held_ll: checksum verification failed", err);
+			return err;
 		}
-		const uint64_t prepare_disk_size = wc->total_size - hdr_footer_size;
-		err = eblob_write_prepare_disk_ll(b, key, wc,
-				prepare_disk_size,
-				EBLOB_COPY_RECORD, 0, &rctl);
-		if (err != 0)
-			goto err_out_cleanup_wc;
-		*prepared = 1;
 	}
 
-	pthread_mutex_unlock(&b->lock);
+	/* Compressed record is uncompressed as a whole */
+	if (wc->flags & BLOB_DISK_CTL_COMPRESSED) {
+		err = eblob_read_uncompressed(b, wc, &data, &record_size);
+		if (err)
+			return err;
 
-	return err;
+		if (offset >= record_size) {
+			err = -E2BIG;
+			goto err_out_free;
+		}
 
-err_out_cleanup_wc:
-	eblob_write_control_cleanup(wc);
-err_out_unlock:
-	pthread_mutex_unlock(&b->lock);
+		record_size -= offset;
+		if (*size && record_size > *size)
+			record_size = *size;
+		if (buf != NULL) {
+			memcpy(buf, (char *)data + offset, record_size);
+			free(data);
+			data = buf;
+		} else if (offset) {
+			memmove(data, (char *)data + offset, record_size);
+		}
+		goto out_done;
+	}
+
+	if (offset >= wc->size)
+		return -E2BIG;
+
+	record_offset = wc->data_offset + offset;
+	record_size = wc->size - offset;
+
+	if (*size && record_size > *size)
+		record_size = *size;
+
+	data = buf != NULL ? buf : malloc(record_size);
+	if (!data)
+		return -ENOMEM;
+
+	if (wc->flags & BLOB_DISK_CTL_CHAINED) {
+		err = eblob_chain_read(wc, chain, data, record_size, offset);
+	} else if (eblob_direct_io(b, wc)) {
+		err = eblob_read_direct(wc->bctl, data, record_size, record_offset);
+		if (err == 0)
+			eblob_stat_inc(b->stat, EBLOB_GST_DIRECT_READS);
+	} else {
+		err = __eblob_read_ll(wc->data_fd, data, record_size, record_offset);
+	}
+	if (err != 0)
+		goto err_out_free;
+
+	if (verify) {
+		wc->offset = offset;
+		wc->size = record_size;
+		err = eblob_verify_checksum_data(b, key, wc, data);
+		if (err) {
+			eblob_dump_wc(b, key, wc, "eblob_read_held_ll: checksum verification failed", err);
+			goto err_out_free;
+		}
+	}
+
+out_done:
+	eblob_stat_inc(b->stat, EBLOB_GST_DATA_READS_NUMBER);
+	eblob_stat_add(b->stat, EBLOB_GST_READS_SIZE, record_size);
+
+	*size = record_size;
+	if (buf == NULL)
+		*dst = data;
+
+	return 0;
+
+err_out_free:
+	if (data != buf)
+		free(data);
 	return err;
 }
 
-int eblob_plain_writev(struct eblob_backend *b, struct eblob_key *key,
-		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags)
+/**
+ * eblob_read_data_ll() - unlike eblob_read it mmaps data, reads it
+ * adjusting @dst pointer;
+ * @key:	hashed key to read
+ * @offset:	offset inside record
+ * @dst:	pointer to destination pointer
+ * @buf:	if not NULL, caller's buffer of @size bytes data is read to
+ *		instead of buffer allocated and returned in @dst
+ * @size:	pointer to store size of data, also constraint to read size
+ *
+ * Data read into @buf is checksummed there, so it is not read twice.
+ */
+static int eblob_read_data_ll(struct eblob_backend *b, struct eblob_key *key,
+		uint64_t offset, char **dst, void *buf, uint64_t *size, enum eblob_read_flavour csum)
 {
-	struct eblob_write_control wc = { .offset = 0 };
-	ssize_t err;
-	int prepared = 0;
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.read_data", b->cfg.stat_id));
+	struct eblob_chain_header chain;
+	struct eblob_write_control wc;
+	int err, verify;
 
-	/* Sanity */
-	if (b == NULL || key == NULL || iov == NULL)
+	if (b == NULL || key == NULL || (dst == NULL && buf == NULL) || size == NULL)
 		return -EINVAL;
-	if (iovcnt < EBLOB_IOVCNT_MIN || iovcnt > EBLOB_IOVCNT_MAX)
-		return -E2BIG;
 
-	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_DEBUG,
-			"key: %s, iovcnt: %" PRIu16 ", flags: %s",
-			eblob_dump_id(key->id), iovcnt, eblob_dump_dctl_flags(flags));
+	/* Records in write buffer are not checksummed yet */
+	err = eblob_wbuf_read(b, key, offset, dst, buf, size);
+	if (err != -ENOENT)
+		return err;
 
-	err = eblob_plain_writev_prepare(b, key, iov, iovcnt, flags, &wc, &prepared);
-	if (err)
+	/* Base is held during the read, so direct fd can't be closed */
+	verify = buf != NULL && csum != EBLOB_READ_NOCSUM;
+	err = eblob_read_hold_ll(b, key, verify ? EBLOB_READ_NOCSUM : csum, &wc, &chain);
+	if (err < 0)
 		goto err_out_exit;
 
-	err = eblob_writev_raw(key, &wc, iov, iovcnt);
-	if (err)
-		goto err_out_cleanup_wc;
-
-	/* Re-commit record to ram if it was copied */
-	if (prepared) {
-		err = eblob_commit_ram(b, key, &wc);
-		if (err != 0)
-			goto err_out_cleanup_wc;
-	}
-
-err_out_cleanup_wc:
+	if (wc.flags & BLOB_DISK_CTL_UNCOMMITTED)
+		err = -ENOENT;
+	else
+		err = eblob_read_held_ll(b, key, &wc, &chain, offset, dst, buf, size, verify);
 	eblob_write_control_cleanup(&wc);
+
 err_out_exit:
-	eblob_log(b->cfg.log, err ? EBLOB_LOG_ERROR : EBLOB_LOG_NOTICE,
-			"blob: %s: %s: eblob_writev_raw: fd: %d: "
-			"size: %" PRIu64 ", offset: %" PRIu64 ": %zd.\n",
-			eblob_dump_id(key->id), __func__, wc.data_fd, wc.size,
-			wc.data_offset + wc.offset, err);
-	if (err) {
-		FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.disk.write.plain.errors.%zd", b->cfg.stat_id, -err), 1);
+	if (err && err != -ENOENT) {
+		FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.disk.read_data.errors.%d", b->cfg.stat_id, -err), 1);
 	}
 	return err;
 }
 
-/*!
- * Write data to eblob
- */
-int eblob_write(struct eblob_backend *b, struct eblob_key *key,
-		void *data, uint64_t offset, uint64_t size,
-		uint64_t flags)
+int eblob_read_data(struct eblob_backend *b, struct eblob_key *key, uint64_t offset, char **dst, uint64_t *size)
 {
-	const struct eblob_iovec iov = {
-		.base = data,
-		.size = size,
-		.offset = offset,
-	};
+	return eblob_read_data_ll(b, key, offset, dst, NULL, size, EBLOB_READ_CSUM);
+}
 
-	return eblob_writev(b, key, &iov, 1, flags);
+int eblob_read_data_nocsum(struct eblob_backend *b, struct eblob_key *key, uint64_t offset, char **dst, uint64_t *size)
+{
+	return eblob_read_data_ll(b, key, offset, dst, NULL, size, EBLOB_READ_NOCSUM);
 }
 
-/*!
- * Write and return wc.
- *
- * This API added mostly for purpose of BLOB_DISK_CTL_WRITE_RETURN removal - it
- * removes overhead of reading data back after writing it to determinate it's
- * location on disk.
+/**
+ * eblob_read_into_ll() - reads up to @len bytes of data at @offset into @buf
+ * without allocating buffer for them.
  */
-int eblob_write_return(struct eblob_backend *b, struct eblob_key *key,
-		void *data, uint64_t offset, uint64_t size, uint64_t flags,
-		struct eblob_write_control *wc)
+static int eblob_read_into_ll(struct eblob_backend *b, struct eblob_key *key, uint64_t offset,
+		void *buf, uint64_t len, uint64_t *out_len, enum eblob_read_flavour csum)
 {
-	const struct eblob_iovec iov = {
-		.base = data,
-		.size = size,
-		.offset = offset,
-	};
+	uint64_t size = len;
+	int err;
 
-	return eblob_writev_return(b, key, &iov, 1, flags, wc);
+	/* Zero size means whole record to eblob_read_data_ll() */
+	if (buf == NULL || len == 0 || out_len == NULL)
+		return -EINVAL;
+
+	err = eblob_read_data_ll(b, key, offset, NULL, buf, &size, csum);
+	if (err == 0)
+		*out_len = size;
+	return err;
 }
 
-int eblob_writev(struct eblob_backend *b, struct eblob_key *key,
-		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags)
+int eblob_read_into(struct eblob_backend *b, struct eblob_key *key, uint64_t offset,
+		void *buf, uint64_t len, uint64_t *out_len)
 {
-	struct eblob_write_control wc;
+	return eblob_read_into_ll(b, key, offset, buf, len, out_len, EBLOB_READ_CSUM);
+}
 
-	return eblob_writev_return(b, key, iov, iovcnt, flags, &wc);
+int eblob_read_into_nocsum(struct eblob_backend *b, struct eblob_key *key, uint64_t offset,
+		void *buf, uint64_t len, uint64_t *out_len)
+{
+	return eblob_read_into_ll(b, key, offset, buf, len, out_len, EBLOB_READ_NOCSUM);
 }
 
-/*!
- * Checks correctness of writev's flags and returns corresponding error code if anything is wrong
+/*
+ * Key of eblob_read_multi() which record is read together with others.
+ * @wc is filled by lookup, but its base is not held: it is held again for
+ * reading and @generation tells if record could have moved in between.
  */
-static int check_writev_return_flags(uint64_t flags, uint16_t iovcnt) {
-	if (flags & BLOB_DISK_CTL_COMPRESS)
-		return -ENOTSUP;
-	if (flags & BLOB_DISK_CTL_WRITE_RETURN)
-		return -ENOTSUP;
-	/* write()-functions must not be used as a replacement for remove */
-	if (flags & BLOB_DISK_CTL_REMOVE)
-		return -ENOTSUP;
-	if (iovcnt < EBLOB_IOVCNT_MIN || iovcnt > EBLOB_IOVCNT_MAX)
-		return -E2BIG;
-	return 0;
+struct eblob_read_multi_key {
+	struct eblob_write_control	wc;
+	struct eblob_base_ctl		*bctl;
+	size_t				generation;
+	uint64_t			size;
+	uint32_t			idx;
+};
+
+static int eblob_read_multi_key_cmp(const void *l, const void *r)
+{
+	const struct eblob_read_multi_key *lk = l, *rk = r;
+
+	if (lk->bctl != rk->bctl)
+		return lk->wc.index != rk->wc.index ? (lk->wc.index > rk->wc.index) - (lk->wc.index < rk->wc.index)
+			: ((uintptr_t)lk->bctl > (uintptr_t)rk->bctl) - ((uintptr_t)lk->bctl < (uintptr_t)rk->bctl);
+	return (lk->wc.data_offset > rk->wc.data_offset) - (lk->wc.data_offset < rk->wc.data_offset);
 }
 
-/*!
- * Writes \a iovcnt number of iovecs to the key and returns information in \a wc
+/**
+ * eblob_read_multi_group() - reads records of @count keys of the same base
+ * sorted by data offset. Records separated by gaps of at most
+ * EBLOB_READ_MULTI_GAP_MAX bytes are read by single preadv(2), gaps are read
+ * into @gap. Keys which records could have moved since lookup or which read
+ * failed are left with -EAGAIN to be read one by one.
  */
-int eblob_writev_return(struct eblob_backend *b, struct eblob_key *key,
-		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags,
-		struct eblob_write_control *wc)
+static void eblob_read_multi_group(struct eblob_backend *b, struct eblob_key *keys,
+		struct eblob_read_multi_key *group, uint32_t count, enum eblob_read_flavour csum,
+		char **data, int *errors, void *gap)
 {
-	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.write", b->cfg.stat_id));
-
-	struct eblob_iovec_bounds bounds;
-	struct eblob_ram_control old;
-	enum eblob_copy_flavour copy = EBLOB_DONT_COPY_RECORD;
-	uint64_t copy_offset = 0;
-	int err;
-	size_t defrag_generation = 0;
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.read.multi.group", b->cfg.stat_id));
+
+	struct eblob_base_ctl *bctl = group[0].bctl;
+	struct eblob_iovec *seg;
+	unsigned int syscalls = 0;
+	uint64_t end = 0;
+	uint32_t i, nseg = 0, nread = 0;
+	size_t generation;
+	int err = 0;
 
-	if (b == NULL || key == NULL || iov == NULL || wc == NULL)
-		return -EINVAL;
+	for (i = 0; i < count; ++i)
+		errors[group[i].idx] = -EAGAIN;
 
-	err = check_writev_return_flags(flags, iovcnt);
-	if (err) {
-		return err;
+	seg = calloc(count * 2, sizeof(struct eblob_iovec));
+	if (seg == NULL) {
+		err = -ENOMEM;
+		goto err_out_exit;
 	}
 
-	memset(wc, 0, sizeof(struct eblob_write_control));
-	eblob_iovec_get_bounds(&bounds, iov, iovcnt);
-	wc->size = bounds.max;
-	wc->flags = eblob_validate_ctl_flags(b, flags);
-	wc->index = -1;
+	/* Same as eblob_fill_write_control_from_ram(): base could have been sorted or removed since lookup */
+	eblob_bctl_hold(bctl);
+	generation = eblob_defrag_generation(b);
+	if (bctl->data_ctl.fd < 0)
+		goto out_release;
 
-	err = eblob_try_overwritev(b, key, iov, iovcnt, wc, &old, &defrag_generation);
-	if (err == 0) {
-		/* We have overwritten old data - bail out */
-		FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.disk.write.rewrites", b->cfg.stat_id), 1);
-		goto err_out_exit;
-	} else if (!(err == -E2BIG || err == -ENOENT || err == -EROFS)) {
-		/* Unknown error occurred during rewrite */
-		goto err_out_exit;
-	} else if (err == -E2BIG || err == -EROFS) {
-		/* If record exists and too small */
+	for (i = 0; i < count; ++i) {
+		const uint64_t offset = group[i].wc.data_offset;
+		const uint32_t idx = group[i].idx;
 
-		/* If new record uses any part of old one - we should copy it */
-		if ((flags & BLOB_DISK_CTL_APPEND)
-				|| bounds.min != 0
-				|| bounds.max < wc->total_data_size
-				|| bounds.contiguous == 0)
-			copy = EBLOB_COPY_RECORD;
+		if (group[i].generation != generation)
+			continue;
 
-		/*
-		 * If now it's extended record and previous was not, then we need to
-		 * copy record with offset of extended record length.
-		 */
-		if ((flags & BLOB_DISK_CTL_EXTHDR)
-				&& !(wc->flags & BLOB_DISK_CTL_EXTHDR)) {
-			copy = EBLOB_COPY_RECORD;
-			copy_offset = iov[0].size;
+		data[idx] = malloc(group[i].size);
+		if (data[idx] == NULL) {
+			err = -ENOMEM;
+			goto err_out_release;
 		}
+		errors[idx] = 0;
 
-		/* We can't overwrite extended record with non-extended one */
-		if (!(flags & BLOB_DISK_CTL_EXTHDR)
-				&& (wc->flags & BLOB_DISK_CTL_EXTHDR)) {
-			err = -EINVAL;
-			goto err_out_exit;
+		if (nseg && offset > end && offset - end <= EBLOB_READ_MULTI_GAP_MAX) {
+			seg[nseg].base = gap;
+			seg[nseg].size = offset - end;
+			seg[nseg].offset = end;
+			++nseg;
 		}
 
-		/* overwrite can modify offset and flags */
-		wc->offset = 0;
-		wc->flags = eblob_validate_ctl_flags(b, flags);
+		seg[nseg].base = data[idx];
+		seg[nseg].size = group[i].size;
+		seg[nseg].offset = offset;
+		++nseg;
+		++nread;
+
+		end = offset + group[i].size;
 	}
 
-	err = eblob_write_prepare_disk(b, key, wc, 0, copy, copy_offset, err == -ENOENT ? NULL : &old, defrag_generation);
+	err = __eblob_readv_ll(bctl->data_ctl.fd, seg, nseg, &syscalls);
+	eblob_stat_add(b->stat, EBLOB_GST_MULTI_READ_SYSCALLS, syscalls);
 	if (err)
-		goto err_out_cleanup_wc;
+		goto err_out_release;
 
-	err = eblob_writev_raw(key, wc, iov, iovcnt);
-	if (err) {
-		eblob_dump_wc(b, key, wc, "eblob_writev: eblob_writev_raw: FAILED", err);
-		goto err_out_cleanup_wc;
-	}
+	for (i = 0; i < count; ++i) {
+		struct eblob_write_control *wc = &group[i].wc;
+		const uint32_t idx = group[i].idx;
 
-	err = eblob_write_commit_ll(b, key, wc);
-	if (err) {
-		eblob_dump_wc(b, key, wc, "eblob_writev: eblob_write_commit_ll: FAILED", err);
-		goto err_out_cleanup_wc;
+		if (errors[idx])
+			continue;
+
+		if (csum != EBLOB_READ_NOCSUM) {
+			/* Checksum covers only what was read, so it is verified in memory */
+			wc->bctl = bctl;
+			wc->offset = 0;
+			wc->size = group[i].size;
+			errors[idx] = eblob_verify_checksum_data(b, &keys[idx], wc, data[idx]);
+			wc->bctl = NULL;
+			if (errors[idx]) {
+				eblob_dump_wc(b, &keys[idx], wc, "eblob_read_multi: checksum verification failed",
+						errors[idx]);
+				continue;
+			}
+		}
+
+		eblob_stat_inc(b->stat, EBLOB_GST_DATA_READS_NUMBER);
+		eblob_stat_add(b->stat, EBLOB_GST_READS_SIZE, group[i].size);
 	}
+	eblob_stat_add(b->stat, EBLOB_GST_MULTI_READ_KEYS, nread);
 
-err_out_cleanup_wc:
-	eblob_write_control_cleanup(wc);
+out_release:
+	eblob_bctl_release(bctl);
+	eblob_log(b->cfg.log, EBLOB_LOG_NOTICE, "blob i%d: %s: records: %" PRIu32 ", read: %" PRIu32
+			", syscalls: %u\n", group[0].wc.index, __func__, count, nread, syscalls);
+	goto out_free;
+
+err_out_release:
+	eblob_bctl_release(bctl);
 err_out_exit:
-	eblob_dump_wc(b, key, wc, "eblob_writev: finished", err);
-	if (err) {
-		FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.disk.write.errors.%d", b->cfg.stat_id, -err), 1);
+	eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob i%d: %s: records: %" PRIu32 ", syscalls: %u: %d\n",
+			group[0].wc.index, __func__, count, syscalls, err);
+	/* Keys are retried one by one, so each of them gets its own error */
+	for (i = 0; i < count; ++i)
+		errors[group[i].idx] = -EAGAIN;
+out_free:
+	for (i = 0; i < count; ++i) {
+		if (errors[group[i].idx]) {
+			free(data[group[i].idx]);
+			data[group[i].idx] = NULL;
+		}
+	}
+	free(seg);
+}
+
+/*!
+ * Reads records of \a num keys at once. Keys are looked up first, then records
+ * are grouped by base and read in order of their data offsets, merging close
+ * ones into vectored reads. Buffered, compressed, chained and O_DIRECT records
+ * as well as keys that moved since lookup are read one by one.
+ */
+int eblob_read_multi(struct eblob_backend *b, struct eblob_key *keys, uint32_t num,
+		enum eblob_read_flavour csum, char **data, uint64_t *sizes, int *errors)
+{
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.read.multi", b->cfg.stat_id));
+
+	struct eblob_read_multi_key *sorted = NULL;
+	struct eblob_chain_header chain;
+	void *gap = NULL;
+	uint32_t i, j, count = 0;
+	int *res, err = 0;
+
+	if (b == NULL || keys == NULL || data == NULL || sizes == NULL)
+		return -EINVAL;
+
+	if (num == 0)
+		return 0;
+
+	res = errors != NULL ? errors : calloc(num, sizeof(int));
+	sorted = calloc(num, sizeof(struct eblob_read_multi_key));
+	gap = malloc(EBLOB_READ_MULTI_GAP_MAX);
+	if (res == NULL || sorted == NULL || gap == NULL) {
+		err = -ENOMEM;
+		goto err_out_free;
+	}
+
+	for (i = 0; i < num; ++i) {
+		struct eblob_read_multi_key *k = &sorted[count];
+		uint64_t size = sizes[i];
+
+		data[i] = NULL;
+
+		/* Records in write buffer are not checksummed yet */
+		res[i] = eblob_wbuf_read(b, &keys[i], 0, &data[i], NULL, &size);
+		if (res[i] != -ENOENT) {
+			if (res[i] == 0)
+				sizes[i] = size;
+			continue;
+		}
+
+		/* Only one base is held at a time, otherwise data-sort waiting for them may deadlock with us */
+		res[i] = eblob_read_lookup_ll(b, &keys[i], &k->wc, &chain);
+		if (res[i])
+			continue;
+
+		k->bctl = k->wc.bctl;
+		k->generation = eblob_defrag_generation(b);
+		k->idx = i;
+		k->size = k->wc.size;
+		if (sizes[i] && k->size > sizes[i])
+			k->size = sizes[i];
+
+		if (k->wc.flags & BLOB_DISK_CTL_UNCOMMITTED)
+			res[i] = -ENOENT;
+		else if (k->wc.size == 0)
+			res[i] = -E2BIG;
+		else if ((k->wc.flags & (BLOB_DISK_CTL_COMPRESSED | BLOB_DISK_CTL_CHAINED)) || eblob_direct_io(b, &k->wc))
+			res[i] = -EAGAIN;
+		else
+			++count;
+		eblob_write_control_cleanup(&k->wc);
+	}
+
+	qsort(sorted, count, sizeof(struct eblob_read_multi_key), eblob_read_multi_key_cmp);
+	for (i = 0; i < count; i = j) {
+		for (j = i + 1; j < count && sorted[j].bctl == sorted[i].bctl; ++j)
+			;
+		eblob_read_multi_group(b, keys, &sorted[i], j - i, csum, data, res, gap);
 	}
+
+	for (i = 0; i < count; ++i)
+		if (res[sorted[i].idx] == 0)
+			sizes[sorted[i].idx] = sorted[i].size;
+
+	for (i = 0; i < num; ++i) {
+		if (res[i] == -EAGAIN) {
+			uint64_t size = sizes[i];
+
+			res[i] = eblob_read_data_ll(b, &keys[i], 0, &data[i], NULL, &size, csum);
+			if (res[i] == 0)
+				sizes[i] = size;
+		}
+	}
+
+	for (i = 0; i < num; ++i) {
+		if (res[i]) {
+			err = res[i];
+			break;
+		}
+	}
+
+err_out_free:
+	if (res != errors)
+		free(res);
+	free(gap);
+	free(sorted);
 	return err;
 }
 
-/**
- * eblob_remove() - remove entry from backend
+/*
+ * Asynchronous request: engine's request and state of the operation.
  */
-int eblob_remove(struct eblob_backend *b, struct eblob_key *key)
+struct eblob_async_req {
+	struct eblob_aio_req		aio;
+	struct eblob_backend		*b;
+	struct eblob_key		key;
+
+	/* Read: record location and destination buffer, base is held until completion */
+	struct eblob_write_control	wc;
+	struct eblob_chain_header	chain;
+	uint64_t			offset;
+	enum eblob_read_flavour		csum;
+	struct iovec			iov;
+	/* Aligned buffer of direct read, data starts at @bounce_skip */
+	char				*bounce;
+	uint64_t			bounce_skip;
+	void				*buf;
+
+	/* Write: copy of user's iovecs */
+	struct eblob_iovec		*wiov;
+	uint16_t			wiovcnt;
+	uint64_t			flags;
+
+	/* Number of bytes read or written */
+	uint64_t			size;
+	eblob_async_complete_t		complete;
+	void				*priv;
+};
+
+static struct eblob_async_req *eblob_async_req_alloc(struct eblob_backend *b, struct eblob_key *key,
+		eblob_async_complete_t complete, void *priv)
 {
-	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.remove", b->cfg.stat_id));
-	struct eblob_ram_control ctl;
-	int err, disk;
+	struct eblob_async_req *r;
+
+	r = calloc(1, sizeof(struct eblob_async_req));
+	if (r == NULL)
+		return NULL;
+
+	r->b = b;
+	r->key = *key;
+	r->complete = complete;
+	r->priv = priv;
+	return r;
+}
+
+/*
+ * eblob_async_finish() - releases base of the read, passes result to user
+ * and frees @r.
+ * Base is released first: user may issue new requests from @complete.
+ */
+static void eblob_async_finish(struct eblob_async_req *r, int err)
+{
+	eblob_write_control_cleanup(&r->wc);
+	r->complete(&r->key, err, err ? 0 : r->size, r->priv);
+	free(r->bounce);
+	free(r->wiov);
+	free(r);
+}
+
+static void eblob_read_async_verify(struct eblob_aio_req *req, int err __attribute_unused__)
+{
+	struct eblob_async_req *r = container_of(req, struct eblob_async_req, aio);
+
+	err = eblob_verify_checksum_data(r->b, &r->key, &r->wc, r->buf);
+	if (err)
+		eblob_dump_wc(r->b, &r->key, &r->wc, "eblob_read_async: checksum verification failed", err);
 
+	eblob_async_finish(r, err);
+}
+
+static void eblob_read_async_complete(struct eblob_aio_req *req, int err)
+{
+	struct eblob_async_req *r = container_of(req, struct eblob_async_req, aio);
 
-	pthread_mutex_lock(&b->lock);
-	err = eblob_cache_lookup(b, key, &ctl, &disk);
 	if (err) {
-		pthread_mutex_unlock(&b->lock);
-		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: %s: %s: eblob_cache_lookup: %d.\n",
-				eblob_dump_id(key->id), __func__, err);
-		goto err_out_exit;
+		eblob_log(r->b->cfg.log, EBLOB_LOG_ERROR, "blob: %s: %s: read failed: fd: %d, "
+				"offset: %" PRIu64 ", size: %" PRIu64 ": %d\n",
+				eblob_dump_id(r->key.id), __func__, r->wc.data_fd,
+				r->wc.data_offset + r->wc.offset, r->size, err);
+		goto err_out_finish;
 	}
 
-	eblob_bctl_hold(ctl.bctl);
-	pthread_mutex_unlock(&b->lock);
+	if (r->bounce != NULL) {
+		memcpy(r->buf, r->bounce + r->bounce_skip, r->size);
+		eblob_stat_inc(r->b->stat, EBLOB_GST_DIRECT_READS);
+	}
 
-	if ((err = eblob_mark_entry_removed_purge(b, key, &ctl)) != 0) {
-		eblob_log(b->cfg.log, EBLOB_LOG_ERROR,
-				"%s: %s: eblob_mark_entry_removed_purge: %d\n",
-				__func__, eblob_dump_id(key->id), -err);
-		goto err_out_bctl_release;
+	eblob_stat_inc(r->b->stat, EBLOB_GST_DATA_READS_NUMBER);
+	eblob_stat_add(r->b->stat, EBLOB_GST_READS_SIZE, r->size);
+
+	/*
+	 * Checksum is computed by pool thread instead of delaying other
+	 * completions. It isn't a blocking call: base is still held, so
+	 * data-sort may wait for it.
+	 */
+	if (r->csum != EBLOB_READ_NOCSUM) {
+		r->aio.op = EBLOB_AIO_CALL;
+		r->aio.complete = eblob_read_async_verify;
+		if (eblob_aio_submit(r->b, &r->aio) != 0)
+			eblob_read_async_verify(&r->aio, 0);
+		return;
 	}
 
-	eblob_log(b->cfg.log, EBLOB_LOG_NOTICE,
-		"blob: %s: eblob_remove: removed block at: %" PRIu64
-		", size: %" PRIu64 ".\n",
-		eblob_dump_id(key->id), ctl.data_offset, ctl.size);
+err_out_finish:
+	eblob_async_finish(r, err);
+}
 
-	FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.remove.size", b->cfg.stat_id), ctl.size);
+static void eblob_read_async_call(struct eblob_aio_req *req, int err __attribute_unused__)
+{
+	struct eblob_async_req *r = container_of(req, struct eblob_async_req, aio);
 
-err_out_bctl_release:
-	eblob_bctl_release(ctl.bctl);
-err_out_exit:
-	if (err && err != -ENOENT) {
-		FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.disk.remove.errors.%d", b->cfg.stat_id, -err), 1);
-	}
-	return err;
+	err = eblob_read_held_ll(r->b, &r->key, &r->wc, &r->chain, r->offset, NULL, r->buf,
+			&r->size, r->csum != EBLOB_READ_NOCSUM);
+	eblob_async_finish(r, err);
 }
 
 /**
- * _eblob_read_ll() - returns @fd, @offset and @size of data for given key.
- * Caller should the read data manually.
+ * eblob_read_async() - reads up to @size bytes of data of @key starting at
+ * @offset into @buf and calls @complete when it's done.
+ * Record is verified after its data is read unless @csum is EBLOB_READ_NOCSUM.
+ * Chained and compressed records are read by pool thread the same way as by
+ * eblob_read_into(), others are read by one I/O request.
  */
-static int _eblob_read_ll(struct eblob_backend *b, struct eblob_key *key,
-		enum eblob_read_flavour csum, struct eblob_write_control *wc)
+int eblob_read_async(struct eblob_backend *b, struct eblob_key *key, uint64_t offset, uint64_t size,
+		void *buf, enum eblob_read_flavour csum, eblob_async_complete_t complete, void *priv)
 {
-	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.read", b->cfg.stat_id));
+	struct eblob_async_req *r;
 	int err;
-	struct timeval start, end;
-	long csum_time;
 
-	assert(b != NULL);
-	assert(key != NULL);
-	assert(wc != NULL);
-
-	eblob_stat_inc(b->stat, EBLOB_GST_LOOKUP_READS_NUMBER);
+	if (b == NULL || key == NULL || buf == NULL || size == 0 || complete == NULL)
+		return -EINVAL;
 
-	memset(wc, 0, sizeof(struct eblob_write_control));
+	r = eblob_async_req_alloc(b, key, complete, priv);
+	if (r == NULL)
+		return -ENOMEM;
 
-	pthread_mutex_lock(&b->lock);
-	err = eblob_fill_write_control_from_ram(b, key, wc, 0, NULL);
-	pthread_mutex_unlock(&b->lock);
-	if (err < 0) {
-		eblob_log(b->cfg.log, EBLOB_LOG_ERROR,
-				"blob: %s: %s: eblob_fill_write_control_from_ram: %d.\n",
-				eblob_dump_id(key->id), __func__, err);
-		goto err_out_exit;
-	}
+	/*
+	 * Base is held until the request completes, so data-sort can't close
+	 * its fds under the read. Pool threads completing reads never wait for
+	 * data-sort: writes and removes are executed by separate threads.
+	 */
+	err = eblob_read_lookup_ll(b, &r->key, &r->wc, &r->chain);
+	if (err)
+		goto err_out_free;
 
-	if (wc->flags & BLOB_DISK_CTL_COMPRESS) {
-		err = -ENOTSUP;
+	if (r->wc.flags & BLOB_DISK_CTL_UNCOMMITTED) {
+		err = -ENOENT;
 		goto err_out_cleanup_wc;
 	}
 
-	gettimeofday(&start, NULL);
+	r->buf = buf;
+	r->csum = csum;
 
-	if (csum != EBLOB_READ_NOCSUM) {
-		err = eblob_verify_checksum(b, key, wc);
-		if (err) {
-			eblob_dump_wc(b, key, wc, "_eblob_read_ll: checksum verification failed", err);
-			goto err_out_cleanup_wc;
-		}
+	if (r->wc.flags & (BLOB_DISK_CTL_CHAINED | BLOB_DISK_CTL_COMPRESSED)) {
+		r->offset = offset;
+		r->size = size;
+		r->aio.op = EBLOB_AIO_CALL;
+		r->aio.complete = eblob_read_async_call;
+		goto out_submit;
 	}
 
-	gettimeofday(&end, NULL);
-	csum_time = DIFF(start, end);
-
-	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob i%d: %s: eblob_read: Ok: data_fd: %d"
-			", ctl_data_offset: %" PRIu64 ", data_offset: %" PRIu64
-			", index_fd: %d, index_offset: %" PRIu64 ", size: %" PRIu64
-			", total(disk)_size: %" PRIu64 ", on_disk: %d, want-csum: %d, csum-time: %ld usecs, err: %d\n",
-			wc->index, eblob_dump_id(key->id), wc->data_fd, wc->ctl_data_offset, wc->data_offset,
-			wc->index_fd, wc->ctl_index_offset, wc->size, wc->total_size, wc->on_disk,
-			csum, csum_time, err);
-
-err_out_cleanup_wc:
-	eblob_write_control_cleanup(wc);
-err_out_exit:
-	if (err && err != -ENOENT) {
-		FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.disk.read.errors.%d", b->cfg.stat_id, -err), 1);
+	if (offset >= r->wc.size) {
+		err = -E2BIG;
+		goto err_out_cleanup_wc;
 	}
-	return err;
-}
 
-/*!
- * Wrapper that reads via _eblob_read_ll expands wc into fd, offset, size
- */
-static int eblob_read_ll(struct eblob_backend *b, struct eblob_key *key, int *fd,
-		uint64_t *offset, uint64_t *size, enum eblob_read_flavour csum)
-{
-	struct eblob_write_control wc = { .size = 0 };
-	int err;
+	r->size = r->wc.size - offset;
+	if (r->size > size)
+		r->size = size;
 
-	if (b == NULL || key == NULL || fd == NULL || offset == NULL || size == NULL)
-		return -EINVAL;
+	r->iov.iov_base = buf;
+	r->iov.iov_len = r->size;
+	r->aio.op = EBLOB_AIO_READV;
+	r->aio.fd = r->wc.data_fd;
+	r->aio.iov = &r->iov;
+	r->aio.iovcnt = 1;
+	r->aio.offset = r->wc.data_offset + offset;
+	r->aio.complete = eblob_read_async_complete;
 
-	err = _eblob_read_ll(b, key, csum, &wc);
-	if (err < 0)
-		goto err;
+	if (eblob_direct_io(b, &r->wc)) {
+		const uint64_t start = r->aio.offset & ~((uint64_t)EBLOB_DIRECT_IO_ALIGN - 1);
+		const uint64_t end = ALIGN(r->aio.offset + r->size, (uint64_t)EBLOB_DIRECT_IO_ALIGN);
+		void *bounce;
 
-	if (wc.flags & BLOB_DISK_CTL_UNCOMMITTED) {
-		err = -ENOENT;
-		goto err;
+		err = posix_memalign(&bounce, EBLOB_DIRECT_IO_ALIGN, end - start);
+		if (err) {
+			err = -err;
+			goto err_out_cleanup_wc;
+		}
+		r->bounce = bounce;
+		r->bounce_skip = r->aio.offset - start;
+		r->iov.iov_base = r->bounce;
+		r->iov.iov_len = end - start;
+		r->aio.fd = r->wc.bctl->direct_fd;
+		r->aio.offset = start;
 	}
 
-	*fd = wc.data_fd;
-	*size = wc.size;
-	*offset = wc.data_offset;
-err:
-	return err;
-}
+	/* Only requested range of chunked checksum is verified */
+	r->wc.offset = offset;
+	r->wc.size = r->size;
 
-int eblob_read(struct eblob_backend *b, struct eblob_key *key, int *fd,
-		uint64_t *offset, uint64_t *size)
-{
-	return eblob_read_ll(b, key, fd, offset, size, EBLOB_READ_CSUM);
-}
+out_submit:
+	err = eblob_aio_submit(b, &r->aio);
+	if (err)
+		goto err_out_cleanup_wc;
 
-int eblob_read_nocsum(struct eblob_backend *b, struct eblob_key *key,
-		int *fd, uint64_t *offset, uint64_t *size)
-{
-	return eblob_read_ll(b, key, fd, offset, size, EBLOB_READ_NOCSUM);
+	return 0;
+
+err_out_cleanup_wc:
+	eblob_write_control_cleanup(&r->wc);
+err_out_free:
+	free(r->bounce);
+	free(r);
+	return err;
 }
 
-int eblob_read_return(struct eblob_backend *b, struct eblob_key *key,
-		enum eblob_read_flavour csum, struct eblob_write_control *wc)
+static void eblob_writev_async_call(struct eblob_aio_req *req, int err __attribute_unused__)
 {
-	if (b == NULL || key == NULL || wc == NULL)
-		return -EINVAL;
+	struct eblob_async_req *r = container_of(req, struct eblob_async_req, aio);
 
-	return _eblob_read_ll(b, key, csum, wc);
+	eblob_async_finish(r, eblob_writev(r->b, &r->key, r->wiov, r->wiovcnt, r->flags));
 }
 
 /**
- * eblob_read_data_ll() - unlike eblob_read it mmaps data, reads it
- * adjusting @dst pointer;
- * @key:	hashed key to read
- * @offset:	offset inside record
- * @dst:	pointer to destination pointer
- * @size:	pointer to store size of data, also constraint to read size
+ * eblob_writev_async() - writes @iov to @key from pool thread and calls
+ * @complete when it's done.
  */
-static int eblob_read_data_ll(struct eblob_backend *b, struct eblob_key *key,
-		uint64_t offset, char **dst, uint64_t *size, enum eblob_read_flavour csum)
+int eblob_writev_async(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags,
+		eblob_async_complete_t complete, void *priv)
 {
-	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.read_data", b->cfg.stat_id));
-	int err, fd;
-	void *data;
-	uint64_t record_offset, record_size;
-
-	err = eblob_read_ll(b, key, &fd, &record_offset, &record_size, csum);
-	if (err < 0)
-		goto err_out_exit;
-
-	if (offset >= record_size) {
-		err = -E2BIG;
-		goto err_out_exit;
-	}
+	struct eblob_async_req *r;
+	uint16_t i;
+	int err;
 
-	record_offset += offset;
-	record_size -= offset;
+	if (b == NULL || key == NULL || iov == NULL || complete == NULL)
+		return -EINVAL;
+	if (iovcnt < EBLOB_IOVCNT_MIN || iovcnt > EBLOB_IOVCNT_MAX)
+		return -E2BIG;
 
-	if (*size && record_size > *size)
-		record_size = *size;
+	r = eblob_async_req_alloc(b, key, complete, priv);
+	if (r == NULL)
+		return -ENOMEM;
 
-	data = malloc(record_size);
-	if (!data) {
+	r->wiov = malloc(iovcnt * sizeof(struct eblob_iovec));
+	if (r->wiov == NULL) {
 		err = -ENOMEM;
-		goto err_out_exit;
-	}
-
-	err = __eblob_read_ll(fd, data, record_size, record_offset);
-	if (err != 0)
 		goto err_out_free;
+	}
+	memcpy(r->wiov, iov, iovcnt * sizeof(struct eblob_iovec));
+	r->wiovcnt = iovcnt;
+	r->flags = flags;
+	for (i = 0; i < iovcnt; ++i)
+		r->size += iov[i].size;
 
-	eblob_stat_inc(b->stat, EBLOB_GST_DATA_READS_NUMBER);
-	eblob_stat_add(b->stat, EBLOB_GST_READS_SIZE, record_size);
+	/* Write updates index and cache, so it can't be split into ring ops */
+	r->aio.op = EBLOB_AIO_CALL_BLOCKING;
+	r->aio.complete = eblob_writev_async_call;
 
-	*size = record_size;
-	*dst = data;
+	err = eblob_aio_submit(b, &r->aio);
+	if (err)
+		goto err_out_free;
 
 	return 0;
 
 err_out_free:
-	free(data);
-err_out_exit:
-	if (err && err != -ENOENT) {
-		FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.disk.read_data.errors.%d", b->cfg.stat_id, -err), 1);
-	}
+	free(r->wiov);
+	free(r);
 	return err;
 }
 
-int eblob_read_data(struct eblob_backend *b, struct eblob_key *key, uint64_t offset, char **dst, uint64_t *size)
+static void eblob_remove_async_call(struct eblob_aio_req *req, int err __attribute_unused__)
 {
-	return eblob_read_data_ll(b, key, offset, dst, size, EBLOB_READ_CSUM);
+	struct eblob_async_req *r = container_of(req, struct eblob_async_req, aio);
+
+	eblob_async_finish(r, eblob_remove(r->b, &r->key));
 }
 
-int eblob_read_data_nocsum(struct eblob_backend *b, struct eblob_key *key, uint64_t offset, char **dst, uint64_t *size)
+/**
+ * eblob_remove_async() - removes @key from pool thread and calls @complete
+ * when it's done.
+ */
+int eblob_remove_async(struct eblob_backend *b, struct eblob_key *key,
+		eblob_async_complete_t complete, void *priv)
 {
-	return eblob_read_data_ll(b, key, offset, dst, size, EBLOB_READ_NOCSUM);
+	struct eblob_async_req *r;
+	int err;
+
+	if (b == NULL || key == NULL || complete == NULL)
+		return -EINVAL;
+
+	r = eblob_async_req_alloc(b, key, complete, priv);
+	if (r == NULL)
+		return -ENOMEM;
+
+	r->aio.op = EBLOB_AIO_CALL_BLOCKING;
+	r->aio.complete = eblob_remove_async_call;
+
+	err = eblob_aio_submit(b, &r->aio);
+	if (err)
+		free(r);
+	return err;
 }
 
 
@@ -2892,8 +6021,15 @@ static void *eblob_sync_thread(void *data)
 		}
 	}
 
-	while (b->cfg.sync && (eblob_event_wait(&b->exit_event, b->cfg.sync) == -ETIMEDOUT)) {
-		eblob_sync(b);
+	/*
+	 * If every operation is synced, only records written without waiting
+	 * for group commit should be synced here.
+	 */
+	while (eblob_event_wait(&b->exit_event, b->cfg.sync ? b->cfg.sync : EBLOB_GCOMMIT_FLUSH_TIMEOUT) == -ETIMEDOUT) {
+		if (b->cfg.sync)
+			eblob_sync(b);
+		else
+			eblob_gcommit_flush(b);
 	}
 
 	return NULL;
@@ -2907,6 +6043,8 @@ int eblob_sync(struct eblob_backend *b)
 {
 	struct eblob_base_ctl *ctl;
 
+	eblob_wbuf_flush(b);
+
 	pthread_mutex_lock(&b->sync_lock);
 
 	list_for_each_entry(ctl, &b->bases, base_entry) {
@@ -2987,6 +6125,14 @@ int eblob_periodic(struct eblob_backend *b)
 		}
 	}
 
+	if (ACCESS_ONCE(b->tombstones.num) >= EBLOB_TOMBSTONES_FOLD_THRESHOLD) {
+		err = eblob_tombstones_fold_all(b);
+		if (err != 0) {
+			EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err,
+				"eblob_tombstones_fold_all: FAILED");
+		}
+	}
+
 	err = eblob_json_commit(b);
 	if (err != 0) {
 		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err,
@@ -3055,6 +6201,41 @@ static void *eblob_inspect_thread(void *data) {
 	return NULL;
 }
 
+/**
+ * eblob_inspect_headers() - checks that data header of record addressed by @dc
+ * is the same as its index header.
+ * Returns -EINVAL on mismatch.
+ */
+static int eblob_inspect_headers(struct eblob_base_ctl *bctl, const struct eblob_disk_control *dc,
+		uint64_t index_offset) {
+	struct eblob_disk_control index_dc, data_dc;
+	int err;
+
+	err = __eblob_read_ll(bctl->data_ctl.fd, &data_dc, sizeof(data_dc), dc->position);
+	if (err)
+		goto err_out_exit;
+	eblob_convert_disk_control(&data_dc);
+
+	if (memcmp(dc, &data_dc, sizeof(data_dc)) == 0)
+		return 0;
+
+	/* Record could be rewritten after index block was read - re-read its index header */
+	err = __eblob_read_ll(bctl->index_ctl.fd, &index_dc, sizeof(index_dc), index_offset);
+	if (err)
+		goto err_out_exit;
+	eblob_convert_disk_control(&index_dc);
+
+	if (eblob_index_data_mismatch(bctl, &index_dc, &data_dc))
+		err = -EINVAL;
+
+err_out_exit:
+	if (err)
+		eblob_log(bctl->back->cfg.log, EBLOB_LOG_ERROR, "inspect: i%d: %s: headers check failed: "
+		          "index-offset: %" PRIu64 ", data-offset: %" PRIu64 ": %d\n",
+		          bctl->index, eblob_dump_id(dc->key.id), index_offset, dc->position, err);
+	return err;
+}
+
 /**
  * eblob_inspect_record() - inspects one record addressed by @dc
  */
@@ -3074,6 +6255,14 @@ static int eblob_inspect_record(struct eblob_base_ctl *bctl, struct eblob_disk_c
 	eblob_log(bctl->back->cfg.log, EBLOB_LOG_NOTICE, "inspect: i%d: inspecting record: %s\n", bctl->index,
 	          eblob_dump_id(dc->key.id));
 
+	/*
+	 * Readers with EBLOB_CACHE_META do not read headers, so check here
+	 * that index and data headers are the same.
+	 */
+	err = eblob_inspect_headers(bctl, dc, index_offset);
+	if (err)
+		return err;
+
 	// TODO: there should be more cases, so we can find, fix and/or mark headers' mismatch or invalidity
 	err = eblob_verify_checksum(bctl->back, &dc->key, &wc);
 	if (err == -EILSEQ)
@@ -3125,8 +6314,12 @@ static int eblob_inspect_bctl(struct eblob_base_ctl *bctl) {
 		dc_block_end  = dc_block + (read_size / sizeof(struct eblob_disk_control));
 		for (dc = dc_block; dc < dc_block_end && bctl->back->want_inspect; ++dc) {
 			eblob_convert_disk_control(dc);
-			// skip removed, uncommitted and records without checksum
-			if (dc->flags & (BLOB_DISK_CTL_REMOVE|BLOB_DISK_CTL_UNCOMMITTED|BLOB_DISK_CTL_NOCSUM))
+			// skip removed and uncommitted records, checksum of records without it is skipped by
+			// eblob_verify_checksum() but their headers are still checked
+			if (dc->flags & (BLOB_DISK_CTL_REMOVE|BLOB_DISK_CTL_UNCOMMITTED))
+				continue;
+			// skip entries reserved in the active base but not yet written
+			if (dc->disk_size == 0)
 				continue;
 			block_offset = (void*)dc - (void*)dc_block;
 			err = eblob_inspect_record(bctl, dc, read_offset + block_offset);
@@ -3140,7 +6333,7 @@ static int eblob_inspect_bctl(struct eblob_base_ctl *bctl) {
 }
 
 /**
- * eblob_inspect() - perform checksum verification for all data
+ * eblob_inspect() - perform headers and checksum verification for all data
  */
 int eblob_inspect(struct eblob_backend *b) {
 	int err = 0;
@@ -3166,6 +6359,12 @@ int eblob_inspect(struct eblob_backend *b) {
 
 void eblob_cleanup(struct eblob_backend *b)
 {
+	/* Complete asynchronous requests while backend is fully functional */
+	eblob_aio_destroy(b);
+
+	/* Write buffered records, including ones written by asynchronous requests */
+	eblob_wbuf_destroy(b);
+
 	eblob_event_set(&b->exit_event);
 
 	if (!(b->cfg.blob_flags & EBLOB_DISABLE_THREADS)) {
@@ -3175,12 +6374,19 @@ void eblob_cleanup(struct eblob_backend *b)
 		pthread_join(b->inspect_tid, NULL);
 	}
 
+	eblob_prealloc_destroy(b);
+
 	eblob_json_stat_destroy(b);
 
+	/* Sync records written without waiting for group commit */
+	eblob_gcommit_flush(b);
+	eblob_gcommit_destroy(&b->gcommit);
+
 	eblob_bases_cleanup(b);
 
-	eblob_hash_destroy(&b->hash);
-	eblob_l2hash_destroy(&b->l2hash);
+	eblob_tombstones_destroy(b);
+
+	eblob_cache_destroy(b);
 
 	free(b->base_dir);
 	free(b->cfg.file);
@@ -3287,6 +6493,36 @@ struct eblob_backend *eblob_init(struct eblob_config *c)
 		c->bg_ioprio_class = IOPRIO_CLASS_NONE;
 	}
 
+	if (!c->cache_shards)
+		c->cache_shards = EBLOB_DEFAULT_CACHE_SHARDS;
+	if (c->cache_shards > EBLOB_CACHE_SHARDS_MAX)
+		c->cache_shards = EBLOB_CACHE_SHARDS_MAX;
+
+	if (!c->active_bases)
+		c->active_bases = EBLOB_DEFAULT_ACTIVE_BASES;
+	if (c->active_bases > EBLOB_ACTIVE_BASES_MAX)
+		c->active_bases = EBLOB_ACTIVE_BASES_MAX;
+
+	if (!c->aio_threads)
+		c->aio_threads = EBLOB_DEFAULT_AIO_THREADS;
+
+	if (!c->compress_threshold)
+		c->compress_threshold = EBLOB_DEFAULT_COMPRESS_THRESHOLD;
+
+	if (!c->wbuf_timeout)
+		c->wbuf_timeout = EBLOB_DEFAULT_WBUF_TIMEOUT;
+
+	if (c->spare_base_threshold > 100)
+		c->spare_base_threshold = 0;
+
+	/* Packed cache entries can't address bigger bases */
+	if (c->blob_flags & EBLOB_PACKED_CACHE) {
+		if (c->blob_size > EBLOB_PACKED_OFFSET_MAX / 2)
+			c->blob_size = EBLOB_PACKED_OFFSET_MAX / 2;
+		if (c->records_in_blob > EBLOB_PACKED_RECORDS_MAX / 2)
+			c->records_in_blob = EBLOB_PACKED_RECORDS_MAX / 2;
+	}
+
 	memcpy(&b->cfg, c, sizeof(struct eblob_config));
 
 	b->cfg.file = strdup(c->file);
@@ -3330,25 +6566,29 @@ struct eblob_backend *eblob_init(struct eblob_config *c)
 	INIT_LIST_HEAD(&b->bases);
 	b->max_index = -1;
 
-	err = eblob_l2hash_init(&b->l2hash);
+	err = eblob_cache_init(b);
 	if (err) {
-		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: l2hash initialization failed: %s %d.\n", strerror(-err), err);
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: cache initialization failed: %s %d.\n", strerror(-err), err);
 		goto err_out_lock_destroy;
 	}
 
-	err = eblob_hash_init(&b->hash, sizeof(struct eblob_ram_control));
+	/* Loaded before bases, as they are checked against tombstones while being loaded */
+	err = eblob_tombstones_init(b);
 	if (err) {
-		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: hash initialization failed: %s %d.\n", strerror(-err), err);
-		goto err_out_l2hash_destroy;
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: tombstones initialization failed: %s %d.\n", strerror(-err), err);
+		goto err_out_cache_destroy;
 	}
 
 	err = eblob_load_data(b);
 	if (err) {
 		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: index iteration failed: %d.\n", err);
-		goto err_out_hash_destroy;
+		goto err_out_tombstones_destroy;
 	}
 	eblob_stat_summary_update(b);
 
+	/* Tombstones of bases that do not exist anymore */
+	eblob_tombstones_drop(b, NULL);
+
 	err = eblob_event_init(&b->exit_event);
 	if (err != 0)
 		goto err_out_cleanup;
@@ -3369,10 +6609,26 @@ struct eblob_backend *eblob_init(struct eblob_config *c)
 	if (err != 0)
 		goto err_out_periodic_lock_destroy;
 
-	err = eblob_json_stat_init(b);
+	err = eblob_gcommit_init(&b->gcommit);
 	if (err != 0)
 		goto err_out_inspect_lock_destroy;
 
+	err = eblob_aio_init(&b->aio);
+	if (err != 0)
+		goto err_out_gcommit_destroy;
+
+	err = eblob_prealloc_init(b);
+	if (err != 0)
+		goto err_out_aio_destroy;
+
+	err = eblob_wbuf_init(b);
+	if (err != 0)
+		goto err_out_prealloc_destroy;
+
+	err = eblob_json_stat_init(b);
+	if (err != 0)
+		goto err_out_wbuf_destroy;
+
 	if (!(b->cfg.blob_flags & EBLOB_DISABLE_THREADS)) {
 		err = pthread_create(&b->sync_tid, NULL, eblob_sync_thread, b);
 		if (err) {
@@ -3413,6 +6669,14 @@ err_out_join_sync:
 	pthread_join(b->sync_tid, NULL);
 err_out_json_stat_destroy:
 	eblob_json_stat_destroy(b);
+err_out_wbuf_destroy:
+	eblob_wbuf_destroy(b);
+err_out_prealloc_destroy:
+	eblob_prealloc_destroy(b);
+err_out_aio_destroy:
+	eblob_aio_destroy(b);
+err_out_gcommit_destroy:
+	eblob_gcommit_destroy(&b->gcommit);
 err_out_inspect_lock_destroy:
 	pthread_mutex_destroy(&b->inspect_lock);
 err_out_periodic_lock_destroy:
@@ -3425,10 +6689,10 @@ err_out_exit_event_destroy:
 	eblob_event_destroy(&b->exit_event);
 err_out_cleanup:
 	eblob_bases_cleanup(b);
-err_out_l2hash_destroy:
-	eblob_l2hash_destroy(&b->l2hash);
-err_out_hash_destroy:
-	eblob_hash_destroy(&b->hash);
+err_out_tombstones_destroy:
+	eblob_tombstones_destroy(b);
+err_out_cache_destroy:
+	eblob_cache_destroy(b);
 err_out_lock_destroy:
 	pthread_mutex_destroy(&b->lock);
 err_out_lockf:
@@ -3568,16 +6832,15 @@ static void eblob_mark_entry_corrupted(struct eblob_backend *b, struct eblob_key
 		goto err_out_release_bctl;
 	}
 
+	eblob_cache_update_flags(b, key, bctl, wc->ctl_data_offset, wc->flags | BLOB_DISK_CTL_CORRUPTED);
+
 	const int64_t record_size = wc->total_size + sizeof(struct eblob_disk_control);
 	eblob_stat_inc(bctl->stat, EBLOB_LST_RECORDS_CORRUPTED);
 	eblob_stat_add(bctl->stat, EBLOB_LST_CORRUPTED_SIZE, record_size);
 	eblob_stat_inc(b->stat_summary, EBLOB_LST_RECORDS_CORRUPTED);
 	eblob_stat_add(b->stat_summary, EBLOB_LST_CORRUPTED_SIZE, record_size);
 
-	if (!b->cfg.sync) {
-		eblob_fdatasync(wc->index_fd);
-		eblob_fdatasync(wc->data_fd);
-	}
+	eblob_sync_record(b, wc->data_fd, wc->index_fd, 0);
 
 err_out_release_bctl:
 	if (!wc->bctl)
@@ -3586,7 +6849,13 @@ err_out:
 	return;
 }
 
-int eblob_verify_checksum(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc) {
+/**
+ * eblob_verify_checksum_data() - verifies checksum of entry pointed by @wc
+ * using @data, its @wc->size bytes at @wc->offset that were just read,
+ * instead of reading them from disk again.
+ */
+int eblob_verify_checksum_data(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
+		const void *data) {
 	if (b->cfg.blob_flags & EBLOB_NO_FOOTER ||
 	    wc->flags & (BLOB_DISK_CTL_NOCSUM | BLOB_DISK_CTL_REMOVE | BLOB_DISK_CTL_UNCOMMITTED))
 		return 0;
@@ -3595,7 +6864,8 @@ int eblob_verify_checksum(struct eblob_backend *b, struct eblob_key *key, struct
 
 	// TODO(shaitan): check if record already marked as corrupted and return -EILSEQ
 
-	if (wc->total_size <= wc->total_data_size + sizeof(struct eblob_disk_control)) {
+	if (!(wc->flags & BLOB_DISK_CTL_CHAINED) &&
+	    wc->total_size <= wc->total_data_size + sizeof(struct eblob_disk_control)) {
 		err = -EINVAL;
 		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: %i: %s: %s: record doesn't have valid footer: "
 		                                       "total_size: %" PRIu64 ", total_data_size + eblob_disk_control: %" PRIu64,
@@ -3607,10 +6877,13 @@ int eblob_verify_checksum(struct eblob_backend *b, struct eblob_key *key, struct
 
 	HANDY_TIMER_SCOPE(("eblob.%u.verify_checksum", b->cfg.stat_id));
 
-	if (wc->flags & BLOB_DISK_CTL_CHUNKED_CSUM)
-		err = eblob_verify_mmhash(b, key, wc);
+	/* Chained record has checksums of its extents in chain header instead of footer */
+	if (wc->flags & BLOB_DISK_CTL_CHAINED)
+		err = eblob_chain_verify_checksum(wc);
+	else if (wc->flags & BLOB_DISK_CTL_CHUNKED_CSUM)
+		err = eblob_verify_mmhash(b, key, wc, data);
 	else
-		err = eblob_verify_sha512(b, key, wc);
+		err = eblob_verify_sha512(b, key, wc, data);
 
 	if (err == -EILSEQ)
 		eblob_mark_entry_corrupted(b, key, wc);
@@ -3622,6 +6895,10 @@ int eblob_verify_checksum(struct eblob_backend *b, struct eblob_key *key, struct
 	return err;
 }
 
+int eblob_verify_checksum(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc) {
+	return eblob_verify_checksum_data(b, key, wc, NULL);
+}
+
 int eblob_set_name(const char *format, ...) {
 	char name[16 + 1];
 	memset(name, 0, sizeof(name));
@@ -22,10 +22,17 @@
 #define __EBLOB_BLOB_H
 #include "datasort.h"
 #include "eblob/blob.h"
+#include "aio.h"
+#include "compress.h"
+#include "gcommit.h"
 #include "hash.h"
 #include "l2hash.h"
+#include "ohash.h"
+#include "prealloc.h"
 #include "list.h"
 #include "stat.h"
+#include "tombstone.h"
+#include "wbuf.h"
 
 #include <sys/statvfs.h>
 
@@ -33,6 +40,7 @@
 #include <errno.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stdint.h>
 
@@ -83,10 +91,60 @@ extern "C" {
 #define EBLOB_DEFAULT_DEFRAG_SPLAY		(3)
 #define EBLOB_DEFAULT_DEFRAG_MIN_TIMEOUT	(60)
 #define EBLOB_DEFAULT_PERIODIC_THREAD_TIMEOUT	(15)
+/* How often records written with BLOB_DISK_CTL_NOSYNC are synced at least */
+#define EBLOB_GCOMMIT_FLUSH_TIMEOUT		(1)
+/* Record is written as header, up to EBLOB_IOVCNT_MAX iovecs and footer */
+#define EBLOB_WRITEV_SEGS_MAX			(EBLOB_IOVCNT_MAX + 2)
+#define EBLOB_DEFAULT_CACHE_SHARDS		(32)
+/* Shards are selected by 16-bit key prefix */
+#define EBLOB_CACHE_SHARDS_MAX			(1 << 16)
+#define EBLOB_DEFAULT_ACTIVE_BASES		(1)
+#define EBLOB_ACTIVE_BASES_MAX			(64)
+#define EBLOB_DEFAULT_AIO_THREADS		(4)
+#define EBLOB_DEFAULT_COMPRESS_THRESHOLD	(512)
+#define EBLOB_DEFAULT_WBUF_TIMEOUT		(100)
+/* Alignment of records, offsets and buffers of O_DIRECT I/O */
+#define EBLOB_DIRECT_IO_ALIGN			(4096)
+/* Upper bound of space reserved ahead by append to BLOB_DISK_CTL_CHAINED record */
+#define EBLOB_CHAIN_EXTENT_MAX			(16 * EBLOB_1_M)
+/* eblob_read_multi() reads over gaps up to that size between records instead of issuing another syscall */
+#define EBLOB_READ_MULTI_GAP_MAX		(64 * 1024)
+/* Limits of EBLOB_PACKED_CACHE encoding */
+#define EBLOB_CACHE_SLOTS_MAX			(1 << 16)
+#define EBLOB_PACKED_OFFSET_MAX			(1ULL << 40)
+#define EBLOB_PACKED_RECORDS_MAX		(1ULL << 32)
+
+/* Record flags that fit into packed entry with EBLOB_CACHE_META */
+#define EBLOB_PACKED_FLAGS_MAX			(1ULL << 24)
+
+/*
+ * Packed form of struct eblob_ram_control used with EBLOB_PACKED_CACHE:
+ * @lo:		data offset (bits 0-39), base slot (40-55), size bits 32-39 (56-63)
+ * @hi:		index offset in records (bits 0-31), size bits 0-31 (32-63)
+ * @meta:	disk size (bits 0-39), record flags (40-63), present only with
+ *		EBLOB_CACHE_META
+ */
+struct eblob_ram_control_packed {
+	uint64_t		lo, hi;
+	uint64_t		meta;
+};
+
+/*
+ * Record metadata kept in cache with EBLOB_CACHE_META, the same as in record
+ * headers on disk. Zero @disk_size means that metadata is unknown and headers
+ * should be read from disk.
+ */
+struct eblob_ram_meta {
+	uint64_t		flags;
+	uint64_t		disk_size;
+};
+
+/* Unpacked cache entry with EBLOB_CACHE_META */
+struct eblob_ram_control_meta {
+	struct eblob_ram_control	rctl;
+	struct eblob_ram_meta		meta;
+};
 
-/* Size of one entry in cache */
-static const size_t EBLOB_HASH_ENTRY_SIZE = sizeof(struct eblob_ram_control)
-	+ sizeof(struct eblob_hash_entry);
 /* Approx. size of l2hash entry (considering there wasn't a collision) */
 static const size_t EBLOB_L2HASH_ENTRY_SIZE = sizeof(struct eblob_l2hash_entry);
 
@@ -145,6 +203,18 @@ struct eblob_base_ctl {
 	struct eblob_file_ctl	data_ctl;
 	struct eblob_file_ctl	index_ctl;
 
+	/* O_DIRECT descriptor of data file if cfg.direct_io_threshold is set, -1 otherwise */
+	int			direct_fd;
+
+	/*
+	 * Ends of extents of data and index files preallocated in background,
+	 * see prealloc.c. Zero if nothing is preallocated.
+	 */
+	uint64_t		prealloc_data_end;
+	uint64_t		prealloc_index_end;
+	/* Preallocation thread was woken up to create spare base for this one */
+	int			spare_kicked;
+
 	/*
 	 * Bloom
 	 */
@@ -160,9 +230,22 @@ struct eblob_base_ctl {
 	/* Number of bctl users inside a critical section */
 	int			critness;
 
+	/*
+	 * Number of runtime iterations that pinned the base, defrag neither sorts
+	 * nor removes pinned bases. Incremented under @back->lock and @lock,
+	 * decremented under @lock.
+	 */
+	int			iterators;
+
+	/* Index in @back->cache_slots with EBLOB_PACKED_CACHE, -1 if not assigned */
+	int			cache_slot;
+
 	/* Binary log rudiment: if enabled stores key removals in list */
 	struct eblob_binlog_cfg	binlog;
 
+	/* zstd dictionary of the base trained by data-sort or NULL */
+	struct eblob_compress_dict	*dict;
+
 	/* Per bctl aka "local" stats */
 	struct eblob_stat	*stat;
 	char			name[];
@@ -377,6 +460,21 @@ inline static void eblob_iovec_get_bounds(struct eblob_iovec_bounds *bounds,
 	}
 }
 
+/*!
+ * Gets offset of \a iov within record data pointed by \a wc, \a first is
+ * set for 0th iov.
+ * NB! Extended records keep 0th iov at the beginning of the record.
+ */
+__attribute_always_inline__
+inline static uint64_t eblob_iovec_data_offset(const struct eblob_write_control *wc,
+		const struct eblob_iovec *iov, int first)
+{
+	if (first && (wc->flags & BLOB_DISK_CTL_EXTHDR))
+		return 0;
+
+	return wc->data_offset - wc->ctl_data_offset - sizeof(struct eblob_disk_control) + iov->offset;
+}
+
 /* Analogue of posix_fadvise POSIX_FADV_WILLNEED */
 #define EBLOB_FLAGS_HINT_WILLNEED (1<<0)
 /* Analogue of posix_fadvise POSIX_FADV_DONTNEED */
@@ -388,6 +486,7 @@ void eblob_base_ctl_cleanup(struct eblob_base_ctl *ctl);
 int _eblob_base_ctl_cleanup(struct eblob_base_ctl *ctl);
 
 int eblob_base_setup_data(struct eblob_base_ctl *ctl, int force);
+void eblob_base_open_direct(struct eblob_backend *b, struct eblob_base_ctl *ctl, const char *path);
 
 int eblob_want_defrag(struct eblob_base_ctl *bctl);
 
@@ -407,6 +506,32 @@ int eblob_event_wait(struct eblob_event *event, long timeout);
 
 struct json_stat_cache;
 
+/*
+ * One shard of in-memory cache.
+ * @hash.root_lock protects @hash, @l2hash and @ohash of the shard.
+ */
+struct eblob_cache_shard {
+	/* In memory cache */
+	struct eblob_hash	hash;
+	/* Level two hash table */
+	struct eblob_l2hash	l2hash;
+	/* Open-addressing cache, used instead of @hash if EBLOB_OHASH is set */
+	struct eblob_ohash	ohash;
+};
+
+/*
+ * Base slot of EBLOB_PACKED_CACHE: packed entries reference bases by slot
+ * number. Slot can be reused by another base only when base is cleaned up
+ * and there are no entries referencing it.
+ */
+struct eblob_cache_slot {
+	struct eblob_base_ctl	*bctl;
+	/* Number of cache entries referencing this slot */
+	int64_t			refs;
+	/* Set by _eblob_base_ctl_cleanup() */
+	int			retired;
+};
+
 struct eblob_backend {
 	struct eblob_config	cfg;
 
@@ -414,11 +539,19 @@ struct eblob_backend {
 
 	struct list_head	bases;
 	int			max_index;
+	/*
+	 * Bases new records are written to, first @cfg.active_bases slots
+	 * are used. Slot is NULL until the first write to it.
+	 * NB! Modified only under @lock, but read locklessly by writers and
+	 * defrag, so use eblob_active_base()/eblob_active_base_set().
+	 */
+	struct eblob_base_ctl	*active_bases[EBLOB_ACTIVE_BASES_MAX];
 
-	/* In memory cache */
-	struct eblob_hash	hash;
-	/* Level two hash table */
-	struct eblob_l2hash	l2hash;
+	/* In memory cache split into @cfg.cache_shards shards */
+	struct eblob_cache_shard	*cache_shards;
+	/* Base slots used with EBLOB_PACKED_CACHE, protected by @cache_slots_lock */
+	struct eblob_cache_slot		*cache_slots;
+	pthread_mutex_t			cache_slots_lock;
 
 	/* Threads exit event */
 	struct eblob_event	exit_event;
@@ -428,6 +561,21 @@ struct eblob_backend {
 	pthread_mutex_t		periodic_lock;
 	pthread_mutex_t		inspect_lock;
 
+	/* Group commit of operations when @cfg.sync is zero */
+	struct eblob_gcommit	gcommit;
+
+	/* Engine of asynchronous requests */
+	struct eblob_aio	aio;
+
+	/* Background preallocation of active bases */
+	struct eblob_prealloc	prealloc;
+
+	/* Journal of removes not yet marked in bases */
+	struct eblob_tombstones	tombstones;
+
+	/* Buffer of small records not written yet */
+	struct eblob_wbuf	wbuf;
+
 	pthread_t		defrag_tid;
 	pthread_t		sync_tid;
 	pthread_t		periodic_tid;
@@ -468,6 +616,8 @@ struct eblob_backend {
 	struct json_stat_cache *json_stat;
 	/* generation counter that is incremented by defrag/data-sort
 	 * it is used for determining that blob has been defraged
+	 * NB! Modified only under @lock, but read locklessly on read path,
+	 * so use eblob_defrag_generation()/eblob_defrag_generation_inc().
 	 */
 	size_t		defrag_generation;
 
@@ -478,17 +628,33 @@ struct eblob_backend {
 	int			want_inspect;
 };
 
-int eblob_add_new_base(struct eblob_backend *b);
+int eblob_add_new_base(struct eblob_backend *b, unsigned int slot);
+struct eblob_base_ctl *eblob_add_spare_base(struct eblob_backend *b, int *errp);
 int eblob_load_data(struct eblob_backend *b);
 void eblob_bases_cleanup(struct eblob_backend *b);
 
-int eblob_cache_lookup(struct eblob_backend *b, struct eblob_key *key, struct eblob_ram_control *res, int *diskp);
+int eblob_cache_init(struct eblob_backend *b);
+void eblob_cache_destroy(struct eblob_backend *b);
+int eblob_cache_empty(struct eblob_backend *b);
+int eblob_cache_lock_shards(struct eblob_backend *b, const struct eblob_disk_control *dcs,
+		uint64_t count, unsigned char **lockedp);
+void eblob_cache_unlock_shards(struct eblob_backend *b, unsigned char *locked);
+int eblob_cache_lookup(struct eblob_backend *b, struct eblob_key *key, struct eblob_ram_control *res,
+		struct eblob_ram_meta *meta, int *diskp);
 int eblob_cache_remove(struct eblob_backend *b, struct eblob_key *key);
 int eblob_cache_remove_nolock(struct eblob_backend *b, struct eblob_key *key);
 int eblob_cache_insert(struct eblob_backend *b, struct eblob_key *key,
-		struct eblob_ram_control *ctl);
+		struct eblob_ram_control *ctl, const struct eblob_ram_meta *meta);
+int eblob_cache_insert_batch(struct eblob_backend *b, struct eblob_disk_control *dcs,
+		struct eblob_ram_control *ctls, const struct eblob_ram_meta *metas,
+		uint64_t count, int *errors);
+int eblob_cache_update_flags(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_base_ctl *bctl, uint64_t data_offset, uint64_t flags);
+void eblob_cache_unpack(struct eblob_backend *b, const struct eblob_ram_control_packed *p,
+		struct eblob_ram_control *rctl, struct eblob_ram_meta *meta);
+void eblob_cache_slot_retire(struct eblob_base_ctl *bctl);
 int eblob_disk_index_lookup(struct eblob_backend *b, struct eblob_key *key,
-		struct eblob_ram_control *rctl);
+		struct eblob_ram_control *rctl, struct eblob_ram_meta *meta);
 
 /*
  * sorted_index_bsearch_raw() - bsearch disk control of \a key in sorted index \a base
@@ -518,7 +684,9 @@ int eblob_index_blocks_destroy(struct eblob_base_ctl *bctl);
 
 int eblob_index_blocks_fill(struct eblob_base_ctl *bctl);
 int __eblob_write_ll(int fd, const void *data, size_t size, off_t offset);
+int __eblob_writev_ll(int fd, const struct eblob_iovec *seg, unsigned int num, unsigned int *syscalls);
 int __eblob_read_ll(int fd, void *data, size_t size, off_t offset);
+int __eblob_readv_ll(int fd, const struct eblob_iovec *seg, unsigned int num, unsigned int *syscalls);
 
 struct eblob_disk_search_stat {
 	int			loops;			// number of bctls checked
@@ -546,11 +714,27 @@ int eblob_disk_control_sort_with_flags(const void *d1, const void *d2);
 
 int eblob_copy_data(int fd_in, uint64_t off_in, int fd_out, uint64_t off_out, ssize_t len);
 int eblob_splice_data(int fd_in, uint64_t off_in, int fd_out, uint64_t off_out, ssize_t len);
+int eblob_chain_copy(int fd_in, const struct eblob_chain_header *chain, int fd_out, uint64_t off_out);
+int eblob_chain_verify(int fd, const struct eblob_chain_header *chain);
+
+/* Data-sort helpers of BLOB_DISK_CTL_COMPRESSED records */
+int eblob_compress_read_record(struct eblob_backend *b, struct eblob_base_ctl *bctl,
+		const struct eblob_disk_control *dc, int fd, uint64_t data_offset,
+		void **data, uint64_t *size);
+int eblob_compress_reencode(struct eblob_backend *b, struct eblob_base_ctl *bctl,
+		const struct eblob_compress_dict *dict, struct eblob_disk_control *dc,
+		int fd, uint64_t data_offset, struct eblob_iovec *data, struct eblob_iovec *footer,
+		struct eblob_compress_stat *zs);
 
 int eblob_preallocate(int fd, off_t offset, off_t size);
 int eblob_pagecache_hint(int fd, uint64_t flag);
 
 int eblob_mark_index_removed(int fd, uint64_t offset);
+/* eblob_write_batch() that bypasses write buffer */
+int eblob_write_batch_ll(struct eblob_backend *b, struct eblob_key *keys,
+		const struct eblob_iovec *iov, uint32_t num, uint64_t flags, int *errors);
+int eblob_verify_checksum_data(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
+		const void *data);
 void eblob_base_wait(struct eblob_base_ctl *bctl);
 void eblob_base_wait_locked(struct eblob_base_ctl *bctl);
 
@@ -579,6 +763,92 @@ static inline const char *eblob_want_defrag_string(int want_defrag)
 	}
 }
 
+/*
+ * eblob_defrag_generation() - lockless read of @b->defrag_generation.
+ */
+static inline size_t eblob_defrag_generation(struct eblob_backend *b)
+{
+	return __atomic_load_n(&b->defrag_generation, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * eblob_defrag_generation_inc() - bumps @b->defrag_generation, should be
+ * called with @b->lock and locks of all affected bctls held.
+ */
+static inline void eblob_defrag_generation_inc(struct eblob_backend *b)
+{
+	__atomic_add_fetch(&b->defrag_generation, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * eblob_active_base() - lockless read of active base in @slot.
+ */
+static inline struct eblob_base_ctl *eblob_active_base(struct eblob_backend *b, unsigned int slot)
+{
+	return __atomic_load_n(&b->active_bases[slot], __ATOMIC_ACQUIRE);
+}
+
+/*
+ * eblob_active_base_set() - switches writers of @slot to @bctl, should be
+ * called with @b->lock held.
+ */
+static inline void eblob_active_base_set(struct eblob_backend *b, unsigned int slot,
+		struct eblob_base_ctl *bctl)
+{
+	__atomic_store_n(&b->active_bases[slot], bctl, __ATOMIC_RELEASE);
+}
+
+/*
+ * eblob_active_base_slot() - selects active base @key is written to.
+ * Bytes after 16-bit prefix are used, so slots are not correlated with cache
+ * shards.
+ */
+static inline unsigned int eblob_active_base_slot(struct eblob_backend *b, const struct eblob_key *key)
+{
+	uint32_t hash;
+
+	if (b->cfg.active_bases == 1)
+		return 0;
+
+	memcpy(&hash, key->id + sizeof(uint16_t), sizeof(hash));
+	return hash % b->cfg.active_bases;
+}
+
+/*
+ * eblob_base_is_active() - checks whether records are still written to @bctl.
+ * Base is made active before it's added to @b->bases and never becomes active
+ * again, so it's safe to check this while walking bases without @b->lock.
+ */
+static inline int eblob_base_is_active(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->cfg.active_bases; ++i)
+		if (eblob_active_base(b, i) == bctl)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * eblob_cache_shard_index() - returns index of RAM index shard for key @id.
+ * Shards are selected by key prefix so that keys order is preserved across
+ * shards, which is used by range requests.
+ */
+static inline unsigned int eblob_cache_shard_index(const struct eblob_backend *b,
+		const unsigned char *id)
+{
+	const uint32_t prefix = ((uint32_t)id[0] << 8) | id[1];
+
+	return (prefix * b->cfg.cache_shards) >> 16;
+}
+
+static inline struct eblob_cache_shard *eblob_cache_shard(struct eblob_backend *b,
+		const struct eblob_key *key)
+{
+	return &b->cache_shards[eblob_cache_shard_index(b, key->id)];
+}
+
 /* Min/Max macros */
 #define EBLOB_MIN(a,b) ((a) < (b) ? (a) : (b))
 #define EBLOB_MAX(a,b) ((a) > (b) ? (a) : (b))
@@ -0,0 +1,467 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Per-record compression.
+ *
+ * Data of BLOB_DISK_CTL_COMPRESSED record is compressed as a whole, so any
+ * read of such record uncompresses it entirely. zstd may use dictionary of
+ * the base trained by data-sort, it helps small records a lot since they do
+ * not have enough data to build their own statistics.
+ *
+ * Compression contexts are per thread and live until thread exits.
+ */
+
+#include "features.h"
+
+#include "blob.h"
+#include "compress.h"
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
+
+/* zstd level records are compressed with */
+#define EBLOB_COMPRESS_ZSTD_LEVEL	(3)
+
+static uint64_t eblob_thread_cpu_usecs(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == -1)
+		return 0;
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+#ifdef HAVE_ZSTD
+struct eblob_zstd_ctx {
+	ZSTD_CCtx	*cctx;
+	ZSTD_DCtx	*dctx;
+};
+
+static pthread_key_t eblob_zstd_key;
+static pthread_once_t eblob_zstd_once = PTHREAD_ONCE_INIT;
+static int eblob_zstd_key_err;
+
+static void eblob_zstd_ctx_free(void *data)
+{
+	struct eblob_zstd_ctx *ctx = data;
+
+	ZSTD_freeCCtx(ctx->cctx);
+	ZSTD_freeDCtx(ctx->dctx);
+	free(ctx);
+}
+
+static void eblob_zstd_key_init(void)
+{
+	eblob_zstd_key_err = -pthread_key_create(&eblob_zstd_key, eblob_zstd_ctx_free);
+}
+
+/*
+ * eblob_zstd_ctx() - returns zstd contexts of current thread, creating them
+ * on first use.
+ */
+static struct eblob_zstd_ctx *eblob_zstd_ctx(void)
+{
+	struct eblob_zstd_ctx *ctx;
+
+	pthread_once(&eblob_zstd_once, eblob_zstd_key_init);
+	if (eblob_zstd_key_err)
+		return NULL;
+
+	ctx = pthread_getspecific(eblob_zstd_key);
+	if (ctx != NULL)
+		return ctx;
+
+	ctx = calloc(1, sizeof(struct eblob_zstd_ctx));
+	if (ctx == NULL)
+		return NULL;
+	ctx->cctx = ZSTD_createCCtx();
+	ctx->dctx = ZSTD_createDCtx();
+	if (ctx->cctx == NULL || ctx->dctx == NULL || pthread_setspecific(eblob_zstd_key, ctx)) {
+		eblob_zstd_ctx_free(ctx);
+		return NULL;
+	}
+	return ctx;
+}
+#endif /* HAVE_ZSTD */
+
+int eblob_compress_algorithm(const struct eblob_backend *b)
+{
+#ifdef HAVE_ZSTD
+	if (b->cfg.blob_flags & EBLOB_COMPRESS_ZSTD)
+		return EBLOB_COMPRESS_ALGORITHM_ZSTD;
+#endif
+#ifdef HAVE_LZ4
+	if (b->cfg.blob_flags & EBLOB_COMPRESS_LZ4)
+		return EBLOB_COMPRESS_ALGORITHM_LZ4;
+#endif
+	(void)b;
+	return 0;
+}
+
+int eblob_compress(int algorithm, const struct eblob_compress_dict *dict,
+		const void *src, uint64_t size, void **dst, uint64_t *dst_size, uint64_t *usecs)
+{
+	const uint64_t start = eblob_thread_cpu_usecs();
+	struct eblob_compress_header *hdr;
+	uint64_t bound, packed;
+	void *buf;
+	int err = -ENOTSUP;
+
+	/* Not used if eblob was built without the libraries */
+	(void)dict;
+	(void)src;
+
+	switch (algorithm) {
+#ifdef HAVE_LZ4
+	case EBLOB_COMPRESS_ALGORITHM_LZ4:
+		if (size > LZ4_MAX_INPUT_SIZE)
+			return -E2BIG;
+		bound = LZ4_compressBound(size);
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case EBLOB_COMPRESS_ALGORITHM_ZSTD:
+		bound = ZSTD_compressBound(size);
+		break;
+#endif
+	default:
+		return -ENOTSUP;
+	}
+
+	buf = malloc(sizeof(struct eblob_compress_header) + bound);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	hdr = buf;
+	memset(hdr, 0, sizeof(struct eblob_compress_header));
+	hdr->algorithm = algorithm;
+	hdr->size = size;
+
+	switch (algorithm) {
+#ifdef HAVE_LZ4
+	case EBLOB_COMPRESS_ALGORITHM_LZ4: {
+		int ret = LZ4_compress_default(src, (char *)(hdr + 1), size, bound);
+
+		err = -EINVAL;
+		if (ret <= 0)
+			goto err_out_free;
+		packed = ret;
+		break;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case EBLOB_COMPRESS_ALGORITHM_ZSTD: {
+		struct eblob_zstd_ctx *ctx = eblob_zstd_ctx();
+		size_t ret;
+
+		err = -ENOMEM;
+		if (ctx == NULL)
+			goto err_out_free;
+
+		if (dict != NULL) {
+			ret = ZSTD_compress_usingCDict(ctx->cctx, hdr + 1, bound, src, size, dict->cdict);
+			hdr->dict_id = dict->id;
+		} else {
+			ret = ZSTD_compressCCtx(ctx->cctx, hdr + 1, bound, src, size, EBLOB_COMPRESS_ZSTD_LEVEL);
+		}
+
+		err = -EINVAL;
+		if (ZSTD_isError(ret))
+			goto err_out_free;
+		packed = ret;
+		break;
+	}
+#endif
+	default:
+		goto err_out_free;
+	}
+
+	*usecs += eblob_thread_cpu_usecs() - start;
+
+	err = -E2BIG;
+	if (sizeof(struct eblob_compress_header) + packed >= size)
+		goto err_out_free;
+
+	eblob_convert_compress_header(hdr);
+	*dst = buf;
+	*dst_size = sizeof(struct eblob_compress_header) + packed;
+	return 0;
+
+err_out_free:
+	free(buf);
+	return err;
+}
+
+int64_t eblob_decompressed_size(const void *src, uint64_t size)
+{
+	struct eblob_compress_header hdr;
+
+	if (size < sizeof(struct eblob_compress_header))
+		return -EILSEQ;
+
+	memcpy(&hdr, src, sizeof(struct eblob_compress_header));
+	eblob_convert_compress_header(&hdr);
+	if (hdr.size > INT64_MAX)
+		return -EILSEQ;
+	return hdr.size;
+}
+
+int eblob_decompress(const struct eblob_compress_dict *dict, const void *src, uint64_t size,
+		void **dst, uint64_t *dst_size, uint64_t *usecs)
+{
+	const uint64_t start = eblob_thread_cpu_usecs();
+	const unsigned char *packed = (const unsigned char *)src + sizeof(struct eblob_compress_header);
+	struct eblob_compress_header hdr;
+	void *buf;
+	int err;
+
+	if (size < sizeof(struct eblob_compress_header))
+		return -EILSEQ;
+
+	memcpy(&hdr, src, sizeof(struct eblob_compress_header));
+	eblob_convert_compress_header(&hdr);
+	size -= sizeof(struct eblob_compress_header);
+
+	if (hdr.size > INT64_MAX)
+		return -EILSEQ;
+
+	buf = malloc(hdr.size ? hdr.size : 1);
+	if (buf == NULL)
+		return -ENOMEM;
+
+	err = -EILSEQ;
+	switch (hdr.algorithm) {
+#ifdef HAVE_LZ4
+	case EBLOB_COMPRESS_ALGORITHM_LZ4: {
+		int ret;
+
+		if (hdr.dict_id != 0 || hdr.size > LZ4_MAX_INPUT_SIZE || size > LZ4_MAX_INPUT_SIZE)
+			goto err_out_free;
+		ret = LZ4_decompress_safe((const char *)packed, buf, size, hdr.size);
+		if (ret < 0 || (uint64_t)ret != hdr.size)
+			goto err_out_free;
+		break;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	case EBLOB_COMPRESS_ALGORITHM_ZSTD: {
+		struct eblob_zstd_ctx *ctx = eblob_zstd_ctx();
+		size_t ret;
+
+		if (ctx == NULL) {
+			err = -ENOMEM;
+			goto err_out_free;
+		}
+
+		if (hdr.dict_id != 0) {
+			if (dict == NULL || dict->id != hdr.dict_id)
+				goto err_out_free;
+			ret = ZSTD_decompress_usingDDict(ctx->dctx, buf, hdr.size, packed, size, dict->ddict);
+		} else {
+			ret = ZSTD_decompressDCtx(ctx->dctx, buf, hdr.size, packed, size);
+		}
+		if (ZSTD_isError(ret) || ret != hdr.size)
+			goto err_out_free;
+		break;
+	}
+#endif
+	default:
+		(void)dict;
+		(void)packed;
+		err = -ENOTSUP;
+		goto err_out_free;
+	}
+
+	*usecs += eblob_thread_cpu_usecs() - start;
+	*dst = buf;
+	*dst_size = hdr.size;
+	return 0;
+
+err_out_free:
+	free(buf);
+	return err;
+}
+
+#ifdef HAVE_ZSTD
+/*
+ * eblob_compress_dict_new() - wraps raw zstd dictionary @data of @size bytes,
+ * takes ownership of @data on success.
+ */
+static int eblob_compress_dict_new(void *data, size_t size, struct eblob_compress_dict **dictp)
+{
+	struct eblob_compress_dict *dict;
+
+	dict = calloc(1, sizeof(struct eblob_compress_dict));
+	if (dict == NULL)
+		return -ENOMEM;
+
+	dict->id = ZSTD_getDictID_fromDict(data, size);
+	if (dict->id == 0) {
+		free(dict);
+		return -EILSEQ;
+	}
+
+	dict->cdict = ZSTD_createCDict(data, size, EBLOB_COMPRESS_ZSTD_LEVEL);
+	dict->ddict = ZSTD_createDDict(data, size);
+	if (dict->cdict == NULL || dict->ddict == NULL) {
+		ZSTD_freeCDict(dict->cdict);
+		ZSTD_freeDDict(dict->ddict);
+		free(dict);
+		return -ENOMEM;
+	}
+
+	dict->data = data;
+	dict->size = size;
+	*dictp = dict;
+	return 0;
+}
+#endif /* HAVE_ZSTD */
+
+int eblob_compress_dict_train(const void *samples, const size_t *sizes, unsigned int num,
+		struct eblob_compress_dict **dict)
+{
+#ifdef HAVE_ZSTD
+	void *data;
+	size_t ret;
+	int err;
+
+	if (num < EBLOB_COMPRESS_DICT_SAMPLES_MIN)
+		return -ENODATA;
+
+	data = malloc(EBLOB_COMPRESS_DICT_SIZE);
+	if (data == NULL)
+		return -ENOMEM;
+
+	ret = ZDICT_trainFromBuffer(data, EBLOB_COMPRESS_DICT_SIZE, samples, sizes, num);
+	if (ZDICT_isError(ret)) {
+		err = -ENODATA;
+		goto err_out_free;
+	}
+
+	err = eblob_compress_dict_new(data, ret, dict);
+	if (err)
+		goto err_out_free;
+	return 0;
+
+err_out_free:
+	free(data);
+	return err;
+#else
+	(void)samples;
+	(void)sizes;
+	(void)num;
+	(void)dict;
+	return -ENOTSUP;
+#endif
+}
+
+int eblob_compress_dict_load(const char *path, struct eblob_compress_dict **dict)
+{
+#ifdef HAVE_ZSTD
+	struct stat st;
+	void *data = NULL;
+	int fd, err;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+
+	if (fstat(fd, &st) == -1) {
+		err = -errno;
+		goto err_out_close;
+	}
+
+	err = -EILSEQ;
+	if (st.st_size == 0 || st.st_size > 16 * EBLOB_COMPRESS_DICT_SIZE)
+		goto err_out_close;
+
+	err = -ENOMEM;
+	data = malloc(st.st_size);
+	if (data == NULL)
+		goto err_out_close;
+
+	err = __eblob_read_ll(fd, data, st.st_size, 0);
+	if (err)
+		goto err_out_free;
+
+	err = eblob_compress_dict_new(data, st.st_size, dict);
+	if (err)
+		goto err_out_free;
+
+	close(fd);
+	return 0;
+
+err_out_free:
+	free(data);
+err_out_close:
+	close(fd);
+	return err;
+#else
+	/* Records compressed with dictionary can't be read anyway */
+	(void)dict;
+	if (access(path, F_OK) == -1)
+		return -errno;
+	return -ENOTSUP;
+#endif
+}
+
+int eblob_compress_dict_save(const struct eblob_compress_dict *dict, const char *path)
+{
+	int fd, err;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -errno;
+
+	err = __eblob_write_ll(fd, dict->data, dict->size, 0);
+	if (!err)
+		err = eblob_fdatasync(fd);
+
+	close(fd);
+	if (err)
+		unlink(path);
+	return err;
+}
+
+void eblob_compress_dict_free(struct eblob_compress_dict *dict)
+{
+	if (dict == NULL)
+		return;
+
+#ifdef HAVE_ZSTD
+	ZSTD_freeCDict(dict->cdict);
+	ZSTD_freeDDict(dict->ddict);
+#endif
+	free(dict->data);
+	free(dict);
+}
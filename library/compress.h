@@ -0,0 +1,103 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __EBLOB_COMPRESS_H
+#define __EBLOB_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct eblob_backend;
+
+/* Suffix of per-base zstd dictionary file */
+#define EBLOB_COMPRESS_DICT_SUFFIX	".dict"
+/* Maximum size of trained dictionary */
+#define EBLOB_COMPRESS_DICT_SIZE	(64 * 1024)
+/* Dictionary is trained on up to this many bytes of data... */
+#define EBLOB_COMPRESS_DICT_SAMPLES	(8 * 1024 * 1024)
+/* ...taken by at most this many bytes from every record */
+#define EBLOB_COMPRESS_DICT_SAMPLE_MAX	(16 * 1024)
+/* ...of at most this many records */
+#define EBLOB_COMPRESS_DICT_SAMPLES_NUM	(64 * 1024)
+/* Training is skipped if there are fewer records */
+#define EBLOB_COMPRESS_DICT_SAMPLES_MIN	(64)
+
+/* Compression of one record, accounted to the base it's written to */
+struct eblob_compress_stat {
+	uint64_t		raw_size;
+	uint64_t		size;
+	uint64_t		usecs;
+};
+
+/*
+ * zstd dictionary of a base, immutable once created.
+ */
+struct eblob_compress_dict {
+	uint32_t		id;
+	void			*data;
+	size_t			size;
+	/* Digested ZSTD_CDict and ZSTD_DDict */
+	void			*cdict;
+	void			*ddict;
+};
+
+/*
+ * eblob_compress_algorithm() - returns EBLOB_COMPRESS_ALGORITHM_* new records
+ * of @b are compressed with or 0 if compression is disabled or not built in.
+ */
+int eblob_compress_algorithm(const struct eblob_backend *b);
+
+/*
+ * eblob_compress() - compresses @size bytes of @src with @algorithm and @dict
+ * if it is not NULL. Result prefixed with struct eblob_compress_header is
+ * returned in @dst which should be freed by caller, CPU time spent is added
+ * to @usecs.
+ *
+ * Returns -E2BIG if data does not shrink, other negative error or zero on success.
+ */
+int eblob_compress(int algorithm, const struct eblob_compress_dict *dict,
+		const void *src, uint64_t size, void **dst, uint64_t *dst_size, uint64_t *usecs);
+
+/*
+ * eblob_decompress() - uncompresses payload of BLOB_DISK_CTL_COMPRESSED
+ * record @src of @size bytes compressed with @dict. Result is returned in
+ * @dst which should be freed by caller, CPU time spent is added to @usecs.
+ *
+ * Returns -EILSEQ if payload is malformed or was compressed with another
+ * dictionary, other negative error or zero on success.
+ */
+int eblob_decompress(const struct eblob_compress_dict *dict, const void *src, uint64_t size,
+		void **dst, uint64_t *dst_size, uint64_t *usecs);
+
+/*
+ * eblob_decompressed_size() - returns size of data of compressed payload @src
+ * of @size bytes or -EILSEQ if it is malformed.
+ */
+int64_t eblob_decompressed_size(const void *src, uint64_t size);
+
+/*
+ * Dictionaries: trained from @num samples laid out one after another in
+ * @samples, loaded from and saved to @path.
+ * eblob_compress_dict_load() returns -ENOENT if there is no dictionary.
+ */
+int eblob_compress_dict_train(const void *samples, const size_t *sizes, unsigned int num,
+		struct eblob_compress_dict **dict);
+int eblob_compress_dict_load(const char *path, struct eblob_compress_dict **dict);
+int eblob_compress_dict_save(const struct eblob_compress_dict *dict, const char *path);
+void eblob_compress_dict_free(struct eblob_compress_dict *dict);
+
+#endif /* __EBLOB_COMPRESS_H */
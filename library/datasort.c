@@ -27,6 +27,7 @@
 
 #include "datasort.h"
 #include "blob.h"
+#include "footer.h"
 #include "ioprio.h"
 
 #include <sys/mman.h>
@@ -94,6 +95,16 @@ static int datasort_base_get_path(struct eblob_backend *b, struct eblob_base_ctl
 	return 0;
 }
 
+/**
+ * datasort_dict_get_path() - path dictionary of sorted base is saved to
+ * until the base is swapped on disk.
+ */
+static void datasort_dict_get_path(struct datasort_cfg *dcfg, char *path, unsigned int path_max)
+{
+	snprintf(path, path_max, "%s-0.%d" EBLOB_COMPRESS_DICT_SUFFIX ".tmp",
+			dcfg->b->cfg.file, dcfg->bctl[0]->index);
+}
+
 static int datasort_chunk_get_path(struct eblob_backend *b, struct eblob_base_ctl *bctl,
 		char *path, unsigned int path_max)
 {
@@ -449,7 +460,12 @@ static int datasort_split_iterator(struct eblob_disk_control *dc,
 	struct datasort_cfg *dcfg = priv;
 	struct datasort_chunk_local *local = thread_priv;
 	struct datasort_chunk *c;
+	struct eblob_chain_header chain;
+	struct eblob_iovec data = {NULL, 0, 0}, footer = {NULL, 0, 0};
+	struct eblob_compress_stat zs;
 	const ssize_t hdr_size = sizeof(struct eblob_disk_control);
+	const int chained = !!(dc->flags & BLOB_DISK_CTL_CHAINED);
+	int reencoded = 0;
 
 	assert(dc != NULL);
 	assert(dcfg != NULL);
@@ -459,6 +475,42 @@ static int datasort_split_iterator(struct eblob_disk_control *dc,
 	if (dc->disk_size < (uint64_t)hdr_size)
 		return -EINVAL;
 
+	/* Chained record is coalesced into contiguous one */
+	if (chained) {
+		err = __eblob_read_ll(fd, &chain, sizeof(struct eblob_chain_header), data_offset);
+		if (err) {
+			EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err, "defrag: %s: read-chain",
+					eblob_dump_id(dc->key.id));
+			goto err;
+		}
+
+		eblob_convert_chain_header(&chain);
+		if (chain.num == 0 || chain.num > EBLOB_CHAIN_EXTENTS_MAX) {
+			err = -EINVAL;
+			EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err, "defrag: %s: broken chain: extents: %" PRIu64,
+					eblob_dump_id(dc->key.id), chain.num);
+			goto err;
+		}
+
+		/* Corruption of extents must survive coalescing, so their footer is left zeroed */
+		if (!(dc->flags & (BLOB_DISK_CTL_NOCSUM | BLOB_DISK_CTL_CORRUPTED))) {
+			err = eblob_chain_verify(fd, &chain);
+			if (err == -EILSEQ) {
+				EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err, "defrag: %s: chain checksum mismatch",
+						eblob_dump_id(dc->key.id));
+				dc->flags |= BLOB_DISK_CTL_CORRUPTED;
+			} else if (err) {
+				EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err, "defrag: %s: eblob_chain_verify",
+						eblob_dump_id(dc->key.id));
+				goto err;
+			}
+		}
+
+		dc->flags &= ~BLOB_DISK_CTL_CHAINED;
+		dc->data_size = chain.size;
+		dc->disk_size = hdr_size + chain.size + eblob_calculate_footer_size(dcfg->b, chain.size);
+	}
+
 	/* Shortcut */
 	c = local->current;
 
@@ -496,8 +548,21 @@ static int datasort_split_iterator(struct eblob_disk_control *dc,
 			", size: %" PRIu64 ", flags: %s",
 			eblob_dump_id(dc->key.id), c->fd, c->offset, dc->disk_size, eblob_dump_dctl_flags(dc->flags));
 
-	/* Rewrite position */
+	/* Rewrite position, records are not aligned in sorted base */
 	dc->position = c->offset;
+	dc->flags &= ~BLOB_DISK_CTL_DIRECT;
+
+	/* Compressed record is compressed again with dictionary of sorted base */
+	if (!chained) {
+		err = eblob_compress_reencode(dcfg->b, local->bctl, dcfg->dict, dc, fd, data_offset,
+				&data, &footer, &zs);
+		if (err && err != -EAGAIN) {
+			EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err, "defrag: %s: eblob_compress_reencode",
+					eblob_dump_id(dc->key.id));
+			goto err;
+		}
+		reencoded = (err == 0);
+	}
 
 	/* Extend in-memory index if needed */
 	c->index = datasort_reallocf((void **)&c->index, sizeof(struct eblob_disk_control),
@@ -518,8 +583,30 @@ static int datasort_split_iterator(struct eblob_disk_control *dc,
 	}
 	c->offset += hdr_size;
 
-	/* Copy data */
-	if (fd != c->fd)
+	/* Copy data, chunk covers padding of re-encoded record too */
+	if (reencoded) {
+		err = __eblob_write_ll(c->fd, data.base, data.size, c->offset);
+		if (!err && footer.size)
+			err = __eblob_write_ll(c->fd, footer.base, footer.size, footer.offset);
+		if (!err && ftruncate(c->fd, c->offset + dc->disk_size - hdr_size) == -1)
+			err = -errno;
+	} else if (chained) {
+		err = eblob_chain_copy(fd, &chain, c->fd, c->offset);
+		if (!err && ftruncate(c->fd, c->offset + dc->disk_size - hdr_size) == -1)
+			err = -errno;
+		if (!err && !(dc->flags & BLOB_DISK_CTL_CORRUPTED) && dc->disk_size > hdr_size + dc->data_size) {
+			struct eblob_write_control wc;
+
+			memset(&wc, 0, sizeof(struct eblob_write_control));
+			wc.index = -1;
+			wc.flags = dc->flags;
+			wc.data_fd = c->fd;
+			wc.ctl_data_offset = c->offset - hdr_size;
+			wc.total_data_size = dc->data_size;
+			wc.total_size = dc->disk_size;
+			err = eblob_commit_footer(dcfg->b, &dc->key, &wc, NULL, 0);
+		}
+	} else if (fd != c->fd)
 		err = eblob_splice_data(fd, data_offset, c->fd, c->offset, dc->disk_size - hdr_size);
 	else
 		err = eblob_copy_data(fd, data_offset, c->fd, c->offset, dc->disk_size - hdr_size);
@@ -530,9 +617,20 @@ static int datasort_split_iterator(struct eblob_disk_control *dc,
 
 	c->offset += dc->disk_size - hdr_size;
 	c->count++;
-	return 0;
+
+	if (reencoded && (dc->flags & BLOB_DISK_CTL_COMPRESSED)) {
+		pthread_mutex_lock(&dcfg->lock);
+		dcfg->records_compressed++;
+		dcfg->compressed.raw_size += zs.raw_size;
+		dcfg->compressed.size += zs.size;
+		dcfg->compressed.usecs += zs.usecs;
+		pthread_mutex_unlock(&dcfg->lock);
+	}
+	err = 0;
 
 err:
+	free(data.base);
+	free(footer.base);
 	/* Return err to eblob_blob_iterate to stop iteration */
 	return err;
 }
@@ -560,6 +658,144 @@ static int datasort_split_iterator_free(struct eblob_iterate_control *ictl __att
 	return 0;
 }
 
+/* Samples of data of records dictionary of sorted base is trained on */
+struct datasort_samples {
+	struct datasort_cfg	*dcfg;
+	char			*data;
+	size_t			*sizes;
+	uint64_t		size;
+	unsigned int		num;
+};
+
+/*
+ * Takes sample from the beginning of data of each record until there are
+ * enough of them.
+ */
+static int datasort_sample_iterator(struct eblob_disk_control *dc,
+		struct eblob_ram_control *rctl __attribute_unused__,
+		int fd, uint64_t data_offset, void *priv, void *thread_priv)
+{
+	struct datasort_samples *samples = priv;
+	struct datasort_cfg *dcfg = samples->dcfg;
+	struct eblob_base_ctl *bctl = thread_priv;
+	uint64_t size;
+	void *data;
+	int err, full;
+
+	if (dc->flags & (BLOB_DISK_CTL_REMOVE | BLOB_DISK_CTL_UNCOMMITTED | BLOB_DISK_CTL_EXTHDR |
+			BLOB_DISK_CTL_CHAINED | BLOB_DISK_CTL_CORRUPTED))
+		return 0;
+	if (!(dc->flags & BLOB_DISK_CTL_COMPRESSED) && dc->data_size < dcfg->b->cfg.compress_threshold)
+		return 0;
+
+	pthread_mutex_lock(&dcfg->lock);
+	full = samples->size >= EBLOB_COMPRESS_DICT_SAMPLES || samples->num >= EBLOB_COMPRESS_DICT_SAMPLES_NUM;
+	pthread_mutex_unlock(&dcfg->lock);
+	if (full)
+		return 0;
+
+	if (dc->flags & BLOB_DISK_CTL_COMPRESSED) {
+		err = eblob_compress_read_record(dcfg->b, bctl, dc, fd, data_offset, &data, &size);
+	} else {
+		size = dc->data_size;
+		if (size > EBLOB_COMPRESS_DICT_SAMPLE_MAX)
+			size = EBLOB_COMPRESS_DICT_SAMPLE_MAX;
+		data = malloc(size ? size : 1);
+		err = data ? __eblob_read_ll(fd, data, size, data_offset) : -ENOMEM;
+		if (err)
+			free(data);
+	}
+	/* Record that can't be read is just not sampled */
+	if (err) {
+		EBLOB_WARNC(dcfg->log, EBLOB_LOG_NOTICE, -err, "defrag: %s: sample", eblob_dump_id(dc->key.id));
+		return 0;
+	}
+
+	if (size > EBLOB_COMPRESS_DICT_SAMPLE_MAX)
+		size = EBLOB_COMPRESS_DICT_SAMPLE_MAX;
+
+	pthread_mutex_lock(&dcfg->lock);
+	if (samples->size + size <= EBLOB_COMPRESS_DICT_SAMPLES && samples->num < EBLOB_COMPRESS_DICT_SAMPLES_NUM) {
+		memcpy(samples->data + samples->size, data, size);
+		samples->sizes[samples->num++] = size;
+		samples->size += size;
+	}
+	pthread_mutex_unlock(&dcfg->lock);
+
+	free(data);
+	return 0;
+}
+
+static int datasort_sample_iterator_init(struct eblob_iterate_control *ictl, void **priv_thread)
+{
+	*priv_thread = ictl->base;
+	return 0;
+}
+
+/**
+ * datasort_train_dict() - trains zstd dictionary of sorted base on samples
+ * of records of @dcfg->bctl and saves it next to the base. Records are sorted
+ * without dictionary if there are too few of them or it can't be trained.
+ */
+static void datasort_train_dict(struct datasort_cfg *dcfg)
+{
+	struct eblob_iterate_control ictl;
+	struct datasort_samples samples;
+	char path[PATH_MAX];
+	int err, n;
+
+	if (!(dcfg->b->cfg.blob_flags & EBLOB_COMPRESS_DICT) ||
+			eblob_compress_algorithm(dcfg->b) != EBLOB_COMPRESS_ALGORITHM_ZSTD)
+		return;
+
+	memset(&samples, 0, sizeof(samples));
+	samples.dcfg = dcfg;
+	samples.data = malloc(EBLOB_COMPRESS_DICT_SAMPLES);
+	samples.sizes = calloc(EBLOB_COMPRESS_DICT_SAMPLES_NUM, sizeof(size_t));
+	if (samples.data == NULL || samples.sizes == NULL) {
+		err = -ENOMEM;
+		goto err_out_free;
+	}
+
+	for (n = 0; n < dcfg->bctl_cnt; ++n) {
+		memset(&ictl, 0, sizeof(ictl));
+		ictl.priv = &samples;
+		ictl.b = dcfg->b;
+		ictl.base = dcfg->bctl[n];
+		ictl.log = dcfg->b->cfg.log;
+		ictl.flags = EBLOB_ITERATE_FLAGS_ALL | EBLOB_ITERATE_FLAGS_READONLY;
+		ictl.iterator_cb.iterator = datasort_sample_iterator;
+		ictl.iterator_cb.iterator_init = datasort_sample_iterator_init;
+
+		err = eblob_blob_iterate(&ictl);
+		if (err)
+			goto err_out_free;
+	}
+
+	err = eblob_compress_dict_train(samples.data, samples.sizes, samples.num, &dcfg->dict);
+	if (err)
+		goto err_out_free;
+
+	datasort_dict_get_path(dcfg, path, PATH_MAX);
+	err = eblob_compress_dict_save(dcfg->dict, path);
+	if (err) {
+		eblob_compress_dict_free(dcfg->dict);
+		dcfg->dict = NULL;
+		goto err_out_free;
+	}
+
+	EBLOB_WARNX(dcfg->log, EBLOB_LOG_INFO, "defrag: dictionary trained: %s: id: %" PRIu32
+			", size: %zu, samples: %u, samples size: %" PRIu64,
+			path, dcfg->dict->id, dcfg->dict->size, samples.num, samples.size);
+
+err_out_free:
+	if (err)
+		EBLOB_WARNC(dcfg->log, err == -ENODATA ? EBLOB_LOG_INFO : EBLOB_LOG_ERROR, -err,
+				"defrag: dictionary is not trained: samples: %u", samples.num);
+	free(samples.sizes);
+	free(samples.data);
+}
+
 /* Run datasort_split_iterator on given base */
 static int datasort_split(struct datasort_cfg *dcfg)
 {
@@ -937,6 +1173,16 @@ err:
 /* Recursively destroys dcfg */
 static void datasort_destroy(struct datasort_cfg *dcfg)
 {
+	/* Dictionary is left only if sorted base has not been swapped */
+	if (dcfg->dict != NULL) {
+		char path[PATH_MAX];
+
+		datasort_dict_get_path(dcfg, path, PATH_MAX);
+		unlink(path);
+		eblob_compress_dict_free(dcfg->dict);
+		dcfg->dict = NULL;
+	}
+
 	pthread_mutex_destroy(&dcfg->lock);
 	free(dcfg->dir);
 	free(dcfg->chunks_dir);
@@ -1016,6 +1262,7 @@ static int datasort_swap_memory(struct datasort_cfg *dcfg)
 	struct eblob_base_ctl *sorted_bctl, *unsorted_bctl;
 	struct eblob_file_ctl index;
 	char tmp_index_path[PATH_MAX], data_path[PATH_MAX];
+	unsigned char *locked_shards;
 	uint64_t i, offset;
 	int err, n;
 
@@ -1092,6 +1339,7 @@ static int datasort_swap_memory(struct datasort_cfg *dcfg)
 	 * Setup sorted base
 	 */
 	sorted_bctl->data_ctl.fd = dcfg->result->fd;
+	eblob_base_open_direct(dcfg->b, sorted_bctl, dcfg->result->path);
 	sorted_bctl->index_ctl = index;
 
 	/* Setup new base */
@@ -1110,10 +1358,10 @@ static int datasort_swap_memory(struct datasort_cfg *dcfg)
 		goto err_free_base;
 	}
 
-	/* Protect l2hash/hash from accessing stale fds */
-	if ((err = pthread_rwlock_wrlock(&dcfg->b->hash.root_lock)) != 0) {
-		err = -err;
-		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err, "defrag: pthread_mutex_lock");
+	/* Protect l2hash/hash shards holding sorted keys from accessing stale fds */
+	err = eblob_cache_lock_shards(dcfg->b, dcfg->result->index, dcfg->result->count, &locked_shards);
+	if (err != 0) {
+		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err, "defrag: eblob_cache_lock_shards");
 		goto err_free_base;
 	}
 
@@ -1144,6 +1392,13 @@ static int datasort_swap_memory(struct datasort_cfg *dcfg)
 	eblob_stat_set(sorted_bctl->stat, EBLOB_LST_BASE_SIZE,
 			sorted_bctl->index_ctl.size + sorted_bctl->data_ctl.size);
 	eblob_stat_set(sorted_bctl->stat, EBLOB_LST_RECORDS_TOTAL, dcfg->result->count);
+	eblob_stat_set(sorted_bctl->stat, EBLOB_LST_RECORDS_COMPRESSED, dcfg->records_compressed);
+	eblob_stat_set(sorted_bctl->stat, EBLOB_LST_COMPRESS_RAW_SIZE, dcfg->compressed.raw_size);
+	eblob_stat_set(sorted_bctl->stat, EBLOB_LST_COMPRESS_SIZE, dcfg->compressed.size);
+	eblob_stat_set(sorted_bctl->stat, EBLOB_LST_COMPRESS_TIME, dcfg->compressed.usecs);
+
+	/* Records of sorted base are compressed with its dictionary */
+	sorted_bctl->dict = dcfg->dict;
 
 	/*
 	 * Replace unsorted bctl(s) with sorted one
@@ -1157,10 +1412,11 @@ static int datasort_swap_memory(struct datasort_cfg *dcfg)
 		__list_del(dcfg->bctl[n]->base_entry.prev, dcfg->bctl[n]->base_entry.next);
 
 	/* Unlock hash */
-	pthread_rwlock_unlock(&dcfg->b->hash.root_lock);
+	eblob_cache_unlock_shards(dcfg->b, locked_shards);
 
 	/* Save pointer to sorted_bctl for datasort_swap_disk() */
 	dcfg->sorted_bctl = sorted_bctl;
+	dcfg->dict = NULL;
 
 	EBLOB_WARNX(dcfg->log, EBLOB_LOG_INFO, "defrag: %s: finished", __func__);
 	return 0;
@@ -1180,7 +1436,7 @@ static int datasort_swap_disk(struct datasort_cfg *dcfg)
 	struct eblob_base_ctl *sorted_bctl, *unsorted_bctl;
 	char tmp_index_path[PATH_MAX];
 	char sorted_index_path[PATH_MAX], data_path[PATH_MAX];
-	char mark_path[PATH_MAX];
+	char mark_path[PATH_MAX], tmp_dict_path[PATH_MAX], dict_path[PATH_MAX];
 	int err, n;
 
 	assert(dcfg != NULL);
@@ -1205,6 +1461,8 @@ static int datasort_swap_disk(struct datasort_cfg *dcfg)
 	snprintf(mark_path, PATH_MAX, "%s" EBLOB_DATASORT_SORTED_MARK_SUFFIX, data_path);
 	snprintf(sorted_index_path, PATH_MAX, "%s.index.sorted", data_path);
 	snprintf(tmp_index_path, PATH_MAX, "%s.tmp", sorted_index_path);
+	snprintf(dict_path, PATH_MAX, "%s" EBLOB_COMPRESS_DICT_SUFFIX, data_path);
+	datasort_dict_get_path(dcfg, tmp_dict_path, PATH_MAX);
 
 	/*
 	 * Remove old base.
@@ -1237,6 +1495,9 @@ static int datasort_swap_disk(struct datasort_cfg *dcfg)
 	if (rename(tmp_index_path, sorted_index_path) == -1)
 		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, errno, "defrag: rename: %s -> %s",
 				tmp_index_path, sorted_index_path);
+	if (sorted_bctl->dict != NULL && rename(tmp_dict_path, dict_path) == -1)
+		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, errno, "defrag: rename: %s -> %s",
+				tmp_dict_path, dict_path);
 
 	/* Leave mark that data file is sorted */
 	if ((err = open(mark_path, O_TRUNC | O_CREAT | O_CLOEXEC, 0644)) != -1) {
@@ -1406,6 +1667,9 @@ int eblob_generate_sorted_data(struct datasort_cfg *dcfg)
 		}
 	}
 
+	/* Dictionary is trained before records are split, as they are compressed with it */
+	datasort_train_dict(dcfg);
+
 	/*
 	 * Split blob into unsorted chunks
 	 */
@@ -1456,6 +1720,16 @@ int eblob_generate_sorted_data(struct datasort_cfg *dcfg)
 		EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, errno, "defrag: ioprio_set: FAILED to set higher ioprio");
 	}
 
+	/* Iteration pinned bases while they were sorted, sorted data is dropped */
+	for (n = 0; n < dcfg->bctl_cnt; ++n) {
+		if (dcfg->bctl[n]->iterators != 0) {
+			err = -EBUSY;
+			EBLOB_WARNC(dcfg->log, EBLOB_LOG_ERROR, -err, "defrag: base is being iterated: %s",
+					dcfg->bctl[n]->name);
+			goto err_unlock_bctl;
+		}
+	}
+
 	/* Apply binlog */
 	err = datasort_binlog_apply(dcfg);
 	if (err != 0) {
@@ -1498,7 +1772,7 @@ int eblob_generate_sorted_data(struct datasort_cfg *dcfg)
 
 	/* Increase defrag_generation in order to interrupted operation could relookup keys.
 	 */
-	dcfg->b->defrag_generation += 1;
+	eblob_defrag_generation_inc(dcfg->b);
 
 	/* restore original io priority */
 	if ((ioprio != -1) && (eblob_ioprio_set(ioprio) == -1))
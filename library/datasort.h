@@ -23,6 +23,7 @@
 
 #include "eblob/blob.h"
 
+#include "compress.h"
 #include "list.h"
 
 #include <assert.h>
@@ -95,6 +96,11 @@ struct datasort_cfg {
 	int				bctl_cnt;
 	/* Pointer to sorted bctl */
 	struct eblob_base_ctl		*sorted_bctl;
+	/* zstd dictionary trained for sorted base or NULL */
+	struct eblob_compress_dict	*dict;
+	/* Records compressed again by split, accounted to sorted base */
+	uint64_t			records_compressed;
+	struct eblob_compress_stat	compressed;
 };
 
 /*
@@ -59,10 +59,10 @@ int eblob_want_defrag(struct eblob_base_ctl *bctl)
 	int level = EBLOB_LOG_DEBUG;
 
 	/*
-	 * do not compute want_defrag status for the last base
-	 * the last base does not participate in defragmentation
+	 * do not compute want_defrag status for active bases
+	 * they do not participate in defragmentation
 	 */
-	if (list_is_last(&bctl->base_entry, &bctl->back->bases))
+	if (eblob_base_is_active(b, bctl))
 		return EBLOB_DEFRAG_NOT_NEEDED;
 
 	pthread_mutex_lock(&bctl->lock);
@@ -179,19 +179,31 @@ int eblob_defrag(struct eblob_backend *b)
 	list_for_each_entry(bctl, &b->bases, base_entry) {
 		int want;
 
-		/* do not process last entry, it can be used for writing */
-		if (list_is_last(&bctl->base_entry, &b->bases))
-			break;
+		/* do not process active entries, they are used for writing */
+		if (eblob_base_is_active(b, bctl))
+			continue;
 
 		/* Decide what we want to do with this bctl */
 		want = eblob_want_defrag(bctl);
 		if (want < 0)
 			EBLOB_WARNC(b->cfg.log, -want, EBLOB_LOG_ERROR, "defrag: eblob_want_defrag: FAILED");
 
+		/* Pinned bases are left alone until next defrag, see eblob_iterate_pinned() */
+		if (bctl->iterators != 0) {
+			EBLOB_WARNX(b->cfg.log, EBLOB_LOG_INFO, "defrag: index: %d: base is being iterated - skipping.",
+					bctl->index);
+			continue;
+		}
+
 		if (want == EBLOB_REMOVE_NEEDED) {
 			EBLOB_WARNX(b->cfg.log, EBLOB_LOG_INFO, "defrag: empty blob - removing.");
 
 			pthread_mutex_lock(&b->lock);
+			/* Iteration could have pinned the base meanwhile */
+			if (bctl->iterators != 0) {
+				pthread_mutex_unlock(&b->lock);
+				continue;
+			}
 			/* Remove it from list, but do not poisson next and prev */
 			__list_del(bctl->base_entry.prev, bctl->base_entry.next);
 
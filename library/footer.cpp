@@ -37,7 +37,7 @@
  * @result - computed MurmurHash64A.
  */
 static inline int mmhash_file(int fd, off_t offset, size_t count, uint64_t &result) {
-	static const size_t buffer_size = 4096;
+	static const size_t buffer_size = EBLOB_CSUM_BLOCK_SIZE;
 	char buffer[buffer_size];
 	size_t read_size = buffer_size;
 	int err = 0;
@@ -59,6 +59,88 @@ static inline int mmhash_file(int fd, off_t offset, size_t count, uint64_t &resu
 	return err;
 }
 
+/*
+ * mmhash_iov() - computes MurmurHash64A of bytes range of record data with @offset and @count
+ * the same way as mmhash_file() does, but takes bytes from @iov that were just written to the record.
+ * Range should be entirely covered by @iov.
+ *
+ * Results:
+ * @result - computed MurmurHash64A.
+ */
+static void mmhash_iov(const struct eblob_write_control *wc, const struct eblob_iovec *iov, uint16_t iovcnt,
+                       uint64_t offset, uint64_t count, uint64_t &result) {
+	static const size_t buffer_size = EBLOB_CSUM_BLOCK_SIZE;
+	char buffer[buffer_size];
+	size_t read_size = buffer_size;
+	result = 0;
+
+	while (count) {
+		const char *data = buffer;
+
+		if (count < buffer_size)
+			read_size = count;
+
+		/* hash bytes in place if one iov covers them, otherwise gather them into @buffer */
+		for (uint16_t i = 0; i < iovcnt; ++i) {
+			const uint64_t start = eblob_iovec_data_offset(wc, &iov[i], i == 0);
+			const uint64_t lo = EBLOB_MAX(start, offset);
+			const uint64_t hi = EBLOB_MIN(start + iov[i].size, offset + read_size);
+
+			if (lo >= hi)
+				continue;
+
+			if (lo == offset && hi == offset + read_size) {
+				data = static_cast<const char *>(iov[i].base) + (offset - start);
+				break;
+			}
+
+			memcpy(buffer + (lo - offset), static_cast<const char *>(iov[i].base) + (lo - start), hi - lo);
+		}
+
+		result = MurmurHash64A(data, read_size, result);
+		count -= read_size;
+		offset += read_size;
+	}
+}
+
+/*
+ * iov_covers() - checks that bytes range of record data with @offset and @count is entirely covered by @iov.
+ * NB! @iov should not overlap.
+ */
+static bool iov_covers(const struct eblob_write_control *wc, const struct eblob_iovec *iov, uint16_t iovcnt,
+                       uint64_t offset, uint64_t count) {
+	uint64_t covered = 0;
+
+	for (uint16_t i = 0; i < iovcnt; ++i) {
+		const uint64_t start = eblob_iovec_data_offset(wc, &iov[i], i == 0);
+		const uint64_t lo = EBLOB_MAX(start, offset);
+		const uint64_t hi = EBLOB_MIN(start + iov[i].size, offset + count);
+
+		if (lo < hi)
+			covered += hi - lo;
+	}
+
+	return covered == count;
+}
+
+/*
+ * iov_ordered() - checks that @iov are placed within record data in ascending order without overlapping,
+ * so that data of the record is what is in @iov.
+ */
+static bool iov_ordered(const struct eblob_write_control *wc, const struct eblob_iovec *iov, uint16_t iovcnt) {
+	uint64_t end = 0;
+
+	for (uint16_t i = 0; i < iovcnt; ++i) {
+		const uint64_t start = eblob_iovec_data_offset(wc, &iov[i], i == 0);
+
+		if (start < end)
+			return false;
+		end = start + iov[i].size;
+	}
+
+	return true;
+}
+
 /*
  * chunked_footer_offset() - calculates chunked footer offset within record pointed by @wc.
  *
@@ -93,10 +175,15 @@ static inline uint64_t chunked_footer_offset(const struct eblob_write_control *w
  * @footers - calculated MurmurHash64A of chunks
  * @footers_offset - offset of record's footer with corresponding checksums.
  * @footers_offset can be used for reading and verifying on-disk checksums or for writing calculated checksums
+ *
+ * Chunks entirely covered by @iov are hashed from memory, the rest is read from disk.
+ * If @from_disk is false and some chunk is not covered by @iov, -EAGAIN is returned.
  */
 static int eblob_chunked_mmhash(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
                                 const uint64_t offset, const uint64_t size,
-                                std::vector<uint64_t> &checksums, uint64_t &checksums_offset) {
+                                std::vector<uint64_t> &checksums, uint64_t &checksums_offset,
+                                const struct eblob_iovec *iov = nullptr, uint16_t iovcnt = 0,
+                                bool from_disk = true) {
 	int err = 0;
 	const uint64_t first_chunk = offset / EBLOB_CSUM_CHUNK_SIZE;
 
@@ -130,6 +217,16 @@ static int eblob_chunked_mmhash(struct eblob_backend *b, struct eblob_key *key,
 	for (auto it = checksums.begin(); it != checksums.end() ; ++it, chunk_offset += chunk_size) {
 		chunk_size = EBLOB_MIN(chunk_size, (offset_max - chunk_offset));
 
+		if (iov != nullptr && iov_covers(wc, iov, iovcnt, chunk_offset - data_offset, chunk_size)) {
+			mmhash_iov(wc, iov, iovcnt, chunk_offset - data_offset, chunk_size, *it);
+			continue;
+		}
+
+		if (!from_disk) {
+			err = -EAGAIN;
+			break;
+		}
+
 		err = mmhash_file(wc->data_fd, chunk_offset, chunk_size, *it);
 		if (err) {
 			eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob i%d: %s: mmhash_file failed: "
@@ -163,7 +260,8 @@ uint64_t eblob_get_footer_size(const struct eblob_backend *b, const struct eblob
 		return sizeof(struct eblob_disk_footer);
 }
 
-int eblob_verify_sha512(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc) {
+int eblob_verify_sha512(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
+                        const void *data) {
 	struct eblob_disk_footer f;
 	unsigned char csum[EBLOB_ID_SIZE];
 	int err = 0;
@@ -189,8 +287,13 @@ int eblob_verify_sha512(struct eblob_backend *b, struct eblob_key *key, struct e
 
 	memset(csum, 0, sizeof(csum));
 
-	off = wc->ctl_data_offset + hdr_size;
-	err = sha512_file(wc->data_fd, off, wc->total_data_size, csum);
+	/* sha512 covers whole record's data, so @data is used only if it is all there */
+	if (data != nullptr && wc->offset == 0 && wc->size == wc->total_data_size) {
+		sha512_buffer(static_cast<const char *>(data), wc->size, csum);
+	} else {
+		off = wc->ctl_data_offset + hdr_size;
+		err = sha512_file(wc->data_fd, off, wc->total_data_size, csum);
+	}
 	if (err) {
 		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob i%d: %s: %s: sha512_file failed: err: %d\n",
 		          wc->index, eblob_dump_id(key->id), __func__, err);
@@ -211,7 +314,8 @@ int eblob_verify_sha512(struct eblob_backend *b, struct eblob_key *key, struct e
 }
 
 
-int eblob_verify_mmhash(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc) {
+int eblob_verify_mmhash(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
+                        const void *data) {
 	int err = 0;
 	uint64_t footers_offset = 0,
 	         footers_size = 0;
@@ -228,7 +332,19 @@ int eblob_verify_mmhash(struct eblob_backend *b, struct eblob_key *key, struct e
 
 	std::vector<uint64_t> calc_footers, check_footers;
 
-	err = eblob_chunked_mmhash(b, key, wc, wc->offset, wc->size, calc_footers, footers_offset);
+	/*
+	 * @data is placed at @wc->offset of record data regardless of where
+	 * @wc->data_offset points and whether record has extended header
+	 */
+	struct eblob_write_control dwc = *wc;
+	struct eblob_iovec iov = {const_cast<void *>(data), wc->size, wc->offset};
+	if (data != nullptr) {
+		dwc.flags &= ~BLOB_DISK_CTL_EXTHDR;
+		dwc.data_offset = wc->ctl_data_offset + sizeof(struct eblob_disk_control);
+	}
+
+	err = eblob_chunked_mmhash(b, key, &dwc, wc->offset, wc->size, calc_footers, footers_offset,
+	                           data != nullptr ? &iov : nullptr, data != nullptr ? 1 : 0);
 	if (err) {
 		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob i%d: %s: %s: eblob_chunked_mmhash: failed: fd: %d, size: %" PRIu64
 		          ", offset: %" PRIu64 "\n",
@@ -260,33 +376,90 @@ int eblob_verify_mmhash(struct eblob_backend *b, struct eblob_key *key, struct e
 	return 0;
 }
 
-int eblob_commit_footer(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc) {
-	/*
-	 * skip footer committing if eblob is configured with EBLOB_NO_FOOTER flag or
-	 * the record should not be checksummed
-	 */
+/*
+ * eblob_build_footer() - calculates footer of record pointed by @wc: chunked MurmurHash64A of whole record's data
+ * followed by final MurmurHash64A of them.
+ *
+ * Results:
+ * @footer - footer to be written to the record.
+ * @footer_offset - offset of footer within data file.
+ */
+static int eblob_build_footer(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
+                              const struct eblob_iovec *iov, uint16_t iovcnt, bool from_disk,
+                              std::vector<uint64_t> &footer, uint64_t &footer_offset) {
+	int err;
+
+	/* overlapping @iov don't tell what is on disk, so read all the data back */
+	if (iov != nullptr && !iov_ordered(wc, iov, iovcnt)) {
+		if (!from_disk)
+			return -EAGAIN;
+		iov = nullptr;
+	}
+
+	/* calculates chunked MurmurHash64A of whole record's data */
+	err = eblob_chunked_mmhash(b, key, wc, 0, wc->total_data_size, footer, footer_offset, iov, iovcnt, from_disk);
+	if (err)
+		return err;
+
+	/* final MurmurHash64A of previously calculated chunked MurmurHash64A */
+	const uint64_t final_checksum = MurmurHash64A(footer.data(), footer.size() * sizeof(footer.front()), 0);
+
+	try {
+		footer.push_back(final_checksum);
+	} catch (const std::exception &e) {
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob i%d: %s: %s: failed to allocate footer: %s\n",
+		          wc->index, eblob_dump_id(key->id), __func__, e.what());
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+int eblob_fill_footer(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
+                      const struct eblob_iovec *iov, uint16_t iovcnt, struct eblob_iovec *footer) {
+	footer->base = NULL;
+	footer->size = 0;
+	footer->offset = 0;
+
 	if (b->cfg.blob_flags & EBLOB_NO_FOOTER)
 		return 0;
 
 	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.write.commit.footer", b->cfg.stat_id));
 
-	int err;
 	std::vector<uint64_t> checksums;
 	uint64_t checksums_offset;
 
-	/* calculates chunked MurmurHash64A of whole record's data */
-	err = eblob_chunked_mmhash(b, key, wc, 0, wc->total_data_size, checksums, checksums_offset);
+	int err = eblob_build_footer(b, key, wc, iov, iovcnt, false, checksums, checksums_offset);
 	if (err)
 		return err;
 
-	/* size of checksums in bytes */
 	const size_t checksums_size = checksums.size() * sizeof(checksums.front());
 
-	/* final MurmurHash64A of previously calculated chunked MurmurHash64A */
-	const uint64_t final_checksum = MurmurHash64A(checksums.data(), checksums_size, 0);
+	footer->base = malloc(checksums_size);
+	if (footer->base == NULL)
+		return -ENOMEM;
+
+	memcpy(footer->base, checksums.data(), checksums_size);
+	footer->size = checksums_size;
+	footer->offset = checksums_offset;
+
+	return 0;
+}
+
+/*
+ * eblob_write_footer() - writes @checksums of record pointed by @wc, including final checksum,
+ * at @checksums_offset within data file.
+ */
+static int eblob_write_footer(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
+                              const std::vector<uint64_t> &checksums, uint64_t checksums_offset) {
+	int err;
 
-	/* writes chunked MurmurHash64A to footer */
+	/* size of checksums in bytes including final checksum */
+	const size_t checksums_size = checksums.size() * sizeof(checksums.front());
+
+	/* writes chunked MurmurHash64A and final MurmurHash64A to footer */
 	err = __eblob_write_ll(wc->data_fd, checksums.data(), checksums_size, checksums_offset);
+	eblob_stat_inc(b->stat, EBLOB_GST_WRITE_SYSCALLS);
 	if (err) {
 		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob i%d: %s: %s: failed to write checksums: "
 		          "fd: %d, size: %" PRIu64 ", offset: %" PRIu64 ": %d\n",
@@ -295,23 +468,132 @@ int eblob_commit_footer(struct eblob_backend *b, struct eblob_key *key, struct e
 		return err;
 	}
 
-	checksums_offset += checksums_size;
+	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob i%d: %s: %s: checksums have been updated, final checksum: %" PRIx64 "\n",
+	          wc->index, eblob_dump_id(key->id), __func__, checksums.back());
+
+	return 0;
+}
 
-	/* writes final MurmurHash64A to footer */
-	err = __eblob_write_ll(wc->data_fd, &final_checksum, sizeof(final_checksum), checksums_offset);
-	if (err) {
-		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob i%d: %s: %s: failed to write final checksums: "
-		          "fd: %d, size: %zu, offset: %" PRIu64 ": %d\n",
-		          wc->index, eblob_dump_id(key->id), __func__,
-		          wc->data_fd, sizeof(final_checksum), checksums_offset, err);
+int eblob_commit_footer(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
+                        const struct eblob_iovec *iov, uint16_t iovcnt) {
+	/*
+	 * skip footer committing if eblob is configured with EBLOB_NO_FOOTER flag or
+	 * the record should not be checksummed
+	 */
+	if (b->cfg.blob_flags & EBLOB_NO_FOOTER)
+		return 0;
+
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.write.commit.footer", b->cfg.stat_id));
+
+	int err;
+	std::vector<uint64_t> checksums;
+	uint64_t checksums_offset;
+
+	err = eblob_build_footer(b, key, wc, iov, iovcnt, true, checksums, checksums_offset);
+	if (err)
 		return err;
-	}
 
-	eblob_log(b->cfg.log, EBLOB_LOG_INFO, "blob i%d: %s: %s: checksums have been updated, final checksum: %" PRIx64 "\n",
-	          wc->index, eblob_dump_id(key->id), __func__, final_checksum);
+	return eblob_write_footer(b, key, wc, checksums, checksums_offset);
+}
 
-	if (!b->cfg.sync)
-		fsync(wc->data_fd);
+int eblob_footer_stream_init(struct eblob_footer_stream *fs, uint64_t data_size) {
+	memset(fs, 0, sizeof(*fs));
+
+	fs->checksums_max = (data_size == 0) ? 0 : ((data_size - 1) / EBLOB_CSUM_CHUNK_SIZE + 1);
+	if (fs->checksums_max == 0)
+		return 0;
+
+	fs->checksums = static_cast<uint64_t *>(calloc(fs->checksums_max, sizeof(uint64_t)));
+	if (fs->checksums == NULL)
+		return -ENOMEM;
 
 	return 0;
 }
+
+void eblob_footer_stream_destroy(struct eblob_footer_stream *fs) {
+	free(fs->checksums);
+	fs->checksums = NULL;
+}
+
+/*
+ * eblob_footer_stream_block() - adds @size bytes of the block to checksum of current chunk
+ * and completes the chunk once it's full or @last is set.
+ */
+static void eblob_footer_stream_block(struct eblob_footer_stream *fs, const void *data, uint64_t size, bool last) {
+	if (size != 0) {
+		fs->chunk_hash = MurmurHash64A(data, size, fs->chunk_hash);
+		fs->chunk_size += size;
+	}
+
+	if (fs->chunk_size == EBLOB_CSUM_CHUNK_SIZE || (last && fs->chunk_size != 0)) {
+		assert(fs->checksums_num < fs->checksums_max);
+		fs->checksums[fs->checksums_num++] = fs->chunk_hash;
+		fs->chunk_hash = 0;
+		fs->chunk_size = 0;
+	}
+}
+
+void eblob_footer_stream_update(struct eblob_footer_stream *fs, const void *data, uint64_t size) {
+	const unsigned char *p = static_cast<const unsigned char *>(data);
+
+	while (size != 0) {
+		/* whole blocks are hashed in place */
+		if (fs->block_size == 0 && size >= EBLOB_CSUM_BLOCK_SIZE) {
+			eblob_footer_stream_block(fs, p, EBLOB_CSUM_BLOCK_SIZE, false);
+			p += EBLOB_CSUM_BLOCK_SIZE;
+			size -= EBLOB_CSUM_BLOCK_SIZE;
+			continue;
+		}
+
+		const uint64_t count = EBLOB_MIN(size, EBLOB_CSUM_BLOCK_SIZE - fs->block_size);
+		memcpy(fs->block + fs->block_size, p, count);
+		fs->block_size += count;
+		p += count;
+		size -= count;
+
+		if (fs->block_size == EBLOB_CSUM_BLOCK_SIZE) {
+			eblob_footer_stream_block(fs, fs->block, fs->block_size, false);
+			fs->block_size = 0;
+		}
+	}
+}
+
+int eblob_commit_footer_stream(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
+                               struct eblob_footer_stream *fs) {
+	if (b->cfg.blob_flags & EBLOB_NO_FOOTER)
+		return 0;
+
+	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.write.commit.footer", b->cfg.stat_id));
+
+	/* the last chunk can be incomplete */
+	eblob_footer_stream_block(fs, fs->block, fs->block_size, true);
+	fs->block_size = 0;
+
+	const uint64_t chunks_count = (wc->total_data_size == 0) ? 0 :
+		((wc->total_data_size - 1) / EBLOB_CSUM_CHUNK_SIZE + 1);
+	if (fs->checksums_num != chunks_count) {
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob i%d: %s: %s: data is not entirely hashed: "
+		          "chunks: %" PRIu64 ", expected: %" PRIu64 "\n",
+		          wc->index, eblob_dump_id(key->id), __func__, fs->checksums_num, chunks_count);
+		return -EINVAL;
+	}
+
+	std::vector<uint64_t> checksums;
+
+	try {
+		checksums.resize(chunks_count + 1, 0);
+	} catch (const std::exception &e) {
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob i%d: %s: %s: failed to allocate footer: %s\n",
+		          wc->index, eblob_dump_id(key->id), __func__, e.what());
+		return -ENOMEM;
+	}
+
+	/* checksums of the entry are left zero if checksumming is disabled, as eblob_chunked_mmhash() does */
+	if (!(wc->flags & BLOB_DISK_CTL_NOCSUM) && chunks_count != 0)
+		memcpy(checksums.data(), fs->checksums, chunks_count * sizeof(uint64_t));
+
+	/* final MurmurHash64A of chunked MurmurHash64A */
+	checksums.back() = MurmurHash64A(checksums.data(), chunks_count * sizeof(uint64_t), 0);
+
+	return eblob_write_footer(b, key, wc, checksums, wc->ctl_data_offset + chunked_footer_offset(wc));
+}
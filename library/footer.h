@@ -29,6 +29,8 @@ extern "C" {
 #endif
 
 #define EBLOB_CSUM_CHUNK_SIZE	(1UL<<20)
+/* Checksum of chunk is MurmurHash64A chained over blocks of this size */
+#define EBLOB_CSUM_BLOCK_SIZE	(4096)
 
 /*
  * eblob_disk_footer contains csum of data.
@@ -55,26 +57,85 @@ uint64_t eblob_get_footer_size(const struct eblob_backend *b, const struct eblob
 
 /*
  * eblob_commit_footer() - computes and writes footer for @key pointed by @wc
+ * @iov - data that has just been written to the record or NULL. Checksums of chunks
+ * entirely covered by @iov are computed from it instead of reading data back from disk.
  *
  * Returns negative error value or zero on success
  */
-int eblob_commit_footer(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc);
+int eblob_commit_footer(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
+                        const struct eblob_iovec *iov, uint16_t iovcnt);
+
+/*
+ * Chunked MurmurHash64A of record data computed as data is appended to the
+ * record sequentially from its beginning. Gives the same checksums as
+ * eblob_commit_footer() computes from disk.
+ */
+struct eblob_footer_stream {
+	/* Checksums of completed chunks */
+	uint64_t	*checksums;
+	uint64_t	checksums_num, checksums_max;
+	/* Checksum of hashed blocks of current chunk and their size */
+	uint64_t	chunk_hash;
+	uint64_t	chunk_size;
+	/* Head of the next block */
+	unsigned char	block[EBLOB_CSUM_BLOCK_SIZE];
+	uint64_t	block_size;
+};
+
+/*
+ * eblob_footer_stream_init() - prepares @fs for up to @data_size bytes of data
+ *
+ * Returns negative error value or zero on success
+ */
+int eblob_footer_stream_init(struct eblob_footer_stream *fs, uint64_t data_size);
+void eblob_footer_stream_destroy(struct eblob_footer_stream *fs);
+
+/*
+ * eblob_footer_stream_update() - hashes next @size bytes of data
+ */
+void eblob_footer_stream_update(struct eblob_footer_stream *fs, const void *data, uint64_t size);
+
+/*
+ * eblob_commit_footer_stream() - writes footer for @key pointed by @wc computed by @fs without
+ * reading data from disk. All @wc->total_data_size bytes of data must have been hashed by @fs.
+ *
+ * Returns negative error value or zero on success
+ */
+int eblob_commit_footer_stream(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
+                               struct eblob_footer_stream *fs);
+
+/*
+ * eblob_fill_footer() - computes footer for @key pointed by @wc from @iov without reading data from disk
+ * and without writing it. Footer is returned in @footer: @footer->base should be freed by caller,
+ * @footer->offset is offset of footer within data file. If eblob is configured with EBLOB_NO_FOOTER flag,
+ * @footer->size is 0.
+ *
+ * Returns -EAGAIN if some chunk is not entirely covered by @iov, other negative error value or zero on success
+ */
+int eblob_fill_footer(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
+                      const struct eblob_iovec *iov, uint16_t iovcnt, struct eblob_iovec *footer);
 
 /*
  * eblob_verify_sha512() - verifies checksum of enty pointed by @wc by comparing sha512 of whole record's data with
  * footer.
+ * @data - NULL or @wc->size bytes of record's data at @wc->offset that were just read. If they are whole record's data,
+ * sha512 is computed from them instead of reading data from disk.
  *
  * Returns negative error value or zero on success.
  */
-int eblob_verify_sha512(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc);
+int eblob_verify_sha512(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
+                        const void *data);
 
 /*
  * eblob_verify_mmhash() - verifies checksum of entry pointed by @wc by comparing MurmurHash64A of record's data chunks
  * with footer. It will checks only chunks that intersect @wc->offset and @wc->size.
+ * @data - NULL or @wc->size bytes of record's data at @wc->offset that were just read. Chunks entirely covered by
+ * @data are hashed from it instead of reading data from disk.
  *
  * Returns negative error value or zero on success.
  */
-int eblob_verify_mmhash(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc);
+int eblob_verify_mmhash(struct eblob_backend *b, struct eblob_key *key, struct eblob_write_control *wc,
+                        const void *data);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,231 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Group commit.
+ *
+ * With cfg.sync == 0 every write and remove should be on disk before it
+ * returns. Instead of one fdatasync(2) per operation concurrent operations
+ * share them: while leader syncs one batch, the next one is accumulated, so
+ * under load number of syncs per second doesn't depend on number of writers.
+ *
+ * Writers hold bctls their fds belong to while they wait, so fds of waiters
+ * can't be closed before they are synced. Fds of requests that do not wait may
+ * be closed meanwhile - errors of their sync are ignored.
+ */
+
+#include "blob.h"
+
+#include <stdlib.h>
+
+struct eblob_gcommit_waiter {
+	struct list_head	entry;
+	const int		*fds;
+	unsigned int		num;
+	int			err;
+	int			done;
+};
+
+int eblob_gcommit_init(struct eblob_gcommit *gc)
+{
+	int err;
+
+	memset(gc, 0, sizeof(struct eblob_gcommit));
+	INIT_LIST_HEAD(&gc->queue);
+
+	err = eblob_mutex_init(&gc->lock);
+	if (err)
+		goto err_out_exit;
+
+	err = eblob_cond_init(&gc->cond);
+	if (err)
+		goto err_out_mutex_destroy;
+
+	return 0;
+
+err_out_mutex_destroy:
+	pthread_mutex_destroy(&gc->lock);
+err_out_exit:
+	return err;
+}
+
+void eblob_gcommit_destroy(struct eblob_gcommit *gc)
+{
+	assert(list_empty(&gc->queue));
+
+	free(gc->pending.fd);
+	free(gc->pending.err);
+	free(gc->batch.fd);
+	free(gc->batch.err);
+	pthread_cond_destroy(&gc->cond);
+	pthread_mutex_destroy(&gc->lock);
+}
+
+/*
+ * eblob_gcommit_fds_add() - adds @fd to the set unless it's already there.
+ */
+static int eblob_gcommit_fds_add(struct eblob_gcommit_fds *fds, int fd)
+{
+	unsigned int i;
+
+	for (i = 0; i < fds->num; ++i)
+		if (fds->fd[i] == fd)
+			return 0;
+
+	if (fds->num == fds->size) {
+		const unsigned int size = fds->size ? fds->size * 2 : 16;
+		int *fd_new, *err_new;
+
+		fd_new = realloc(fds->fd, size * sizeof(int));
+		if (fd_new == NULL)
+			return -ENOMEM;
+		fds->fd = fd_new;
+
+		err_new = realloc(fds->err, size * sizeof(int));
+		if (err_new == NULL)
+			return -ENOMEM;
+		fds->err = err_new;
+
+		fds->size = size;
+	}
+
+	fds->fd[fds->num++] = fd;
+	return 0;
+}
+
+/*
+ * eblob_gcommit_fds_err() - returns result of sync of @fd in the batch.
+ */
+static int eblob_gcommit_fds_err(const struct eblob_gcommit_fds *fds, int fd)
+{
+	unsigned int i;
+
+	for (i = 0; i < fds->num; ++i)
+		if (fds->fd[i] == fd)
+			return fds->err[i];
+
+	return -ENOENT;
+}
+
+/*
+ * eblob_gcommit_lead() - syncs all pending fds and completes queued waiters.
+ * NB! Called with @gc->lock held, drops it during sync.
+ */
+static void eblob_gcommit_lead(struct eblob_backend *b)
+{
+	struct eblob_gcommit *gc = &b->gcommit;
+	struct eblob_gcommit_fds tmp;
+	struct eblob_gcommit_waiter *w;
+	LIST_HEAD(waiters);
+	unsigned int i, num = 0;
+
+	gc->leader = 1;
+	list_splice_init(&gc->queue, &waiters);
+	tmp = gc->batch;
+	gc->batch = gc->pending;
+	gc->pending = tmp;
+	gc->pending.num = 0;
+	pthread_mutex_unlock(&gc->lock);
+
+	for (i = 0; i < gc->batch.num; ++i)
+		gc->batch.err[i] = eblob_fdatasync(gc->batch.fd[i]);
+
+	pthread_mutex_lock(&gc->lock);
+	list_for_each_entry(w, &waiters, entry) {
+		for (i = 0; i < w->num && w->err == 0; ++i)
+			w->err = eblob_gcommit_fds_err(&gc->batch, w->fds[i]);
+		w->done = 1;
+		++num;
+	}
+
+	eblob_stat_inc(b->stat, EBLOB_GST_GROUP_COMMITS);
+	eblob_stat_add(b->stat, EBLOB_GST_GROUP_COMMIT_WAITERS, num);
+
+	gc->batch.num = 0;
+	gc->leader = 0;
+	pthread_cond_broadcast(&gc->cond);
+}
+
+/**
+ * eblob_gcommit_sync() - makes writes to @fds durable.
+ * @wait:	wait until @fds are synced, otherwise they are only scheduled to
+ *		be synced by the next batch and 0 is returned.
+ *
+ * If there is no memory to add @fds to the batch they are synced directly.
+ */
+int eblob_gcommit_sync(struct eblob_backend *b, const int *fds, unsigned int num, int wait)
+{
+	struct eblob_gcommit *gc = &b->gcommit;
+	struct eblob_gcommit_waiter w = {
+		.fds = fds,
+		.num = num,
+	};
+	unsigned int i;
+	int err = 0;
+
+	pthread_mutex_lock(&gc->lock);
+	for (i = 0; i < num; ++i) {
+		err = eblob_gcommit_fds_add(&gc->pending, fds[i]);
+		if (err)
+			break;
+	}
+
+	if (err) {
+		pthread_mutex_unlock(&gc->lock);
+
+		for (err = 0, i = 0; i < num; ++i) {
+			const int sync_err = eblob_fdatasync(fds[i]);
+			if (err == 0)
+				err = sync_err;
+		}
+		return err;
+	}
+
+	if (!wait) {
+		pthread_mutex_unlock(&gc->lock);
+		return 0;
+	}
+
+	list_add_tail(&w.entry, &gc->queue);
+	while (!w.done) {
+		if (gc->leader)
+			pthread_cond_wait(&gc->cond, &gc->lock);
+		else
+			eblob_gcommit_lead(b);
+	}
+	pthread_mutex_unlock(&gc->lock);
+
+	return w.err;
+}
+
+/**
+ * eblob_gcommit_flush() - syncs fds scheduled by requests that do not wait.
+ */
+int eblob_gcommit_flush(struct eblob_backend *b)
+{
+	struct eblob_gcommit *gc = &b->gcommit;
+	unsigned int pending;
+
+	pthread_mutex_lock(&gc->lock);
+	pending = gc->pending.num;
+	pthread_mutex_unlock(&gc->lock);
+
+	if (pending == 0)
+		return 0;
+
+	return eblob_gcommit_sync(b, NULL, 0, 1);
+}
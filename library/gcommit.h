@@ -0,0 +1,61 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __EBLOB_GCOMMIT_H
+#define __EBLOB_GCOMMIT_H
+
+#include "list.h"
+
+#include <pthread.h>
+
+struct eblob_backend;
+
+/* Set of distinct file descriptors to be synced */
+struct eblob_gcommit_fds {
+	int			*fd;
+	/* Result of sync of each fd, filled by leader */
+	int			*err;
+	unsigned int		num, size;
+};
+
+/*
+ * Group commit of writes and removes when backend syncs every operation.
+ *
+ * Writers add their fds to @pending and wait in @queue. First of them becomes
+ * the leader: it takes all pending fds and queued waiters, syncs each fd once
+ * and wakes waiters of the batch together. Requests that came during the sync
+ * are batched by the next leader.
+ */
+struct eblob_gcommit {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	/* Fds written since the last batch was started */
+	struct eblob_gcommit_fds	pending;
+	/* Fds being synced by the leader, reused by the next batch */
+	struct eblob_gcommit_fds	batch;
+	/* Waiters for the next batch */
+	struct list_head	queue;
+	/* Batch is being synced */
+	int			leader;
+};
+
+int eblob_gcommit_init(struct eblob_gcommit *gc);
+void eblob_gcommit_destroy(struct eblob_gcommit *gc);
+int eblob_gcommit_sync(struct eblob_backend *b, const int *fds, unsigned int num, int wait);
+int eblob_gcommit_flush(struct eblob_backend *b);
+
+#endif /* __EBLOB_GCOMMIT_H */
@@ -48,16 +48,14 @@
 #include <string.h>
 #include <unistd.h>
 
-static inline void eblob_hash_entry_put(struct eblob_hash *h __attribute_unused__,
-		struct eblob_hash_entry *e)
+static inline void eblob_hash_entry_put(struct eblob_hash *h, struct eblob_hash_entry *e)
 {
-	free(e);
+	eblob_slab_free(&h->slab, e);
 }
 
 static int eblob_hash_entry_add(struct eblob_hash *hash, struct eblob_key *key, void *data, int replace, int *replaced)
 {
 	struct rb_node **n, *parent;
-	uint64_t esize = sizeof(struct eblob_hash_entry) + hash->dsize;
 	struct eblob_hash_entry *e, *t;
 	int err, cmp;
 
@@ -90,7 +88,7 @@ static int eblob_hash_entry_add(struct eblob_hash *hash, struct eblob_key *key,
 	}
 
 	/* Add */
-	e = malloc(esize);
+	e = eblob_slab_alloc(&hash->slab);
 	if (!e) {
 		err = -ENOMEM;
 		goto err_out_exit;
@@ -117,6 +115,7 @@ int eblob_hash_init(struct eblob_hash *h, unsigned int dsize)
 	memset(h, 0, sizeof(struct eblob_hash));
 	h->root = RB_ROOT;
 	h->dsize = dsize;
+	eblob_slab_init(&h->slab, sizeof(struct eblob_hash_entry) + dsize);
 
 	err = pthread_rwlock_init(&h->root_lock, NULL);
 	if (err != 0) {
@@ -128,19 +127,16 @@ err_out_exit:
 	return err;
 }
 
+/**
+ * eblob_hash_destroy() - frees all entries at once by releasing slab, there
+ * is no need to walk the tree.
+ */
 void eblob_hash_destroy(struct eblob_hash *h)
 {
-	struct rb_node *n, *t;
-
 	assert(h != NULL);
 
-	for (n = rb_first(&h->root); n != NULL; n = t) {
-		struct eblob_hash_entry *e = rb_entry(n, struct eblob_hash_entry, node);
-
-		t = rb_next(n);
-		rb_erase(n, &h->root);
-		eblob_hash_entry_put(h, e);
-	}
+	eblob_slab_destroy(&h->slab);
+	h->root = RB_ROOT;
 
 	pthread_rwlock_destroy(&h->root_lock);
 }
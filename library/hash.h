@@ -23,6 +23,7 @@
 
 #include "list.h"
 #include "rbtree.h"
+#include "slab.h"
 
 #include <strings.h>
 
@@ -30,6 +31,8 @@ struct eblob_hash {
 	struct rb_root		root;
 	pthread_rwlock_t	root_lock;
 	unsigned int		dsize;
+	/* Allocator of tree entries */
+	struct eblob_slab	slab;
 };
 
 int eblob_hash_init(struct eblob_hash *h, unsigned int dsize);
@@ -128,6 +128,16 @@ static int eblob_find_non_removed_callback(struct eblob_disk_control *sorted,
 	return !(sorted->flags & rem);
 }
 
+/*
+ * eblob_index_tombstone_exists() - checks whether record of @bctl which
+ * header @dc is read from its index is removed by tombstone.
+ */
+static int eblob_index_tombstone_exists(struct eblob_backend *b, const struct eblob_base_ctl *bctl,
+		const struct eblob_disk_control *dc)
+{
+	return eblob_tombstone_exists(b, bctl, &dc->key, eblob_bswap64(dc->position));
+}
+
 int eblob_index_blocks_destroy(struct eblob_base_ctl *bctl)
 {
 	pthread_rwlock_wrlock(&bctl->index_blocks_lock);
@@ -340,7 +350,8 @@ int eblob_index_blocks_fill(struct eblob_base_ctl *bctl)
 			if (i == 0)
 				block->start_key = dc.key;
 
-			if (dc.flags & eblob_bswap64(BLOB_DISK_CTL_REMOVE)) {
+			if ((dc.flags & eblob_bswap64(BLOB_DISK_CTL_REMOVE)) ||
+					eblob_index_tombstone_exists(bctl->back, bctl, &dc)) {
 				removed++;
 				/* size of the place occupied by the record in the index and the blob */
 				removed_size += dc.disk_size + sizeof(struct eblob_disk_control);
@@ -465,7 +476,7 @@ static int eblob_find_on_disk(struct eblob_backend *b,
 	sorted = sorted_orig;
 	end = search_end;
 	while (eblob_disk_control_sort(sorted, dc) == 0) {
-		if (callback(sorted, dc)) {
+		if (callback(sorted, dc) && !eblob_index_tombstone_exists(b, bctl, sorted)) {
 			found = sorted;
 			break;
 		}
@@ -515,7 +526,7 @@ static int eblob_find_on_disk(struct eblob_backend *b,
 		if (eblob_disk_control_sort(sorted, dc))
 			break;
 
-		if (callback(sorted, dc)) {
+		if (callback(sorted, dc) && !eblob_index_tombstone_exists(b, bctl, sorted)) {
 			found = sorted;
 			break;
 		}
@@ -658,12 +669,7 @@ static int indexsort_flush_cache(struct eblob_backend *b, void *sorted_index, ui
 	/*
 	 * Check whether cache is empty
 	 */
-	if (b->cfg.blob_flags & EBLOB_L2HASH) {
-		err = eblob_l2hash_empty(&b->l2hash);
-	} else {
-		err = eblob_hash_empty(&b->hash);
-	}
-	if (err) {
+	if (eblob_cache_empty(b)) {
 		/*
 		 * There is nothing we can flush - cache is empty.
 		 * Skip iterating over indexes, this should speed up initial eblob load.
@@ -695,6 +701,7 @@ static int indexsort_flush_cache(struct eblob_backend *b, void *sorted_index, ui
 int eblob_generate_sorted_index(struct eblob_backend *b, struct eblob_base_ctl *bctl) {
 	int fd, old_fd, err, len;
 	char *file, *dst_file;
+	unsigned char *locked_shards;
 	ssize_t index_size;
 	void *sorted_index;
 
@@ -770,6 +777,17 @@ int eblob_generate_sorted_index(struct eblob_backend *b, struct eblob_base_ctl *
 		goto err_out_free_index;
 	}
 
+	/*
+	 * Mark records removed by tombstones in unsorted index before it's
+	 * read, tombstones added since then are in binlog too.
+	 */
+	err = eblob_tombstones_fold(b, bctl);
+	if (err != 0) {
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "defrag: indexsort: eblob_tombstones_fold: index: %d",
+			    bctl->index);
+		goto err_out_stop_binlog;
+	}
+
 	err = __eblob_read_ll(bctl->index_ctl.fd, sorted_index, index_size, 0);
 	if (err) {
 		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "defrag: indexsort: read: index: %d, size: %llu: %s",
@@ -787,10 +805,21 @@ int eblob_generate_sorted_index(struct eblob_backend *b, struct eblob_base_ctl *
 
 	old_fd = bctl->index_ctl.fd;
 
-	/* Lock hash - prevent using old offsets with new sorted index */
-	if ((err = pthread_rwlock_wrlock(&b->hash.root_lock)) != 0) {
-		err = -err;
-		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "defrag: indexsort: pthread_rwlock_wrlock: index: %d: FAILED",
+	/* Iteration pinned the base while its index was sorted */
+	if (bctl->iterators != 0) {
+		err = -EBUSY;
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "defrag: indexsort: base is being iterated: index: %d",
+				bctl->index);
+		goto err_unlock_bctl;
+	}
+
+	/*
+	 * Lock hash shards that hold keys of this base - prevent using old
+	 * offsets with new sorted index
+	 */
+	err = eblob_cache_lock_shards(b, sorted_index, index_size / sizeof(struct eblob_disk_control), &locked_shards);
+	if (err != 0) {
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "defrag: indexsort: eblob_cache_lock_shards: index: %d: FAILED",
 				bctl->index);
 		goto err_unlock_bctl;
 	}
@@ -851,11 +880,14 @@ int eblob_generate_sorted_index(struct eblob_backend *b, struct eblob_base_ctl *
 		goto err_unlock_hash;
 	}
 
+	/* Removes captured by binlog are applied, their tombstones refer to unsorted index */
+	eblob_tombstones_drop(b, bctl);
+
 	bctl->index_ctl.sorted = 1;
-	b->defrag_generation += 1;
+	eblob_defrag_generation_inc(b);
 
 	/* Unlock */
-	pthread_rwlock_unlock(&b->hash.root_lock);
+	eblob_cache_unlock_shards(b, locked_shards);
 	pthread_mutex_unlock(&bctl->lock);
 	pthread_mutex_unlock(&b->lock);
 
@@ -875,7 +907,7 @@ int eblob_generate_sorted_index(struct eblob_backend *b, struct eblob_base_ctl *
 	return 0;
 
 err_unlock_hash:
-	pthread_rwlock_unlock(&b->hash.root_lock);
+	eblob_cache_unlock_shards(b, locked_shards);
 err_unlock_bctl:
 	bctl->index_ctl.fd = old_fd;
 	pthread_mutex_unlock(&bctl->lock);
@@ -911,8 +943,12 @@ static char *eblob_dump_search_stat(const struct eblob_disk_search_stat *st, int
 	return ss;
 }
 
+/**
+ * eblob_disk_index_lookup() - looks for @key in sorted indexes.
+ * @meta:	if not NULL, filled with metadata of found record
+ */
 int eblob_disk_index_lookup(struct eblob_backend *b, struct eblob_key *key,
-		struct eblob_ram_control *rctl)
+		struct eblob_ram_control *rctl, struct eblob_ram_meta *meta)
 {
 	FORMATTED(HANDY_TIMER_SCOPE, ("eblob.%u.disk.lookup", b->cfg.stat_id));
 
@@ -973,6 +1009,11 @@ again:
 		rctl->size = dc.data_size;
 		rctl->bctl = bctl;
 
+		if (meta != NULL) {
+			meta->flags = dc.flags;
+			meta->disk_size = dc.disk_size;
+		}
+
 		eblob_bctl_release(bctl);
 
 		eblob_log(b->cfg.log, EBLOB_LOG_NOTICE, eblob_dump_id(key->id),
@@ -83,6 +83,15 @@ static void eblob_stat_config_json(struct eblob_backend *b, rapidjson::Value &st
 	stat.AddMember("bg_ioprio_data", b->cfg.bg_ioprio_data, allocator);
 	auto ioprio_class = ioprio_class_string(b->cfg.bg_ioprio_class);
 	stat.AddMember("string_bg_ioprio_class", rapidjson::Value(ioprio_class, allocator), allocator);
+	stat.AddMember("cache_shards", b->cfg.cache_shards, allocator);
+	stat.AddMember("active_bases", b->cfg.active_bases, allocator);
+	stat.AddMember("aio_threads", b->cfg.aio_threads, allocator);
+	stat.AddMember("direct_io_threshold", b->cfg.direct_io_threshold, allocator);
+	stat.AddMember("prealloc_size", b->cfg.prealloc_size, allocator);
+	stat.AddMember("compress_threshold", b->cfg.compress_threshold, allocator);
+	stat.AddMember("spare_base_threshold", b->cfg.spare_base_threshold, allocator);
+	stat.AddMember("wbuf_size", b->cfg.wbuf_size, allocator);
+	stat.AddMember("wbuf_timeout", b->cfg.wbuf_timeout, allocator);
 }
 
 static char *get_dir_path(const char *data_path) {
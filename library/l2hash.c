@@ -56,50 +56,15 @@ int eblob_l2hash_init(struct eblob_l2hash *l2h)
 	memset(l2h, 0, sizeof(*l2h));
 	l2h->root = RB_ROOT;
 	l2h->collisions = RB_ROOT;
+	eblob_slab_init(&l2h->entry_slab, sizeof(struct eblob_l2hash_entry));
+	eblob_slab_init(&l2h->collision_slab, sizeof(struct eblob_l2hash_collision));
 
 	return 0;
 }
 
 /**
- * __eblob_l2hash_tree_destroy() - removes all entries from given tree and
- * frees memory allocated by tree entries.
- */
-static void __eblob_l2hash_tree_destroy(struct rb_root *root) {
-	struct rb_node *n, *t;
-
-	assert(root != NULL);
-
-	for (n = rb_first(root); n != NULL; n = t) {
-		struct eblob_l2hash_entry *e;
-
-		e = rb_entry(n, struct eblob_l2hash_entry, node);
-		t = rb_next(n);
-		rb_erase(n, root);
-		free(e);
-	}
-}
-
-/**
- * __eblob_l2hash_collision_tree_destroy() - removes all entries from given
- * collision tree and frees memory allocated by tree entries.
- */
-static void __eblob_l2hash_collision_tree_destroy(struct rb_root *root) {
-	struct rb_node *n, *t;
-
-	assert(root != NULL);
-
-	for (n = rb_first(root); n != NULL; n = t) {
-		struct eblob_l2hash_collision *e;
-
-		e = rb_entry(n, struct eblob_l2hash_collision, node);
-		t = rb_next(n);
-		rb_erase(n, root);
-		free(e);
-	}
-}
-
-/**
- * eblob_l2hash_destroy() - frees memory allocated by eblob_l2hash_init()
+ * eblob_l2hash_destroy() - frees all entries of both trees at once by
+ * releasing their slabs.
  * NB! Caller must manually synchronize calls to eblob_l2hash_destroy()
  */
 int eblob_l2hash_destroy(struct eblob_l2hash *l2h)
@@ -107,9 +72,10 @@ int eblob_l2hash_destroy(struct eblob_l2hash *l2h)
 	if (l2h == NULL)
 		return -EINVAL;
 
-	/* Destroy trees */
-	__eblob_l2hash_tree_destroy(&l2h->root);
-	__eblob_l2hash_collision_tree_destroy(&l2h->collisions);
+	eblob_slab_destroy(&l2h->entry_slab);
+	eblob_slab_destroy(&l2h->collision_slab);
+	l2h->root = RB_ROOT;
+	l2h->collisions = RB_ROOT;
 
 	return 0;
 }
@@ -201,20 +167,22 @@ __eblob_l2hash_collision_walk(struct rb_root *root,
 /**
  * __eblob_l2hash_collision_insert() - inserts entry into collision tree
  */
-static int __eblob_l2hash_collision_insert(struct rb_root *root,
+static int __eblob_l2hash_collision_insert(struct eblob_l2hash *l2h,
 		const struct eblob_key *key,
 		const struct eblob_ram_control *rctl)
 {
 	struct eblob_l2hash_collision *collision;
 	struct rb_node *n, *parent, **node;
+	struct rb_root *root = &l2h->collisions;
 
 	n = __eblob_l2hash_collision_walk(root, key, &parent, &node);
 	if (n != NULL)
 		return -EEXIST;
 
-	collision = calloc(1, sizeof(struct eblob_l2hash_collision));
+	collision = eblob_slab_alloc(&l2h->collision_slab);
 	if (collision == NULL)
 		return -ENOMEM;
+	memset(collision, 0, sizeof(struct eblob_l2hash_collision));
 	collision->key = *key;
 	collision->rctl = *rctl;
 
@@ -336,20 +304,22 @@ __eblob_l2hash_noncollision_walk(struct rb_root *root,
 /**
  * __eblob_l2hash_noncollision_insert() - inserts entry in l2hash tree
  */
-static int __eblob_l2hash_noncollision_insert(struct rb_root *root,
+static int __eblob_l2hash_noncollision_insert(struct eblob_l2hash *l2h,
 		const struct eblob_key *key,
 		const struct eblob_ram_control *rctl)
 {
 	struct eblob_l2hash_entry *e;
 	struct rb_node *n, *parent, **node;
+	struct rb_root *root = &l2h->root;
 
 	n = __eblob_l2hash_noncollision_walk(root, key, &parent, &node);
 	if (n != NULL)
 		return -EEXIST;
 
-	e = calloc(1, sizeof(struct eblob_l2hash_entry));
+	e = eblob_slab_alloc(&l2h->entry_slab);
 	if (e == NULL)
 		return -ENOMEM;
+	memset(e, 0, sizeof(struct eblob_l2hash_entry));
 	e->l2key = eblob_l2hash_key(key);
 	e->rctl = *rctl;
 
@@ -435,7 +405,7 @@ int eblob_l2hash_remove(struct eblob_l2hash *l2h,
 		switch(err = eblob_l2hash_compare_index(key, &e->rctl)) {
 		case 0:
 			rb_erase(&e->node, &l2h->root);
-			free(e);
+			eblob_slab_free(&l2h->entry_slab, e);
 			return 0;
 		case 1:
 			return -ENOENT;
@@ -451,7 +421,7 @@ int eblob_l2hash_remove(struct eblob_l2hash *l2h,
 
 	/* Otherwise - remove entry from collision tree */
 	rb_erase(&collision->node, &l2h->collisions);
-	free(collision);
+	eblob_slab_free(&l2h->collision_slab, collision);
 	return 0;
 }
 
@@ -494,7 +464,7 @@ static int _eblob_l2hash_insert(struct eblob_l2hash *l2h,
 		/* No entry with matching l2hash - inserting */
 		if (flavor == EBLOB_L2HASH_FLAVOR_UPDATE)
 			return -ENOENT;
-		return __eblob_l2hash_noncollision_insert(&l2h->root, key, rctl);
+		return __eblob_l2hash_noncollision_insert(l2h, key, rctl);
 	}
 	/* There is already entry with matching l2hash */
 	if (e->collision == 0) {
@@ -521,13 +491,13 @@ static int _eblob_l2hash_insert(struct eblob_l2hash *l2h,
 			return -ENOENT;
 
 		/* Move old entry to collision tree */
-		err = __eblob_l2hash_collision_insert(&l2h->collisions, &dc.key, &e->rctl);
+		err = __eblob_l2hash_collision_insert(l2h, &dc.key, &e->rctl);
 		if (err != 0)
 			return err;
 
 		e->collision = 1;
 		memset(&e->rctl, 0, sizeof(struct eblob_ram_control));
-		return __eblob_l2hash_collision_insert(&l2h->collisions, key, rctl);
+		return __eblob_l2hash_collision_insert(l2h, key, rctl);
 	}
 
 	/* Search tree of collisions for matching entry */
@@ -536,7 +506,7 @@ static int _eblob_l2hash_insert(struct eblob_l2hash *l2h,
 		/* No entry found - inserting one */
 		if (flavor == EBLOB_L2HASH_FLAVOR_UPDATE)
 			return -ENOENT;
-		return __eblob_l2hash_collision_insert(&l2h->collisions, key, rctl);
+		return __eblob_l2hash_collision_insert(l2h, key, rctl);
 	}
 
 	/* Entry found - modifying in-place  */
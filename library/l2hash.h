@@ -23,6 +23,7 @@
 
 #include "list.h"
 #include "rbtree.h"
+#include "slab.h"
 
 /*
  * On x86_64:
@@ -57,6 +58,9 @@ struct eblob_l2hash {
 	struct rb_root		root;
 	/* Tree of collisions in l2hash */
 	struct rb_root		collisions;
+	/* Allocators of entries of both trees */
+	struct eblob_slab	entry_slab;
+	struct eblob_slab	collision_slab;
 };
 
 /*
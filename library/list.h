@@ -55,9 +55,14 @@ static inline void __list_add(struct list_head *new_node,
 			      struct list_head *prev,
 			      struct list_head *next)
 {
-	next->prev = new_node;
+	/*
+	 * Fully initialize @new_node before linking it: bases list is walked
+	 * without locks (in both directions) on read path.
+	 */
 	new_node->next = next;
 	new_node->prev = prev;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	next->prev = new_node;
 	prev->next = new_node;
 }
 
@@ -123,8 +128,9 @@ static inline void list_replace(struct list_head *old,
 				struct list_head *new_node)
 {
 	new_node->next = old->next;
-	new_node->next->prev = new_node;
 	new_node->prev = old->prev;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	new_node->next->prev = new_node;
 	new_node->prev->next = new_node;
 }
 
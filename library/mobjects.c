@@ -41,6 +41,7 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <pthread.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -119,8 +120,15 @@ int _eblob_base_ctl_cleanup(struct eblob_base_ctl *ctl)
 
 	close(ctl->index_ctl.fd);
 	close(ctl->data_ctl.fd);
+	if (ctl->direct_fd >= 0)
+		close(ctl->direct_fd);
 
-	ctl->index_ctl.fd = ctl->data_ctl.fd = -1;
+	ctl->index_ctl.fd = ctl->data_ctl.fd = ctl->direct_fd = -1;
+
+	eblob_compress_dict_free(ctl->dict);
+	ctl->dict = NULL;
+
+	eblob_cache_slot_retire(ctl);
 
 	eblob_stat_set(ctl->stat, EBLOB_LST_BASE_SIZE, 0);
 	eblob_stat_set(ctl->stat, EBLOB_LST_RECORDS_TOTAL, 0);
@@ -195,6 +203,28 @@ err_out_exit:
 	return err;
 }
 
+/**
+ * eblob_base_open_direct() - opens O_DIRECT descriptor of data file @path
+ * of @ctl if direct I/O is enabled.
+ * Direct I/O is optional: if file system does not support it, records of the
+ * base are written and read through page cache.
+ */
+void eblob_base_open_direct(struct eblob_backend *b, struct eblob_base_ctl *ctl, const char *path)
+{
+	ctl->direct_fd = -1;
+	if (b->cfg.direct_io_threshold == 0)
+		return;
+
+#ifdef O_DIRECT
+	ctl->direct_fd = open(path, O_RDWR | O_CLOEXEC | O_DIRECT);
+	if (ctl->direct_fd == -1)
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, errno,
+				"direct I/O is not available, using page cache: %s", path);
+#else
+	(void)path;
+#endif
+}
+
 static int eblob_base_ctl_open(struct eblob_backend *b, struct eblob_base_ctl *ctl,
 		const char *dir_base, const char *name, int name_len)
 {
@@ -238,6 +268,25 @@ static int eblob_base_ctl_open(struct eblob_backend *b, struct eblob_base_ctl *c
 	}
 	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_NOTICE, "base opened: %s", full);
 
+	eblob_base_open_direct(b, ctl, full);
+
+	/* Dictionary is written by data-sort, without it records compressed with it can't be read */
+	sprintf(full, "%s/%s" EBLOB_COMPRESS_DICT_SUFFIX, dir_base, name);
+	if (created) {
+		unlink(full);
+	} else {
+		err = eblob_compress_dict_load(full, &ctl->dict);
+		if (err == 0) {
+			EBLOB_WARNX(b->cfg.log, EBLOB_LOG_INFO, "dictionary loaded: %s: id: %" PRIu32,
+					full, ctl->dict->id);
+		} else if (err != -ENOENT) {
+			EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "eblob_compress_dict_load: %s", full);
+		}
+
+		/* Before index is sorted or loaded, both of them check tombstones */
+		eblob_tombstones_bind(b, ctl);
+	}
+
 again:
 	sprintf(full, "%s/%s.index.sorted", dir_base, name);
 	err = access(full, R_OK);
@@ -332,6 +381,12 @@ err_out_close_index:
 	}
 err_out_close_data:
 	close(ctl->data_ctl.fd);
+	if (ctl->direct_fd >= 0) {
+		close(ctl->direct_fd);
+		ctl->direct_fd = -1;
+	}
+	eblob_compress_dict_free(ctl->dict);
+	ctl->dict = NULL;
 	if (created != NULL) {
 		EBLOB_WARNX(b->cfg.log, EBLOB_LOG_INFO, "removing created base and index: %s", created);
 		if (unlink(created) == -1)
@@ -364,6 +419,8 @@ struct eblob_base_ctl *eblob_base_ctl_new(struct eblob_backend *b, int index,
 	ctl->back = b;
 	ctl->index = index;
 	ctl->index_ctl.fd = -1;
+	ctl->direct_fd = -1;
+	ctl->cache_slot = -1;
 
 	memcpy(ctl->name, name, name_len);
 	ctl->name[name_len] = '\0';
@@ -497,7 +554,10 @@ static void eblob_add_new_base_ctl(struct eblob_backend *b, struct eblob_base_ct
 void eblob_bases_cleanup(struct eblob_backend *b)
 {
 	struct eblob_base_ctl *ctl, *tmp;
+	unsigned int i;
 
+	for (i = 0; i < b->cfg.active_bases; ++i)
+		eblob_active_base_set(b, i, NULL);
 	list_for_each_entry_safe(ctl, tmp, &b->bases, base_entry) {
 		list_del_init(&ctl->base_entry);
 
@@ -509,6 +569,7 @@ void eblob_bases_cleanup(struct eblob_backend *b)
 static int eblob_scan_base(struct eblob_backend *b)
 {
 	struct eblob_base_ctl *bctl;
+	unsigned int slot = 0;
 	int base_len, err;
 	DIR *dir;
 	struct dirent64 *d;
@@ -577,7 +638,19 @@ static int eblob_scan_base(struct eblob_backend *b)
 	}
 
 	/*
-	 * Run over all bases and sort all indexes except the last one.
+	 * Writes continue to the last @cfg.active_bases bases unless they are
+	 * already sorted, new bases are added for the rest of slots on demand.
+	 */
+	list_for_each_entry_reverse(bctl, &b->bases, base_entry) {
+		if (slot == b->cfg.active_bases)
+			break;
+		if (!bctl->index_ctl.sorted)
+			eblob_active_base_set(b, slot, bctl);
+		++slot;
+	}
+
+	/*
+	 * Run over all bases and sort all indexes except the active ones.
 	 * There is another similar code at eblob_base_ctl_open() - we generate
 	 * sorted index if given blob is large enough, in particular when number of records
 	 * or data size exceed config parameters.
@@ -586,12 +659,12 @@ static int eblob_scan_base(struct eblob_backend *b)
 	 * for example maximum allowed blob size increased. In this case check in eblob_base_ctl_open()
 	 * will never be true ending up with eating memory to hold indexes.
 	 *
-	 * This loop fixes that - we ALWAYS generate sorted index for all but the last blob at the start.
+	 * This loop fixes that - we ALWAYS generate sorted index for all but the active blobs at the start.
 	 */
 	list_for_each_entry(bctl, &b->bases, base_entry) {
-		/* do not process last entry, it can be used for writing */
-		if (list_is_last(&bctl->base_entry, &b->bases))
-			break;
+		/* do not process active entries, they are used for writing */
+		if (eblob_base_is_active(b, bctl))
+			continue;
 
 		/* Sort only nonempty and unsorted indexes */
 		if (bctl->index_ctl.size && !bctl->index_ctl.sorted) {
@@ -613,62 +686,560 @@ err_out_exit:
 	return err;
 }
 
+/* l2hash keeps full ram control since it needs bctl to resolve collisions */
+static inline int eblob_cache_packed(struct eblob_backend *b)
+{
+	return (b->cfg.blob_flags & (EBLOB_PACKED_CACHE | EBLOB_L2HASH)) == EBLOB_PACKED_CACHE;
+}
+
+/* l2hash entries have no room for metadata either */
+static inline int eblob_cache_meta(struct eblob_backend *b)
+{
+	return (b->cfg.blob_flags & (EBLOB_CACHE_META | EBLOB_L2HASH)) == EBLOB_CACHE_META;
+}
+
+/* Size of data stored in rb-tree and open-addressing cache per key */
+static inline unsigned int eblob_cache_dsize(struct eblob_backend *b)
+{
+	if (eblob_cache_packed(b))
+		return eblob_cache_meta(b) ? sizeof(struct eblob_ram_control_packed)
+			: offsetof(struct eblob_ram_control_packed, meta);
+	else
+		return eblob_cache_meta(b) ? sizeof(struct eblob_ram_control_meta)
+			: sizeof(struct eblob_ram_control);
+}
+
+/* Size of one entry in cache */
+static inline size_t eblob_cache_entry_size(struct eblob_backend *b)
+{
+	if (b->cfg.blob_flags & EBLOB_L2HASH)
+		return EBLOB_L2HASH_ENTRY_SIZE;
+	else if (b->cfg.blob_flags & EBLOB_OHASH)
+		return sizeof(struct eblob_key) + eblob_cache_dsize(b) + sizeof(uint32_t);
+	else
+		return sizeof(struct eblob_hash_entry) + eblob_cache_dsize(b);
+}
+
 /**
- * eblob_cache_insert() - inserts or updates ram control in hash.
+ * eblob_cache_init() - allocates and initializes @b->cfg.cache_shards shards
+ * of in-memory cache.
  */
-int eblob_cache_insert(struct eblob_backend *b, struct eblob_key *key,
-		struct eblob_ram_control *ctl)
+int eblob_cache_init(struct eblob_backend *b)
 {
-	size_t entry_size;
-	int replaced;
+	unsigned int i, dsize = eblob_cache_dsize(b);
 	int err;
 
-	if (b == NULL || key == NULL || ctl == NULL || ctl->bctl == NULL)
-		return -EINVAL;
+	if (b->cfg.blob_flags & EBLOB_PACKED_CACHE) {
+		b->cache_slots = calloc(EBLOB_CACHE_SLOTS_MAX, sizeof(struct eblob_cache_slot));
+		if (b->cache_slots == NULL)
+			return -ENOMEM;
 
-	pthread_rwlock_wrlock(&b->hash.root_lock);
+		err = eblob_mutex_init(&b->cache_slots_lock);
+		if (err) {
+			free(b->cache_slots);
+			b->cache_slots = NULL;
+			return err;
+		}
+	}
 
-	/* Do not accept bctls invalidated by data-sort */
-	if (ctl->bctl->index_ctl.fd < 0) {
+	b->cache_shards = calloc(b->cfg.cache_shards, sizeof(struct eblob_cache_shard));
+	if (b->cache_shards == NULL) {
+		err = -ENOMEM;
+		goto err_out_free_slots;
+	}
+
+	for (i = 0; i < b->cfg.cache_shards; ++i) {
+		struct eblob_cache_shard *shard = &b->cache_shards[i];
+
+		err = eblob_l2hash_init(&shard->l2hash);
+		if (err)
+			goto err_out_destroy;
+
+		err = eblob_hash_init(&shard->hash, dsize);
+		if (err) {
+			eblob_l2hash_destroy(&shard->l2hash);
+			goto err_out_destroy;
+		}
+
+		err = eblob_ohash_init(&shard->ohash, dsize);
+		if (err) {
+			eblob_hash_destroy(&shard->hash);
+			eblob_l2hash_destroy(&shard->l2hash);
+			goto err_out_destroy;
+		}
+	}
+
+	return 0;
+
+err_out_destroy:
+	while (i-- > 0) {
+		eblob_ohash_destroy(&b->cache_shards[i].ohash);
+		eblob_hash_destroy(&b->cache_shards[i].hash);
+		eblob_l2hash_destroy(&b->cache_shards[i].l2hash);
+	}
+	free(b->cache_shards);
+	b->cache_shards = NULL;
+err_out_free_slots:
+	if (b->cache_slots != NULL) {
+		pthread_mutex_destroy(&b->cache_slots_lock);
+		free(b->cache_slots);
+		b->cache_slots = NULL;
+	}
+	return err;
+}
+
+void eblob_cache_destroy(struct eblob_backend *b)
+{
+	unsigned int i;
+
+	if (b->cache_shards == NULL)
+		return;
+
+	for (i = 0; i < b->cfg.cache_shards; ++i) {
+		eblob_ohash_destroy(&b->cache_shards[i].ohash);
+		eblob_hash_destroy(&b->cache_shards[i].hash);
+		eblob_l2hash_destroy(&b->cache_shards[i].l2hash);
+	}
+	free(b->cache_shards);
+	b->cache_shards = NULL;
+
+	if (b->cache_slots != NULL) {
+		pthread_mutex_destroy(&b->cache_slots_lock);
+		free(b->cache_slots);
+		b->cache_slots = NULL;
+	}
+}
+
+/**
+ * eblob_cache_empty() - returns non-zero if there are no keys in all shards.
+ * NB! Result is racy unless all writers are blocked.
+ */
+int eblob_cache_empty(struct eblob_backend *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->cfg.cache_shards; ++i) {
+		struct eblob_cache_shard *shard = &b->cache_shards[i];
+
+		if (b->cfg.blob_flags & EBLOB_L2HASH) {
+			if (!eblob_l2hash_empty(&shard->l2hash))
+				return 0;
+		} else if (b->cfg.blob_flags & EBLOB_OHASH) {
+			if (!eblob_ohash_empty(&shard->ohash))
+				return 0;
+		} else {
+			if (!eblob_hash_empty(&shard->hash))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * eblob_cache_lock_shards() - exclusively locks all shards that may contain
+ * keys from @dcs array of @count entries, removed entries are skipped.
+ * Shards are locked in ascending order, so two concurrent callers can't deadlock.
+ * On success @lockedp is set to the map of locked shards that should be
+ * passed to eblob_cache_unlock_shards().
+ */
+int eblob_cache_lock_shards(struct eblob_backend *b, const struct eblob_disk_control *dcs,
+		uint64_t count, unsigned char **lockedp)
+{
+	unsigned char *locked;
+	unsigned int i;
+	uint64_t n;
+
+	locked = calloc(b->cfg.cache_shards, sizeof(unsigned char));
+	if (locked == NULL)
+		return -ENOMEM;
+
+	for (n = 0; n < count; ++n) {
+		if (dcs[n].flags & BLOB_DISK_CTL_REMOVE)
+			continue;
+		locked[eblob_cache_shard_index(b, dcs[n].key.id)] = 1;
+	}
+
+	for (i = 0; i < b->cfg.cache_shards; ++i) {
+		if (locked[i])
+			pthread_rwlock_wrlock(&b->cache_shards[i].hash.root_lock);
+	}
+
+	*lockedp = locked;
+	return 0;
+}
+
+void eblob_cache_unlock_shards(struct eblob_backend *b, unsigned char *locked)
+{
+	unsigned int i;
+
+	for (i = 0; i < b->cfg.cache_shards; ++i) {
+		if (locked[i])
+			pthread_rwlock_unlock(&b->cache_shards[i].hash.root_lock);
+	}
+	free(locked);
+}
+
+/**
+ * eblob_cache_shard_rss() - returns memory actually used by allocator of
+ * @shard cache engine.
+ * NB! Caller should hold lock of the shard.
+ */
+static uint64_t eblob_cache_shard_rss(struct eblob_backend *b, struct eblob_cache_shard *shard)
+{
+	if (b->cfg.blob_flags & EBLOB_L2HASH)
+		return eblob_slab_rss(&shard->l2hash.entry_slab)
+			+ eblob_slab_rss(&shard->l2hash.collision_slab);
+	else if (b->cfg.blob_flags & EBLOB_OHASH)
+		return eblob_ohash_rss(&shard->ohash);
+	else
+		return eblob_slab_rss(&shard->hash.slab);
+}
+
+/*
+ * Wrappers around cache engines, @data is either struct eblob_ram_control or
+ * struct eblob_ram_control_packed depending on EBLOB_PACKED_CACHE.
+ */
+static int eblob_cache_engine_replace(struct eblob_backend *b, struct eblob_cache_shard *shard,
+		struct eblob_key *key, void *data, int *replaced)
+{
+	if (b->cfg.blob_flags & EBLOB_L2HASH)
+		return eblob_l2hash_upsert(&shard->l2hash, key, data, replaced);
+	else if (b->cfg.blob_flags & EBLOB_OHASH)
+		return eblob_ohash_replace_nolock(&shard->ohash, key, data, replaced);
+	else
+		return eblob_hash_replace_nolock(&shard->hash, key, data, replaced);
+}
+
+static int eblob_cache_engine_lookup(struct eblob_backend *b, struct eblob_cache_shard *shard,
+		struct eblob_key *key, void *data)
+{
+	if (b->cfg.blob_flags & EBLOB_L2HASH)
+		return eblob_l2hash_lookup(&shard->l2hash, key, data);
+	else if (b->cfg.blob_flags & EBLOB_OHASH)
+		return eblob_ohash_lookup_nolock(&shard->ohash, key, data);
+	else
+		return eblob_hash_lookup_nolock(&shard->hash, key, data);
+}
+
+static int eblob_cache_engine_remove(struct eblob_backend *b, struct eblob_cache_shard *shard,
+		struct eblob_key *key)
+{
+	if (b->cfg.blob_flags & EBLOB_L2HASH)
+		return eblob_l2hash_remove(&shard->l2hash, key);
+	else if (b->cfg.blob_flags & EBLOB_OHASH)
+		return eblob_ohash_remove_nolock(&shard->ohash, key);
+	else
+		return eblob_hash_remove_nolock(&shard->hash, key);
+}
+
+/**
+ * eblob_cache_slot_assign() - binds free or reusable slot to @bctl.
+ * Returns slot number or negative error.
+ */
+static int eblob_cache_slot_assign(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	struct eblob_cache_slot *slot;
+	struct eblob_base_ctl *old;
+	int i, err;
+
+	pthread_mutex_lock(&b->cache_slots_lock);
+
+	/* Somebody could assign it while we were waiting for the lock */
+	i = bctl->cache_slot;
+	if (i >= 0 && b->cache_slots[i].bctl == bctl) {
+		err = i;
+		goto err_out_unlock;
+	}
+
+	/* Pairs with eblob_cache_slot_retire() */
+	if (bctl->index_ctl.fd < 0) {
 		err = -EAGAIN;
-		goto err_out_exit;
+		goto err_out_unlock;
+	}
+
+	for (i = 0; i < EBLOB_CACHE_SLOTS_MAX; ++i) {
+		slot = &b->cache_slots[i];
+		old = slot->bctl;
+
+		if (old == NULL)
+			break;
+		if (!slot->retired || __atomic_load_n(&slot->refs, __ATOMIC_SEQ_CST) != 0)
+			continue;
+
+		/*
+		 * Unbind and re-check references: concurrent
+		 * eblob_cache_slot_get() either sees unbound slot or we see
+		 * its reference.
+		 */
+		__atomic_store_n(&slot->bctl, NULL, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&slot->refs, __ATOMIC_SEQ_CST) == 0)
+			break;
+		__atomic_store_n(&slot->bctl, old, __ATOMIC_SEQ_CST);
+	}
+
+	if (i == EBLOB_CACHE_SLOTS_MAX) {
+		err = -ENOSPC;
+		goto err_out_unlock;
 	}
 
-	if (b->cfg.blob_flags & EBLOB_L2HASH) {
-		err = eblob_l2hash_upsert(&b->l2hash, key, ctl, &replaced);
-		entry_size = EBLOB_L2HASH_ENTRY_SIZE;
+	slot->retired = 0;
+	__atomic_store_n(&slot->bctl, bctl, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&bctl->cache_slot, i, __ATOMIC_RELEASE);
+	err = i;
+
+err_out_unlock:
+	pthread_mutex_unlock(&b->cache_slots_lock);
+	if (err == -ENOSPC)
+		EBLOB_WARNX(b->cfg.log, EBLOB_LOG_ERROR, "cache: all %d base slots are in use", EBLOB_CACHE_SLOTS_MAX);
+	return err;
+}
+
+/**
+ * eblob_cache_slot_get() - returns slot of @bctl with reference held, slot is
+ * assigned on first use.
+ */
+static int eblob_cache_slot_get(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	struct eblob_cache_slot *slot;
+	int i;
+
+	for (;;) {
+		i = __atomic_load_n(&bctl->cache_slot, __ATOMIC_ACQUIRE);
+		if (i < 0 || __atomic_load_n(&b->cache_slots[i].bctl, __ATOMIC_ACQUIRE) != bctl) {
+			i = eblob_cache_slot_assign(b, bctl);
+			if (i < 0)
+				return i;
+		}
+
+		slot = &b->cache_slots[i];
+		__atomic_add_fetch(&slot->refs, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&slot->bctl, __ATOMIC_SEQ_CST) == bctl)
+			return i;
+
+		/* Slot is being reused right now - drop reference and retry */
+		__atomic_sub_fetch(&slot->refs, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+static inline void eblob_cache_slot_put(struct eblob_backend *b, unsigned int slot)
+{
+	__atomic_sub_fetch(&b->cache_slots[slot].refs, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline unsigned int eblob_cache_packed_slot(const struct eblob_ram_control_packed *p)
+{
+	return (p->lo >> 40) & (EBLOB_CACHE_SLOTS_MAX - 1);
+}
+
+/**
+ * eblob_cache_slot_retire() - allows slot of @bctl to be reused by another
+ * base once all entries referencing it are gone. Called when @bctl files are
+ * closed.
+ */
+void eblob_cache_slot_retire(struct eblob_base_ctl *bctl)
+{
+	struct eblob_backend *b = bctl->back;
+	int i;
+
+	if (b == NULL || b->cache_slots == NULL)
+		return;
+
+	pthread_mutex_lock(&b->cache_slots_lock);
+	i = bctl->cache_slot;
+	if (i >= 0 && b->cache_slots[i].bctl == bctl)
+		b->cache_slots[i].retired = 1;
+	pthread_mutex_unlock(&b->cache_slots_lock);
+}
+
+static int eblob_cache_pack(const struct eblob_ram_control *rctl, const struct eblob_ram_meta *meta,
+		unsigned int slot, struct eblob_ram_control_packed *p)
+{
+	const uint64_t index_num = rctl->index_offset / sizeof(struct eblob_disk_control);
+
+	if (rctl->data_offset >= EBLOB_PACKED_OFFSET_MAX
+			|| rctl->size >= EBLOB_PACKED_OFFSET_MAX
+			|| index_num >= EBLOB_PACKED_RECORDS_MAX
+			|| rctl->index_offset % sizeof(struct eblob_disk_control) != 0)
+		return -ERANGE;
+
+	p->lo = rctl->data_offset | (uint64_t)slot << 40 | (rctl->size >> 32) << 56;
+	p->hi = index_num | rctl->size << 32;
+
+	/* Metadata that does not fit is stored as unknown */
+	p->meta = 0;
+	if (meta != NULL && meta->disk_size < EBLOB_PACKED_OFFSET_MAX
+			&& meta->flags < EBLOB_PACKED_FLAGS_MAX)
+		p->meta = meta->disk_size | meta->flags << 40;
+	return 0;
+}
+
+/**
+ * eblob_cache_unpack() - decodes packed entry into @rctl and, if @meta is not
+ * NULL, into @meta. @meta should be NULL if EBLOB_CACHE_META is not set.
+ * NB! Caller should hold lock of the shard entry belongs to.
+ */
+void eblob_cache_unpack(struct eblob_backend *b, const struct eblob_ram_control_packed *p,
+		struct eblob_ram_control *rctl, struct eblob_ram_meta *meta)
+{
+	rctl->data_offset = p->lo & (EBLOB_PACKED_OFFSET_MAX - 1);
+	rctl->index_offset = (p->hi & (EBLOB_PACKED_RECORDS_MAX - 1)) * sizeof(struct eblob_disk_control);
+	rctl->size = (p->hi >> 32) | (p->lo >> 56) << 32;
+	rctl->bctl = __atomic_load_n(&b->cache_slots[eblob_cache_packed_slot(p)].bctl, __ATOMIC_ACQUIRE);
+
+	if (meta != NULL) {
+		meta->disk_size = p->meta & (EBLOB_PACKED_OFFSET_MAX - 1);
+		meta->flags = p->meta >> 40;
+	}
+}
+
+/**
+ * eblob_cache_insert_packed() - packs @ctl and inserts it, maintaining
+ * references of base slots of new and replaced entries.
+ */
+static int eblob_cache_insert_packed(struct eblob_backend *b, struct eblob_cache_shard *shard,
+		struct eblob_key *key, struct eblob_ram_control *ctl, const struct eblob_ram_meta *meta,
+		int *replaced)
+{
+	struct eblob_ram_control_packed p, old;
+	int slot, err;
+
+	slot = eblob_cache_slot_get(b, ctl->bctl);
+	if (slot < 0)
+		return slot;
+
+	err = eblob_cache_pack(ctl, meta, slot, &p);
+	if (err)
+		goto err_out_put;
+
+	if (eblob_cache_engine_lookup(b, shard, key, &old) != 0)
+		old.lo = old.hi = 0;
+
+	err = eblob_cache_engine_replace(b, shard, key, &p, replaced);
+	if (err)
+		goto err_out_put;
+
+	if (*replaced)
+		eblob_cache_slot_put(b, eblob_cache_packed_slot(&old));
+	return 0;
+
+err_out_put:
+	eblob_cache_slot_put(b, slot);
+	return err;
+}
+
+/**
+ * eblob_cache_insert_nolock() - inserts or updates ram control and metadata
+ * of @key in @shard.
+ * NB! Caller should hold write lock of @shard.
+ */
+static int eblob_cache_insert_nolock(struct eblob_backend *b, struct eblob_cache_shard *shard,
+		struct eblob_key *key, struct eblob_ram_control *ctl, const struct eblob_ram_meta *meta)
+{
+	const uint64_t rss = eblob_cache_shard_rss(b, shard);
+	int replaced;
+	int err;
+
+	/* Do not accept bctls invalidated by data-sort */
+	if (ctl->bctl->index_ctl.fd < 0)
+		return -EAGAIN;
+
+	if (eblob_cache_packed(b)) {
+		err = eblob_cache_insert_packed(b, shard, key, ctl, meta, &replaced);
+	} else if (eblob_cache_meta(b)) {
+		struct eblob_ram_control_meta e = { .rctl = *ctl, };
+
+		if (meta != NULL)
+			e.meta = *meta;
+		err = eblob_cache_engine_replace(b, shard, key, &e, &replaced);
 	} else {
-		err = eblob_hash_replace_nolock(&b->hash, key, ctl, &replaced);
-		entry_size = EBLOB_HASH_ENTRY_SIZE;
+		err = eblob_cache_engine_replace(b, shard, key, ctl, &replaced);
 	}
 
 	/* Bump counters only if entry was added and not replaced */
 	if (err == 0 && replaced == 0) {
-		eblob_stat_add(b->stat, EBLOB_GST_CACHED, entry_size);
+		eblob_stat_add(b->stat, EBLOB_GST_CACHED, eblob_cache_entry_size(b));
 		FORMATTED(HANDY_COUNTER_INCREMENT, ("eblob.%u.cache.size", b->cfg.stat_id), 1);
 	}
 
-err_out_exit:
-	pthread_rwlock_unlock(&b->hash.root_lock);
+	/* Allocators never shrink until cache is destroyed, so only insert changes RSS */
+	eblob_stat_add(b->stat, EBLOB_GST_CACHED_RSS, eblob_cache_shard_rss(b, shard) - rss);
+
+	return err;
+}
+
+/**
+ * eblob_cache_insert() - inserts or updates ram control in hash.
+ * @meta:	record metadata, may be NULL if it is unknown
+ */
+int eblob_cache_insert(struct eblob_backend *b, struct eblob_key *key,
+		struct eblob_ram_control *ctl, const struct eblob_ram_meta *meta)
+{
+	struct eblob_cache_shard *shard;
+	int err;
+
+	if (b == NULL || key == NULL || ctl == NULL || ctl->bctl == NULL)
+		return -EINVAL;
+
+	shard = eblob_cache_shard(b, key);
+	pthread_rwlock_wrlock(&shard->hash.root_lock);
+	err = eblob_cache_insert_nolock(b, shard, key, ctl, meta);
+	pthread_rwlock_unlock(&shard->hash.root_lock);
 
 	return err;
 }
 
+/**
+ * eblob_cache_insert_batch() - inserts ram controls and metadata of keys of
+ * @count entries from @dcs, taking lock of every shard only once. Removed
+ * entries are skipped.
+ * @errors:	receives result of insert of each entry
+ */
+int eblob_cache_insert_batch(struct eblob_backend *b, struct eblob_disk_control *dcs,
+		struct eblob_ram_control *ctls, const struct eblob_ram_meta *metas,
+		uint64_t count, int *errors)
+{
+	unsigned char *locked;
+	uint64_t n;
+	int err;
+
+	err = eblob_cache_lock_shards(b, dcs, count, &locked);
+	if (err)
+		return err;
+
+	for (n = 0; n < count; ++n) {
+		if (dcs[n].flags & BLOB_DISK_CTL_REMOVE)
+			continue;
+		errors[n] = eblob_cache_insert_nolock(b, eblob_cache_shard(b, &dcs[n].key),
+				&dcs[n].key, &ctls[n], &metas[n]);
+	}
+
+	eblob_cache_unlock_shards(b, locked);
+	return 0;
+}
+
+/**
+ * eblob_cache_remove_nolock() - removes @key from cache.
+ * NB! Caller should hold write lock of the shard @key belongs to.
+ */
 int eblob_cache_remove_nolock(struct eblob_backend *b, struct eblob_key *key)
 {
-	size_t entry_size;
+	struct eblob_cache_shard *shard = eblob_cache_shard(b, key);
+	struct eblob_ram_control_packed old;
 	int err;
 
-	if (b->cfg.blob_flags & EBLOB_L2HASH) {
-		err = eblob_l2hash_remove(&b->l2hash, key);
-		entry_size = EBLOB_L2HASH_ENTRY_SIZE;
+	if (eblob_cache_packed(b)) {
+		err = eblob_cache_engine_lookup(b, shard, key, &old);
+		if (err == 0)
+			err = eblob_cache_engine_remove(b, shard, key);
+		if (err == 0)
+			eblob_cache_slot_put(b, eblob_cache_packed_slot(&old));
 	} else {
-		err = eblob_hash_remove_nolock(&b->hash, key);
-		entry_size = EBLOB_HASH_ENTRY_SIZE;
+		err = eblob_cache_engine_remove(b, shard, key);
 	}
 
 	if (err == 0) {
-		eblob_stat_sub(b->stat, EBLOB_GST_CACHED, entry_size);
+		eblob_stat_sub(b->stat, EBLOB_GST_CACHED, eblob_cache_entry_size(b));
 		FORMATTED(HANDY_COUNTER_DECREMENT, ("eblob.%u.cache.size", b->cfg.stat_id), 1);
 	}
 
@@ -677,34 +1248,101 @@ int eblob_cache_remove_nolock(struct eblob_backend *b, struct eblob_key *key)
 
 int eblob_cache_remove(struct eblob_backend *b, struct eblob_key *key)
 {
+	struct eblob_cache_shard *shard = eblob_cache_shard(b, key);
 	int err;
 
-	pthread_rwlock_wrlock(&b->hash.root_lock);
+	pthread_rwlock_wrlock(&shard->hash.root_lock);
 	err = eblob_cache_remove_nolock(b, key);
-	pthread_rwlock_unlock(&b->hash.root_lock);
+	pthread_rwlock_unlock(&shard->hash.root_lock);
+	return err;
+}
+
+/**
+ * eblob_cache_lookup_nolock() - returns copy of ram control and, if @meta is
+ * not NULL, metadata of @key stored in @shard.
+ * NB! Caller should hold lock of @shard.
+ */
+static int eblob_cache_lookup_nolock(struct eblob_backend *b, struct eblob_cache_shard *shard,
+		struct eblob_key *key, struct eblob_ram_control *res, struct eblob_ram_meta *meta)
+{
+	struct eblob_ram_control_packed p;
+	struct eblob_ram_control_meta e;
+	int err;
+
+	if (meta != NULL)
+		memset(meta, 0, sizeof(struct eblob_ram_meta));
+
+	if (eblob_cache_packed(b)) {
+		err = eblob_cache_engine_lookup(b, shard, key, &p);
+		if (err == 0)
+			eblob_cache_unpack(b, &p, res, eblob_cache_meta(b) ? meta : NULL);
+	} else if (eblob_cache_meta(b)) {
+		err = eblob_cache_engine_lookup(b, shard, key, &e);
+		if (err == 0) {
+			*res = e.rctl;
+			if (meta != NULL)
+				*meta = e.meta;
+		}
+	} else {
+		err = eblob_cache_engine_lookup(b, shard, key, res);
+	}
+
+	return err;
+}
+
+/**
+ * eblob_cache_update_flags() - replaces cached flags of @key if it still
+ * refers to record at @data_offset of @bctl, so that cache follows changes
+ * made to record headers on disk.
+ */
+int eblob_cache_update_flags(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_base_ctl *bctl, uint64_t data_offset, uint64_t flags)
+{
+	struct eblob_cache_shard *shard = eblob_cache_shard(b, key);
+	struct eblob_ram_control rctl;
+	struct eblob_ram_meta meta;
+	int err;
+
+	if (!eblob_cache_meta(b))
+		return 0;
+
+	pthread_rwlock_wrlock(&shard->hash.root_lock);
+	err = eblob_cache_lookup_nolock(b, shard, key, &rctl, &meta);
+	if (err)
+		goto err_out_unlock;
+
+	if (rctl.bctl != bctl || rctl.data_offset != data_offset || meta.disk_size == 0)
+		goto err_out_unlock;
+
+	meta.flags = flags;
+	err = eblob_cache_insert_nolock(b, shard, key, &rctl, &meta);
+
+err_out_unlock:
+	pthread_rwlock_unlock(&shard->hash.root_lock);
 	return err;
 }
 
+/**
+ * eblob_cache_lookup() - looks for @key in cache and then in sorted indexes.
+ * @meta:	if not NULL, filled with record metadata with EBLOB_CACHE_META
+ *		or zeroed if it is unknown
+ * @diskp:	if not NULL, set to 1 if key was found on disk
+ */
 int eblob_cache_lookup(struct eblob_backend *b, struct eblob_key *key,
-		struct eblob_ram_control *res, int *diskp)
+		struct eblob_ram_control *res, struct eblob_ram_meta *meta, int *diskp)
 {
+	struct eblob_cache_shard *shard = eblob_cache_shard(b, key);
 	int err = 1, disk = 0;
 
 	FORMATTED(HANDY_TIMER_START, ("eblob.%u.cache.lookup", b->cfg.stat_id), (uint64_t)key);
-	pthread_rwlock_rdlock(&b->hash.root_lock);
-	if (b->cfg.blob_flags & EBLOB_L2HASH) {
-		/* If l2hash is enabled - look in it */
-		err = eblob_l2hash_lookup(&b->l2hash, key, res);
-	} else {
-		/* Look in memory cache */
-		err = eblob_hash_lookup_nolock(&b->hash, key, res);
-	}
-	pthread_rwlock_unlock(&b->hash.root_lock);
+	pthread_rwlock_rdlock(&shard->hash.root_lock);
+	err = eblob_cache_lookup_nolock(b, shard, key, res, meta);
+	pthread_rwlock_unlock(&shard->hash.root_lock);
 	FORMATTED(HANDY_TIMER_STOP, ("eblob.%u.cache.lookup", b->cfg.stat_id), (uint64_t)key);
 
 	if (err == -ENOENT) {
 		/* Look on disk */
-		err = eblob_disk_index_lookup(b, key, res);
+		err = eblob_disk_index_lookup(b, key, res, eblob_cache_meta(b) ? meta : NULL);
 		if (err)
 			goto err_out_exit;
 		disk = 1;
@@ -730,7 +1368,82 @@ static int eblob_blob_iter(struct eblob_disk_control *dc, struct eblob_ram_contr
 			(unsigned long long)dc->data_size, (unsigned long long)dc->disk_size,
 			eblob_dump_dctl_flags(dc->flags));
 
-	return eblob_cache_insert(b, &dc->key, ctl);
+	struct eblob_ram_meta meta = {
+		.flags = dc->flags,
+		.disk_size = dc->disk_size,
+	};
+
+	return eblob_cache_insert(b, &dc->key, ctl, &meta);
+}
+
+/**
+ * eblob_iterate_unpin() - releases base pinned by eblob_iterate_pinned()
+ */
+static void eblob_iterate_unpin(struct eblob_base_ctl *bctl)
+{
+	pthread_mutex_lock(&bctl->lock);
+	assert(bctl->iterators > 0);
+	bctl->iterators--;
+	pthread_mutex_unlock(&bctl->lock);
+}
+
+/**
+ * eblob_iterate_pinned() - iterates over bases existing at the start of
+ * runtime iteration.
+ *
+ * All of them are pinned at once under backend lock, so defrag can neither
+ * swap them with sorted ones nor remove them while iteration is in progress.
+ * Each base is unpinned as soon as it is iterated.
+ */
+static int eblob_iterate_pinned(struct eblob_backend *b, struct eblob_iterate_control *ctl)
+{
+	struct eblob_base_ctl *bctl, **bctls;
+	int err = 0, idx, num = 0;
+
+	pthread_mutex_lock(&b->lock);
+	list_for_each_entry(bctl, &b->bases, base_entry)
+		++num;
+
+	/* Allocation of zero bytes is undefined, so allocate at least one entry */
+	bctls = calloc(num ? num : 1, sizeof(struct eblob_base_ctl *));
+	if (bctls == NULL) {
+		pthread_mutex_unlock(&b->lock);
+		return -ENOMEM;
+	}
+
+	num = 0;
+	list_for_each_entry(bctl, &b->bases, base_entry) {
+		pthread_mutex_lock(&bctl->lock);
+		bctl->iterators++;
+		pthread_mutex_unlock(&bctl->lock);
+		bctls[num++] = bctl;
+	}
+	pthread_mutex_unlock(&b->lock);
+
+	for (idx = 0; idx < num; ++idx) {
+		bctl = bctls[idx];
+
+		if (err == 0 && (!ctl->blob_num ||
+				((idx >= ctl->blob_start) && (idx < ctl->blob_num - ctl->blob_start)))) {
+			ctl->base = bctl;
+
+			if (!bctl->index_ctl.sorted || (ctl->flags & EBLOB_ITERATE_FLAGS_ALL))
+				err = eblob_blob_iterate(ctl);
+
+			eblob_log(ctl->log, EBLOB_LOG_INFO, "blob: bctl: index: %d, data_fd: %d, index_fd: %d, "
+					"data_size: %llu, data_offset: %llu, have_sort: %d, err: %d\n",
+					bctl->index, bctl->data_ctl.fd, bctl->index_ctl.fd,
+					(unsigned long long)bctl->data_ctl.size, (unsigned long long)bctl->data_ctl.offset,
+					bctl->index_ctl.sorted, err);
+		}
+
+		eblob_iterate_unpin(bctl);
+	}
+	free(bctls);
+
+	if (err == 0)
+		eblob_log(ctl->log, EBLOB_LOG_INFO, "blob: %s: finished.\n", __func__);
+	return err;
 }
 
 static int eblob_iterate_existing(struct eblob_backend *b, struct eblob_iterate_control *ctl)
@@ -745,14 +1458,16 @@ static int eblob_iterate_existing(struct eblob_backend *b, struct eblob_iterate_
 	ctl->log = b->cfg.log;
 	ctl->b = b;
 
-	if (ctl->flags & EBLOB_ITERATE_FLAGS_INITIAL_LOAD) {
-		err = eblob_scan_base(b);
-		if (err) {
-			eblob_log(b->cfg.log, EBLOB_LOG_ERROR,
-					"blob: eblob_iterate_existing: eblob_scan_base: '%s': %s %d\n",
-					b->cfg.file, strerror(-err), err);
-			goto err_out_exit;
-		}
+	/* Runtime iterations race with defrag, so they pin bases they walk */
+	if (!(ctl->flags & EBLOB_ITERATE_FLAGS_INITIAL_LOAD))
+		return eblob_iterate_pinned(b, ctl);
+
+	err = eblob_scan_base(b);
+	if (err) {
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR,
+				"blob: eblob_iterate_existing: eblob_scan_base: '%s': %s %d\n",
+				b->cfg.file, strerror(-err), err);
+		goto err_out_exit;
 	}
 
 	list_for_each_entry_safe(bctl, bctl_tmp, &b->bases, base_entry) {
@@ -765,33 +1480,31 @@ static int eblob_iterate_existing(struct eblob_backend *b, struct eblob_iterate_
 				err = eblob_blob_iterate(ctl);
 			}
 
-			if (ctl->flags & EBLOB_ITERATE_FLAGS_INITIAL_LOAD) {
-				want = eblob_want_defrag(bctl);
-				if (want < 0)
-					EBLOB_WARNC(b->cfg.log, -want, EBLOB_LOG_ERROR,
-							"eblob_want_defrag: FAILED");
-
-				if (want == EBLOB_REMOVE_NEEDED) {
-					/*
-					 * This is racey if removed at runtime, so only valid at initial load
-					 */
-					pthread_mutex_lock(&b->lock);
-					list_del_init(&bctl->base_entry);
-					pthread_mutex_unlock(&b->lock);
-
-					eblob_base_remove(bctl);
-
-					eblob_log(ctl->log, EBLOB_LOG_INFO, "blob: removing: index: %d, data_fd: %d, index_fd: %d, "
-							"data_size: %llu, data_offset: %llu, have_sort: %d\n",
-							bctl->index, bctl->data_ctl.fd, bctl->index_ctl.fd,
-							(unsigned long long)bctl->data_ctl.size, (unsigned long long)bctl->data_ctl.offset,
-							bctl->index_ctl.sorted);
-
-
-					eblob_base_ctl_cleanup(bctl);
-					free(bctl);
-					continue;
-				}
+			want = eblob_want_defrag(bctl);
+			if (want < 0)
+				EBLOB_WARNC(b->cfg.log, -want, EBLOB_LOG_ERROR,
+						"eblob_want_defrag: FAILED");
+
+			if (want == EBLOB_REMOVE_NEEDED) {
+				/*
+				 * This is racey if removed at runtime, so only valid at initial load
+				 */
+				pthread_mutex_lock(&b->lock);
+				list_del_init(&bctl->base_entry);
+				pthread_mutex_unlock(&b->lock);
+
+				eblob_base_remove(bctl);
+
+				eblob_log(ctl->log, EBLOB_LOG_INFO, "blob: removing: index: %d, data_fd: %d, index_fd: %d, "
+						"data_size: %llu, data_offset: %llu, have_sort: %d\n",
+						bctl->index, bctl->data_ctl.fd, bctl->index_ctl.fd,
+						(unsigned long long)bctl->data_ctl.size, (unsigned long long)bctl->data_ctl.offset,
+						bctl->index_ctl.sorted);
+
+
+				eblob_base_ctl_cleanup(bctl);
+				free(bctl);
+				continue;
 			}
 
 			eblob_log(ctl->log, EBLOB_LOG_INFO, "blob: bctl: index: %d, data_fd: %d, index_fd: %d, "
@@ -807,21 +1520,22 @@ static int eblob_iterate_existing(struct eblob_backend *b, struct eblob_iterate_
 	eblob_log(ctl->log, EBLOB_LOG_INFO, "blob: %s: finished.\n", __func__);
 
 	/* If automatic data-sort is enabled - start it */
-	if (b->cfg.blob_flags & EBLOB_AUTO_DATASORT
-			&& ctl->flags & EBLOB_ITERATE_FLAGS_INITIAL_LOAD)
+	if (b->cfg.blob_flags & EBLOB_AUTO_DATASORT)
 		eblob_start_defrag(b);
 
 	return 0;
 
 err_out_bases_cleanup:
-	if (ctl->flags & EBLOB_ITERATE_FLAGS_INITIAL_LOAD)
-		eblob_bases_cleanup(b);
+	eblob_bases_cleanup(b);
 err_out_exit:
 	return err;
 }
 
 int eblob_iterate(struct eblob_backend *b, struct eblob_iterate_control *ctl)
 {
+	/* Buffered records are iterated once they are written */
+	eblob_wbuf_flush(b);
+
 	return eblob_iterate_existing(b, ctl);
 }
 
@@ -841,11 +1555,13 @@ int eblob_load_data(struct eblob_backend *b)
 
 /**
  * eblob_add_new_base_ll() - sequentially tries bases until it finds unused one.
+ * @locked:	caller holds "backend" lock, otherwise it's taken only to pick
+ *		index of the next base
  */
-static struct eblob_base_ctl *eblob_add_new_base_ll(struct eblob_backend *b, int *errp)
+static struct eblob_base_ctl *eblob_add_new_base_ll(struct eblob_backend *b, int locked, int *errp)
 {
 	struct eblob_base_ctl *ctl;
-	int err;
+	int err, index;
 	char *dir_base, *tmp, name[64];
 	const char *base;
 
@@ -863,8 +1579,12 @@ static struct eblob_base_ctl *eblob_add_new_base_ll(struct eblob_backend *b, int
 		*tmp = '\0';
 
 try_again:
-	b->max_index++;
-	snprintf(name, sizeof(name), "%s-0.%d", base, b->max_index);
+	if (!locked)
+		pthread_mutex_lock(&b->lock);
+	index = ++b->max_index;
+	if (!locked)
+		pthread_mutex_unlock(&b->lock);
+	snprintf(name, sizeof(name), "%s-0.%d", base, index);
 
 	err = 0;
 	ctl = eblob_get_base_ctl(b, dir_base, base, name, strlen(name), &err);
@@ -885,9 +1605,10 @@ try_again:
 }
 
 /**
- * eblob_add_new_base() - creates new base and adds it to the list of bases
+ * eblob_add_new_base() - makes spare base of @slot or newly created one active
+ * in @slot and adds it to the list of bases
  */
-int eblob_add_new_base(struct eblob_backend *b)
+int eblob_add_new_base(struct eblob_backend *b, unsigned int slot)
 {
 	struct eblob_base_ctl *ctl;
 	int err = 0;
@@ -895,16 +1616,30 @@ int eblob_add_new_base(struct eblob_backend *b)
 	if (b == NULL)
 		return -EINVAL;
 
-	if ((ctl = eblob_add_new_base_ll(b, &err)) == NULL) {
+	ctl = eblob_prealloc_take_spare(b, slot);
+	if (ctl != NULL) {
+		eblob_stat_inc(b->stat, EBLOB_GST_ROLLOVERS_SPARE);
+	} else if ((ctl = eblob_add_new_base_ll(b, 1, &err)) == NULL) {
 		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "eblob: %s: could not add new base: %d\n", __func__, err);
 		goto err_out_exit;
 	}
+	/* Base should be active before defrag can see it in the list */
+	eblob_active_base_set(b, slot, ctl);
 	eblob_add_new_base_ctl(b, ctl);
 
 err_out_exit:
 	return err;
 }
 
+/**
+ * eblob_add_spare_base() - creates new base that is not yet added to the list
+ * of bases. Must be called without "backend" lock.
+ */
+struct eblob_base_ctl *eblob_add_spare_base(struct eblob_backend *b, int *errp)
+{
+	return eblob_add_new_base_ll(b, 0, errp);
+}
+
 void eblob_remove_blobs(struct eblob_backend *b)
 {
 	struct eblob_base_ctl *ctl, *tmp;
@@ -983,4 +1718,9 @@ void eblob_base_remove(struct eblob_base_ctl *bctl)
 
 	snprintf(path, PATH_MAX, "%s.index.sorted", base_path);
 	unlink(path);
+
+	snprintf(path, PATH_MAX, "%s" EBLOB_COMPRESS_DICT_SUFFIX, base_path);
+	unlink(path);
+
+	eblob_tombstones_drop(b, bctl);
 }
@@ -0,0 +1,280 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Open-addressing in-memory cache.
+ *
+ * Flat table with linear probing and Robin Hood displacement: entry that is
+ * further from its home slot takes the place of the "richer" one. This keeps
+ * probe sequences short, so most lookups touch one or two cache lines of
+ * @meta and single slot, instead of ~log2(N) dependent cache misses of
+ * rb-tree walk. Removal uses backward shift, so there are no tombstones.
+ */
+
+#include "eblob/blob.h"
+
+#include "ohash.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Initial number of slots, table is allocated on first insert */
+#define EBLOB_OHASH_MIN_CAPACITY	(64)
+/* Maximum load factor is 7/8 */
+#define EBLOB_OHASH_LOAD_NUM		(7)
+#define EBLOB_OHASH_LOAD_DEN		(8)
+
+#define EBLOB_OHASH_PSL_MASK		(0xffffU)
+#define EBLOB_OHASH_META(tag, psl)	(((uint32_t)(tag) << 16) | (psl))
+#define EBLOB_OHASH_PSL(meta)		((meta) & EBLOB_OHASH_PSL_MASK)
+#define EBLOB_OHASH_TAG(meta)		((meta) >> 16)
+
+/**
+ * eblob_ohash_hash() - hash of the key.
+ * Keys are usually already cryptographic hashes, but all words of the key
+ * are mixed anyway so that poorly distributed ids (e.g. with zero tail) do
+ * not degrade table into linear scan.
+ */
+static inline uint64_t eblob_ohash_hash(const struct eblob_key *key)
+{
+	uint64_t w, h = 0;
+	unsigned int i;
+
+	for (i = 0; i < EBLOB_ID_SIZE; i += sizeof(uint64_t)) {
+		memcpy(&w, key->id + i, sizeof(uint64_t));
+		h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+	}
+
+	/* MurmurHash3 finalizer */
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+static inline uint32_t eblob_ohash_tag(uint64_t hash)
+{
+	return hash >> 48;
+}
+
+static inline unsigned char *eblob_ohash_slot(const struct eblob_ohash *h, uint64_t idx)
+{
+	return h->slots + idx * h->slot_size;
+}
+
+static inline unsigned char *eblob_ohash_slot_data(const struct eblob_ohash *h, uint64_t idx)
+{
+	return eblob_ohash_slot(h, idx) + sizeof(struct eblob_key);
+}
+
+/**
+ * eblob_ohash_find() - returns slot index of @key or -1 if there is no such key.
+ */
+static int64_t eblob_ohash_find(const struct eblob_ohash *h, const struct eblob_key *key, uint64_t hash)
+{
+	const uint64_t mask = h->capacity - 1;
+	const uint32_t tag = eblob_ohash_tag(hash);
+	uint64_t idx = hash & mask;
+	uint32_t psl = 1;
+
+	if (h->capacity == 0)
+		return -1;
+
+	for (;; idx = (idx + 1) & mask, ++psl) {
+		const uint32_t meta = h->meta[idx];
+
+		/* Robin Hood invariant: our key would have displaced this one */
+		if (meta == 0 || EBLOB_OHASH_PSL(meta) < psl)
+			return -1;
+
+		if (EBLOB_OHASH_TAG(meta) == tag &&
+				memcmp(eblob_ohash_slot(h, idx), key, sizeof(struct eblob_key)) == 0)
+			return idx;
+	}
+}
+
+/**
+ * eblob_ohash_insert() - inserts @key that is known to be absent from table.
+ * NB! Table should have at least one free slot.
+ */
+static void eblob_ohash_insert(struct eblob_ohash *h, const struct eblob_key *key,
+		const void *data, uint64_t hash)
+{
+	const uint64_t mask = h->capacity - 1;
+	unsigned char *cur = h->swap, *tmp = h->swap + h->slot_size, *t;
+	uint32_t cur_meta = EBLOB_OHASH_META(eblob_ohash_tag(hash), 1);
+	uint64_t idx = hash & mask;
+
+	memcpy(cur, key, sizeof(struct eblob_key));
+	memcpy(cur + sizeof(struct eblob_key), data, h->dsize);
+
+	for (;; idx = (idx + 1) & mask, ++cur_meta) {
+		const uint32_t meta = h->meta[idx];
+
+		if (meta == 0) {
+			h->meta[idx] = cur_meta;
+			memcpy(eblob_ohash_slot(h, idx), cur, h->slot_size);
+			h->count++;
+			return;
+		}
+
+		/* Take slot from entry which is closer to its home */
+		if (EBLOB_OHASH_PSL(meta) < EBLOB_OHASH_PSL(cur_meta)) {
+			memcpy(tmp, eblob_ohash_slot(h, idx), h->slot_size);
+			memcpy(eblob_ohash_slot(h, idx), cur, h->slot_size);
+			h->meta[idx] = cur_meta;
+
+			t = cur;
+			cur = tmp;
+			tmp = t;
+			cur_meta = meta;
+		}
+
+		/* Can't happen with load factor below 1 and sane hash */
+		assert(EBLOB_OHASH_PSL(cur_meta) < EBLOB_OHASH_PSL_MASK);
+	}
+}
+
+/**
+ * eblob_ohash_resize() - rehashes table into @capacity slots.
+ */
+static int eblob_ohash_resize(struct eblob_ohash *h, uint64_t capacity)
+{
+	uint32_t *old_meta = h->meta;
+	unsigned char *old_slots = h->slots;
+	const uint64_t old_capacity = h->capacity;
+	uint64_t i;
+
+	h->meta = calloc(capacity, sizeof(uint32_t));
+	h->slots = malloc(capacity * h->slot_size);
+	if (h->meta == NULL || h->slots == NULL) {
+		free(h->meta);
+		free(h->slots);
+		h->meta = old_meta;
+		h->slots = old_slots;
+		return -ENOMEM;
+	}
+	h->capacity = capacity;
+	h->count = 0;
+
+	for (i = 0; i < old_capacity; ++i) {
+		const unsigned char *slot = old_slots + i * h->slot_size;
+		const struct eblob_key *key = (const struct eblob_key *)slot;
+
+		if (old_meta[i] == 0)
+			continue;
+
+		eblob_ohash_insert(h, key, slot + sizeof(struct eblob_key), eblob_ohash_hash(key));
+	}
+
+	free(old_meta);
+	free(old_slots);
+	return 0;
+}
+
+int eblob_ohash_init(struct eblob_ohash *h, unsigned int dsize)
+{
+	memset(h, 0, sizeof(struct eblob_ohash));
+	h->dsize = dsize;
+	h->slot_size = sizeof(struct eblob_key) + dsize;
+
+	h->swap = malloc(2 * h->slot_size);
+	if (h->swap == NULL)
+		return -ENOMEM;
+
+	return 0;
+}
+
+void eblob_ohash_destroy(struct eblob_ohash *h)
+{
+	assert(h != NULL);
+
+	free(h->meta);
+	free(h->slots);
+	free(h->swap);
+	memset(h, 0, sizeof(struct eblob_ohash));
+}
+
+int eblob_ohash_replace_nolock(struct eblob_ohash *h, struct eblob_key *key, void *data, int *replaced)
+{
+	const uint64_t hash = eblob_ohash_hash(key);
+	int64_t idx;
+	int err;
+
+	idx = eblob_ohash_find(h, key, hash);
+	if (idx >= 0) {
+		memcpy(eblob_ohash_slot_data(h, idx), data, h->dsize);
+		*replaced = 1;
+		return 0;
+	}
+
+	if ((h->count + 1) * EBLOB_OHASH_LOAD_DEN > h->capacity * EBLOB_OHASH_LOAD_NUM) {
+		err = eblob_ohash_resize(h, h->capacity ? h->capacity * 2 : EBLOB_OHASH_MIN_CAPACITY);
+		if (err)
+			return err;
+	}
+
+	eblob_ohash_insert(h, key, data, hash);
+	*replaced = 0;
+	return 0;
+}
+
+int eblob_ohash_remove_nolock(struct eblob_ohash *h, struct eblob_key *key)
+{
+	const uint64_t mask = h->capacity - 1;
+	uint64_t idx, next;
+	int64_t found;
+	uint32_t meta;
+
+	found = eblob_ohash_find(h, key, eblob_ohash_hash(key));
+	if (found < 0)
+		return -ENOENT;
+
+	/* Backward shift: pull following displaced entries one slot closer to home */
+	idx = found;
+	for (next = (idx + 1) & mask;
+			(meta = h->meta[next]) != 0 && EBLOB_OHASH_PSL(meta) > 1;
+			idx = next, next = (next + 1) & mask) {
+		h->meta[idx] = meta - 1;
+		memcpy(eblob_ohash_slot(h, idx), eblob_ohash_slot(h, next), h->slot_size);
+	}
+	h->meta[idx] = 0;
+	h->count--;
+
+	return 0;
+}
+
+/**
+ * eblob_ohash_lookup_nolock() - returns copy of data stored in cache
+ */
+int eblob_ohash_lookup_nolock(struct eblob_ohash *h, struct eblob_key *key, void *data)
+{
+	int64_t idx;
+
+	idx = eblob_ohash_find(h, key, eblob_ohash_hash(key));
+	if (idx < 0)
+		return -ENOENT;
+
+	memcpy(data, eblob_ohash_slot_data(h, idx), h->dsize);
+	return 0;
+}
@@ -0,0 +1,65 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __EBLOB_OHASH_H
+#define __EBLOB_OHASH_H
+
+#include <stdint.h>
+
+struct eblob_key;
+
+/*
+ * Open-addressing (Robin Hood, linear probing) in-memory cache that is used
+ * instead of rb-tree hash when EBLOB_OHASH flag is set.
+ *
+ * Each slot is @meta word plus key followed by @dsize bytes of data in @slots.
+ * Meta word is zero for empty slot, otherwise it holds 16-bit tag of the key
+ * in upper half and probe sequence length + 1 in lower half.
+ *
+ * No locking is done inside, caller should serialize access.
+ */
+struct eblob_ohash {
+	uint32_t		*meta;
+	unsigned char		*slots;
+	/* Scratch slots used for Robin Hood swaps */
+	unsigned char		*swap;
+	/* Number of slots, always power of two (or zero) */
+	uint64_t		capacity;
+	/* Number of used slots */
+	uint64_t		count;
+	unsigned int		dsize;
+	unsigned int		slot_size;
+};
+
+int eblob_ohash_init(struct eblob_ohash *h, unsigned int dsize);
+void eblob_ohash_destroy(struct eblob_ohash *h);
+int eblob_ohash_remove_nolock(struct eblob_ohash *h, struct eblob_key *key);
+int eblob_ohash_lookup_nolock(struct eblob_ohash *h, struct eblob_key *key, void *datap);
+int eblob_ohash_replace_nolock(struct eblob_ohash *h, struct eblob_key *key, void *data, int *replaced);
+
+static inline int eblob_ohash_empty(struct eblob_ohash *h)
+{
+	return (h == NULL) || (h->count == 0);
+}
+
+/* Memory used by table arrays */
+static inline uint64_t eblob_ohash_rss(const struct eblob_ohash *h)
+{
+	return h->capacity * (sizeof(uint32_t) + h->slot_size) + 2 * h->slot_size;
+}
+
+#endif /* __EBLOB_OHASH_H */
@@ -0,0 +1,470 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Base-level preallocation.
+ *
+ * Per-record posix_fallocate(3) makes file system allocate blocks for every
+ * record separately. Instead active base is preallocated in large extents
+ * by background thread and writers only check that their reservation is
+ * inside of the extent, see eblob_prealloc_covered().
+ *
+ * The same thread creates the next base in advance, see eblob_add_new_base().
+ */
+
+#include "features.h"
+
+#include "blob.h"
+#include "ioprio.h"
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Index grows @cfg.prealloc_size / EBLOB_PREALLOC_INDEX_RATIO ahead, but not
+ * less than EBLOB_PREALLOC_INDEX_MIN
+ */
+#define EBLOB_PREALLOC_INDEX_RATIO	(64)
+#define EBLOB_PREALLOC_INDEX_MIN	(1 << 20)
+
+/*
+ * eblob_fallocate_keep_size() - allocates blocks for [@offset, @offset + @size)
+ * of @fd without changing its size.
+ */
+static int eblob_fallocate_keep_size(int fd, uint64_t offset, uint64_t size)
+{
+#ifdef FALLOC_FL_KEEP_SIZE
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, size) == -1)
+		return -errno;
+	return 0;
+#else
+	(void) fd;
+	(void) offset;
+	(void) size;
+	return -ENOTSUP;
+#endif
+}
+
+/*
+ * eblob_fallocate_trim() - frees blocks allocated beyond the end of @fd.
+ *
+ * Hole can't be punched beyond the end of file, but truncate to the current
+ * size frees such blocks. Nobody must be extending @fd meanwhile.
+ */
+static int eblob_fallocate_trim(int fd)
+{
+	struct stat st;
+
+	if (fstat(fd, &st) == -1)
+		return -errno;
+	if (ftruncate(fd, st.st_size) == -1)
+		return -errno;
+	return 0;
+}
+
+/**
+ * eblob_prealloc_covered() - checks that data of reservation ending at
+ * @data_end is inside of the extent preallocated for @bctl.
+ *
+ * Extent of active base only grows, so positive answer stays true while
+ * caller holds @bctl.
+ */
+int eblob_prealloc_covered(struct eblob_base_ctl *bctl, uint64_t data_end)
+{
+	return data_end <= __atomic_load_n(&bctl->prealloc_data_end, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * eblob_prealloc_spare_wanted() - checks that @bctl is filled above
+ * @cfg.spare_base_threshold percent either by data or by records.
+ */
+static int eblob_prealloc_spare_wanted(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	const uint64_t threshold = b->cfg.spare_base_threshold;
+	const uint64_t data_offset = __atomic_load_n(&bctl->data_ctl.offset, __ATOMIC_RELAXED);
+	const uint64_t index_size = __atomic_load_n(&bctl->index_ctl.size, __ATOMIC_RELAXED);
+
+	if (threshold == 0)
+		return 0;
+
+	return (data_offset * 100 >= b->cfg.blob_size * threshold) ||
+		(index_size / sizeof(struct eblob_disk_control) * 100 >=
+		 b->cfg.records_in_blob * threshold);
+}
+
+/**
+ * eblob_prealloc_kick() - wakes up preallocation thread if reservation ending
+ * at @data_end has passed half of the extent preallocated for @bctl or if
+ * @bctl has just been filled enough to prepare spare base.
+ */
+void eblob_prealloc_kick(struct eblob_backend *b, struct eblob_base_ctl *bctl,
+		uint64_t data_end)
+{
+	struct eblob_prealloc *pa = &b->prealloc;
+
+	if (!pa->started)
+		return;
+
+	if (b->cfg.prealloc_size && data_end + b->cfg.prealloc_size / 2 >
+			__atomic_load_n(&bctl->prealloc_data_end, __ATOMIC_ACQUIRE)) {
+		/* Extent is running out */
+	} else if (!__atomic_load_n(&bctl->spare_kicked, __ATOMIC_RELAXED) &&
+			eblob_prealloc_spare_wanted(b, bctl)) {
+		/* Spare is requested once per base, thread rechecks it anyway */
+		__atomic_store_n(&bctl->spare_kicked, 1, __ATOMIC_RELAXED);
+	} else {
+		return;
+	}
+
+	if (__atomic_load_n(&pa->wakeup, __ATOMIC_RELAXED))
+		return;
+
+	pthread_mutex_lock(&pa->lock);
+	pa->wakeup = 1;
+	pthread_cond_signal(&pa->cond);
+	pthread_mutex_unlock(&pa->lock);
+}
+
+/*
+ * eblob_prealloc_extend() - grows extent of @fd ending at @end to @ahead bytes
+ * after @offset once less than half of it is left. Extent never grows beyond
+ * @limit.
+ */
+static int eblob_prealloc_extend(struct eblob_backend *b, struct eblob_base_ctl *bctl,
+		int fd, uint64_t *end, uint64_t offset, uint64_t ahead, uint64_t limit)
+{
+	uint64_t start = *end, target = offset + ahead;
+	int err;
+
+	if (target > limit)
+		target = limit;
+	if (start < offset)
+		start = offset;
+	if (offset + ahead / 2 <= *end || target <= start)
+		return 0;
+
+	err = eblob_fallocate_keep_size(fd, start, target - start);
+	if (err) {
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err,
+				"blob i%d: prealloc: fd: %d, offset: %" PRIu64 ", size: %" PRIu64,
+				bctl->index, fd, start, target - start);
+		return err;
+	}
+
+	__atomic_store_n(end, target, __ATOMIC_RELEASE);
+	eblob_stat_inc(b->stat, EBLOB_GST_PREALLOC_EXTENTS);
+	return 0;
+}
+
+static void eblob_prealloc_active(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	const uint64_t dc_size = sizeof(struct eblob_disk_control);
+	uint64_t index_ahead = b->cfg.prealloc_size / EBLOB_PREALLOC_INDEX_RATIO;
+
+	if (b->cfg.prealloc_size == 0 || bctl->data_ctl.fd < 0 || bctl->index_ctl.fd < 0)
+		return;
+
+	if (index_ahead < EBLOB_PREALLOC_INDEX_MIN)
+		index_ahead = EBLOB_PREALLOC_INDEX_MIN;
+
+	eblob_prealloc_extend(b, bctl, bctl->data_ctl.fd, &bctl->prealloc_data_end,
+			__atomic_load_n(&bctl->data_ctl.offset, __ATOMIC_RELAXED),
+			b->cfg.prealloc_size, b->cfg.blob_size);
+	eblob_prealloc_extend(b, bctl, bctl->index_ctl.fd, &bctl->prealloc_index_end,
+			__atomic_load_n(&bctl->index_ctl.size, __ATOMIC_RELAXED),
+			index_ahead, b->cfg.records_in_blob * dc_size);
+}
+
+/*
+ * eblob_prealloc_trim() - frees blocks preallocated beyond the end of @bctl.
+ * @force:	nobody can reserve space in @bctl, otherwise trim is skipped
+ *		while anyone but caller holds @bctl, since reservation could
+ *		have been made just before @bctl stopped being active.
+ */
+static void eblob_prealloc_trim(struct eblob_backend *b, struct eblob_base_ctl *bctl, int force)
+{
+	int err;
+
+	if (!force) {
+		int busy;
+
+		pthread_mutex_lock(&bctl->lock);
+		busy = bctl->critness > 1;
+		pthread_mutex_unlock(&bctl->lock);
+		if (busy)
+			return;
+	}
+
+	if (bctl->data_ctl.fd >= 0 && bctl->prealloc_data_end != 0) {
+		err = eblob_fallocate_trim(bctl->data_ctl.fd);
+		if (err)
+			EBLOB_WARNC(b->cfg.log, EBLOB_LOG_NOTICE, -err,
+					"blob i%d: prealloc: data trim failed", bctl->index);
+	}
+	if (bctl->index_ctl.fd >= 0 && bctl->prealloc_index_end != 0) {
+		err = eblob_fallocate_trim(bctl->index_ctl.fd);
+		if (err)
+			EBLOB_WARNC(b->cfg.log, EBLOB_LOG_NOTICE, -err,
+					"blob i%d: prealloc: index trim failed", bctl->index);
+	}
+
+	bctl->prealloc_data_end = 0;
+	bctl->prealloc_index_end = 0;
+}
+
+static int eblob_prealloc_is_active(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	unsigned int slot;
+
+	for (slot = 0; slot < b->cfg.active_bases; ++slot) {
+		if (eblob_active_base(b, slot) == bctl)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * eblob_prealloc_discard() - removes spare base that has never been used.
+ */
+static void eblob_prealloc_discard(struct eblob_base_ctl *bctl)
+{
+	eblob_base_remove(bctl);
+	eblob_base_ctl_cleanup(bctl);
+	free(bctl);
+}
+
+/**
+ * eblob_prealloc_take_spare() - returns spare base of @slot, if any, and
+ * removes it from spares.
+ * NB! Caller should hold "backend" lock.
+ */
+struct eblob_base_ctl *eblob_prealloc_take_spare(struct eblob_backend *b, unsigned int slot)
+{
+	struct eblob_prealloc *pa = &b->prealloc;
+	struct eblob_base_ctl *bctl;
+
+	if (pa->spare == NULL)
+		return NULL;
+
+	bctl = pa->spare[slot];
+	pa->spare[slot] = NULL;
+	return bctl;
+}
+
+/*
+ * eblob_prealloc_spare() - creates spare base for @slot and preallocates it.
+ * Base is created without "backend" lock, so writers are not stalled.
+ */
+static void eblob_prealloc_spare(struct eblob_backend *b, unsigned int slot)
+{
+	struct eblob_base_ctl *bctl;
+	int err = 0;
+
+	bctl = eblob_add_spare_base(b, &err);
+	if (bctl == NULL) {
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err,
+				"prealloc: could not create spare base for slot %u", slot);
+		return;
+	}
+
+	eblob_prealloc_active(b, bctl);
+
+	pthread_mutex_lock(&b->lock);
+	b->prealloc.spare[slot] = bctl;
+	pthread_mutex_unlock(&b->lock);
+
+	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_INFO, "prealloc: spare base i%d is ready for slot %u",
+			bctl->index, slot);
+}
+
+/*
+ * eblob_prealloc_run() - preallocates active bases, creates spare bases and
+ * trims bases that are no longer active.
+ *
+ * Bases are held and processed without @b->lock, so that allocation does not
+ * stall rollover. At most EBLOB_ACTIVE_BASES_MAX bases are trimmed per run.
+ */
+static void eblob_prealloc_run(struct eblob_backend *b)
+{
+	struct eblob_base_ctl *active[EBLOB_ACTIVE_BASES_MAX], *trim[EBLOB_ACTIVE_BASES_MAX];
+	unsigned int spare[EBLOB_ACTIVE_BASES_MAX];
+	struct eblob_base_ctl *bctl;
+	unsigned int active_num = 0, trim_num = 0, spare_num = 0, i;
+
+	pthread_mutex_lock(&b->lock);
+	for (i = 0; i < b->cfg.active_bases; ++i) {
+		bctl = eblob_active_base(b, i);
+		if (bctl != NULL) {
+			eblob_bctl_hold(bctl);
+			active[active_num++] = bctl;
+			if (b->prealloc.spare[i] == NULL && eblob_prealloc_spare_wanted(b, bctl))
+				spare[spare_num++] = i;
+		}
+	}
+	list_for_each_entry(bctl, &b->bases, base_entry) {
+		if (trim_num == EBLOB_ACTIVE_BASES_MAX)
+			break;
+		if (bctl->prealloc_data_end == 0 && bctl->prealloc_index_end == 0)
+			continue;
+		if (eblob_prealloc_is_active(b, bctl))
+			continue;
+		eblob_bctl_hold(bctl);
+		trim[trim_num++] = bctl;
+	}
+	pthread_mutex_unlock(&b->lock);
+
+	for (i = 0; i < active_num; ++i) {
+		eblob_prealloc_active(b, active[i]);
+		eblob_bctl_release(active[i]);
+	}
+	for (i = 0; i < spare_num; ++i)
+		eblob_prealloc_spare(b, spare[i]);
+	for (i = 0; i < trim_num; ++i) {
+		eblob_prealloc_trim(b, trim[i], 0);
+		eblob_bctl_release(trim[i]);
+	}
+}
+
+static void *eblob_prealloc_thread(void *data)
+{
+	struct eblob_backend *b = data;
+	struct eblob_prealloc *pa = &b->prealloc;
+	struct timespec ts;
+
+	eblob_set_name("prealloc_%u", b->cfg.stat_id);
+
+	if (b->cfg.bg_ioprio_class != IOPRIO_CLASS_NONE) {
+		if (eblob_ioprio_set(IOPRIO_PRIO_VALUE(b->cfg.bg_ioprio_class, b->cfg.bg_ioprio_data)) == -1) {
+			eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "%s: failed to set ioprio: %s[%d]",
+			          __func__, strerror(errno), errno);
+		}
+	}
+
+	pthread_mutex_lock(&pa->lock);
+	while (!pa->need_exit) {
+		pa->wakeup = 0;
+		pthread_mutex_unlock(&pa->lock);
+
+		eblob_prealloc_run(b);
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += 1;
+
+		pthread_mutex_lock(&pa->lock);
+		while (!pa->wakeup && !pa->need_exit) {
+			if (pthread_cond_timedwait(&pa->cond, &pa->lock, &ts) == ETIMEDOUT)
+				break;
+		}
+	}
+	pthread_mutex_unlock(&pa->lock);
+
+	return NULL;
+}
+
+/**
+ * eblob_prealloc_init() - starts preallocation thread if it's enabled.
+ */
+int eblob_prealloc_init(struct eblob_backend *b)
+{
+	struct eblob_prealloc *pa = &b->prealloc;
+	int err;
+
+	memset(pa, 0, sizeof(*pa));
+
+	err = eblob_mutex_init(&pa->lock);
+	if (err)
+		goto err_out_exit;
+
+	err = -pthread_cond_init(&pa->cond, NULL);
+	if (err)
+		goto err_out_lock_destroy;
+
+	if ((b->cfg.prealloc_size == 0 && b->cfg.spare_base_threshold == 0) ||
+	    (b->cfg.blob_flags & EBLOB_DISABLE_THREADS))
+		return 0;
+
+	pa->spare = calloc(b->cfg.active_bases, sizeof(struct eblob_base_ctl *));
+	if (pa->spare == NULL) {
+		err = -ENOMEM;
+		goto err_out_cond_destroy;
+	}
+
+	err = -pthread_create(&pa->tid, NULL, eblob_prealloc_thread, b);
+	if (err) {
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: eblob prealloc thread creation failed: %d.\n", err);
+		goto err_out_free_spare;
+	}
+	pa->started = 1;
+
+	return 0;
+
+err_out_free_spare:
+	free(pa->spare);
+	pa->spare = NULL;
+err_out_cond_destroy:
+	pthread_cond_destroy(&pa->cond);
+err_out_lock_destroy:
+	pthread_mutex_destroy(&pa->lock);
+err_out_exit:
+	return err;
+}
+
+/**
+ * eblob_prealloc_destroy() - stops preallocation thread, frees extents
+ * preallocated beyond the end of every base and removes unused spare bases.
+ *
+ * Must be called when no writes are in flight.
+ */
+void eblob_prealloc_destroy(struct eblob_backend *b)
+{
+	struct eblob_prealloc *pa = &b->prealloc;
+	struct eblob_base_ctl *bctl;
+	unsigned int i;
+
+	if (pa->started) {
+		pthread_mutex_lock(&pa->lock);
+		pa->need_exit = 1;
+		pthread_cond_signal(&pa->cond);
+		pthread_mutex_unlock(&pa->lock);
+
+		pthread_join(pa->tid, NULL);
+		pa->started = 0;
+	}
+
+	pthread_mutex_lock(&b->lock);
+	list_for_each_entry(bctl, &b->bases, base_entry) {
+		if (bctl->prealloc_data_end != 0 || bctl->prealloc_index_end != 0)
+			eblob_prealloc_trim(b, bctl, 1);
+	}
+	for (i = 0; pa->spare != NULL && i < b->cfg.active_bases; ++i) {
+		bctl = eblob_prealloc_take_spare(b, i);
+		if (bctl != NULL)
+			eblob_prealloc_discard(bctl);
+	}
+	pthread_mutex_unlock(&b->lock);
+	free(pa->spare);
+	pa->spare = NULL;
+
+	pthread_cond_destroy(&pa->cond);
+	pthread_mutex_destroy(&pa->lock);
+}
@@ -0,0 +1,65 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __EBLOB_PREALLOC_H
+#define __EBLOB_PREALLOC_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+struct eblob_backend;
+struct eblob_base_ctl;
+
+/*
+ * Background preallocation of active bases.
+ *
+ * Thread keeps data and index files of every active base allocated with
+ * FALLOC_FL_KEEP_SIZE ahead of their reservation cursors, so records are
+ * written into extents allocated in advance. Writer wakes the thread up when
+ * its reservation passes half of the preallocated extent. Extents left beyond
+ * the end of bases that are no longer active are freed.
+ *
+ * Thread also creates spare base for every active slot which base is filled
+ * above @cfg.spare_base_threshold percent, so that rollover only makes the
+ * spare active instead of creating new base under "backend" lock.
+ *
+ * Started only if @cfg.prealloc_size or @cfg.spare_base_threshold is set and
+ * threads are enabled.
+ */
+struct eblob_prealloc {
+	pthread_mutex_t		lock;
+	/* Signalled by eblob_prealloc_kick() and on exit */
+	pthread_cond_t		cond;
+	pthread_t		tid;
+	int			wakeup;
+	int			started;
+	int			need_exit;
+	/*
+	 * Spare base per active slot, not in the list of bases yet.
+	 * NB! Protected by "backend" lock.
+	 */
+	struct eblob_base_ctl	**spare;
+};
+
+int eblob_prealloc_init(struct eblob_backend *b);
+void eblob_prealloc_destroy(struct eblob_backend *b);
+void eblob_prealloc_kick(struct eblob_backend *b, struct eblob_base_ctl *bctl,
+		uint64_t data_end);
+int eblob_prealloc_covered(struct eblob_base_ctl *bctl, uint64_t data_end);
+struct eblob_base_ctl *eblob_prealloc_take_spare(struct eblob_backend *b, unsigned int slot);
+
+#endif /* __EBLOB_PREALLOC_H */
@@ -223,22 +223,20 @@ err_out_exit:
 	return err;
 }
 
-int eblob_read_range(struct eblob_range_request *req)
+/*
+ * eblob_read_range_shard() - runs range request over one shard of in-memory
+ * cache. Returns positive value if requested limit was reached.
+ */
+static int eblob_read_range_shard(struct eblob_range_request *req, struct eblob_cache_shard *shard)
 {
 	struct eblob_backend *b = req->back;
-	struct eblob_hash *h = &b->hash;
-	struct rb_node *n = h->root.rb_node;
+	struct eblob_hash *h = &shard->hash;
+	struct rb_node *n;
 	struct eblob_hash_entry *e = NULL, *t = NULL;
 	int err = -ENOENT, cmp;
 
-	/*
-	 * It's non-trivial to make range requests with l2hash enabled so
-	 * disable it all along
-	 */
-	if (b->cfg.blob_flags & EBLOB_L2HASH)
-		return -ENOTSUP;
-
 	pthread_rwlock_rdlock(&h->root_lock);
+	n = h->root.rb_node;
 	while (n) {
 		t = rb_entry(n, struct eblob_hash_entry, node);
 
@@ -275,10 +273,18 @@ int eblob_read_range(struct eblob_range_request *req)
 		}
 
 		if (eblob_id_in_range(e->key.id, req->start, req->end)) {
-			for (unsigned int i = 0;
-					i < h->dsize / sizeof(struct eblob_ram_control); ++i) {
+			unsigned int count = h->dsize / sizeof(struct eblob_ram_control);
+			struct eblob_ram_control unpacked;
+
+			if (b->cfg.blob_flags & EBLOB_PACKED_CACHE) {
+				eblob_cache_unpack(b, (void *)e->data, &unpacked, NULL);
+				count = 1;
+			}
+
+			for (unsigned int i = 0; i < count; ++i) {
 				struct eblob_ram_control __attribute__((__may_alias__))
-					*const ctl = (void *)e->data + i;
+					*const ctl = (b->cfg.blob_flags & EBLOB_PACKED_CACHE) ?
+						&unpacked : (void *)e->data + i;
 
 				/*
 				 * ctl->index is an index of the blob, which hosts given key. This key is currently in RAM (tree)
@@ -320,6 +326,35 @@ int eblob_read_range(struct eblob_range_request *req)
 
 err_out_unlock:
 	pthread_rwlock_unlock(&h->root_lock);
+	return err;
+}
+
+int eblob_read_range(struct eblob_range_request *req)
+{
+	struct eblob_backend *b = req->back;
+	unsigned int i, first, last;
+	int err;
+
+	/*
+	 * It's non-trivial to make range requests with l2hash or unordered
+	 * open-addressing hash enabled so disable it all along
+	 */
+	if (b->cfg.blob_flags & (EBLOB_L2HASH | EBLOB_OHASH))
+		return -ENOTSUP;
+
+	eblob_wbuf_flush(b);
+
+	/*
+	 * Shards are selected by key prefix, so walk only shards that may
+	 * contain keys from requested range in ascending order
+	 */
+	first = eblob_cache_shard_index(b, req->start);
+	last = eblob_cache_shard_index(b, req->end);
+	for (i = first; i <= last; ++i) {
+		err = eblob_read_range_shard(req, &b->cache_shards[i]);
+		if (err > 0)
+			break;
+	}
 
 	err = eblob_read_range_on_disk(req);
 
@@ -0,0 +1,153 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Slab allocator for in-memory cache entries.
+ *
+ * Each cache shard has its own slabs, so they are protected by shard lock and
+ * do not contend with each other or with the rest of the process in malloc.
+ * Chunks grow geometrically, so small shards do not waste memory and large
+ * ones are not fragmented into thousands of mappings.
+ */
+
+#include "slab.h"
+
+#include <sys/mman.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+/* First chunk size, each next one is twice as big up to the maximum */
+#define EBLOB_SLAB_MIN_CHUNK	(64 * 1024)
+#define EBLOB_SLAB_MAX_CHUNK	(2 * 1024 * 1024)
+/* Objects are aligned to pointer size - rb_node keeps color in low bits */
+#define EBLOB_SLAB_ALIGN	(sizeof(void *))
+
+struct eblob_slab_chunk {
+	struct eblob_slab_chunk	*next;
+	size_t			size;
+};
+
+/* Objects start after chunk header, rounded up to alignment */
+#define EBLOB_SLAB_CHUNK_HDR \
+	((sizeof(struct eblob_slab_chunk) + EBLOB_SLAB_ALIGN - 1) & ~(EBLOB_SLAB_ALIGN - 1))
+
+void eblob_slab_init(struct eblob_slab *s, size_t obj_size)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	memset(s, 0, sizeof(struct eblob_slab));
+
+	if (obj_size < sizeof(void *))
+		obj_size = sizeof(void *);
+	s->obj_size = (obj_size + EBLOB_SLAB_ALIGN - 1) & ~(EBLOB_SLAB_ALIGN - 1);
+	s->chunk_size = EBLOB_SLAB_MIN_CHUNK;
+	s->page_size = page_size > 0 ? page_size : 4096;
+}
+
+/**
+ * eblob_slab_destroy() - unmaps all chunks at once.
+ * NB! All objects allocated from @s become invalid.
+ */
+void eblob_slab_destroy(struct eblob_slab *s)
+{
+	struct eblob_slab_chunk *c, *next;
+
+	assert(s != NULL);
+
+	for (c = s->chunks; c != NULL; c = next) {
+		next = c->next;
+		munmap(c, c->size);
+	}
+
+	s->free_list = NULL;
+	s->chunks = NULL;
+	s->cur = s->end = NULL;
+	s->chunk_size = EBLOB_SLAB_MIN_CHUNK;
+	s->mapped = 0;
+}
+
+static int eblob_slab_grow(struct eblob_slab *s)
+{
+	struct eblob_slab_chunk *c;
+	size_t size = s->chunk_size;
+
+	while (size < EBLOB_SLAB_CHUNK_HDR + s->obj_size)
+		size *= 2;
+
+	c = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (c == MAP_FAILED)
+		return -ENOMEM;
+
+	c->next = s->chunks;
+	c->size = size;
+	s->chunks = c;
+	s->cur = (unsigned char *)c + EBLOB_SLAB_CHUNK_HDR;
+	s->end = (unsigned char *)c + size;
+	s->mapped += size;
+
+	if (s->chunk_size < EBLOB_SLAB_MAX_CHUNK)
+		s->chunk_size *= 2;
+
+	return 0;
+}
+
+/**
+ * eblob_slab_alloc() - returns uninitialized object or NULL if there is no
+ * memory left.
+ */
+void *eblob_slab_alloc(struct eblob_slab *s)
+{
+	void *obj;
+
+	if (s->free_list != NULL) {
+		obj = s->free_list;
+		s->free_list = *(void **)obj;
+		return obj;
+	}
+
+	if ((size_t)(s->end - s->cur) < s->obj_size)
+		if (eblob_slab_grow(s))
+			return NULL;
+
+	obj = s->cur;
+	s->cur += s->obj_size;
+	return obj;
+}
+
+void eblob_slab_free(struct eblob_slab *s, void *obj)
+{
+	if (obj == NULL)
+		return;
+
+	*(void **)obj = s->free_list;
+	s->free_list = obj;
+}
+
+/**
+ * eblob_slab_rss() - returns number of resident bytes used by @s.
+ * Anonymous pages are populated on first touch, so untouched tail of current
+ * chunk is not counted.
+ */
+size_t eblob_slab_rss(const struct eblob_slab *s)
+{
+	const size_t untouched = (size_t)(s->end - s->cur) & ~(s->page_size - 1);
+
+	return s->mapped - untouched;
+}
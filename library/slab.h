@@ -0,0 +1,58 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __EBLOB_SLAB_H
+#define __EBLOB_SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct eblob_slab_chunk;
+
+/*
+ * Allocator of fixed-size objects for in-memory cache entries.
+ *
+ * Objects are carved sequentially from anonymous mmap'ed chunks, so there
+ * are no per-object malloc headers and entries of one tree are packed
+ * together. Freed objects are kept in free list and reused, chunks are
+ * returned to the system only by eblob_slab_destroy() which is O(chunks)
+ * instead of O(objects).
+ *
+ * No locking is done inside, caller should serialize access.
+ */
+struct eblob_slab {
+	/* Singly-linked list of freed objects */
+	void				*free_list;
+	/* List of mapped chunks, current one is first */
+	struct eblob_slab_chunk		*chunks;
+	/* Unused tail of current chunk */
+	unsigned char			*cur, *end;
+	size_t				obj_size;
+	/* Size of next chunk to map */
+	size_t				chunk_size;
+	size_t				page_size;
+	/* Bytes of memory mapped by all chunks */
+	size_t				mapped;
+};
+
+void eblob_slab_init(struct eblob_slab *s, size_t obj_size);
+void eblob_slab_destroy(struct eblob_slab *s);
+void *eblob_slab_alloc(struct eblob_slab *s);
+void eblob_slab_free(struct eblob_slab *s, void *obj);
+size_t eblob_slab_rss(const struct eblob_slab *s);
+
+#endif /* __EBLOB_SLAB_H */
@@ -109,6 +109,126 @@ static const struct eblob_stat_entry eblob_stat_default_global[] = {
 		EBLOB_GST_DATASORT_COMPLETION_STATUS,
 		{0}
 	},
+	{
+		"memory_index_rss",
+		EBLOB_GST_CACHED_RSS,
+		{0}
+	},
+	{
+		"lookup_meta_reads_number",
+		EBLOB_GST_CACHED_META_READS,
+		{0}
+	},
+	{
+		"read_copy_updates_time",
+		EBLOB_GST_READ_COPY_UPDATE_TIME,
+		{0}
+	},
+	{
+		"group_commits",
+		EBLOB_GST_GROUP_COMMITS,
+		{0}
+	},
+	{
+		"group_commit_waiters",
+		EBLOB_GST_GROUP_COMMIT_WAITERS,
+		{0}
+	},
+	{
+		"write_syscalls",
+		EBLOB_GST_WRITE_SYSCALLS,
+		{0}
+	},
+	{
+		"direct_writes",
+		EBLOB_GST_DIRECT_WRITES,
+		{0}
+	},
+	{
+		"direct_reads",
+		EBLOB_GST_DIRECT_READS,
+		{0}
+	},
+	{
+		"prealloc_extents",
+		EBLOB_GST_PREALLOC_EXTENTS,
+		{0}
+	},
+	{
+		"prealloc_fallbacks",
+		EBLOB_GST_PREALLOC_FALLBACKS,
+		{0}
+	},
+	{
+		"rollovers",
+		EBLOB_GST_ROLLOVERS,
+		{0}
+	},
+	{
+		"rollovers_spare",
+		EBLOB_GST_ROLLOVERS_SPARE,
+		{0}
+	},
+	{
+		"rollovers_time",
+		EBLOB_GST_ROLLOVERS_TIME,
+		{0}
+	},
+	{
+		"rollover_time_max",
+		EBLOB_GST_ROLLOVER_TIME_MAX,
+		{0}
+	},
+	{
+		"chain_appends",
+		EBLOB_GST_CHAIN_APPENDS,
+		{0}
+	},
+	{
+		"chain_extents",
+		EBLOB_GST_CHAIN_EXTENTS,
+		{0}
+	},
+	{
+		"chain_coalesces",
+		EBLOB_GST_CHAIN_COALESCES,
+		{0}
+	},
+	{
+		"tombstones",
+		EBLOB_GST_TOMBSTONES,
+		{0}
+	},
+	{
+		"tombstones_folded",
+		EBLOB_GST_TOMBSTONES_FOLDED,
+		{0}
+	},
+	{
+		"wbuf_records",
+		EBLOB_GST_WBUF_RECORDS,
+		{0}
+	},
+	{
+		"wbuf_flushes",
+		EBLOB_GST_WBUF_FLUSHES,
+		{0}
+	},
+	{
+		"wbuf_reads",
+		EBLOB_GST_WBUF_READS,
+		{0}
+	},
+	{
+		"multi_read_keys",
+		EBLOB_GST_MULTI_READ_KEYS,
+		{0}
+	},
+	{
+		"multi_read_syscalls",
+		EBLOB_GST_MULTI_READ_SYSCALLS,
+		{0}
+	},
 	{
 		"MAX",
 		EBLOB_GST_MAX,
@@ -187,6 +307,31 @@ static const struct eblob_stat_entry eblob_stat_default_local[] = {
 		EBLOB_LST_CORRUPTED_SIZE,
 		{0}
 	},
+	{
+		"records_compressed",
+		EBLOB_LST_RECORDS_COMPRESSED,
+		{0}
+	},
+	{
+		"compress_raw_size",
+		EBLOB_LST_COMPRESS_RAW_SIZE,
+		{0}
+	},
+	{
+		"compress_size",
+		EBLOB_LST_COMPRESS_SIZE,
+		{0}
+	},
+	{
+		"compress_time",
+		EBLOB_LST_COMPRESS_TIME,
+		{0}
+	},
+	{
+		"decompress_time",
+		EBLOB_LST_DECOMPRESS_TIME,
+		{0}
+	},
 	{
 		"MAX",
 		EBLOB_LST_MAX,
@@ -0,0 +1,794 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Tombstone journal.
+ *
+ * Marking record removed in place costs two random writes into index and
+ * data file of the base record lives in, so bulk removes of old records are
+ * limited by seeks. Tombstone journal makes remove a sequential append to one
+ * file per backend, while index and data headers are marked later in batches
+ * by index sort, data-sort or periodic thread.
+ */
+
+#include "features.h"
+
+#include "blob.h"
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Number of entries read or written by one syscall */
+#define EBLOB_TOMBSTONES_BATCH		(4096)
+
+struct eblob_tombstone {
+	struct rb_node			node;
+	/* Base record belongs to, NULL until it's loaded */
+	const struct eblob_base_ctl	*bctl;
+	/* Converted to host byte order */
+	struct eblob_tombstone_disk	td;
+};
+
+static int eblob_tombstone_cmp(int index, uint64_t data_offset, const struct eblob_base_ctl *bctl,
+		const struct eblob_tombstone *t)
+{
+	if (index != (int)t->td.index)
+		return index < (int)t->td.index ? -1 : 1;
+	if (data_offset != t->td.data_offset)
+		return data_offset < t->td.data_offset ? -1 : 1;
+	if (bctl != t->bctl)
+		return (uintptr_t)bctl < (uintptr_t)t->bctl ? -1 : 1;
+	return 0;
+}
+
+/*
+ * eblob_tombstone_insert_nolock() - adds @t to the tree, returns -EEXIST if
+ * record is already there.
+ */
+static int eblob_tombstone_insert_nolock(struct eblob_tombstones *ts, struct eblob_tombstone *t)
+{
+	struct rb_node **n = &ts->root.rb_node, *parent = NULL;
+	int cmp;
+
+	while (*n) {
+		parent = *n;
+		cmp = eblob_tombstone_cmp(t->td.index, t->td.data_offset, t->bctl,
+				rb_entry(parent, struct eblob_tombstone, node));
+		if (cmp < 0)
+			n = &parent->rb_left;
+		else if (cmp > 0)
+			n = &parent->rb_right;
+		else
+			return -EEXIST;
+	}
+
+	rb_link_node(&t->node, parent, n);
+	rb_insert_color(&t->node, &ts->root);
+	ts->num++;
+	return 0;
+}
+
+static void eblob_tombstone_erase_nolock(struct eblob_tombstones *ts, struct eblob_tombstone *t)
+{
+	rb_erase(&t->node, &ts->root);
+	ts->num--;
+	free(t);
+}
+
+/*
+ * eblob_tombstone_lower_bound() - returns first tombstone that is not less
+ * than (@index, @data_offset) or NULL.
+ */
+static struct eblob_tombstone *eblob_tombstone_lower_bound(struct eblob_tombstones *ts,
+		int index, uint64_t data_offset)
+{
+	struct rb_node *n = ts->root.rb_node;
+	struct eblob_tombstone *t, *found = NULL;
+
+	while (n) {
+		t = rb_entry(n, struct eblob_tombstone, node);
+		if (eblob_tombstone_cmp(index, data_offset, NULL, t) <= 0) {
+			found = t;
+			n = n->rb_left;
+		} else {
+			n = n->rb_right;
+		}
+	}
+
+	return found;
+}
+
+static struct eblob_tombstone *eblob_tombstone_next(struct eblob_tombstone *t)
+{
+	struct rb_node *n = rb_next(&t->node);
+
+	return n ? rb_entry(n, struct eblob_tombstone, node) : NULL;
+}
+
+static struct eblob_tombstone *eblob_tombstone_first(struct eblob_tombstones *ts)
+{
+	struct rb_node *n = rb_first(&ts->root);
+
+	return n ? rb_entry(n, struct eblob_tombstone, node) : NULL;
+}
+
+/*
+ * eblob_tombstones_load() - reads journal into the tree. Torn entry at the
+ * end of journal left by crash during append is cut off.
+ */
+static int eblob_tombstones_load(struct eblob_backend *b)
+{
+	struct eblob_tombstones *ts = &b->tombstones;
+	struct eblob_tombstone_disk *batch;
+	struct eblob_tombstone *t;
+	struct stat st;
+	uint64_t offset, size;
+	size_t i, num;
+	int err;
+
+	if (fstat(ts->fd, &st) == -1)
+		return -errno;
+
+	size = st.st_size - st.st_size % sizeof(struct eblob_tombstone_disk);
+	if (size != (uint64_t)st.st_size) {
+		EBLOB_WARNX(b->cfg.log, EBLOB_LOG_ERROR, "%s: truncating torn entry: size: %" PRIu64 " -> %" PRIu64,
+				ts->path, (uint64_t)st.st_size, size);
+		if (ftruncate(ts->fd, size) == -1)
+			return -errno;
+	}
+
+	batch = malloc(EBLOB_TOMBSTONES_BATCH * sizeof(struct eblob_tombstone_disk));
+	if (batch == NULL)
+		return -ENOMEM;
+
+	for (offset = 0; offset < size; offset += num * sizeof(struct eblob_tombstone_disk)) {
+		num = (size - offset) / sizeof(struct eblob_tombstone_disk);
+		if (num > EBLOB_TOMBSTONES_BATCH)
+			num = EBLOB_TOMBSTONES_BATCH;
+
+		err = __eblob_read_ll(ts->fd, batch, num * sizeof(struct eblob_tombstone_disk), offset);
+		if (err)
+			goto err_out_free;
+
+		for (i = 0; i < num; ++i) {
+			t = malloc(sizeof(struct eblob_tombstone));
+			if (t == NULL) {
+				err = -ENOMEM;
+				goto err_out_free;
+			}
+
+			t->bctl = NULL;
+			t->td = batch[i];
+			eblob_convert_tombstone_disk(&t->td);
+
+			if (eblob_tombstone_insert_nolock(ts, t))
+				free(t);
+		}
+	}
+
+	ts->offset = size;
+	err = 0;
+
+err_out_free:
+	free(batch);
+	return err;
+}
+
+/* Number of times journal tail is copied without @ts->lock before rewrite takes it */
+#define EBLOB_TOMBSTONES_REWRITE_TRIES	(4)
+
+/*
+ * eblob_tombstones_copy() - appends entries of journal between @from and @to
+ * to @fd at @offset.
+ */
+static int eblob_tombstones_copy(struct eblob_tombstones *ts, int fd,
+		uint64_t from, uint64_t to, uint64_t offset)
+{
+	char buf[EBLOB_TOMBSTONES_BATCH];
+	uint64_t size;
+	int err;
+
+	for (; from < to; from += size, offset += size) {
+		size = to - from;
+		if (size > sizeof(buf))
+			size = sizeof(buf);
+
+		err = __eblob_read_ll(ts->fd, buf, size, from);
+		if (err)
+			return err;
+		err = __eblob_write_ll(fd, buf, size, offset);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+/*
+ * eblob_fsync_dir() - makes rename in directory @path durable.
+ */
+static int eblob_fsync_dir(const char *path)
+{
+	int fd, err;
+
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+
+	err = eblob_fsync(fd);
+	close(fd);
+	return err;
+}
+
+/*
+ * eblob_tombstones_rewrite() - atomically replaces journal with entries that
+ * are in the tree.
+ *
+ * New journal is written and synced without @ts->lock, so removes are not
+ * blocked meanwhile: tree is copied first, entries appended to the journal
+ * since then are copied from its tail. @ts->lock is held only to copy what's
+ * left of the tail and to swap journals. Entries dropped from the tree after
+ * it was copied are removed from the journal by next rewrite, which is
+ * always done by whoever drops them.
+ * Journal fd is kept, so syncs of removes waiting for group commit still
+ * refer to the journal.
+ */
+static int eblob_tombstones_rewrite(struct eblob_backend *b)
+{
+	struct eblob_tombstones *ts = &b->tombstones;
+	struct eblob_tombstone_disk *tds = NULL;
+	struct eblob_tombstone *t;
+	char tmp_path[PATH_MAX];
+	uint64_t i, num, offset, tail, end;
+	int fd, tries, err;
+
+	snprintf(tmp_path, PATH_MAX, "%s.tmp", ts->path);
+
+	pthread_mutex_lock(&ts->rewrite_lock);
+
+	/* Entries appended after @tail are not in the copy of tree */
+	pthread_mutex_lock(&ts->lock);
+	pthread_rwlock_rdlock(&ts->root_lock);
+	num = ts->num;
+	if (num) {
+		tds = malloc(num * sizeof(struct eblob_tombstone_disk));
+		if (tds == NULL) {
+			pthread_rwlock_unlock(&ts->root_lock);
+			pthread_mutex_unlock(&ts->lock);
+			err = -ENOMEM;
+			goto err_out_unlock;
+		}
+	}
+	for (i = 0, t = eblob_tombstone_first(ts); t != NULL; t = eblob_tombstone_next(t), ++i) {
+		tds[i] = t->td;
+		eblob_convert_tombstone_disk(&tds[i]);
+	}
+	tail = ts->offset;
+	pthread_rwlock_unlock(&ts->root_lock);
+	pthread_mutex_unlock(&ts->lock);
+
+	fd = open(tmp_path, O_RDWR | O_CLOEXEC | O_TRUNC | O_CREAT, 0644);
+	if (fd == -1) {
+		err = -errno;
+		goto err_out_free;
+	}
+
+	offset = num * sizeof(struct eblob_tombstone_disk);
+	if (num) {
+		err = __eblob_write_ll(fd, tds, offset, 0);
+		if (err)
+			goto err_out_unlink;
+	}
+
+	/* @ts->fd is changed only by rewrite, so tail is read without @ts->lock */
+	for (tries = 0;; ++tries) {
+		err = eblob_fsync(fd);
+		if (err)
+			goto err_out_unlink;
+
+		pthread_mutex_lock(&ts->lock);
+		end = ts->offset;
+		if (end == tail || tries == EBLOB_TOMBSTONES_REWRITE_TRIES)
+			break;
+		pthread_mutex_unlock(&ts->lock);
+
+		err = eblob_tombstones_copy(ts, fd, tail, end, offset);
+		if (err)
+			goto err_out_unlink;
+		offset += end - tail;
+		tail = end;
+	}
+
+	/* Removes keep coming, copy the rest under the lock */
+	if (end != tail) {
+		err = eblob_tombstones_copy(ts, fd, tail, end, offset);
+		if (err)
+			goto err_out_unlock_unlink;
+		offset += end - tail;
+		err = eblob_fsync(fd);
+		if (err)
+			goto err_out_unlock_unlink;
+	}
+
+	if (rename(tmp_path, ts->path) == -1) {
+		err = -errno;
+		goto err_out_unlock_unlink;
+	}
+
+	err = eblob_fsync_dir(b->base_dir);
+	if (err)
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "%s: rewrite: fsync: %s",
+				ts->path, b->base_dir);
+
+	if (ts->fd >= 0) {
+		if (dup2(fd, ts->fd) == -1) {
+			err = -errno;
+			pthread_mutex_unlock(&ts->lock);
+			goto err_out_close;
+		}
+		close(fd);
+	} else {
+		ts->fd = fd;
+	}
+
+	ts->offset = offset;
+	pthread_mutex_unlock(&ts->lock);
+	pthread_mutex_unlock(&ts->rewrite_lock);
+	free(tds);
+	return 0;
+
+err_out_unlock_unlink:
+	pthread_mutex_unlock(&ts->lock);
+err_out_unlink:
+	unlink(tmp_path);
+err_out_close:
+	close(fd);
+err_out_free:
+	free(tds);
+err_out_unlock:
+	pthread_mutex_unlock(&ts->rewrite_lock);
+	EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "%s: rewrite: FAILED", ts->path);
+	return err;
+}
+
+/**
+ * eblob_tombstones_init() - opens tombstone journal of backend and loads it.
+ * Journal is created only if EBLOB_TOMBSTONE_JOURNAL is set.
+ */
+int eblob_tombstones_init(struct eblob_backend *b)
+{
+	struct eblob_tombstones *ts = &b->tombstones;
+	int err;
+
+	memset(ts, 0, sizeof(struct eblob_tombstones));
+	ts->root = RB_ROOT;
+	ts->fd = -1;
+
+	ts->path = malloc(PATH_MAX);
+	if (ts->path == NULL) {
+		err = -ENOMEM;
+		goto err_out_exit;
+	}
+	snprintf(ts->path, PATH_MAX, "%s" EBLOB_TOMBSTONES_SUFFIX, b->cfg.file);
+
+	err = eblob_mutex_init(&ts->lock);
+	if (err)
+		goto err_out_free;
+
+	err = eblob_mutex_init(&ts->rewrite_lock);
+	if (err)
+		goto err_out_destroy_lock;
+
+	err = pthread_rwlock_init(&ts->root_lock, NULL);
+	if (err) {
+		err = -err;
+		goto err_out_destroy_rewrite_lock;
+	}
+
+	ts->fd = open(ts->path, O_RDWR | O_CLOEXEC |
+			((b->cfg.blob_flags & EBLOB_TOMBSTONE_JOURNAL) ? O_CREAT : 0), 0644);
+	if (ts->fd == -1) {
+		err = -errno;
+		if (err == -ENOENT)
+			return 0;
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "%s: open: FAILED", ts->path);
+		goto err_out_destroy_root_lock;
+	}
+
+	err = eblob_tombstones_load(b);
+	if (err) {
+		EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "%s: load: FAILED", ts->path);
+		goto err_out_destroy;
+	}
+
+	eblob_stat_set(b->stat, EBLOB_GST_TOMBSTONES, ts->num);
+	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_INFO, "%s: loaded: %" PRIu64 " tombstones", ts->path, ts->num);
+	return 0;
+
+err_out_destroy:
+	eblob_tombstones_destroy(b);
+	return err;
+
+err_out_destroy_root_lock:
+	pthread_rwlock_destroy(&ts->root_lock);
+err_out_destroy_rewrite_lock:
+	pthread_mutex_destroy(&ts->rewrite_lock);
+err_out_destroy_lock:
+	pthread_mutex_destroy(&ts->lock);
+err_out_free:
+	free(ts->path);
+err_out_exit:
+	return err;
+}
+
+void eblob_tombstones_destroy(struct eblob_backend *b)
+{
+	struct eblob_tombstones *ts = &b->tombstones;
+	struct eblob_tombstone *t;
+
+	while ((t = eblob_tombstone_first(ts)) != NULL)
+		eblob_tombstone_erase_nolock(ts, t);
+
+	if (ts->fd >= 0)
+		close(ts->fd);
+	free(ts->path);
+	pthread_rwlock_destroy(&ts->root_lock);
+	pthread_mutex_destroy(&ts->rewrite_lock);
+	pthread_mutex_destroy(&ts->lock);
+}
+
+/**
+ * eblob_tombstone_add() - appends tombstone of record @key described by @rctl
+ * to the journal. Journal is not synced, see eblob_tombstones_sync().
+ */
+int eblob_tombstone_add(struct eblob_backend *b, const struct eblob_key *key,
+		const struct eblob_ram_control *rctl)
+{
+	struct eblob_tombstones *ts = &b->tombstones;
+	struct eblob_tombstone *t;
+	struct eblob_tombstone_disk td;
+	int err;
+
+	if (ts->fd < 0)
+		return -EBADF;
+
+	t = malloc(sizeof(struct eblob_tombstone));
+	if (t == NULL)
+		return -ENOMEM;
+
+	memset(t, 0, sizeof(struct eblob_tombstone));
+	t->bctl = rctl->bctl;
+	t->td.key = *key;
+	t->td.index = rctl->bctl->index;
+	t->td.data_offset = rctl->data_offset;
+	t->td.index_offset = rctl->index_offset;
+
+	td = t->td;
+	eblob_convert_tombstone_disk(&td);
+
+	pthread_mutex_lock(&ts->lock);
+	err = __eblob_write_ll(ts->fd, &td, sizeof(td), ts->offset);
+	if (err) {
+		pthread_mutex_unlock(&ts->lock);
+		free(t);
+		return err;
+	}
+	ts->offset += sizeof(td);
+
+	pthread_rwlock_wrlock(&ts->root_lock);
+	err = eblob_tombstone_insert_nolock(ts, t);
+	pthread_rwlock_unlock(&ts->root_lock);
+	pthread_mutex_unlock(&ts->lock);
+
+	/* Record is already removed by tombstone, journal just has a duplicate */
+	if (err) {
+		free(t);
+		return 0;
+	}
+
+	eblob_stat_inc(b->stat, EBLOB_GST_TOMBSTONES);
+	return 0;
+}
+
+/**
+ * eblob_tombstones_sync() - makes appended tombstones durable if every
+ * operation should be synced, see eblob_sync_record().
+ */
+int eblob_tombstones_sync(struct eblob_backend *b, uint64_t flags)
+{
+	if (b->cfg.sync)
+		return 0;
+
+	return eblob_gcommit_sync(b, &b->tombstones.fd, 1, !(flags & BLOB_DISK_CTL_NOSYNC));
+}
+
+/**
+ * eblob_tombstone_exists() - checks whether record @key of @bctl at
+ * @data_offset is removed by tombstone.
+ */
+int eblob_tombstone_exists(struct eblob_backend *b, const struct eblob_base_ctl *bctl,
+		const struct eblob_key *key, uint64_t data_offset)
+{
+	struct eblob_tombstones *ts = &b->tombstones;
+	struct eblob_tombstone *t;
+	int found = 0;
+
+	if (ACCESS_ONCE(ts->num) == 0)
+		return 0;
+
+	pthread_rwlock_rdlock(&ts->root_lock);
+	for (t = eblob_tombstone_lower_bound(ts, bctl->index, data_offset);
+			t != NULL && (int)t->td.index == bctl->index && t->td.data_offset == data_offset;
+			t = eblob_tombstone_next(t)) {
+		if (t->bctl == bctl && eblob_id_cmp(t->td.key.id, key->id) == 0) {
+			found = 1;
+			break;
+		}
+	}
+	pthread_rwlock_unlock(&ts->root_lock);
+
+	return found;
+}
+
+/**
+ * eblob_tombstones_bind() - attributes tombstones loaded from journal for
+ * index of @bctl to it. Called when base is opened, tombstones of bases that
+ * were not opened are removed by eblob_tombstones_drop(b, NULL).
+ */
+void eblob_tombstones_bind(struct eblob_backend *b, const struct eblob_base_ctl *bctl)
+{
+	struct eblob_tombstones *ts = &b->tombstones;
+	struct eblob_tombstone *t, *next;
+
+	pthread_mutex_lock(&ts->lock);
+	pthread_rwlock_wrlock(&ts->root_lock);
+	for (t = eblob_tombstone_lower_bound(ts, bctl->index, 0);
+			t != NULL && (int)t->td.index == bctl->index; t = next) {
+		next = eblob_tombstone_next(t);
+		if (t->bctl != NULL)
+			continue;
+
+		/* Tree is ordered by bctl too, so reinsert */
+		rb_erase(&t->node, &ts->root);
+		ts->num--;
+		t->bctl = bctl;
+		if (eblob_tombstone_insert_nolock(ts, t))
+			free(t);
+	}
+	pthread_rwlock_unlock(&ts->root_lock);
+	pthread_mutex_unlock(&ts->lock);
+}
+
+/**
+ * eblob_tombstones_drop() - forgets tombstones of @bctl and rewrites journal
+ * without them. Called when records of @bctl are marked removed on disk or
+ * don't exist anymore.
+ */
+void eblob_tombstones_drop(struct eblob_backend *b, const struct eblob_base_ctl *bctl)
+{
+	struct eblob_tombstones *ts = &b->tombstones;
+	struct eblob_tombstone *t, *next;
+	uint64_t dropped = 0;
+
+	if (ACCESS_ONCE(ts->num) == 0)
+		return;
+
+	pthread_mutex_lock(&ts->lock);
+	pthread_rwlock_wrlock(&ts->root_lock);
+	for (t = eblob_tombstone_first(ts); t != NULL; t = next) {
+		next = eblob_tombstone_next(t);
+		if (t->bctl == bctl) {
+			eblob_tombstone_erase_nolock(ts, t);
+			dropped++;
+		}
+	}
+	pthread_rwlock_unlock(&ts->root_lock);
+	pthread_mutex_unlock(&ts->lock);
+
+	if (dropped) {
+		eblob_stat_sub(b->stat, EBLOB_GST_TOMBSTONES, dropped);
+		eblob_tombstones_rewrite(b);
+	}
+}
+
+/*
+ * eblob_tombstone_mark() - marks removed index and data headers of record
+ * @td in @bctl unless they belong to other record.
+ */
+static int eblob_tombstone_mark(struct eblob_backend *b, struct eblob_base_ctl *bctl,
+		const struct eblob_tombstone_disk *td)
+{
+	struct eblob_disk_control dc;
+	int err;
+
+	err = __eblob_read_ll(bctl->index_ctl.fd, &dc, sizeof(dc), td->index_offset);
+	if (err)
+		return err;
+
+	if (eblob_id_cmp(dc.key.id, td->key.id) == 0 && eblob_bswap64(dc.position) == td->data_offset) {
+		err = eblob_mark_index_removed(bctl->index_ctl.fd, td->index_offset);
+		if (err)
+			return err;
+	}
+
+	err = __eblob_read_ll(bctl->data_ctl.fd, &dc, sizeof(dc), td->data_offset);
+	if (err)
+		return err;
+
+	if (eblob_id_cmp(dc.key.id, td->key.id) == 0) {
+		err = eblob_mark_index_removed(bctl->data_ctl.fd, td->data_offset);
+		if (err)
+			return err;
+	}
+
+	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_DEBUG, "%s: folded: index: %d, data position: %" PRIu64
+			", index position: %" PRIu64, eblob_dump_id(td->key.id), bctl->index,
+			td->data_offset, td->index_offset);
+	return 0;
+}
+
+/**
+ * eblob_tombstones_fold() - marks records of @bctl removed by tombstones in
+ * its index and data file in order of their offsets and drops tombstones.
+ * Tombstones added meanwhile are kept.
+ * NB! Caller must guarantee that @bctl is not swapped by data-sort or index
+ * sort meanwhile.
+ */
+int eblob_tombstones_fold(struct eblob_backend *b, struct eblob_base_ctl *bctl)
+{
+	struct eblob_tombstones *ts = &b->tombstones;
+	struct eblob_tombstone_disk *tds = NULL;
+	struct eblob_tombstone *t, *next;
+	uint64_t i, num = 0, size = 0, dropped = 0;
+	int err = 0;
+
+	if (ACCESS_ONCE(ts->num) == 0)
+		return 0;
+
+	pthread_rwlock_rdlock(&ts->root_lock);
+	for (t = eblob_tombstone_lower_bound(ts, bctl->index, 0);
+			t != NULL && (int)t->td.index == bctl->index; t = eblob_tombstone_next(t)) {
+		if (t->bctl != bctl)
+			continue;
+
+		if (num == size) {
+			struct eblob_tombstone_disk *tmp;
+
+			size = size ? size * 2 : EBLOB_TOMBSTONES_BATCH;
+			tmp = realloc(tds, size * sizeof(struct eblob_tombstone_disk));
+			if (tmp == NULL) {
+				pthread_rwlock_unlock(&ts->root_lock);
+				err = -ENOMEM;
+				goto err_out_free;
+			}
+			tds = tmp;
+		}
+		tds[num++] = t->td;
+	}
+	pthread_rwlock_unlock(&ts->root_lock);
+
+	if (num == 0)
+		goto err_out_free;
+
+	for (i = 0; i < num; ++i) {
+		err = eblob_tombstone_mark(b, bctl, &tds[i]);
+		if (err) {
+			EBLOB_WARNC(b->cfg.log, EBLOB_LOG_ERROR, -err, "%s: fold: index: %d, data position: %" PRIu64
+					": FAILED", eblob_dump_id(tds[i].key.id), bctl->index, tds[i].data_offset);
+			goto err_out_free;
+		}
+	}
+
+	err = eblob_fdatasync(bctl->index_ctl.fd);
+	if (err)
+		goto err_out_free;
+	err = eblob_fdatasync(bctl->data_ctl.fd);
+	if (err)
+		goto err_out_free;
+
+	/* Drop only tombstones that were folded */
+	pthread_mutex_lock(&ts->lock);
+	pthread_rwlock_wrlock(&ts->root_lock);
+	for (i = 0; i < num; ++i) {
+		for (t = eblob_tombstone_lower_bound(ts, bctl->index, tds[i].data_offset);
+				t != NULL && (int)t->td.index == bctl->index &&
+				t->td.data_offset == tds[i].data_offset; t = next) {
+			next = eblob_tombstone_next(t);
+			if (t->bctl == bctl) {
+				eblob_tombstone_erase_nolock(ts, t);
+				dropped++;
+				break;
+			}
+		}
+	}
+	pthread_rwlock_unlock(&ts->root_lock);
+	pthread_mutex_unlock(&ts->lock);
+	eblob_tombstones_rewrite(b);
+
+	eblob_stat_sub(b->stat, EBLOB_GST_TOMBSTONES, dropped);
+	eblob_stat_add(b->stat, EBLOB_GST_TOMBSTONES_FOLDED, num);
+	EBLOB_WARNX(b->cfg.log, EBLOB_LOG_INFO, "%s: folded: index: %d, tombstones: %" PRIu64,
+			ts->path, bctl->index, num);
+
+err_out_free:
+	free(tds);
+	return err;
+}
+
+/**
+ * eblob_tombstones_fold_all() - folds tombstones of all bases except ones
+ * being sorted, they are folded by the sort itself, and ones already cleaned
+ * up by defrag.
+ *
+ * @b->lock is taken only to copy list of bases, so writes and sorts are not
+ * blocked by folding. Each base is held while it's folded: sorts wait for
+ * holders before they start or swap the base, and base swapped before it was
+ * held has no tombstones anymore. Only one base is held at a time, since
+ * data-sort waits for its bases one by one under @b->lock.
+ */
+int eblob_tombstones_fold_all(struct eblob_backend *b)
+{
+	struct eblob_base_ctl *bctl, **bctls;
+	size_t i, num = 0;
+	int err, ret = 0;
+
+	pthread_mutex_lock(&b->lock);
+	list_for_each_entry(bctl, &b->bases, base_entry)
+		num++;
+	if (num == 0) {
+		pthread_mutex_unlock(&b->lock);
+		return 0;
+	}
+
+	bctls = malloc(num * sizeof(struct eblob_base_ctl *));
+	if (bctls == NULL) {
+		pthread_mutex_unlock(&b->lock);
+		return -ENOMEM;
+	}
+
+	/* Bases are not freed until backend is destroyed */
+	num = 0;
+	list_for_each_entry(bctl, &b->bases, base_entry)
+		bctls[num++] = bctl;
+	pthread_mutex_unlock(&b->lock);
+
+	for (i = 0; i < num; ++i) {
+		bctl = bctls[i];
+
+		/*
+		 * Base cleaned up by defrag has no files anymore, its records
+		 * were either moved to sorted base or removed with it.
+		 */
+		eblob_bctl_hold(bctl);
+		if (bctl->index_ctl.fd >= 0 && bctl->data_ctl.fd >= 0 &&
+				!eblob_binlog_enabled(&bctl->binlog)) {
+			err = eblob_tombstones_fold(b, bctl);
+			if (err && ret == 0)
+				ret = err;
+		}
+		eblob_bctl_release(bctl);
+	}
+
+	free(bctls);
+	return ret;
+}
@@ -0,0 +1,99 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __EBLOB_TOMBSTONE_H
+#define __EBLOB_TOMBSTONE_H
+
+#include "eblob/blob.h"
+#include "rbtree.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+struct eblob_backend;
+struct eblob_base_ctl;
+struct eblob_ram_control;
+
+/* Suffix of tombstone journal of backend */
+#define EBLOB_TOMBSTONES_SUFFIX		".tombstones"
+/* Periodic thread folds journal into bases once it has that many entries */
+#define EBLOB_TOMBSTONES_FOLD_THRESHOLD	(1024 * 1024)
+
+/*
+ * Entry of tombstone journal: record of base @index at @data_offset, which
+ * header is at @index_offset of its index, is removed.
+ */
+struct eblob_tombstone_disk {
+	struct eblob_key	key;
+	uint32_t		index;
+	uint32_t		__pad;
+	uint64_t		data_offset;
+	uint64_t		index_offset;
+} __attribute__ ((packed));
+
+static inline void eblob_convert_tombstone_disk(struct eblob_tombstone_disk *td)
+{
+	td->index = eblob_bswap32(td->index);
+	td->data_offset = eblob_bswap64(td->data_offset);
+	td->index_offset = eblob_bswap64(td->index_offset);
+}
+
+/*
+ * Tombstone journal.
+ *
+ * With EBLOB_TOMBSTONE_JOURNAL removes are appended to the journal instead of
+ * marking index and data headers with BLOB_DISK_CTL_REMOVE in place. Entries
+ * are kept in @root ordered by base and data offset, lookups in sorted indexes
+ * and iterators treat records found there as removed. In memory entries belong
+ * to base controls, so tombstones of base replaced by data-sort do not apply
+ * to the sorted one which has the same index.
+ *
+ * Index sort and data-sort fold tombstones of the bases they sort into the
+ * sorted ones, periodic thread folds all of them when journal grows above
+ * EBLOB_TOMBSTONES_FOLD_THRESHOLD. Journal is rewritten without folded
+ * entries.
+ *
+ * Journal is loaded even if the flag is not set, so removes made with it
+ * are not lost.
+ */
+struct eblob_tombstones {
+	/* Serializes appends to the journal and its swap by rewrite */
+	pthread_mutex_t		lock;
+	/* Serializes rewrites, new journal is built without @lock */
+	pthread_mutex_t		rewrite_lock;
+	/* Protects @root and @num */
+	pthread_rwlock_t	root_lock;
+	struct rb_root		root;
+	uint64_t		num;
+	int			fd;
+	uint64_t		offset;
+	char			*path;
+};
+
+int eblob_tombstones_init(struct eblob_backend *b);
+void eblob_tombstones_destroy(struct eblob_backend *b);
+int eblob_tombstone_add(struct eblob_backend *b, const struct eblob_key *key,
+		const struct eblob_ram_control *rctl);
+int eblob_tombstones_sync(struct eblob_backend *b, uint64_t flags);
+int eblob_tombstone_exists(struct eblob_backend *b, const struct eblob_base_ctl *bctl,
+		const struct eblob_key *key, uint64_t data_offset);
+void eblob_tombstones_bind(struct eblob_backend *b, const struct eblob_base_ctl *bctl);
+int eblob_tombstones_fold(struct eblob_backend *b, struct eblob_base_ctl *bctl);
+int eblob_tombstones_fold_all(struct eblob_backend *b);
+void eblob_tombstones_drop(struct eblob_backend *b, const struct eblob_base_ctl *bctl);
+
+#endif /* __EBLOB_TOMBSTONE_H */
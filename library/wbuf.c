@@ -0,0 +1,684 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Write coalescing buffer.
+ *
+ * Every record written by eblob_writev() costs reservation under "backend"
+ * lock, RAM index update and several syscalls regardless of its size, so
+ * records of few hundred bytes are limited by number of operations rather
+ * than by bytes. Buffer collects such records in memory and writes them by
+ * eblob_write_batch(), which lays them out back to back with one
+ * reservation, few pwritev(2) and one index write.
+ */
+
+#include "features.h"
+
+#include "blob.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Flags buffered records may be written with */
+#define EBLOB_WBUF_FLAGS	(BLOB_DISK_CTL_NOSYNC | BLOB_DISK_CTL_NOCSUM)
+
+struct eblob_wbuf_entry {
+	struct rb_node		node;
+	struct eblob_key	key;
+	uint64_t		flags;
+	uint64_t		size;
+	char			data[];
+};
+
+static uint64_t eblob_wbuf_now_usecs(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static struct eblob_wbuf_slot *eblob_wbuf_slot(struct eblob_backend *b, const struct eblob_key *key)
+{
+	return &b->wbuf.slots[eblob_active_base_slot(b, key)];
+}
+
+static struct eblob_wbuf_entry *eblob_wbuf_lookup_nolock(struct rb_root *root,
+		const struct eblob_key *key)
+{
+	struct rb_node *n = root->rb_node;
+	struct eblob_wbuf_entry *e;
+	int cmp;
+
+	while (n) {
+		e = rb_entry(n, struct eblob_wbuf_entry, node);
+		cmp = eblob_id_cmp(key->id, e->key.id);
+		if (cmp < 0)
+			n = n->rb_left;
+		else if (cmp > 0)
+			n = n->rb_right;
+		else
+			return e;
+	}
+
+	return NULL;
+}
+
+/* Buffered record of @key, one being flushed is found if there is no newer one */
+static struct eblob_wbuf_entry *eblob_wbuf_lookup_any_nolock(struct eblob_wbuf_slot *s,
+		const struct eblob_key *key)
+{
+	struct eblob_wbuf_entry *e;
+
+	e = eblob_wbuf_lookup_nolock(&s->root, key);
+	if (e == NULL)
+		e = eblob_wbuf_lookup_nolock(&s->flushing, key);
+	return e;
+}
+
+/* Links @e into @s->root, it's already accounted in @s->num */
+static void eblob_wbuf_link_nolock(struct eblob_wbuf_slot *s, struct eblob_wbuf_entry *e)
+{
+	struct rb_node **n = &s->root.rb_node, *parent = NULL;
+
+	while (*n) {
+		parent = *n;
+		if (eblob_id_cmp(e->key.id, rb_entry(parent, struct eblob_wbuf_entry, node)->key.id) < 0)
+			n = &parent->rb_left;
+		else
+			n = &parent->rb_right;
+	}
+
+	rb_link_node(&e->node, parent, n);
+	rb_insert_color(&e->node, &s->root);
+
+	if (s->size == 0)
+		s->first_usecs = eblob_wbuf_now_usecs();
+	s->size += e->size + sizeof(struct eblob_disk_control);
+}
+
+static void eblob_wbuf_insert_nolock(struct eblob_wbuf_slot *s, struct eblob_wbuf_entry *e)
+{
+	eblob_wbuf_link_nolock(s, e);
+	ACCESS_ONCE(s->num) = s->num + 1;
+}
+
+static void eblob_wbuf_erase_nolock(struct eblob_wbuf_slot *s, struct eblob_wbuf_entry *e)
+{
+	rb_erase(&e->node, &s->root);
+	ACCESS_ONCE(s->num) = s->num - 1;
+	s->size -= e->size + sizeof(struct eblob_disk_control);
+	free(e);
+}
+
+static int eblob_wbuf_entry_flags_cmp(const void *l, const void *r)
+{
+	const struct eblob_wbuf_entry *le = *(struct eblob_wbuf_entry * const *)l;
+	const struct eblob_wbuf_entry *re = *(struct eblob_wbuf_entry * const *)r;
+
+	return (le->flags > re->flags) - (le->flags < re->flags);
+}
+
+/*
+ * eblob_wbuf_flush_nolock() - writes all records of @s->root.
+ *
+ * Waits for running flush of @s first. Records are moved to @s->flushing and
+ * written without @s->lock, because eblob_write_batch() takes "backend" lock
+ * and may take long, they are read from there meanwhile.
+ *
+ * eblob_write_batch() writes all records with the same flags, so they are
+ * written by one batch per distinct flags. Writers were told that their
+ * records are written, so records that could not be written are returned to
+ * the buffer and are retried by the next flush, unless they were overwritten
+ * meanwhile.
+ *
+ * If @key is not NULL, only error of its record is returned: errors of other
+ * records are not caller's business. Otherwise error of the first failed
+ * record is returned.
+ *
+ * Called and returns with @s->lock held.
+ */
+static int eblob_wbuf_flush_nolock(struct eblob_backend *b, struct eblob_wbuf_slot *s,
+		const struct eblob_key *key)
+{
+	struct eblob_wbuf_entry **entries = NULL;
+	struct eblob_key *keys = NULL;
+	struct eblob_iovec *iov = NULL;
+	struct rb_node *n;
+	uint64_t i, start, failed = 0, num;
+	int *errors = NULL, err = 0;
+
+	while (s->flush_running)
+		pthread_cond_wait(&s->cond, &s->lock);
+
+	/* @s->flushing is empty when no flush is running */
+	num = s->num;
+	if (num == 0)
+		return 0;
+
+	entries = malloc(num * sizeof(struct eblob_wbuf_entry *));
+	keys = malloc(num * sizeof(struct eblob_key));
+	iov = malloc(num * sizeof(struct eblob_iovec));
+	errors = calloc(num, sizeof(int));
+	if (entries == NULL || keys == NULL || iov == NULL || errors == NULL) {
+		/* Records stay in the buffer until the next try */
+		err = -ENOMEM;
+		goto err_out_free;
+	}
+
+	for (i = 0, n = rb_first(&s->root); n != NULL; n = rb_next(n))
+		entries[i++] = rb_entry(n, struct eblob_wbuf_entry, node);
+	qsort(entries, num, sizeof(struct eblob_wbuf_entry *), eblob_wbuf_entry_flags_cmp);
+
+	for (i = 0; i < num; ++i) {
+		keys[i] = entries[i]->key;
+		iov[i].base = entries[i]->data;
+		iov[i].size = entries[i]->size;
+		iov[i].offset = 0;
+	}
+
+	s->flushing = s->root;
+	s->root = RB_ROOT;
+	s->size = 0;
+	s->flush_running = 1;
+	pthread_mutex_unlock(&s->lock);
+
+	for (start = 0, i = 1; i <= num; ++i) {
+		if (i < num && entries[i]->flags == entries[start]->flags)
+			continue;
+		eblob_write_batch_ll(b, keys + start, iov + start, i - start,
+				entries[start]->flags, errors + start);
+		start = i;
+	}
+
+	pthread_mutex_lock(&s->lock);
+	for (i = 0; i < num; ++i) {
+		rb_erase(&entries[i]->node, &s->flushing);
+
+		if (errors[i] != 0 && eblob_wbuf_lookup_nolock(&s->root, &keys[i]) == NULL) {
+			eblob_log(b->cfg.log, EBLOB_LOG_ERROR,
+					"blob: %s: %s: buffered record is not written, will retry: %d\n",
+					__func__, eblob_dump_id(keys[i].id), errors[i]);
+			eblob_wbuf_link_nolock(s, entries[i]);
+			failed++;
+			if (key == NULL ? err == 0 : eblob_id_cmp(keys[i].id, key->id) == 0)
+				err = errors[i];
+			continue;
+		}
+
+		/* Written or overwritten by newer record while it was written */
+		ACCESS_ONCE(s->num) = s->num - 1;
+		free(entries[i]);
+	}
+	s->flush_running = 0;
+	pthread_cond_broadcast(&s->cond);
+
+	eblob_stat_inc(b->stat, EBLOB_GST_WBUF_FLUSHES);
+
+err_out_free:
+	eblob_log(b->cfg.log, (failed || err) ? EBLOB_LOG_ERROR : EBLOB_LOG_NOTICE,
+			"blob: %s: records: %" PRIu64 ", failed: %" PRIu64 ": %d\n",
+			__func__, num, failed, err);
+	free(errors);
+	free(iov);
+	free(keys);
+	free(entries);
+	return err;
+}
+
+/*
+ * eblob_wbuf_flush_key_nolock() - flushes @s until record of @key is
+ * neither buffered nor being flushed: it may be buffered again while
+ * previous one is written.
+ */
+static int eblob_wbuf_flush_key_nolock(struct eblob_backend *b, struct eblob_wbuf_slot *s,
+		const struct eblob_key *key)
+{
+	int err = 0;
+
+	while (err == 0 && eblob_wbuf_lookup_any_nolock(s, key) != NULL)
+		err = eblob_wbuf_flush_nolock(b, s, key);
+
+	return err;
+}
+
+/**
+ * eblob_wbuf_write() - buffers full write of @iov to @key.
+ *
+ * Returns -EAGAIN if record should be written to disk by caller: it's too
+ * big, partial, has flags batch can't write, exists on disk or should be
+ * durable. Buffered version of @key is flushed before that, so it does not
+ * overwrite the record later, error is returned if it could not be flushed.
+ * Before durable write the whole buffer of its slot is flushed, so it's not
+ * overtaken by writes made before.
+ *
+ * Buffer that has grown above @cfg.wbuf_size is flushed by caller. Records
+ * that failed to be flushed are kept and retried, so they are not reported
+ * to the caller. While buffer can't be flushed records are not buffered:
+ * -EAGAIN is returned, so each writer gets error of its own record.
+ */
+int eblob_wbuf_write(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags)
+{
+	const int durable = !b->cfg.sync && !(flags & BLOB_DISK_CTL_NOSYNC);
+	struct eblob_iovec_bounds bounds;
+	struct eblob_wbuf_entry *e, *old;
+	struct eblob_ram_control rctl;
+	struct eblob_wbuf_slot *s;
+	uint16_t i;
+	int err = 0, disk;
+
+	if (b->wbuf.slots == NULL)
+		return -EAGAIN;
+
+	s = eblob_wbuf_slot(b, key);
+	eblob_iovec_get_bounds(&bounds, iov, iovcnt);
+	if (durable || (flags & ~EBLOB_WBUF_FLAGS) || bounds.min != 0 || bounds.contiguous == 0
+			|| bounds.max == 0 || bounds.max > EBLOB_WBUF_RECORD_MAX) {
+		if (ACCESS_ONCE(s->num) == 0)
+			return -EAGAIN;
+
+		pthread_mutex_lock(&s->lock);
+		if (durable)
+			err = eblob_wbuf_flush_nolock(b, s, key);
+		if (err == 0)
+			err = eblob_wbuf_flush_key_nolock(b, s, key);
+		pthread_mutex_unlock(&s->lock);
+		return err ? err : -EAGAIN;
+	}
+
+	e = malloc(sizeof(struct eblob_wbuf_entry) + bounds.max);
+	if (e == NULL)
+		return -EAGAIN;
+
+	e->key = *key;
+	e->flags = flags;
+	e->size = bounds.max;
+	for (i = 0; i < iovcnt; ++i)
+		memcpy(e->data + iov[i].offset, iov[i].base, iov[i].size);
+
+	pthread_mutex_lock(&s->lock);
+
+	/* Buffer is still full only if its last flush failed */
+	if (s->size >= b->cfg.wbuf_size && eblob_wbuf_flush_nolock(b, s, NULL) != 0) {
+		/* Caller's write of the whole record supersedes buffered one */
+		old = eblob_wbuf_lookup_nolock(&s->root, key);
+		if (old != NULL)
+			eblob_wbuf_erase_nolock(s, old);
+		pthread_mutex_unlock(&s->lock);
+		free(e);
+		return -EAGAIN;
+	}
+
+	old = eblob_wbuf_lookup_nolock(&s->root, key);
+	if (old != NULL) {
+		eblob_wbuf_erase_nolock(s, old);
+	} else if (eblob_wbuf_lookup_nolock(&s->flushing, key) == NULL &&
+			eblob_cache_lookup(b, key, &rctl, NULL, &disk) != -ENOENT) {
+		/*
+		 * Only new records are batched, one being flushed is not on
+		 * disk yet and is overwritten by the next flush
+		 */
+		pthread_mutex_unlock(&s->lock);
+		free(e);
+		return -EAGAIN;
+	}
+
+	eblob_wbuf_insert_nolock(s, e);
+	eblob_stat_inc(b->stat, EBLOB_GST_WBUF_RECORDS);
+
+	if (s->size >= b->cfg.wbuf_size)
+		eblob_wbuf_flush_nolock(b, s, NULL);
+	pthread_mutex_unlock(&s->lock);
+
+	return 0;
+}
+
+/**
+ * eblob_wbuf_read() - reads buffered data of @key the same way
+ * eblob_read_data() reads it from disk. If @buf is not NULL data is copied
+ * there instead of allocated buffer returned in @dst, if both are NULL only
+ * size of data is returned.
+ *
+ * Returns -ENOENT if @key is not buffered.
+ */
+int eblob_wbuf_read(struct eblob_backend *b, struct eblob_key *key, uint64_t offset,
+		char **dst, void *buf, uint64_t *size)
+{
+	struct eblob_wbuf_entry *e;
+	struct eblob_wbuf_slot *s;
+	uint64_t record_size;
+	char *data;
+	int err = 0;
+
+	if (b->wbuf.slots == NULL)
+		return -ENOENT;
+
+	s = eblob_wbuf_slot(b, key);
+	if (ACCESS_ONCE(s->num) == 0)
+		return -ENOENT;
+
+	pthread_mutex_lock(&s->lock);
+	e = eblob_wbuf_lookup_any_nolock(s, key);
+	if (e == NULL) {
+		err = -ENOENT;
+		goto err_out_unlock;
+	}
+
+	if (dst == NULL && buf == NULL) {
+		*size = e->size;
+		goto err_out_unlock;
+	}
+
+	if (offset >= e->size) {
+		err = -E2BIG;
+		goto err_out_unlock;
+	}
+
+	record_size = e->size - offset;
+	if (*size && record_size > *size)
+		record_size = *size;
+
+	data = buf != NULL ? buf : malloc(record_size);
+	if (data == NULL) {
+		err = -ENOMEM;
+		goto err_out_unlock;
+	}
+	memcpy(data, e->data + offset, record_size);
+
+	if (buf == NULL)
+		*dst = data;
+	*size = record_size;
+
+	eblob_stat_inc(b->stat, EBLOB_GST_WBUF_READS);
+	eblob_stat_inc(b->stat, EBLOB_GST_DATA_READS_NUMBER);
+	eblob_stat_add(b->stat, EBLOB_GST_READS_SIZE, record_size);
+
+err_out_unlock:
+	pthread_mutex_unlock(&s->lock);
+	return err;
+}
+
+/**
+ * eblob_wbuf_remove() - drops buffered record of @key.
+ * Record being flushed can't be dropped, so flush is waited for, then record
+ * is either on disk or back in the buffer.
+ * Returns -ENOENT if @key is not buffered.
+ */
+int eblob_wbuf_remove(struct eblob_backend *b, struct eblob_key *key)
+{
+	struct eblob_wbuf_entry *e;
+	struct eblob_wbuf_slot *s;
+	int err = -ENOENT;
+
+	if (b->wbuf.slots == NULL)
+		return -ENOENT;
+
+	s = eblob_wbuf_slot(b, key);
+	if (ACCESS_ONCE(s->num) == 0)
+		return -ENOENT;
+
+	pthread_mutex_lock(&s->lock);
+	while (eblob_wbuf_lookup_nolock(&s->root, key) == NULL &&
+			eblob_wbuf_lookup_nolock(&s->flushing, key) != NULL)
+		pthread_cond_wait(&s->cond, &s->lock);
+
+	e = eblob_wbuf_lookup_nolock(&s->root, key);
+	if (e != NULL) {
+		eblob_wbuf_erase_nolock(s, e);
+		err = 0;
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	return err;
+}
+
+/**
+ * eblob_wbuf_flush_key() - writes buffer holding @key if any, so that
+ * @key can be found on disk.
+ * Returns error only if record of @key could not be written.
+ */
+int eblob_wbuf_flush_key(struct eblob_backend *b, struct eblob_key *key)
+{
+	struct eblob_wbuf_slot *s;
+	int err = 0;
+
+	if (b->wbuf.slots == NULL)
+		return 0;
+
+	s = eblob_wbuf_slot(b, key);
+	if (ACCESS_ONCE(s->num) == 0)
+		return 0;
+
+	pthread_mutex_lock(&s->lock);
+	err = eblob_wbuf_flush_key_nolock(b, s, key);
+	pthread_mutex_unlock(&s->lock);
+
+	return err;
+}
+
+/**
+ * eblob_wbuf_flush() - writes buffers of all slots.
+ */
+int eblob_wbuf_flush(struct eblob_backend *b)
+{
+	struct eblob_wbuf_slot *s;
+	unsigned int i;
+	int err = 0, ret;
+
+	if (b->wbuf.slots == NULL)
+		return 0;
+
+	for (i = 0; i < b->cfg.active_bases; ++i) {
+		s = &b->wbuf.slots[i];
+		if (ACCESS_ONCE(s->num) == 0)
+			continue;
+
+		pthread_mutex_lock(&s->lock);
+		ret = eblob_wbuf_flush_nolock(b, s, NULL);
+		pthread_mutex_unlock(&s->lock);
+		if (ret && err == 0)
+			err = ret;
+	}
+
+	return err;
+}
+
+/*
+ * eblob_wbuf_flush_expired() - writes buffers which oldest record is in it
+ * for @cfg.wbuf_timeout and returns time the next buffer expires at.
+ */
+static uint64_t eblob_wbuf_flush_expired(struct eblob_backend *b)
+{
+	const uint64_t timeout = b->cfg.wbuf_timeout * 1000ULL;
+	const uint64_t now = eblob_wbuf_now_usecs();
+	uint64_t next = now + timeout;
+	struct eblob_wbuf_slot *s;
+	unsigned int i;
+
+	for (i = 0; i < b->cfg.active_bases; ++i) {
+		s = &b->wbuf.slots[i];
+		if (ACCESS_ONCE(s->num) == 0)
+			continue;
+
+		pthread_mutex_lock(&s->lock);
+		if (s->size != 0) {
+			if (s->first_usecs + timeout <= now)
+				eblob_wbuf_flush_nolock(b, s, NULL);
+			else if (s->first_usecs + timeout < next)
+				next = s->first_usecs + timeout;
+		}
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	return next;
+}
+
+static void *eblob_wbuf_thread(void *data)
+{
+	struct eblob_backend *b = data;
+	struct eblob_wbuf *wb = &b->wbuf;
+	struct timespec ts;
+	uint64_t next;
+
+	eblob_set_name("wbuf_%u", b->cfg.stat_id);
+
+	pthread_mutex_lock(&wb->lock);
+	while (!wb->need_exit) {
+		pthread_mutex_unlock(&wb->lock);
+
+		next = eblob_wbuf_flush_expired(b);
+		ts.tv_sec = next / 1000000;
+		ts.tv_nsec = (next % 1000000) * 1000;
+
+		pthread_mutex_lock(&wb->lock);
+		while (!wb->need_exit) {
+			if (pthread_cond_timedwait(&wb->cond, &wb->lock, &ts) == ETIMEDOUT)
+				break;
+		}
+	}
+	pthread_mutex_unlock(&wb->lock);
+
+	return NULL;
+}
+
+/**
+ * eblob_wbuf_init() - allocates buffers of active base slots and starts
+ * flusher thread if buffer is enabled.
+ */
+int eblob_wbuf_init(struct eblob_backend *b)
+{
+	struct eblob_wbuf *wb = &b->wbuf;
+	pthread_condattr_t attr;
+	unsigned int i;
+	int err;
+
+	memset(wb, 0, sizeof(*wb));
+
+	err = eblob_mutex_init(&wb->lock);
+	if (err)
+		goto err_out_exit;
+
+	/* Flusher sleeps until expiration time of eblob_wbuf_now_usecs() clock */
+	err = -pthread_condattr_init(&attr);
+	if (err)
+		goto err_out_lock_destroy;
+	err = -pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if (err == 0)
+		err = -pthread_cond_init(&wb->cond, &attr);
+	pthread_condattr_destroy(&attr);
+	if (err)
+		goto err_out_lock_destroy;
+
+	if (b->cfg.wbuf_size == 0)
+		return 0;
+
+	wb->slots = calloc(b->cfg.active_bases, sizeof(struct eblob_wbuf_slot));
+	if (wb->slots == NULL) {
+		err = -ENOMEM;
+		goto err_out_cond_destroy;
+	}
+
+	for (i = 0; i < b->cfg.active_bases; ++i) {
+		err = eblob_mutex_init(&wb->slots[i].lock);
+		if (err)
+			goto err_out_slots_destroy;
+		err = eblob_cond_init(&wb->slots[i].cond);
+		if (err) {
+			pthread_mutex_destroy(&wb->slots[i].lock);
+			goto err_out_slots_destroy;
+		}
+		wb->slots[i].root = RB_ROOT;
+		wb->slots[i].flushing = RB_ROOT;
+	}
+
+	if (b->cfg.blob_flags & EBLOB_DISABLE_THREADS)
+		return 0;
+
+	err = -pthread_create(&wb->tid, NULL, eblob_wbuf_thread, b);
+	if (err) {
+		eblob_log(b->cfg.log, EBLOB_LOG_ERROR, "blob: eblob wbuf thread creation failed: %d.\n", err);
+		goto err_out_slots_destroy;
+	}
+	wb->started = 1;
+
+	return 0;
+
+err_out_slots_destroy:
+	while (i-- > 0) {
+		pthread_cond_destroy(&wb->slots[i].cond);
+		pthread_mutex_destroy(&wb->slots[i].lock);
+	}
+	free(wb->slots);
+	wb->slots = NULL;
+err_out_cond_destroy:
+	pthread_cond_destroy(&wb->cond);
+err_out_lock_destroy:
+	pthread_mutex_destroy(&wb->lock);
+err_out_exit:
+	return err;
+}
+
+/**
+ * eblob_wbuf_destroy() - stops flusher thread and writes all buffered
+ * records.
+ *
+ * Must be called while backend is able to write and no writes are in flight.
+ */
+void eblob_wbuf_destroy(struct eblob_backend *b)
+{
+	struct eblob_wbuf *wb = &b->wbuf;
+	unsigned int i;
+
+	if (wb->started) {
+		pthread_mutex_lock(&wb->lock);
+		wb->need_exit = 1;
+		pthread_cond_signal(&wb->cond);
+		pthread_mutex_unlock(&wb->lock);
+
+		pthread_join(wb->tid, NULL);
+		wb->started = 0;
+	}
+
+	if (wb->slots != NULL) {
+		eblob_wbuf_flush(b);
+		for (i = 0; i < b->cfg.active_bases; ++i) {
+			struct eblob_wbuf_slot *s = &wb->slots[i];
+			struct eblob_wbuf_entry *e;
+			struct rb_node *n;
+
+			/* There is no next flush to retry failed records */
+			while ((n = rb_first(&s->root)) != NULL) {
+				e = rb_entry(n, struct eblob_wbuf_entry, node);
+				eblob_log(b->cfg.log, EBLOB_LOG_ERROR,
+						"blob: %s: %s: buffered record is lost\n",
+						__func__, eblob_dump_id(e->key.id));
+				eblob_wbuf_erase_nolock(s, e);
+			}
+			pthread_cond_destroy(&s->cond);
+			pthread_mutex_destroy(&s->lock);
+		}
+		free(wb->slots);
+		wb->slots = NULL;
+	}
+
+	pthread_cond_destroy(&wb->cond);
+	pthread_mutex_destroy(&wb->lock);
+}
@@ -0,0 +1,83 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __EBLOB_WBUF_H
+#define __EBLOB_WBUF_H
+
+#include "eblob/blob.h"
+#include "rbtree.h"
+
+#include <pthread.h>
+#include <stdint.h>
+
+struct eblob_backend;
+
+/* Only records with at most that many bytes of data are buffered */
+#define EBLOB_WBUF_RECORD_MAX		(4096)
+
+/*
+ * Buffer of active base slot: records not written yet ordered by key.
+ * Flush moves records from @root to @flushing under @lock and writes them
+ * without it, so key is always either in one of the trees or in RAM index.
+ * Only one flush of the slot runs at a time, @cond is signalled when it ends.
+ */
+struct eblob_wbuf_slot {
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	struct rb_root		root;
+	struct rb_root		flushing;
+	int			flush_running;
+	/* Records in both trees, read without @lock to skip empty buffers */
+	uint64_t		num;
+	/* Bytes of data and headers in @root */
+	uint64_t		size;
+	/* Time first of buffered records was added, in microseconds */
+	uint64_t		first_usecs;
+};
+
+/*
+ * Write buffer, used if @cfg.wbuf_size is set.
+ *
+ * Small writes, that do not need to be durable before they return, are
+ * copied into buffer of active base slot key is written to. Buffer is
+ * written by eblob_write_batch() once it grows above @cfg.wbuf_size, its
+ * oldest record is in it for @cfg.wbuf_timeout milliseconds or durable
+ * write to the same slot arrives. Reads of buffered keys are served from
+ * memory, operations that need record on disk flush the buffer first.
+ */
+struct eblob_wbuf {
+	struct eblob_wbuf_slot	*slots;
+
+	/* Flusher thread, signalled on exit */
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	pthread_t		tid;
+	int			started;
+	int			need_exit;
+};
+
+int eblob_wbuf_init(struct eblob_backend *b);
+void eblob_wbuf_destroy(struct eblob_backend *b);
+int eblob_wbuf_write(struct eblob_backend *b, struct eblob_key *key,
+		const struct eblob_iovec *iov, uint16_t iovcnt, uint64_t flags);
+int eblob_wbuf_read(struct eblob_backend *b, struct eblob_key *key, uint64_t offset,
+		char **dst, void *buf, uint64_t *size);
+int eblob_wbuf_remove(struct eblob_backend *b, struct eblob_key *key);
+int eblob_wbuf_flush_key(struct eblob_backend *b, struct eblob_key *key);
+int eblob_wbuf_flush(struct eblob_backend *b);
+
+#endif /* __EBLOB_WBUF_H */
@@ -0,0 +1,296 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Asynchronous read benchmark.
+ *
+ * Writes @items records and reads random keys from single thread: first with
+ * blocking eblob_read_data(), then with eblob_read_async() keeping 1, 2, 4,
+ * ... @depth requests in flight, printing throughput of each run.
+ * Pass EBLOB_IO_URING (0x8000) in blob flags to use io_uring.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "eblob/blob.h"
+
+#define BENCH_NS_IN_S		(1000LL * 1000LL * 1000LL)
+
+#define DEFAULT_BLOB_FLAGS	(0)
+#define DEFAULT_ITEMS		(10000)
+#define DEFAULT_ITEM_SIZE	(4096)
+#define DEFAULT_READS		(100000)
+#define DEFAULT_DEPTH		(64)
+#define DEFAULT_PATH		"./"
+
+struct bench_cfg {
+	long long		blob_flags;	/* Passed to cfg.blob_flags */
+	long long		items;		/* Number of distinct keys */
+	long long		item_size;	/* Size of each record */
+	long long		reads;		/* Number of reads per run */
+	long			depth;		/* Max number of requests in flight */
+	long			csum;		/* Verify checksums */
+	char			*path;		/* Path to test directory */
+
+	struct eblob_backend	*b;
+	struct eblob_key	*keys;
+	char			*data;
+	unsigned int		seed;
+
+	/* Async run state */
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	long			inflight;
+	long long		completed;
+	long			errors;
+};
+
+static struct bench_cfg cfg = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void usage(const char *progname, int eval)
+{
+	fprintf(stderr, "Usage: %s [-c] [-d depth] [-F blob_flags] [-i items] [-I item_size] "
+			"[-p path] [-r reads]\n", progname);
+	exit(eval);
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * BENCH_NS_IN_S + ts.tv_nsec;
+}
+
+static struct eblob_key *random_key(void)
+{
+	return &cfg.keys[rand_r(&cfg.seed) % cfg.items];
+}
+
+/* Reads with eblob_read_data() and returns reads per second */
+static double bench_sync(void)
+{
+	long long i, start, elapsed;
+	uint64_t size;
+	char *data;
+	int error;
+
+	start = now_ns();
+	for (i = 0; i < cfg.reads; ++i) {
+		size = 0;
+		if (cfg.csum)
+			error = eblob_read_data(cfg.b, random_key(), 0, &data, &size);
+		else
+			error = eblob_read_data_nocsum(cfg.b, random_key(), 0, &data, &size);
+		if (error != 0) {
+			cfg.errors++;
+			continue;
+		}
+		free(data);
+	}
+	elapsed = now_ns() - start;
+
+	return (double)cfg.reads * BENCH_NS_IN_S / (elapsed ? elapsed : 1);
+}
+
+static void bench_complete(struct eblob_key *key __attribute__ ((unused)), int error,
+		uint64_t size __attribute__ ((unused)), void *priv __attribute__ ((unused)))
+{
+	pthread_mutex_lock(&cfg.lock);
+	if (error != 0)
+		cfg.errors++;
+	cfg.inflight--;
+	cfg.completed++;
+	pthread_cond_signal(&cfg.cond);
+	pthread_mutex_unlock(&cfg.lock);
+}
+
+/* Reads with eblob_read_async() keeping @depth requests in flight */
+static double bench_async(long depth)
+{
+	const enum eblob_read_flavour csum = cfg.csum ? EBLOB_READ_CSUM : EBLOB_READ_NOCSUM;
+	long long submitted = 0, start, elapsed;
+	char *bufs;
+	int error;
+
+	bufs = malloc(depth * cfg.item_size);
+	if (bufs == NULL)
+		err(EX_OSERR, "malloc");
+
+	cfg.completed = 0;
+	start = now_ns();
+	pthread_mutex_lock(&cfg.lock);
+	while (cfg.completed < cfg.reads) {
+		while (cfg.inflight < depth && submitted < cfg.reads) {
+			/* Completion frees one slot, any buffer of that slot is unused */
+			char *buf = bufs + (submitted % depth) * cfg.item_size;
+
+			cfg.inflight++;
+			submitted++;
+			pthread_mutex_unlock(&cfg.lock);
+
+				error = eblob_read_async(cfg.b, random_key(), 0, cfg.item_size, buf,
+					csum, bench_complete, NULL);
+
+			pthread_mutex_lock(&cfg.lock);
+			if (error != 0) {
+				cfg.errors++;
+				cfg.inflight--;
+				cfg.completed++;
+			}
+		}
+		if (cfg.completed < cfg.reads)
+			pthread_cond_wait(&cfg.cond, &cfg.lock);
+	}
+	pthread_mutex_unlock(&cfg.lock);
+	elapsed = now_ns() - start;
+
+	free(bufs);
+
+	return (double)cfg.reads * BENCH_NS_IN_S / (elapsed ? elapsed : 1);
+}
+
+int main(int argc, char **argv)
+{
+	static struct eblob_config bcfg;
+	static struct eblob_log logger;
+	static char log_path[PATH_MAX], blob_path[PATH_MAX];
+	double rps, sync_rps;
+	char key[32];
+	long long i;
+	long depth;
+	int ch, error;
+
+	cfg.blob_flags = DEFAULT_BLOB_FLAGS;
+	cfg.items = DEFAULT_ITEMS;
+	cfg.item_size = DEFAULT_ITEM_SIZE;
+	cfg.reads = DEFAULT_READS;
+	cfg.depth = DEFAULT_DEPTH;
+	cfg.path = DEFAULT_PATH;
+	cfg.seed = 1;
+
+	while ((ch = getopt(argc, argv, "cd:F:hi:I:p:r:")) != -1) {
+		switch (ch) {
+		case 'c':
+			cfg.csum = 1;
+			break;
+		case 'd':
+			cfg.depth = strtol(optarg, NULL, 0);
+			break;
+		case 'F':
+			cfg.blob_flags = strtoll(optarg, NULL, 0);
+			break;
+		case 'i':
+			cfg.items = strtoll(optarg, NULL, 0);
+			break;
+		case 'I':
+			cfg.item_size = strtoll(optarg, NULL, 0);
+			break;
+		case 'p':
+			cfg.path = optarg;
+			break;
+		case 'r':
+			cfg.reads = strtoll(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0], EX_OK);
+		default:
+			usage(argv[0], EX_USAGE);
+		}
+	}
+
+	if (cfg.items <= 0 || cfg.item_size <= 0 || cfg.reads <= 0 || cfg.depth <= 0)
+		usage(argv[0], EX_USAGE);
+
+	snprintf(log_path, PATH_MAX, "%s/%s", cfg.path, "bench.log");
+	snprintf(blob_path, PATH_MAX, "%s/%s", cfg.path, "bench-blob");
+
+	logger.log_level = EBLOB_LOG_ERROR;
+	logger.log = eblob_log_raw_formatted;
+	if ((logger.log_private = fopen(log_path, "a")) == NULL)
+		err(EX_OSFILE, "fopen: %s", log_path);
+
+	bcfg.blob_flags = cfg.blob_flags | EBLOB_DISABLE_THREADS | EBLOB_NO_FREE_SPACE_CHECK;
+	bcfg.file = blob_path;
+	bcfg.log = &logger;
+	bcfg.sync = 30;
+	cfg.b = eblob_init(&bcfg);
+	if (cfg.b == NULL)
+		errx(EX_OSERR, "eblob_init");
+
+	/* Remove all data that may belong to previous run */
+	eblob_remove_blobs(cfg.b);
+	eblob_cleanup(cfg.b);
+
+	cfg.b = eblob_init(&bcfg);
+	if (cfg.b == NULL)
+		errx(EX_OSERR, "eblob_init");
+
+	cfg.keys = calloc(cfg.items, sizeof(struct eblob_key));
+	cfg.data = malloc(cfg.item_size);
+	if (cfg.keys == NULL || cfg.data == NULL)
+		err(EX_OSERR, "malloc");
+	memset(cfg.data, 0xa5, cfg.item_size);
+
+	for (i = 0; i < cfg.items; ++i) {
+		snprintf(key, sizeof(key), "bench-%lld", i);
+		eblob_hash(cfg.b, cfg.keys[i].id, sizeof(cfg.keys[i].id), key, strlen(key));
+
+		error = eblob_write(cfg.b, &cfg.keys[i], cfg.data, 0, cfg.item_size, 0);
+		if (error != 0)
+			errx(EX_SOFTWARE, "eblob_write: %d", error);
+	}
+
+	sync_rps = bench_sync();
+	printf("sync:            reads: %10lld, rps: %12.0f\n", cfg.reads, sync_rps);
+	fflush(stdout);
+
+	for (depth = 1; depth <= cfg.depth; depth *= 2) {
+		rps = bench_async(depth);
+		printf("async depth: %3ld, reads: %10lld, rps: %12.0f, speedup: %6.2f\n",
+				depth, cfg.reads, rps, rps / sync_rps);
+		fflush(stdout);
+	}
+
+	if (cfg.errors)
+		warnx("read errors: %ld", cfg.errors);
+
+	eblob_remove_blobs(cfg.b);
+	eblob_cleanup(cfg.b);
+	free(cfg.keys);
+	free(cfg.data);
+	fclose(logger.log_private);
+
+	return cfg.errors ? EX_SOFTWARE : EX_OK;
+}
@@ -0,0 +1,207 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * In-memory index microbenchmark.
+ *
+ * Compares rb-tree hash (eblob_hash_*) with open-addressing one
+ * (eblob_ohash_*) on @items random keys: insert, lookup of existing and
+ * missing keys, remove. Prints nanoseconds per operation.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "eblob/blob.h"
+#include "../../library/blob.h"
+
+#define BENCH_NS_IN_S		(1000LL * 1000LL * 1000LL)
+#define DEFAULT_ITEMS		(1000000)
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * BENCH_NS_IN_S + ts.tv_nsec;
+}
+
+/* splitmix64 - rand_r() has too short period to generate millions of unique keys */
+static uint64_t next_rnd(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+static void fill_keys(struct eblob_key *keys, long long items, uint64_t seed)
+{
+	long long i;
+	unsigned int j;
+
+	for (i = 0; i < items; ++i) {
+		for (j = 0; j < EBLOB_ID_SIZE; j += sizeof(uint64_t)) {
+			const uint64_t rnd = next_rnd(&seed);
+			memcpy(keys[i].id + j, &rnd, sizeof(uint64_t));
+		}
+	}
+}
+
+/* Wraps both engines into the same set of callbacks */
+struct bench_engine {
+	const char	*name;
+	void		*h;
+	int		(*replace)(void *h, struct eblob_key *key, void *data, int *replaced);
+	int		(*lookup)(void *h, struct eblob_key *key, void *data);
+	int		(*remove)(void *h, struct eblob_key *key);
+};
+
+static int rb_replace(void *h, struct eblob_key *key, void *data, int *replaced)
+{
+	return eblob_hash_replace_nolock(h, key, data, replaced);
+}
+
+static int rb_lookup(void *h, struct eblob_key *key, void *data)
+{
+	return eblob_hash_lookup_nolock(h, key, data);
+}
+
+static int rb_remove(void *h, struct eblob_key *key)
+{
+	return eblob_hash_remove_nolock(h, key);
+}
+
+static int oa_replace(void *h, struct eblob_key *key, void *data, int *replaced)
+{
+	return eblob_ohash_replace_nolock(h, key, data, replaced);
+}
+
+static int oa_lookup(void *h, struct eblob_key *key, void *data)
+{
+	return eblob_ohash_lookup_nolock(h, key, data);
+}
+
+static int oa_remove(void *h, struct eblob_key *key)
+{
+	return eblob_ohash_remove_nolock(h, key);
+}
+
+static void bench_engine(struct bench_engine *e, struct eblob_key *keys,
+		struct eblob_key *missing, long long items)
+{
+	struct eblob_ram_control rctl;
+	long long i, start, insert, hit, miss, remove;
+	int replaced;
+
+	memset(&rctl, 0, sizeof(rctl));
+
+	start = now_ns();
+	for (i = 0; i < items; ++i) {
+		rctl.data_offset = i;
+		if (e->replace(e->h, &keys[i], &rctl, &replaced) != 0)
+			errx(EX_SOFTWARE, "%s: replace: %lld", e->name, i);
+	}
+	insert = now_ns() - start;
+
+	start = now_ns();
+	for (i = 0; i < items; ++i) {
+		if (e->lookup(e->h, &keys[i], &rctl) != 0 || rctl.data_offset != (uint64_t)i)
+			errx(EX_SOFTWARE, "%s: lookup: %lld", e->name, i);
+	}
+	hit = now_ns() - start;
+
+	start = now_ns();
+	for (i = 0; i < items; ++i) {
+		if (e->lookup(e->h, &missing[i], &rctl) != -ENOENT)
+			errx(EX_SOFTWARE, "%s: lookup missing: %lld", e->name, i);
+	}
+	miss = now_ns() - start;
+
+	start = now_ns();
+	for (i = 0; i < items; ++i) {
+		if (e->remove(e->h, &keys[i]) != 0)
+			errx(EX_SOFTWARE, "%s: remove: %lld", e->name, i);
+	}
+	remove = now_ns() - start;
+
+	printf("%-8s items: %10lld, insert: %7.1f ns, lookup: %7.1f ns, "
+			"lookup-missing: %7.1f ns, remove: %7.1f ns\n", e->name, items,
+			(double)insert / items, (double)hit / items,
+			(double)miss / items, (double)remove / items);
+}
+
+int main(int argc, char **argv)
+{
+	struct eblob_hash hash;
+	struct eblob_ohash ohash;
+	struct eblob_key *keys, *missing;
+	long long items = DEFAULT_ITEMS;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "hi:")) != -1) {
+		switch (ch) {
+		case 'i':
+			items = strtoll(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-i items]\n", argv[0]);
+			return ch == 'h' ? EX_OK : EX_USAGE;
+		}
+	}
+	if (items <= 0)
+		errx(EX_USAGE, "items must be positive");
+
+	keys = malloc(items * sizeof(struct eblob_key));
+	missing = malloc(items * sizeof(struct eblob_key));
+	if (keys == NULL || missing == NULL)
+		err(EX_OSERR, "malloc");
+	fill_keys(keys, items, 1);
+	fill_keys(missing, items, 1ULL << 63);
+
+	if (eblob_hash_init(&hash, sizeof(struct eblob_ram_control)) != 0)
+		errx(EX_OSERR, "eblob_hash_init");
+	if (eblob_ohash_init(&ohash, sizeof(struct eblob_ram_control)) != 0)
+		errx(EX_OSERR, "eblob_ohash_init");
+
+	struct bench_engine engines[] = {
+		{ "rbtree", &hash, rb_replace, rb_lookup, rb_remove },
+		{ "ohash", &ohash, oa_replace, oa_lookup, oa_remove },
+	};
+
+	for (unsigned int i = 0; i < sizeof(engines) / sizeof(engines[0]); ++i)
+		bench_engine(&engines[i], keys, missing, items);
+
+	eblob_hash_destroy(&hash);
+	eblob_ohash_destroy(&ohash);
+	free(keys);
+	free(missing);
+
+	return EX_OK;
+}
@@ -0,0 +1,254 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Multi-threaded read benchmark.
+ *
+ * Populates blob with @items records and then reads random keys from 1, 2, 4,
+ * ... @threads threads printing throughput and scaling relative to
+ * single-threaded run.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "eblob/blob.h"
+
+#define BENCH_NS_IN_S		(1000LL * 1000LL * 1000LL)
+
+#define DEFAULT_BLOB_FLAGS	(0)
+#define DEFAULT_ITEMS		(100000)
+#define DEFAULT_ITEM_SIZE	(100)
+#define DEFAULT_READS		(200000)
+#define DEFAULT_THREADS		(16)
+#define DEFAULT_PATH		"./"
+
+struct bench_cfg {
+	long long		blob_flags;	/* Passed to cfg.blob_flags */
+	long long		items;		/* Number of records */
+	long long		item_size;	/* Size of each record */
+	long long		reads;		/* Number of reads per thread */
+	long			threads;	/* Max number of reader threads */
+	long			nocsum;		/* Read without checksum verification */
+	char			*path;		/* Path to test directory */
+
+	struct eblob_backend	*b;
+	struct eblob_key	*keys;
+	long			errors;
+};
+
+static struct bench_cfg cfg;
+
+struct bench_thread {
+	int		tid;
+	unsigned int	seed;
+	long		errors;
+};
+
+static void usage(const char *progname, int eval)
+{
+	fprintf(stderr, "Usage: %s [-c] [-F blob_flags] [-i items] [-I item_size] "
+			"[-p path] [-r reads_per_thread] [-T threads]\n", progname);
+	exit(eval);
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * BENCH_NS_IN_S + ts.tv_nsec;
+}
+
+static void *bench_thread(void *priv)
+{
+	struct bench_thread *t = priv;
+	long long i;
+	int err, fd;
+	uint64_t offset, size;
+
+	for (i = 0; i < cfg.reads; ++i) {
+		struct eblob_key *key = &cfg.keys[rand_r(&t->seed) % cfg.items];
+
+		if (cfg.nocsum)
+			err = eblob_read_nocsum(cfg.b, key, &fd, &offset, &size);
+		else
+			err = eblob_read(cfg.b, key, &fd, &offset, &size);
+		if (err != 0)
+			t->errors++;
+	}
+
+	return NULL;
+}
+
+/* Runs @threads readers and returns reads per second */
+static double bench_run(long threads)
+{
+	pthread_t *tids;
+	struct bench_thread *t;
+	long long start, elapsed;
+	long i;
+	int error;
+
+	tids = calloc(threads, sizeof(pthread_t));
+	t = calloc(threads, sizeof(struct bench_thread));
+	if (tids == NULL || t == NULL)
+		err(EX_OSERR, "calloc");
+
+	start = now_ns();
+	for (i = 0; i < threads; ++i) {
+		t[i].tid = i;
+		t[i].seed = i + 1;
+		error = pthread_create(&tids[i], NULL, bench_thread, &t[i]);
+		if (error != 0)
+			errx(EX_OSERR, "pthread_create: %d", error);
+	}
+	for (i = 0; i < threads; ++i) {
+		pthread_join(tids[i], NULL);
+		cfg.errors += t[i].errors;
+	}
+	elapsed = now_ns() - start;
+
+	free(tids);
+	free(t);
+
+	return (double)cfg.reads * threads * BENCH_NS_IN_S / (elapsed ? elapsed : 1);
+}
+
+int main(int argc, char **argv)
+{
+	static struct eblob_config bcfg;
+	static struct eblob_log logger;
+	static char log_path[PATH_MAX], blob_path[PATH_MAX];
+	double rps, base_rps = 0;
+	char *data, key[32];
+	long long i;
+	long threads;
+	int ch, error;
+
+	cfg.blob_flags = DEFAULT_BLOB_FLAGS;
+	cfg.items = DEFAULT_ITEMS;
+	cfg.item_size = DEFAULT_ITEM_SIZE;
+	cfg.reads = DEFAULT_READS;
+	cfg.threads = DEFAULT_THREADS;
+	cfg.path = DEFAULT_PATH;
+
+	while ((ch = getopt(argc, argv, "cF:hi:I:p:r:T:")) != -1) {
+		switch (ch) {
+		case 'c':
+			cfg.nocsum = 1;
+			break;
+		case 'F':
+			cfg.blob_flags = strtoll(optarg, NULL, 0);
+			break;
+		case 'i':
+			cfg.items = strtoll(optarg, NULL, 0);
+			break;
+		case 'I':
+			cfg.item_size = strtoll(optarg, NULL, 0);
+			break;
+		case 'p':
+			cfg.path = optarg;
+			break;
+		case 'r':
+			cfg.reads = strtoll(optarg, NULL, 0);
+			break;
+		case 'T':
+			cfg.threads = strtol(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0], EX_OK);
+		default:
+			usage(argv[0], EX_USAGE);
+		}
+	}
+
+	if (cfg.items <= 0 || cfg.item_size <= 0 || cfg.reads <= 0 || cfg.threads <= 0)
+		usage(argv[0], EX_USAGE);
+
+	snprintf(log_path, PATH_MAX, "%s/%s", cfg.path, "bench.log");
+	snprintf(blob_path, PATH_MAX, "%s/%s", cfg.path, "bench-blob");
+
+	logger.log_level = EBLOB_LOG_ERROR;
+	logger.log = eblob_log_raw_formatted;
+	if ((logger.log_private = fopen(log_path, "a")) == NULL)
+		err(EX_OSFILE, "fopen: %s", log_path);
+
+	bcfg.blob_flags = cfg.blob_flags | EBLOB_DISABLE_THREADS | EBLOB_NO_FREE_SPACE_CHECK;
+	bcfg.file = blob_path;
+	bcfg.log = &logger;
+	bcfg.sync = -1;
+	cfg.b = eblob_init(&bcfg);
+	if (cfg.b == NULL)
+		errx(EX_OSERR, "eblob_init");
+
+	/* Remove all data that may belong to previous run */
+	eblob_remove_blobs(cfg.b);
+	eblob_cleanup(cfg.b);
+
+	cfg.b = eblob_init(&bcfg);
+	if (cfg.b == NULL)
+		errx(EX_OSERR, "eblob_init");
+
+	cfg.keys = calloc(cfg.items, sizeof(struct eblob_key));
+	data = malloc(cfg.item_size);
+	if (cfg.keys == NULL || data == NULL)
+		err(EX_OSERR, "malloc");
+	memset(data, 0xa5, cfg.item_size);
+
+	warnx("populating: items: %lld, item_size: %lld", cfg.items, cfg.item_size);
+	for (i = 0; i < cfg.items; ++i) {
+		snprintf(key, sizeof(key), "bench-%lld", i);
+		eblob_hash(cfg.b, cfg.keys[i].id, sizeof(cfg.keys[i].id), key, strlen(key));
+		error = eblob_write(cfg.b, &cfg.keys[i], data, 0, cfg.item_size, 0);
+		if (error != 0)
+			errx(EX_SOFTWARE, "eblob_write: %lld: %d", i, error);
+	}
+
+	for (threads = 1; threads <= cfg.threads; threads *= 2) {
+		rps = bench_run(threads);
+		if (threads == 1)
+			base_rps = rps;
+		printf("threads: %3ld, reads: %10lld, rps: %12.0f, scaling: %6.2f\n",
+				threads, cfg.reads * threads, rps, rps / base_rps);
+		fflush(stdout);
+	}
+
+	if (cfg.errors)
+		warnx("read errors: %ld", cfg.errors);
+
+	eblob_remove_blobs(cfg.b);
+	eblob_cleanup(cfg.b);
+	free(cfg.keys);
+	free(data);
+	fclose(logger.log_private);
+
+	return cfg.errors ? EX_SOFTWARE : EX_OK;
+}
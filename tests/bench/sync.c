@@ -0,0 +1,262 @@
+/*
+ * This file is part of Eblob.
+ *
+ * Eblob is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Eblob is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Eblob.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Durable write benchmark.
+ *
+ * Opens blob with sync == 0, so every write is synced, and writes random keys
+ * from 1, 2, 4, ... @threads threads printing throughput, scaling relative to
+ * single-threaded run, average number of writes per group commit and number
+ * of write syscalls per record.
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "eblob/blob.h"
+#include "../../library/blob.h"
+
+#define BENCH_NS_IN_S		(1000LL * 1000LL * 1000LL)
+
+#define DEFAULT_BLOB_FLAGS	(0)
+#define DEFAULT_ITEMS		(10000)
+#define DEFAULT_ITEM_SIZE	(4096)
+#define DEFAULT_WRITES		(1000)
+#define DEFAULT_THREADS		(32)
+#define DEFAULT_PATH		"./"
+
+struct bench_cfg {
+	long long		blob_flags;	/* Passed to cfg.blob_flags */
+	long long		items;		/* Number of distinct keys */
+	long long		item_size;	/* Size of each record */
+	long long		writes;		/* Number of writes per thread */
+	long			threads;	/* Max number of writer threads */
+	long			nosync;		/* Write with BLOB_DISK_CTL_NOSYNC */
+	char			*path;		/* Path to test directory */
+
+	struct eblob_backend	*b;
+	struct eblob_key	*keys;
+	char			*data;
+	long			errors;
+};
+
+static struct bench_cfg cfg;
+
+struct bench_thread {
+	int		tid;
+	unsigned int	seed;
+	long		errors;
+};
+
+static void usage(const char *progname, int eval)
+{
+	fprintf(stderr, "Usage: %s [-n] [-F blob_flags] [-i items] [-I item_size] "
+			"[-p path] [-w writes_per_thread] [-T threads]\n", progname);
+	exit(eval);
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * BENCH_NS_IN_S + ts.tv_nsec;
+}
+
+static void *bench_thread(void *priv)
+{
+	struct bench_thread *t = priv;
+	const uint64_t flags = cfg.nosync ? BLOB_DISK_CTL_NOSYNC : 0;
+	long long i;
+	int err;
+
+	for (i = 0; i < cfg.writes; ++i) {
+		struct eblob_key *key = &cfg.keys[rand_r(&t->seed) % cfg.items];
+
+		err = eblob_write(cfg.b, key, cfg.data, 0, cfg.item_size, flags);
+		if (err != 0)
+			t->errors++;
+	}
+
+	return NULL;
+}
+
+/* Runs @threads writers and returns writes per second */
+static double bench_run(long threads)
+{
+	pthread_t *tids;
+	struct bench_thread *t;
+	long long start, elapsed;
+	long i;
+	int error;
+
+	tids = calloc(threads, sizeof(pthread_t));
+	t = calloc(threads, sizeof(struct bench_thread));
+	if (tids == NULL || t == NULL)
+		err(EX_OSERR, "calloc");
+
+	start = now_ns();
+	for (i = 0; i < threads; ++i) {
+		t[i].tid = i;
+		t[i].seed = i + 1;
+		error = pthread_create(&tids[i], NULL, bench_thread, &t[i]);
+		if (error != 0)
+			errx(EX_OSERR, "pthread_create: %d", error);
+	}
+	for (i = 0; i < threads; ++i) {
+		pthread_join(tids[i], NULL);
+		cfg.errors += t[i].errors;
+	}
+	elapsed = now_ns() - start;
+
+	free(tids);
+	free(t);
+
+	return (double)cfg.writes * threads * BENCH_NS_IN_S / (elapsed ? elapsed : 1);
+}
+
+int main(int argc, char **argv)
+{
+	static struct eblob_config bcfg;
+	static struct eblob_log logger;
+	static char log_path[PATH_MAX], blob_path[PATH_MAX];
+	double wps, base_wps = 0;
+	int64_t commits, waiters, syscalls;
+	char key[32];
+	long long i;
+	long threads;
+	int ch;
+
+	cfg.blob_flags = DEFAULT_BLOB_FLAGS;
+	cfg.items = DEFAULT_ITEMS;
+	cfg.item_size = DEFAULT_ITEM_SIZE;
+	cfg.writes = DEFAULT_WRITES;
+	cfg.threads = DEFAULT_THREADS;
+	cfg.path = DEFAULT_PATH;
+
+	while ((ch = getopt(argc, argv, "F:hi:I:np:T:w:")) != -1) {
+		switch (ch) {
+		case 'F':
+			cfg.blob_flags = strtoll(optarg, NULL, 0);
+			break;
+		case 'i':
+			cfg.items = strtoll(optarg, NULL, 0);
+			break;
+		case 'I':
+			cfg.item_size = strtoll(optarg, NULL, 0);
+			break;
+		case 'n':
+			cfg.nosync = 1;
+			break;
+		case 'p':
+			cfg.path = optarg;
+			break;
+		case 'T':
+			cfg.threads = strtol(optarg, NULL, 0);
+			break;
+		case 'w':
+			cfg.writes = strtoll(optarg, NULL, 0);
+			break;
+		case 'h':
+			usage(argv[0], EX_OK);
+		default:
+			usage(argv[0], EX_USAGE);
+		}
+	}
+
+	if (cfg.items <= 0 || cfg.item_size <= 0 || cfg.writes <= 0 || cfg.threads <= 0)
+		usage(argv[0], EX_USAGE);
+
+	snprintf(log_path, PATH_MAX, "%s/%s", cfg.path, "bench.log");
+	snprintf(blob_path, PATH_MAX, "%s/%s", cfg.path, "bench-blob");
+
+	logger.log_level = EBLOB_LOG_ERROR;
+	logger.log = eblob_log_raw_formatted;
+	if ((logger.log_private = fopen(log_path, "a")) == NULL)
+		err(EX_OSFILE, "fopen: %s", log_path);
+
+	bcfg.blob_flags = cfg.blob_flags | EBLOB_DISABLE_THREADS | EBLOB_NO_FREE_SPACE_CHECK;
+	bcfg.file = blob_path;
+	bcfg.log = &logger;
+	bcfg.sync = 0;
+	cfg.b = eblob_init(&bcfg);
+	if (cfg.b == NULL)
+		errx(EX_OSERR, "eblob_init");
+
+	/* Remove all data that may belong to previous run */
+	eblob_remove_blobs(cfg.b);
+	eblob_cleanup(cfg.b);
+
+	cfg.b = eblob_init(&bcfg);
+	if (cfg.b == NULL)
+		errx(EX_OSERR, "eblob_init");
+
+	cfg.keys = calloc(cfg.items, sizeof(struct eblob_key));
+	cfg.data = malloc(cfg.item_size);
+	if (cfg.keys == NULL || cfg.data == NULL)
+		err(EX_OSERR, "malloc");
+	memset(cfg.data, 0xa5, cfg.item_size);
+
+	for (i = 0; i < cfg.items; ++i) {
+		snprintf(key, sizeof(key), "bench-%lld", i);
+		eblob_hash(cfg.b, cfg.keys[i].id, sizeof(cfg.keys[i].id), key, strlen(key));
+	}
+
+	for (threads = 1; threads <= cfg.threads; threads *= 2) {
+		commits = eblob_stat_get(cfg.b->stat, EBLOB_GST_GROUP_COMMITS);
+		waiters = eblob_stat_get(cfg.b->stat, EBLOB_GST_GROUP_COMMIT_WAITERS);
+		syscalls = eblob_stat_get(cfg.b->stat, EBLOB_GST_WRITE_SYSCALLS);
+
+		wps = bench_run(threads);
+		if (threads == 1)
+			base_wps = wps;
+
+		commits = eblob_stat_get(cfg.b->stat, EBLOB_GST_GROUP_COMMITS) - commits;
+		waiters = eblob_stat_get(cfg.b->stat, EBLOB_GST_GROUP_COMMIT_WAITERS) - waiters;
+		syscalls = eblob_stat_get(cfg.b->stat, EBLOB_GST_WRITE_SYSCALLS) - syscalls;
+		printf("threads: %3ld, writes: %10lld, wps: %12.0f, scaling: %6.2f, waiters per commit: %6.2f"
+				", syscalls per write: %5.2f\n",
+				threads, cfg.writes * threads, wps, wps / base_wps,
+				commits ? (double)waiters / commits : 0,
+				(double)syscalls / (cfg.writes * threads));
+		fflush(stdout);
+	}
+
+	if (cfg.errors)
+		warnx("write errors: %ld", cfg.errors);
+
+	eblob_remove_blobs(cfg.b);
+	eblob_cleanup(cfg.b);
+	free(cfg.keys);
+	free(cfg.data);
+	fclose(logger.log_private);
+
+	return cfg.errors ? EX_SOFTWARE : EX_OK;
+}
@@ -57,6 +57,37 @@ class eblob_test {
 			}
 		}
 
+		void fill_batch(const std::vector<std::string>& prefixes)
+		{
+			std::vector<struct eblob_key> keys;
+			std::vector<std::string> data;
+
+			for (int i = 0; i < m_iterations; ++i) {
+				std::ostringstream value;
+				value << "Batch item: " << i;
+
+				for(std::vector<std::string>::const_iterator p = prefixes.begin();
+						p != prefixes.end(); ++p) {
+					std::ostringstream key;
+					struct eblob_key ekey;
+
+					key << *p << m_key_base << i;
+					m_blob->key(key.str(), ekey);
+					keys.push_back(ekey);
+					data.push_back(value.str());
+				}
+			}
+
+			std::vector<int> errors = m_blob->write_batch(keys, data);
+			for (size_t i = 0; i < errors.size(); ++i) {
+				if (errors[i]) {
+					std::ostringstream str;
+					str << "Batch write failed for key #" << i << ": " << errors[i];
+					throw std::runtime_error(str.str());
+				}
+			}
+		}
+
 		void check(const std::vector<std::string>& prefixes)
 		{
 			static const uint64_t offset = 0;
@@ -85,6 +116,58 @@ class eblob_test {
 			}
 		}
 
+		void check_multi(const std::vector<std::string>& prefixes)
+		{
+			std::vector<struct eblob_key> keys;
+			std::vector<std::string> names, data;
+
+			for (int i = 0; i < m_iterations; ++i) {
+				for (std::vector<std::string>::const_iterator p = prefixes.begin();
+						p != prefixes.end(); ++p) {
+					std::ostringstream key;
+					struct eblob_key ekey;
+
+					key << *p << m_key_base << i;
+					m_blob->key(key.str(), ekey);
+					keys.push_back(ekey);
+					names.push_back(key.str());
+				}
+			}
+
+			std::vector<int> errors = m_blob->read_multi(keys, data);
+			for (size_t i = 0; i < errors.size(); ++i) {
+				if (errors[i] || data[i] != m_blob->read_hashed(names[i], 0, 0)) {
+					std::ostringstream str;
+					str << "Multi read failed for key '" << names[i] << "': " << errors[i];
+					throw std::runtime_error(str.str());
+				}
+			}
+		}
+
+		void check_into(const std::vector<std::string>& prefixes)
+		{
+			std::vector<char> buf(4096);
+
+			for (int i = 0; i < m_iterations; ++i) {
+				for (std::vector<std::string>::const_iterator p = prefixes.begin();
+						p != prefixes.end(); ++p) {
+					std::ostringstream key;
+					struct eblob_key ekey;
+
+					key << *p << m_key_base << i;
+					m_blob->key(key.str(), ekey);
+
+					const uint64_t size = m_blob->read(ekey, 0, buf.data(), buf.size());
+					if (std::string(buf.data(), size) != m_blob->read_hashed(key.str(), 0, 0)) {
+						std::ostringstream str;
+
+						str << "Data mismatch for key '" << key.str() << "' read into buffer";
+						throw std::runtime_error(str.str());
+					}
+				}
+			}
+		}
+
 		void remove(int start, const std::vector<std::string>& prefixes)
 		{
 			for (int i = start; i < m_iterations; ++i) {
@@ -127,6 +210,9 @@ int main()
 	static const std::string key_base = "test-";
 	static const char* prefix_list[] = {"1_", "2_", "3_", "4_"};
 	static const std::vector<std::string> prefixes(prefix_list, prefix_list + sizeof(prefix_list)/sizeof(prefix_list[0]));
+	static const char* batch_prefix_list[] = {"5_", "6_"};
+	static const std::vector<std::string> batch_prefixes(batch_prefix_list,
+			batch_prefix_list + sizeof(batch_prefix_list)/sizeof(batch_prefix_list[0]));
 	static const int iterations = 1000, timeout = 10;
 
 	std::cout << "Tests started." << std::endl;
@@ -138,6 +224,17 @@ int main()
 		//Check
 		t.check(prefixes);
 
+		// Batch write
+		t.fill_batch(batch_prefixes);
+		t.check(batch_prefixes);
+
+		// Multi read
+		t.check_multi(prefixes);
+		t.check_multi(batch_prefixes);
+
+		// Read into buffer
+		t.check_into(prefixes);
+
 		// Fragment
 		t.remove(iterations / 4, prefixes);
 
@@ -147,6 +244,8 @@ int main()
 
 		// Recheck after defrag
 		t.check(prefixes);
+		t.check(batch_prefixes);
+		t.check_multi(prefixes);
 	} catch (const std::exception &e) {
 		std::cerr << "Got an exception: " << e.what() << std::endl;
 		exit(EXIT_FAILURE);
@@ -23,6 +23,19 @@ for i in range(0,5):
 
 print e.elements()
 
+ids = [eblob_id([i] * 64) for i in range(0, 5)]
+batch = ["batch%d" % i for i in range(0, 5)]
+errors = e.write_batch(ids, batch, 0)
+print errors
+assert errors == [0] * len(ids)
+for i in range(0, 5):
+	assert e.read(ids[i], 0, 0) == batch[i]
+data = e.read_multi(ids + [eblob_id([0xff] * 64)])
+print data
+assert data == batch + [None]
+
+print e.elements()
+
 iterator = my_iter()
 iterator.use_index = 1;
 
@@ -12,6 +12,7 @@ $(find . -name eblob_cpp_test)
 # Run unit tests
 $(find . -name eblob_crypto_test)
 $(find . -name eblob_corruption_test)
+$(find . -name eblob_api_test)
 
 # Big and small stress tests
 $(find . -name eblob_stress) -m0 -f1000 -D0 -I300000 -o20000 -i1000 -l4 -r 1000 -S10 -F87
@@ -25,3 +26,47 @@ $(find . -name eblob_stress) -m0 -f1000 -D0 -I300000 -o20000 -i1000 -l4 -r 1000
 # Overwrite-heavy test with many bases and threads
 $(find . -name eblob_stress) -f1000 -D0 -I100000 -i64 -r 40 -S10 -F64 -T32 -l4 -o 0
 $(find . -name eblob_stress) -f1000 -D0 -I100000 -i64 -r 40 -S10 -F2112 -T32 -l4 -o 0
+
+# Open-addressing in-memory index
+$(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l4 -r 100 -S100 -F6144
+
+# Frequent reopens release and refill slabs of rb-tree in-memory index
+$(find . -name eblob_stress) -f1000 -D0 -I100000 -i1000 -r 100 -S10 -F2048 -T32 -l4 -o 5000
+
+# Packed in-memory index entries
+$(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l4 -r 100 -S100 -F10240
+
+# Record metadata cached in in-memory index
+$(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l4 -r 100 -S100 -F18432
+
+# Several active bases
+$(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l4 -r 100 -S100 -F2048 -a4
+
+# Durable writes and removes from many threads are group committed
+$(find . -name eblob_stress) -f1000 -D0 -I100000 -i64 -r 40 -S10 -F2112 -T32 -l4 -o 0 -y0
+
+# Asynchronous requests executed with io_uring
+$(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l4 -r 100 -S100 -F34816
+
+# Big records are written and read with O_DIRECT
+$(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l4 -r 100 -S10000 -F2048 -j4096
+
+# Active bases are preallocated in background
+$(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l4 -r 100 -S100 -F2048 -e1048576
+
+# Next base is created in background ahead of rollover
+$(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l4 -r 100 -S100 -F2048 -w50
+
+# Appends are written as chained extents
+$(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l4 -r 100 -S100 -F2048 -c1
+
+# Compression with LZ4, zstd and zstd with dictionaries trained by data-sort
+$(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l4 -r 100 -S2000 -F67584
+$(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l4 -r 100 -S2000 -F133120
+$(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l4 -r 100 -S2000 -F395264
+
+# Removes are recorded in tombstone journal
+$(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l4 -r 100 -S100 -F526336
+
+# Small records are coalesced in write buffer
+$(find . -name eblob_stress) -m0 -f100 -D0 -I30000 -o2000 -i100 -l4 -r 100 -S100 -F2048 -W65536
@@ -45,11 +45,11 @@ void
 options_usage(char *progname, int eval, FILE *stream)
 {
 	fprintf(stream, "usage: %s ", progname);
-	fprintf(stream, "[-d defrag_time] [-D delay ] [-f force_defrag] [-F eblob_flags] ");
+	fprintf(stream, "[-a active_bases] [-d defrag_time] [-D delay ] [-e prealloc_size] [-w spare_base_threshold] [-W wbuf_size] [-f force_defrag] [-F eblob_flags] [-j direct_io_threshold] ");
 	fprintf(stream, "[-i test_items] [-I iterations] [-b block size] ");
 	fprintf(stream, "[-l log_level] [-m milestone] [-o reopen] [-p path] [-r blob_records] ");
 	fprintf(stream, "[-R random_seed] [-s blob_size] [-S item_size] [-t iterator_threads] ");
-	fprintf(stream, "[-T test_threads] [-y sync_time] [-P use_datasort_dir]");
+	fprintf(stream, "[-T test_threads] [-y sync_time] [-P use_datasort_dir] [-c chained]");
 	fprintf(stream, "\n");
 
 	exit(eval);
@@ -84,6 +84,11 @@ options_set_defaults(void)
 {
 
 	memset(&cfg, 0, sizeof(cfg));
+	cfg.blob_active_bases = DEFAULT_BLOB_ACTIVE_BASES;
+	cfg.blob_direct_io = DEFAULT_BLOB_DIRECT_IO;
+	cfg.blob_prealloc = DEFAULT_BLOB_PREALLOC;
+	cfg.blob_spare = DEFAULT_BLOB_SPARE;
+	cfg.blob_wbuf = DEFAULT_BLOB_WBUF;
 	cfg.blob_flags = DEFAULT_BLOB_FLAGS;
 	cfg.blob_defrag = DEFAULT_BLOB_DEFRAG;
 	cfg.blob_records = DEFAULT_BLOB_RECORDS;
@@ -99,6 +104,7 @@ options_set_defaults(void)
 	cfg.test_reopen = DEFAULT_TEST_REOPEN;
 	cfg.test_rnd_seed = (long long)time(NULL);
 	cfg.test_threads = DEFAULT_TEST_THREADS;
+	cfg.test_chained = DEFAULT_TEST_CHAINED;
 	cfg.use_datasort_dir = 0;
 
 	if ((cfg.test_path = strdup(DEFAULT_TEST_PATH)) == NULL)
@@ -112,13 +118,19 @@ options_get(int argc, char **argv)
 {
 	int ch;
 	struct option longopts[] = {
+		{ "blob-active-bases",	required_argument,	NULL,		'a' },
 		{ "blob-flags",		required_argument,	NULL,		'F' },
 		{ "blob-defrag",	required_argument,	NULL,		'd' },
+		{ "blob-direct-io",	required_argument,	NULL,		'j' },
+		{ "blob-prealloc",	required_argument,	NULL,		'e' },
+		{ "blob-spare",		required_argument,	NULL,		'w' },
+		{ "blob-wbuf",		required_argument,	NULL,		'W' },
 		{ "blob-records",	required_argument,	NULL,		'r' },
 		{ "blob-size",		required_argument,	NULL,		's' },
 		{ "blob-sync",		required_argument,	NULL,		'y' },
 		{ "blob-threads",	required_argument,	NULL,		't' },
 		{ "test-threads",	required_argument,	NULL,		'T' },
+		{ "test-chained",	required_argument,	NULL,		'c' },
 		{ "help",		no_argument,		NULL,		'h' },
 		{ "log-level",		required_argument,	NULL,		'l' },
 		{ "test-delay",		required_argument,	NULL,		'D' },
@@ -136,11 +148,29 @@ options_get(int argc, char **argv)
 	};
 
 	opterr = 0;
-	while ((ch = getopt_long(argc, argv, "d:D:f:F:hi:I:l:m:o:p:P:r:R:s:S:t:T:vy:", longopts, NULL)) != -1) {
+	while ((ch = getopt_long(argc, argv, "a:c:d:D:e:f:F:hi:I:j:l:m:o:p:P:r:R:s:S:t:T:vw:W:y:", longopts, NULL)) != -1) {
 		switch(ch) {
+		case 'a':
+			options_get_l(&cfg.blob_active_bases, optarg);
+			break;
+		case 'c':
+			options_get_l(&cfg.test_chained, optarg);
+			break;
 		case 'd':
 			options_get_l(&cfg.blob_defrag, optarg);
 			break;
+		case 'j':
+			options_get_ll(&cfg.blob_direct_io, optarg);
+			break;
+		case 'e':
+			options_get_ll(&cfg.blob_prealloc, optarg);
+			break;
+		case 'w':
+			options_get_l(&cfg.blob_spare, optarg);
+			break;
+		case 'W':
+			options_get_ll(&cfg.blob_wbuf, optarg);
+			break;
 		case 'D':
 			options_get_l(&cfg.test_delay, optarg);
 			break;
@@ -212,6 +242,11 @@ options_dump(void)
 	printf("Stress version: v" EBLOB_TEST_VERSION "\n");
 	printf("\n");
 	printf("Flags: %s\n", eblob_dump_blob_flags(cfg.blob_flags));
+	printf("Number of active bases: %ld\n", cfg.blob_active_bases);
+	printf("Direct I/O threshold: %lld\n", cfg.blob_direct_io);
+	printf("Preallocation size: %lld\n", cfg.blob_prealloc);
+	printf("Spare base threshold: %ld\n", cfg.blob_spare);
+	printf("Write buffer size: %lld\n", cfg.blob_wbuf);
 	printf("Defrag timeout in seconds: %ld\n", cfg.blob_defrag);
 	printf("Maximum number of records per base: %lld\n", cfg.blob_records);
 	printf("Maximum size of base in bytes: %lld\n", cfg.blob_size);
@@ -226,6 +261,7 @@ options_dump(void)
 	printf("Close and open blob: %lld\n", cfg.test_reopen);
 	printf("Random seed: %lld\n", cfg.test_rnd_seed);
 	printf("Test threads num: %ld\n", cfg.test_threads);
+	printf("Chained appends: %ld\n", cfg.test_chained);
 	printf("Test path: %s\n", cfg.test_path);
 	printf("Use datasort dir: %ld\n", cfg.use_datasort_dir);
 	printf("\n");
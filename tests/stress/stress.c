@@ -60,6 +60,8 @@ humanize_flags(int flags, char *buf)
 		strcat(buf, "nocsum,");
 	if (flags & BLOB_DISK_CTL_APPEND)
 		strcat(buf, "append,");
+	if (flags & BLOB_DISK_CTL_CHAINED)
+		strcat(buf, "chained,");
 
 	assert(strlen(buf) >= 1);
 
@@ -233,6 +235,9 @@ item_check(struct shadow *item, struct eblob_backend *b)
 		/* Unknown read type */
 		abort();
 	}
+	/* Compressed record can be read only into buffer */
+	if (error == -ENOTSUP && (cfg.blob_flags & (EBLOB_COMPRESS_LZ4 | EBLOB_COMPRESS_ZSTD)))
+		error = eblob_read_data(b, &item->ekey, 0, (char **)&data, &size);
 	if (item->flags & BLOB_DISK_CTL_REMOVE) {
 		/* Item is removed and read MUST fail */
 		if (error == 0) {
@@ -291,6 +296,8 @@ item_generate_random(struct shadow *item, struct eblob_backend *b)
 		item->flags = generate_random_flags(FLAG_TYPE_REMOVED);
 	else
 		item->flags = generate_random_flags(FLAG_TYPE_EXISTING);
+	if (cfg.test_chained && (item->flags & BLOB_DISK_CTL_APPEND))
+		item->flags |= BLOB_DISK_CTL_CHAINED;
 	humanize_flags(item->flags, item->hflags);
 
 	/*
@@ -326,6 +333,9 @@ item_generate_random(struct shadow *item, struct eblob_backend *b)
 		 */
 		if (old_item.flags & BLOB_DISK_CTL_REMOVE)
 			item->offset = 0;
+		/* Chained records can only be overwritten as a whole */
+		else if (cfg.test_chained)
+			item->offset = 0;
 		else
 			item->offset = random() % item->size;
 		/*
@@ -544,6 +554,20 @@ struct iterate_private {
 
 };
 
+/*
+ * Reads chain header of a chained record at @offset
+ */
+static int
+iterate_read_chain(int fd, uint64_t offset, struct eblob_chain_header *chain)
+{
+	if (pread(fd, chain, sizeof(*chain), offset) != sizeof(*chain))
+		return -EIO;
+	eblob_convert_chain_header(chain);
+	if (chain->num == 0 || chain->num > EBLOB_CHAIN_EXTENTS_MAX)
+		return -EINVAL;
+	return 0;
+}
+
 /*
  * Callback function that will be passed to iteration.
  * It will be called for each found key from iteration ranges.
@@ -555,6 +579,8 @@ static int iterate_callback(struct eblob_disk_control *dc,
                             struct eblob_ram_control *rctl __attribute_unused__,
                             int fd, uint64_t data_offset, void *priv, void *thread_priv __attribute_unused__) {
 	struct iterate_private *ipriv = (struct iterate_private*)priv;
+	struct eblob_chain_header chain;
+	uint64_t data_size;
 	int i, error;
 
 	assert (dc != NULL);
@@ -576,16 +602,59 @@ static int iterate_callback(struct eblob_disk_control *dc,
 					errx(EX_SOFTWARE, "key is supposed to exist: %s (%s), flags: %s, error: %d",
 					    item->item->key, eblob_dump_id(item->item->ekey.id), item->item->hflags, -ENOENT);
 				}
-				if (item->item->size != dc->data_size) {
+				/* Iterators get compressed payload, so record is read back uncompressed */
+				if (dc->flags & BLOB_DISK_CTL_COMPRESSED) {
+					char *raw;
+					uint64_t raw_size = 0;
+
+					error = eblob_read_data(ipriv->cfg->b, &dc->key, 0, &raw, &raw_size);
+					if (error != 0) {
+						errx(EX_SOFTWARE, "read of compressed record has been failed for: %s (%s), error: %d",
+						     item->item->key, eblob_dump_id(item->item->ekey.id), -error);
+					}
+					if (raw_size != item->item->size || memcmp(raw, item->item->value, raw_size) != 0) {
+						errx(EX_SOFTWARE, "data verification has been failed for: %s (%s), flags: %s",
+						    item->item->key, eblob_dump_id(item->item->ekey.id), item->item->hflags);
+					}
+					free(raw);
+					item->checked = 1;
+					break;
+				}
+				if (dc->flags & BLOB_DISK_CTL_CHAINED) {
+					error = iterate_read_chain(fd, data_offset, &chain);
+					if (error != 0) {
+						errx(EX_SOFTWARE, "chain header read has been failed for: %s (%s), error: %d",
+						     item->item->key, eblob_dump_id(item->item->ekey.id), -error);
+					}
+					data_size = chain.size;
+				} else {
+					data_size = dc->data_size;
+				}
+				if (item->item->size != data_size) {
 					errx(EX_SOFTWARE, "size mismatch for key: %s (%s): "
 						"stored: %" PRIu64 ", current: %" PRIu64,
 						item->item->key, eblob_dump_id(item->item->ekey.id),
-						item->item->size, dc->data_size);
+						item->item->size, data_size);
 				}
 				assert(item->item->size > 0);
 				void *data = malloc(item->item->size);
 				assert(data);
-				error = pread(fd, data, item->item->size, data_offset);
+				if (dc->flags & BLOB_DISK_CTL_CHAINED) {
+					uint64_t j, done = 0;
+
+					for (j = 0; j < chain.num && done < chain.size; ++j) {
+						uint64_t size = chain.ext[j].size;
+
+						if (size > chain.size - done)
+							size = chain.size - done;
+						error = pread(fd, data + done, size, chain.ext[j].position);
+						if (error == -1)
+							break;
+						done += size;
+					}
+				} else {
+					error = pread(fd, data, item->item->size, data_offset);
+				}
 				if (error == -1) {
 					errx(EX_SOFTWARE, "pread has been failed for: %s (%s), flags: %s, error: %d",
 					     item->item->key, eblob_dump_id(item->item->ekey.id), item->item->hflags, errno);
@@ -817,6 +886,11 @@ main(int argc, char **argv)
 		err(EX_OSFILE, "fopen: %s", log_path);
 
 	/* Init eblob */
+	bcfg.active_bases = cfg.blob_active_bases;
+	bcfg.direct_io_threshold = cfg.blob_direct_io;
+	bcfg.prealloc_size = cfg.blob_prealloc;
+	bcfg.spare_base_threshold = cfg.blob_spare;
+	bcfg.wbuf_size = cfg.blob_wbuf;
 	bcfg.blob_flags = cfg.blob_flags;
 	bcfg.blob_size = cfg.blob_size;
 	bcfg.defrag_timeout = cfg.blob_defrag;
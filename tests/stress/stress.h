@@ -64,6 +64,12 @@ enum rnd_flags_types {
  * Test configuration
  */
 struct test_cfg {
+	long		blob_active_bases;	/* Number of bases written to
+						   simultaneously */
+	long long	blob_direct_io;		/* Passed to cfg.direct_io_threshold */
+	long long	blob_prealloc;		/* Passed to cfg.prealloc_size */
+	long		blob_spare;		/* Passed to cfg.spare_base_threshold */
+	long long	blob_wbuf;		/* Passed to cfg.wbuf_size */
 	long long	blob_flags;		/* Passed to cfg.eblob_flags */
 	long		blob_defrag;		/* Defrag timeout in seconds */
 	long long	blob_records;		/* Number of records in base */
@@ -88,6 +94,7 @@ struct test_cfg {
 	long long	test_rnd_seed;		/* Random seed for reproducible
 						   test-cases */
 	long		test_threads;		/* Number of test threads */
+	long		test_chained;		/* Append with chained extents */
 
 	/* Internal structures follow */
 	sig_atomic_t		need_exit;	/* SIGINT caught */
@@ -114,6 +121,11 @@ struct test_thread_cfg {
 /*
  * Defaults for test_cfg above
  */
+#define DEFAULT_BLOB_ACTIVE_BASES	(1)
+#define DEFAULT_BLOB_DIRECT_IO		(0)
+#define DEFAULT_BLOB_PREALLOC		(0)
+#define DEFAULT_BLOB_SPARE		(0)
+#define DEFAULT_BLOB_WBUF		(0)
 #define DEFAULT_BLOB_FLAGS		(0)
 #define DEFAULT_BLOB_DEFRAG		(10)
 #define DEFAULT_BLOB_DEFRAG_TIME	(4)
@@ -131,6 +143,7 @@ struct test_thread_cfg {
 #define DEFAULT_TEST_PATH		"./"
 #define DEFAULT_TEST_REOPEN		(0)
 #define DEFAULT_TEST_THREADS		(16)
+#define DEFAULT_TEST_CHAINED		(0)
 
 void options_get_l(long *cfg_entry, const char *optarg);
 void options_get_ll(long long *cfg_entry, const char *optarg);
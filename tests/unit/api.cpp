@@ -0,0 +1,344 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE API library test
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include "library/blob.h"
+
+#include "wrapper.hpp"
+
+static void test_exists(unsigned int flags) {
+	eblob_wrapper wrapper(flags);
+	BOOST_REQUIRE(wrapper.get() != nullptr);
+
+	auto key = hash("some key");
+	auto prepared_key = hash("prepared key");
+	auto removed_key = hash("removed key");
+	constexpr char data[] = "some data";
+	uint64_t size = 0;
+
+	BOOST_REQUIRE_EQUAL(eblob_exists(wrapper.get(), &key, &size), -ENOENT);
+
+	BOOST_REQUIRE_EQUAL(eblob_write(wrapper.get(), &key, (void *)data, /*offset*/ 0, sizeof(data), /*flags*/ 0), 0);
+	BOOST_REQUIRE_EQUAL(eblob_exists(wrapper.get(), &key, &size), 0);
+	BOOST_REQUIRE_EQUAL(size, sizeof(data));
+	// @size is optional
+	BOOST_REQUIRE_EQUAL(eblob_exists(wrapper.get(), &key, nullptr), 0);
+
+	// uncommitted record does not exist until it's committed
+	BOOST_REQUIRE_EQUAL(eblob_write_prepare(wrapper.get(), &prepared_key, sizeof(data), /*flags*/ 0), 0);
+	BOOST_REQUIRE_EQUAL(eblob_exists(wrapper.get(), &prepared_key, &size), -ENOENT);
+	BOOST_REQUIRE_EQUAL(eblob_plain_write(wrapper.get(), &prepared_key, (void *)data, /*offset*/ 0, sizeof(data),
+	                                      /*flags*/ 0), 0);
+	BOOST_REQUIRE_EQUAL(eblob_write_commit(wrapper.get(), &prepared_key, sizeof(data), /*flags*/ 0), 0);
+	BOOST_REQUIRE_EQUAL(eblob_exists(wrapper.get(), &prepared_key, &size), 0);
+	BOOST_REQUIRE_EQUAL(size, sizeof(data));
+
+	BOOST_REQUIRE_EQUAL(eblob_write(wrapper.get(), &removed_key, (void *)data, /*offset*/ 0, sizeof(data), /*flags*/ 0), 0);
+	BOOST_REQUIRE_EQUAL(eblob_remove(wrapper.get(), &removed_key), 0);
+	BOOST_REQUIRE_EQUAL(eblob_exists(wrapper.get(), &removed_key, &size), -ENOENT);
+
+	wrapper.restart();
+	BOOST_REQUIRE(wrapper.get() != nullptr);
+
+	BOOST_REQUIRE_EQUAL(eblob_exists(wrapper.get(), &key, &size), 0);
+	BOOST_REQUIRE_EQUAL(size, sizeof(data));
+	BOOST_REQUIRE_EQUAL(eblob_exists(wrapper.get(), &prepared_key, &size), 0);
+	BOOST_REQUIRE_EQUAL(size, sizeof(data));
+	BOOST_REQUIRE_EQUAL(eblob_exists(wrapper.get(), &removed_key, &size), -ENOENT);
+}
+
+BOOST_AUTO_TEST_CASE(test_exists_default) {
+	test_exists(0);
+}
+
+BOOST_AUTO_TEST_CASE(test_exists_cache_meta) {
+	/* with EBLOB_CACHE_META existence is checked by in-memory index only */
+	test_exists(EBLOB_CACHE_META);
+}
+
+struct async_result {
+	std::promise<std::pair<int, uint64_t>> promise;
+
+	static void complete(struct eblob_key *, int err, uint64_t size, void *priv) {
+		static_cast<async_result *>(priv)->promise.set_value(std::make_pair(err, size));
+	}
+};
+
+/*
+ * Records written with BLOB_DISK_CTL_CHAINED in @write_flags are appended in
+ * two parts, so their data is split between extents.
+ */
+static void test_read_async(unsigned int flags, uint64_t write_flags = 0) {
+	eblob_wrapper wrapper(flags);
+	BOOST_REQUIRE(wrapper.get() != nullptr);
+
+	constexpr size_t keys_number = 100;
+
+	for (size_t i = 0; i < keys_number; ++i) {
+		auto key = hash(std::to_string(i));
+		const std::string data(1 + i * 97, 'a' + i % 26);
+		if (write_flags & BLOB_DISK_CTL_CHAINED) {
+			const size_t head = data.size() / 3;
+			BOOST_REQUIRE_EQUAL(
+				eblob_write(wrapper.get(), &key, (void *)data.data(), /*offset*/ 0, head, write_flags),
+				0
+			);
+			BOOST_REQUIRE_EQUAL(
+				eblob_write(wrapper.get(), &key, (void *)(data.data() + head), /*offset*/ 0,
+				            data.size() - head, write_flags),
+				0
+			);
+		} else {
+			BOOST_REQUIRE_EQUAL(
+				eblob_write(wrapper.get(), &key, (void *)data.data(), /*offset*/ 0, data.size(), write_flags),
+				0
+			);
+		}
+	}
+
+	for (size_t i = 0; i < keys_number; ++i) {
+		auto key = hash(std::to_string(i));
+		char *sync_data = nullptr;
+		uint64_t sync_size = 0;
+		BOOST_REQUIRE_EQUAL(eblob_read_data(wrapper.get(), &key, /*offset*/ 0, &sync_data, &sync_size), 0);
+		std::unique_ptr<char, decltype(&free)> sync_guard(sync_data, &free);
+
+		// read whole record and its tail at some offset
+		for (uint64_t offset : {uint64_t(0), sync_size / 2}) {
+			std::vector<char> buf(sync_size);
+			async_result result;
+			auto future = result.promise.get_future();
+
+			BOOST_REQUIRE_EQUAL(eblob_read_async(wrapper.get(), &key, offset, buf.size(), buf.data(),
+			                                     EBLOB_READ_CSUM, &async_result::complete, &result),
+			                    0);
+			const auto ret = future.get();
+			BOOST_REQUIRE_EQUAL(ret.first, 0);
+			BOOST_REQUIRE_EQUAL(ret.second, sync_size - offset);
+			BOOST_REQUIRE(std::equal(buf.begin(), buf.begin() + ret.second, sync_data + offset));
+		}
+	}
+
+	// request for missing key is never submitted
+	auto key = hash("missing key");
+	char buf[1];
+	async_result result;
+	BOOST_REQUIRE_EQUAL(eblob_read_async(wrapper.get(), &key, /*offset*/ 0, sizeof(buf), buf,
+	                                     EBLOB_READ_CSUM, &async_result::complete, &result),
+	                    -ENOENT);
+}
+
+BOOST_AUTO_TEST_CASE(test_read_async_threads) {
+	test_read_async(0);
+}
+
+BOOST_AUTO_TEST_CASE(test_read_async_io_uring) {
+	/* falls back to threads if io_uring is not available */
+	test_read_async(EBLOB_IO_URING);
+}
+
+BOOST_AUTO_TEST_CASE(test_read_async_chained) {
+	/* chained records are read by pool thread, not by one I/O request */
+	test_read_async(EBLOB_IO_URING, BLOB_DISK_CTL_APPEND | BLOB_DISK_CTL_CHAINED);
+}
+
+BOOST_AUTO_TEST_CASE(test_read_async_compressed) {
+	/* compressed records are uncompressed by pool thread, records are stored as is without lz4 */
+	test_read_async(EBLOB_IO_URING | EBLOB_COMPRESS_LZ4);
+}
+
+/*
+ * Reads bytes of record pointed by @wc that follow its data: footer and
+ * unused space reserved for the record.
+ */
+static std::vector<char> read_record_tail(const eblob_write_control &wc) {
+	const uint64_t start = wc.data_offset + wc.total_data_size;
+	std::vector<char> tail(wc.ctl_data_offset + wc.total_size - start);
+	BOOST_REQUIRE_EQUAL(__eblob_read_ll(wc.data_fd, tail.data(), tail.size(), start), 0);
+	return tail;
+}
+
+BOOST_AUTO_TEST_CASE(test_stream_footer) {
+	/* footer computed by streaming write should be the same as one computed by eblob_write_commit() */
+	eblob_wrapper wrapper;
+	BOOST_REQUIRE(wrapper.get() != nullptr);
+
+	// few checksum chunks and a partial one
+	std::string data(3 * (1 << 20) + 12345, '\0');
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = i * 7 + i / 1000;
+
+	// stream prepared for the exact size and for more than appended
+	for (uint64_t reserve : {uint64_t(0), uint64_t(4096)}) {
+		const std::string suffix = std::to_string(reserve);
+		auto commit_key = hash("commit key " + suffix);
+		auto stream_key = hash("stream key " + suffix);
+
+		BOOST_REQUIRE_EQUAL(eblob_write_prepare(wrapper.get(), &commit_key, data.size() + reserve, /*flags*/ 0), 0);
+		BOOST_REQUIRE_EQUAL(eblob_plain_write(wrapper.get(), &commit_key, (void *)data.data(), /*offset*/ 0,
+		                                      data.size(), /*flags*/ 0), 0);
+		BOOST_REQUIRE_EQUAL(eblob_write_commit(wrapper.get(), &commit_key, data.size(), /*flags*/ 0), 0);
+
+		eblob_stream *stream = nullptr;
+		BOOST_REQUIRE_EQUAL(eblob_stream_open(wrapper.get(), &stream_key, data.size() + reserve, /*flags*/ 0,
+		                                      &stream), 0);
+		// pieces are not aligned to checksum chunks
+		constexpr size_t piece = 100003;
+		for (size_t offset = 0; offset < data.size(); offset += piece) {
+			const size_t size = std::min(piece, data.size() - offset);
+			BOOST_REQUIRE_EQUAL(eblob_stream_append(stream, data.data() + offset, size), 0);
+		}
+		BOOST_REQUIRE_EQUAL(eblob_stream_close(stream), 0);
+
+		eblob_write_control commit_wc, stream_wc;
+		BOOST_REQUIRE_EQUAL(eblob_read_return(wrapper.get(), &commit_key, EBLOB_READ_CSUM, &commit_wc), 0);
+		BOOST_REQUIRE_EQUAL(eblob_read_return(wrapper.get(), &stream_key, EBLOB_READ_CSUM, &stream_wc), 0);
+		BOOST_REQUIRE_EQUAL(stream_wc.size, data.size());
+		BOOST_REQUIRE_EQUAL(stream_wc.total_size, commit_wc.total_size);
+		BOOST_REQUIRE_EQUAL(stream_wc.total_data_size, commit_wc.total_data_size);
+		BOOST_REQUIRE_EQUAL(eblob_verify_checksum(wrapper.get(), &stream_key, &stream_wc), 0);
+
+		const auto commit_tail = read_record_tail(commit_wc);
+		const auto stream_tail = read_record_tail(stream_wc);
+		BOOST_REQUIRE(!commit_tail.empty());
+		BOOST_REQUIRE(commit_tail == stream_tail);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(test_write_from_fd) {
+	/* record written from file or pipe should be read back with the same data */
+	eblob_wrapper wrapper;
+	BOOST_REQUIRE(wrapper.get() != nullptr);
+
+	std::string data(2 * (1 << 20) + 4321, '\0');
+	for (size_t i = 0; i < data.size(); ++i)
+		data[i] = i * 13 + i / 4096;
+
+	const auto check = [&](eblob_key &key, const char *expected, uint64_t size) {
+		char *read_data = nullptr;
+		uint64_t read_size = 0;
+		BOOST_REQUIRE_EQUAL(eblob_read_data(wrapper.get(), &key, /*offset*/ 0, &read_data, &read_size), 0);
+		std::unique_ptr<char, decltype(&free)> guard(read_data, &free);
+		BOOST_REQUIRE_EQUAL(read_size, size);
+		BOOST_REQUIRE(std::equal(read_data, read_data + read_size, expected));
+	};
+
+	{
+		// file is read at given offset and its position is not used
+		char path[] = "/tmp/eblob-test-src-XXXXXX";
+		const int fd = mkstemp(path);
+		BOOST_REQUIRE(fd >= 0);
+		unlink(path);
+		BOOST_REQUIRE_EQUAL(__eblob_write_ll(fd, data.data(), data.size(), 0), 0);
+
+		constexpr uint64_t offset = 1000;
+		auto key = hash("file key");
+		BOOST_REQUIRE_EQUAL(eblob_write_from_fd(wrapper.get(), &key, fd, offset, data.size() - offset,
+		                                        /*flags*/ 0), 0);
+		close(fd);
+		check(key, data.data() + offset, data.size() - offset);
+	}
+
+	{
+		// pipe is read from its current position while it's being filled
+		int fds[2];
+		BOOST_REQUIRE_EQUAL(pipe(fds), 0);
+		auto writer = std::async(std::launch::async, [&]() {
+			size_t done = 0;
+			while (done < data.size()) {
+				const ssize_t bytes = write(fds[1], data.data() + done, data.size() - done);
+				if (bytes == -1 && errno != EINTR)
+					break;
+				if (bytes > 0)
+					done += bytes;
+			}
+			close(fds[1]);
+			return done;
+		});
+
+		auto key = hash("pipe key");
+		BOOST_REQUIRE_EQUAL(eblob_write_from_fd(wrapper.get(), &key, fds[0], /*offset*/ 0, data.size(),
+		                                        /*flags*/ 0), 0);
+		close(fds[0]);
+		BOOST_REQUIRE_EQUAL(writer.get(), data.size());
+		check(key, data.data(), data.size());
+	}
+
+	wrapper.restart();
+	BOOST_REQUIRE(wrapper.get() != nullptr);
+
+	auto file_key = hash("file key");
+	auto pipe_key = hash("pipe key");
+	check(file_key, data.data() + 1000, data.size() - 1000);
+	check(pipe_key, data.data(), data.size());
+}
+
+BOOST_AUTO_TEST_CASE(test_tombstone_journal_reopen) {
+	/* keys removed through tombstone journal should stay removed after reopen, before and after folding */
+	eblob_wrapper wrapper(EBLOB_TOMBSTONE_JOURNAL);
+	BOOST_REQUIRE(wrapper.get() != nullptr);
+
+	constexpr char data[] = "some data";
+	constexpr char new_data[] = "some new data";
+	constexpr size_t keys_number = 300;
+	uint64_t size = 0;
+
+	for (size_t i = 0; i < keys_number; ++i) {
+		auto key = hash(std::to_string(i));
+		BOOST_REQUIRE_EQUAL(
+			eblob_write(wrapper.get(), &key, (void *)data, /*offset*/ 0, sizeof(data), /*flags*/ 0),
+			0
+		);
+	}
+
+	// every third key is removed, every ninth is written again after removal
+	for (size_t i = 0; i < keys_number; i += 3) {
+		auto key = hash(std::to_string(i));
+		BOOST_REQUIRE_EQUAL(eblob_remove(wrapper.get(), &key), 0);
+		if (i % 9 == 0) {
+			BOOST_REQUIRE_EQUAL(
+				eblob_write(wrapper.get(), &key, (void *)new_data, /*offset*/ 0, sizeof(new_data), /*flags*/ 0),
+				0
+			);
+		}
+	}
+
+	const auto check = [&]() {
+		for (size_t i = 0; i < keys_number; ++i) {
+			auto key = hash(std::to_string(i));
+			if (i % 9 == 0) {
+				BOOST_REQUIRE_EQUAL(eblob_exists(wrapper.get(), &key, &size), 0);
+				BOOST_REQUIRE_EQUAL(size, sizeof(new_data));
+			} else if (i % 3 == 0) {
+				BOOST_REQUIRE_EQUAL(eblob_exists(wrapper.get(), &key, &size), -ENOENT);
+				BOOST_REQUIRE_EQUAL(eblob_remove(wrapper.get(), &key), -ENOENT);
+			} else {
+				BOOST_REQUIRE_EQUAL(eblob_exists(wrapper.get(), &key, &size), 0);
+				BOOST_REQUIRE_EQUAL(size, sizeof(data));
+			}
+		}
+	};
+
+	check();
+
+	// tombstones are replayed from journal
+	wrapper.restart();
+	BOOST_REQUIRE(wrapper.get() != nullptr);
+	check();
+
+	// tombstones are folded into bases by data-sort
+	wrapper.get()->want_defrag = EBLOB_DEFRAG_STATE_DATA_SORT;
+	BOOST_REQUIRE_EQUAL(eblob_defrag(wrapper.get()), 0);
+	wrapper.get()->want_defrag = EBLOB_DEFRAG_STATE_NOT_STARTED;
+	check();
+
+	wrapper.restart();
+	BOOST_REQUIRE(wrapper.get() != nullptr);
+	check();
+}
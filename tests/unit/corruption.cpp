@@ -2,86 +2,18 @@
 #define BOOST_TEST_MODULE CORRUPTION library test
 
 #include <boost/test/unit_test.hpp>
-#include <boost/filesystem.hpp>
 
 #include <future>
 
 #include "library/blob.h"
-#include "library/crypto/sha512.h"
-
-#include "eblob/eblob.hpp"
-
-class eblob_wrapper {
-public:
-	eblob_wrapper()
-	: data_dir_template_("/tmp/eblob-test-XXXXXX")
-	, data_dir_{mkdtemp(&data_dir_template_.front())}
-	, data_path_{data_dir_ + "/data"}
-	, log_path_{data_dir_ + "/log.log"}
-	, logger_{log_path_.c_str(), EBLOB_LOG_DEBUG}
-	, backend_{nullptr} {
-		restart();
-	}
-
-	void restart() {
-		stop();
-		backend_ = [&]() {
-			eblob_config config;
-			memset(&config, 0, sizeof(config));
-			config.blob_flags = EBLOB_L2HASH | EBLOB_DISABLE_THREADS | EBLOB_AUTO_INDEXSORT;
-			config.sync = -2;
-			config.log = logger_.log();
-			config.file = (char *)data_path_.c_str();
-			config.blob_size = EBLOB_BLOB_DEFAULT_BLOB_SIZE;
-			config.records_in_blob = 100 /*EBLOB_BLOB_DEFAULT_RECORDS_IN_BLOB*/;
-			config.defrag_percentage = EBLOB_DEFAULT_DEFRAG_PERCENTAGE;
-			config.defrag_timeout = EBLOB_DEFAULT_DEFRAG_TIMEOUT;
-			config.index_block_size = EBLOB_INDEX_DEFAULT_BLOCK_SIZE;
-			config.index_block_bloom_length = EBLOB_INDEX_DEFAULT_BLOCK_BLOOM_LENGTH;
-			config.blob_size_limit = UINT64_MAX;
-			config.defrag_time = EBLOB_DEFAULT_DEFRAG_TIME;
-			config.defrag_splay = EBLOB_DEFAULT_DEFRAG_SPLAY;
-			config.periodic_timeout = EBLOB_DEFAULT_PERIODIC_THREAD_TIMEOUT;
-			config.stat_id = 12345;
-			config.chunks_dir = nullptr;
-			return eblob_init(&config);
-		}();
-	}
 
-	void stop() {
-		if (backend_) {
-			eblob_cleanup(backend_);
-			backend_ = nullptr;
-		}
-	}
-
-	~eblob_wrapper() {
-		stop();
-		boost::filesystem::remove_all(data_dir_);
-	}
-
-	eblob_backend *get() { return backend_; }
-
-private:
-	std::string data_dir_template_;
-	const std::string data_dir_;
-	const std::string data_path_;
-	const std::string log_path_;
-	ioremap::eblob::eblob_logger logger_;
-	eblob_backend *backend_;
-};
-
-eblob_key hash(std::string key) {
-	eblob_key ret;
-	sha512_buffer(key.data(), key.size(), ret.id);
-	return ret;
-}
+#include "wrapper.hpp"
 
 BOOST_AUTO_TEST_CASE(test_header_corruption) {
 	/* corrupt record's header in blob and check that record isn't considered as corrupted (since data is correct)
 	 * and read is failed with -EINVAL
 	 */
-	eblob_wrapper wrapper;
+	eblob_wrapper wrapper(EBLOB_L2HASH);
 	BOOST_REQUIRE(wrapper.get() != nullptr);
 
 	BOOST_REQUIRE_EQUAL(eblob_stat_get(wrapper.get()->stat_summary, EBLOB_LST_RECORDS_CORRUPTED), 0);
@@ -132,7 +64,7 @@ BOOST_AUTO_TEST_CASE(test_header_corruption) {
 
 BOOST_AUTO_TEST_CASE(test_data_corruption) {
 	/* corrupt record's data and check that the record is considered as corrupted */
-	eblob_wrapper wrapper;
+	eblob_wrapper wrapper(EBLOB_L2HASH);
 	BOOST_REQUIRE(wrapper.get() != nullptr);
 
 	BOOST_REQUIRE_EQUAL(eblob_stat_get(wrapper.get()->stat_summary, EBLOB_LST_RECORDS_CORRUPTED), 0);
@@ -191,7 +123,7 @@ BOOST_AUTO_TEST_CASE(test_data_corruption) {
 
 BOOST_AUTO_TEST_CASE(test_footer_corruption) {
 	/* corrupt record's footer and check that the record is considered as corrupted */
-	eblob_wrapper wrapper;
+	eblob_wrapper wrapper(EBLOB_L2HASH);
 	BOOST_REQUIRE(wrapper.get() != nullptr);
 
 	BOOST_REQUIRE_EQUAL(eblob_stat_get(wrapper.get()->stat_summary, EBLOB_LST_RECORDS_CORRUPTED), 0);
@@ -243,8 +175,93 @@ BOOST_AUTO_TEST_CASE(test_footer_corruption) {
 	BOOST_REQUIRE_EQUAL(eblob_stat_get(wrapper.get()->stat_summary, EBLOB_LST_RECORDS_CORRUPTED), 0);
 }
 
+BOOST_AUTO_TEST_CASE(test_index_hole) {
+	/* zero-filled index entry, reserved by a writer that had not written it before crash,
+	 * should be rejected as a hole, but not a header of a record with zero key
+	 */
+	eblob_wrapper wrapper(EBLOB_L2HASH);
+	BOOST_REQUIRE(wrapper.get() != nullptr);
+
+	eblob_key key;
+	memset(&key, 0, sizeof(key));
+	constexpr char data[] = "some data";
+
+	eblob_write_control wc;
+	BOOST_REQUIRE_EQUAL(
+		eblob_write_return(wrapper.get(), &key, (void *)data, /*offset*/ 0, sizeof(data), /*flags*/ 0, &wc),
+		0);
+
+	auto bctl = list_first_entry(&wrapper.get()->bases, struct eblob_base_ctl, base_entry);
+
+	eblob_disk_control dc;
+	BOOST_REQUIRE_EQUAL(__eblob_read_ll(wc.index_fd, &dc, sizeof(dc), wc.ctl_index_offset), 0);
+	BOOST_REQUIRE_EQUAL(eblob_check_record(bctl, &dc), 0);
+
+	eblob_disk_control hole;
+	memset(&hole, 0, sizeof(hole));
+	BOOST_REQUIRE_EQUAL(eblob_check_record(bctl, &hole), -ESPIPE);
+}
+
+BOOST_AUTO_TEST_CASE(test_chain_corruption) {
+	/* corrupt data of the last extent of chained record and check that the record is considered as corrupted */
+	eblob_wrapper wrapper(EBLOB_L2HASH);
+	BOOST_REQUIRE(wrapper.get() != nullptr);
+
+	auto key = hash("some key");
+	constexpr uint64_t flags = BLOB_DISK_CTL_APPEND | BLOB_DISK_CTL_CHAINED;
+
+	// pieces are not aligned to checksum blocks and fill few extents
+	std::string data;
+	for (size_t i = 0; i < 10; ++i) {
+		const std::string piece(3001 + i * 1000, 'a' + i);
+		BOOST_REQUIRE_EQUAL(
+			eblob_write(wrapper.get(), &key, (void *)piece.data(), /*offset*/ 0, piece.size(), flags),
+			0);
+		data += piece;
+	}
+
+	char *read_data = nullptr;
+	uint64_t read_size = 0;
+	BOOST_REQUIRE_EQUAL(eblob_read_data(wrapper.get(), &key, /*offset*/ 0, &read_data, &read_size), 0);
+	BOOST_REQUIRE_EQUAL(std::string(read_data, read_size), data);
+	free(read_data);
+
+	eblob_ram_control rctl;
+	int disk;
+	BOOST_REQUIRE_EQUAL(eblob_cache_lookup(wrapper.get(), &key, &rctl, nullptr, &disk), 0);
+	const int fd = rctl.bctl->data_ctl.fd;
+
+	eblob_chain_header chain;
+	BOOST_REQUIRE_EQUAL(
+		__eblob_read_ll(fd, &chain, sizeof(chain), rctl.data_offset + sizeof(eblob_disk_control)),
+		0);
+	eblob_convert_chain_header(&chain);
+	BOOST_REQUIRE_GT(chain.num, 1);
+	BOOST_REQUIRE_EQUAL(chain.size, data.size());
+
+	const uint64_t offset = chain.ext[chain.num - 1].position + chain.ext[chain.num - 1].size - 1;
+
+	// read current byte
+	char current_byte;
+	BOOST_REQUIRE_EQUAL(__eblob_read_ll(fd, &current_byte, sizeof(current_byte), offset), 0);
+	// corrupt data
+	BOOST_REQUIRE_EQUAL(__eblob_write_ll(fd, "!", 1, offset), 0);
+
+	BOOST_REQUIRE_EQUAL(eblob_read_data(wrapper.get(), &key, /*offset*/ 0, &read_data, &read_size), -EILSEQ);
+	// read without checksum verification
+	BOOST_REQUIRE_EQUAL(eblob_read_data_nocsum(wrapper.get(), &key, /*offset*/ 0, &read_data, &read_size), 0);
+	free(read_data);
+	BOOST_REQUIRE_EQUAL(eblob_stat_get(wrapper.get()->stat_summary, EBLOB_LST_RECORDS_CORRUPTED), 1);
+
+	// restore data
+	BOOST_REQUIRE_EQUAL(__eblob_write_ll(fd, &current_byte, sizeof(current_byte), offset), 0);
+	BOOST_REQUIRE_EQUAL(eblob_read_data(wrapper.get(), &key, /*offset*/ 0, &read_data, &read_size), 0);
+	BOOST_REQUIRE_EQUAL(std::string(read_data, read_size), data);
+	free(read_data);
+}
+
 BOOST_AUTO_TEST_CASE(test_inspection) {
-	eblob_wrapper wrapper;
+	eblob_wrapper wrapper(EBLOB_L2HASH);
 	BOOST_REQUIRE(wrapper.get() != nullptr);
 
 	constexpr char data[] = "some data";
@@ -0,0 +1,81 @@
+#ifndef __EBLOB_TESTS_UNIT_WRAPPER_HPP
+#define __EBLOB_TESTS_UNIT_WRAPPER_HPP
+
+#include <boost/filesystem.hpp>
+
+#include "library/blob.h"
+#include "library/crypto/sha512.h"
+
+#include "eblob/eblob.hpp"
+
+/* Opens blob in temporary directory which is removed with the wrapper */
+class eblob_wrapper {
+public:
+	/* @flags are added to flags blob is opened with */
+	explicit eblob_wrapper(unsigned int flags = 0)
+	: data_dir_template_("/tmp/eblob-test-XXXXXX")
+	, data_dir_{mkdtemp(&data_dir_template_.front())}
+	, data_path_{data_dir_ + "/data"}
+	, log_path_{data_dir_ + "/log.log"}
+	, logger_{log_path_.c_str(), EBLOB_LOG_DEBUG}
+	, flags_{flags}
+	, backend_{nullptr} {
+		restart();
+	}
+
+	void restart() {
+		stop();
+		backend_ = [&]() {
+			eblob_config config;
+			memset(&config, 0, sizeof(config));
+			config.blob_flags = flags_ | EBLOB_DISABLE_THREADS | EBLOB_AUTO_INDEXSORT;
+			config.sync = -2;
+			config.log = logger_.log();
+			config.file = (char *)data_path_.c_str();
+			config.blob_size = EBLOB_BLOB_DEFAULT_BLOB_SIZE;
+			config.records_in_blob = 100 /*EBLOB_BLOB_DEFAULT_RECORDS_IN_BLOB*/;
+			config.defrag_percentage = EBLOB_DEFAULT_DEFRAG_PERCENTAGE;
+			config.defrag_timeout = EBLOB_DEFAULT_DEFRAG_TIMEOUT;
+			config.index_block_size = EBLOB_INDEX_DEFAULT_BLOCK_SIZE;
+			config.index_block_bloom_length = EBLOB_INDEX_DEFAULT_BLOCK_BLOOM_LENGTH;
+			config.blob_size_limit = UINT64_MAX;
+			config.defrag_time = EBLOB_DEFAULT_DEFRAG_TIME;
+			config.defrag_splay = EBLOB_DEFAULT_DEFRAG_SPLAY;
+			config.periodic_timeout = EBLOB_DEFAULT_PERIODIC_THREAD_TIMEOUT;
+			config.stat_id = 12345;
+			config.chunks_dir = nullptr;
+			return eblob_init(&config);
+		}();
+	}
+
+	void stop() {
+		if (backend_) {
+			eblob_cleanup(backend_);
+			backend_ = nullptr;
+		}
+	}
+
+	~eblob_wrapper() {
+		stop();
+		boost::filesystem::remove_all(data_dir_);
+	}
+
+	eblob_backend *get() { return backend_; }
+
+private:
+	std::string data_dir_template_;
+	const std::string data_dir_;
+	const std::string data_path_;
+	const std::string log_path_;
+	ioremap::eblob::eblob_logger logger_;
+	const unsigned int flags_;
+	eblob_backend *backend_;
+};
+
+inline eblob_key hash(std::string key) {
+	eblob_key ret;
+	sha512_buffer(key.data(), key.size(), ret.id);
+	return ret;
+}
+
+#endif /* __EBLOB_TESTS_UNIT_WRAPPER_HPP */